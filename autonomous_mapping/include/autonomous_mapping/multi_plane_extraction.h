@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2011, Lucian Cosmin Goron <goron@cs.tum.edu>, Zoltan-Csaba Marton <marton@cs.tum.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AUTONOMOUS_MAPPING_MULTI_PLANE_EXTRACTION_H_
+#define AUTONOMOUS_MAPPING_MULTI_PLANE_EXTRACTION_H_
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "pcl/point_types.h"
+#include "pcl/point_cloud.h"
+#include "pcl/ModelCoefficients.h"
+#include "pcl/PointIndices.h"
+
+#include "pcl/features/normal_3d.h"
+
+#include "pcl/sample_consensus/method_types.h"
+#include "pcl/sample_consensus/model_types.h"
+#include "pcl/sample_consensus/sac_model_normal_plane.h"
+
+#include "pcl/segmentation/sac_segmentation.h"
+
+namespace autonomous_mapping
+{
+
+/** \brief Extracts all planes with a normal close to an axis from a point cloud, without any visualization.
+ *
+ * The cloud and its normals are never copied: points that belong to a plane are masked out and the next planes are
+ * searched among the indices of the remaining points. In every round several RANSAC hypotheses are fitted on
+ * separate threads. The first one searches all remaining points, as a sequential extraction would. Fitting the
+ * same points again would only find the same plane, so every other hypothesis searches one slab of the remaining
+ * points, sorted by their offset along the axis, where planes at other offsets dominate. The inliers of a plane
+ * found in a slab are selected again among all remaining points. The hypotheses are accepted from the one with the
+ * most inliers down, each one with the inliers that the planes accepted before it did not take, as long as enough
+ * are left. At the end, planes that were found more than once in nearly the same place are merged and refitted.
+ */
+template <typename PointT, typename NormalT = pcl::Normal>
+class MultiPlaneExtraction
+{
+public:
+  typedef pcl::PointCloud<PointT> PointCloud;
+  typedef typename PointCloud::ConstPtr PointCloudConstPtr;
+  typedef pcl::PointCloud<NormalT> NormalCloud;
+  typedef typename NormalCloud::ConstPtr NormalCloudConstPtr;
+  typedef boost::shared_ptr<std::vector<int> > IndicesPtr;
+
+  MultiPlaneExtraction () :
+    axis_ (0.0, 0.0, 1.0), eps_angle_ (0.010), distance_threshold_ (0.100), normal_distance_weight_ (0.05),
+    max_iterations_ (1000), min_inliers_ (1000), max_failures_ (25), nr_hypotheses_ (0),
+    coplanar_eps_angle_ (0.050), coplanar_distance_ (0.050), nr_rounds_ (0)
+  {
+  }
+
+  void setInputCloud (const PointCloudConstPtr &cloud)
+  {
+    cloud_ = cloud;
+  }
+
+  void setInputNormals (const NormalCloudConstPtr &normals)
+  {
+    normals_ = normals;
+  }
+
+  /** \brief The plane normals may deviate from the axis by at most eps_angle [radians] */
+  void setAxis (const Eigen::Vector3f &axis, double eps_angle)
+  {
+    axis_ = axis;
+    eps_angle_ = eps_angle;
+  }
+
+  void setDistanceThreshold (double distance_threshold)
+  {
+    distance_threshold_ = distance_threshold;
+  }
+
+  void setNormalDistanceWeight (double normal_distance_weight)
+  {
+    normal_distance_weight_ = normal_distance_weight;
+  }
+
+  void setMaxIterations (int max_iterations)
+  {
+    max_iterations_ = max_iterations;
+  }
+
+  /** \brief Planes with fewer inliers are rejected, and the extraction stops when fewer points remain */
+  void setMinInliers (int min_inliers)
+  {
+    min_inliers_ = min_inliers;
+  }
+
+  /** \brief The extraction stops after this many rounds in a row in which no hypothesis was accepted */
+  void setMaxFailures (int max_failures)
+  {
+    max_failures_ = max_failures;
+  }
+
+  /** \brief Hypotheses fitted in parallel in every round, 0 for one per core */
+  void setNumberOfHypotheses (int nr_hypotheses)
+  {
+    nr_hypotheses_ = nr_hypotheses;
+  }
+
+  /** \brief Planes are merged if their normals differ by less than eps_angle [radians] and their distances to the
+   * origin by less than distance [meters] */
+  void setCoplanarThresholds (double eps_angle, double distance)
+  {
+    coplanar_eps_angle_ = eps_angle;
+    coplanar_distance_ = distance;
+  }
+
+  /** \brief Rounds of parallel hypotheses the last extract() needed */
+  int getNumberOfRounds () const
+  {
+    return nr_rounds_;
+  }
+
+  /** \brief Extracts the planes among all points of the input cloud */
+  void extract (std::vector<pcl::PointIndices::Ptr> &planes_inliers,
+                std::vector<pcl::ModelCoefficients::Ptr> &planes_coefficients,
+                std::vector<int> &remaining_indices)
+  {
+    std::vector<int> indices (cloud_->points.size ());
+    for (size_t i = 0; i < indices.size (); i++)
+      indices[i] = i;
+    extract (indices, planes_inliers, planes_coefficients, remaining_indices);
+  }
+
+  /** \brief Extracts the planes among the given points of the input cloud
+   * \param indices the points to search
+   * \param planes_inliers the inliers of every plane, as indices of the input cloud
+   * \param planes_coefficients the coefficients of every plane
+   * \param remaining_indices the points of indices that are in no plane
+   */
+  void extract (const std::vector<int> &indices,
+                std::vector<pcl::PointIndices::Ptr> &planes_inliers,
+                std::vector<pcl::ModelCoefficients::Ptr> &planes_coefficients,
+                std::vector<int> &remaining_indices)
+  {
+    planes_inliers.clear ();
+    planes_coefficients.clear ();
+
+    IndicesPtr remaining (new std::vector<int> (indices));
+
+    int nr_hypotheses = nr_hypotheses_ > 0 ? nr_hypotheses_ : boost::thread::hardware_concurrency ();
+    nr_hypotheses = std::max (1, nr_hypotheses);
+
+    // Points that were taken by a plane
+    std::vector<char> in_plane (cloud_->points.size (), false);
+
+    nr_rounds_ = 0;
+    int failures = 0;
+    do
+    {
+      nr_rounds_++;
+      std::vector<IndicesPtr> search_indices (1, remaining);
+      splitIntoSlabs (*remaining, nr_hypotheses - 1, search_indices);
+
+      std::vector<Hypothesis> hypotheses (search_indices.size ());
+      boost::thread_group threads;
+      for (size_t h = 0; h < hypotheses.size (); h++)
+      {
+        hypotheses[h].inliers.reset (new pcl::PointIndices ());
+        hypotheses[h].coefficients.reset (new pcl::ModelCoefficients ());
+        threads.create_thread (boost::bind (&MultiPlaneExtraction::fitHypothesis, this, search_indices[h], remaining,
+                                            &hypotheses[h]));
+      }
+      threads.join_all ();
+
+      std::sort (hypotheses.begin (), hypotheses.end (), moreInliers);
+
+      bool accepted = false;
+      for (size_t h = 0; h < hypotheses.size (); h++)
+      {
+        if ((int) hypotheses[h].inliers->indices.size () < min_inliers_)
+          break;
+
+        // The inliers the planes accepted before did not take
+        pcl::PointIndices::Ptr inliers (new pcl::PointIndices ());
+        for (size_t i = 0; i < hypotheses[h].inliers->indices.size (); i++)
+        {
+          if (!in_plane[hypotheses[h].inliers->indices[i]])
+            inliers->indices.push_back (hypotheses[h].inliers->indices[i]);
+        }
+        if ((int) inliers->indices.size () < min_inliers_)
+          continue;
+
+        for (size_t i = 0; i < inliers->indices.size (); i++)
+          in_plane[inliers->indices[i]] = true;
+        planes_inliers.push_back (inliers);
+        planes_coefficients.push_back (hypotheses[h].coefficients);
+        accepted = true;
+      }
+
+      if (accepted)
+      {
+        failures = 0;
+        size_t nr_remaining = 0;
+        for (size_t i = 0; i < remaining->size (); i++)
+        {
+          if (!in_plane[(*remaining)[i]])
+            (*remaining)[nr_remaining++] = (*remaining)[i];
+        }
+        remaining->resize (nr_remaining);
+      }
+      else
+        failures++;
+
+    } while ((int) remaining->size () > min_inliers_ && failures < max_failures_);
+
+    mergeCoplanarPlanes (planes_inliers, planes_coefficients);
+
+    remaining_indices = *remaining;
+  }
+
+protected:
+  struct Hypothesis
+  {
+    pcl::PointIndices::Ptr inliers;
+    pcl::ModelCoefficients::Ptr coefficients;
+  };
+
+  static bool moreInliers (const Hypothesis &a, const Hypothesis &b)
+  {
+    return a.inliers->indices.size () > b.inliers->indices.size ();
+  }
+
+  /** \brief Splits the points into at most nr_slabs slabs of equal size along the axis, slabs with fewer points than
+   * min_inliers_ are not made */
+  void splitIntoSlabs (const std::vector<int> &indices, int nr_slabs, std::vector<IndicesPtr> &slabs) const
+  {
+    nr_slabs = std::min (nr_slabs, (int) indices.size () / std::max (1, min_inliers_));
+    if (nr_slabs < 1)
+      return;
+
+    std::vector<std::pair<float, int> > offsets (indices.size ());
+    for (size_t i = 0; i < indices.size (); i++)
+    {
+      const PointT &p = cloud_->points[indices[i]];
+      offsets[i] = std::make_pair (axis_[0] * p.x + axis_[1] * p.y + axis_[2] * p.z, indices[i]);
+    }
+    std::sort (offsets.begin (), offsets.end ());
+
+    for (int s = 0; s < nr_slabs; s++)
+    {
+      IndicesPtr slab (new std::vector<int> ());
+      for (size_t i = offsets.size () * s / nr_slabs; i < offsets.size () * (s + 1) / nr_slabs; i++)
+        slab->push_back (offsets[i].second);
+      slabs.push_back (slab);
+    }
+  }
+
+  /** \brief One RANSAC fit among the search indices, whose inliers are then selected among all remaining points.
+   * The cloud and the normals are shared by all threads */
+  void fitHypothesis (IndicesPtr search_indices, IndicesPtr remaining, Hypothesis *hypothesis)
+  {
+    pcl::SACSegmentationFromNormals<PointT, NormalT> segmentation_of_planes;
+    segmentation_of_planes.setOptimizeCoefficients (true);
+    segmentation_of_planes.setModelType (pcl::SACMODEL_NORMAL_PLANE);
+    segmentation_of_planes.setNormalDistanceWeight (normal_distance_weight_);
+    segmentation_of_planes.setMethodType (pcl::SAC_RANSAC);
+    segmentation_of_planes.setDistanceThreshold (distance_threshold_);
+    segmentation_of_planes.setMaxIterations (max_iterations_);
+    segmentation_of_planes.setAxis (axis_);
+    segmentation_of_planes.setEpsAngle (eps_angle_);
+    segmentation_of_planes.setInputCloud (cloud_);
+    segmentation_of_planes.setInputNormals (normals_);
+    segmentation_of_planes.setIndices (search_indices);
+    segmentation_of_planes.segment (*hypothesis->inliers, *hypothesis->coefficients);
+
+    if (search_indices == remaining || hypothesis->coefficients->values.size () != 4)
+      return;
+
+    // The plane usually extends beyond the slab
+    Eigen::VectorXf coefficients (4);
+    for (int i = 0; i < 4; i++)
+      coefficients[i] = hypothesis->coefficients->values[i];
+    pcl::SampleConsensusModelNormalPlane<PointT, NormalT> model (cloud_);
+    model.setInputNormals (normals_);
+    model.setNormalDistanceWeight (normal_distance_weight_);
+    model.setIndices (remaining);
+    model.selectWithinDistance (coefficients, distance_threshold_, hypothesis->inliers->indices);
+  }
+
+  bool coplanar (const pcl::ModelCoefficients &a, const pcl::ModelCoefficients &b) const
+  {
+    Eigen::Vector3f normal_a (a.values[0], a.values[1], a.values[2]);
+    Eigen::Vector3f normal_b (b.values[0], b.values[1], b.values[2]);
+    float distance_a = a.values[3] / normal_a.norm ();
+    float distance_b = b.values[3] / normal_b.norm ();
+    float cos_angle = normal_a.normalized ().dot (normal_b.normalized ());
+
+    // Same plane with the normal flipped
+    if (cos_angle < 0)
+    {
+      cos_angle = -cos_angle;
+      distance_b = -distance_b;
+    }
+    return cos_angle >= cos (coplanar_eps_angle_) && fabs (distance_a - distance_b) <= coplanar_distance_;
+  }
+
+  /** \brief Joins every plane with the later planes that are coplanar to it, and refits it to all their inliers */
+  void mergeCoplanarPlanes (std::vector<pcl::PointIndices::Ptr> &planes_inliers,
+                            std::vector<pcl::ModelCoefficients::Ptr> &planes_coefficients) const
+  {
+    for (size_t p = 0; p < planes_inliers.size (); p++)
+    {
+      bool merged = false;
+      for (size_t q = p + 1; q < planes_inliers.size (); )
+      {
+        if (!coplanar (*planes_coefficients[p], *planes_coefficients[q]))
+        {
+          q++;
+          continue;
+        }
+        planes_inliers[p]->indices.insert (planes_inliers[p]->indices.end (),
+                                           planes_inliers[q]->indices.begin (), planes_inliers[q]->indices.end ());
+        planes_inliers.erase (planes_inliers.begin () + q);
+        planes_coefficients.erase (planes_coefficients.begin () + q);
+        merged = true;
+      }
+      if (!merged)
+        continue;
+
+      // Least squares plane of the joined inliers, oriented like the plane found first
+      Eigen::Vector4f plane_parameters;
+      float curvature;
+      pcl::computePointNormal (*cloud_, planes_inliers[p]->indices, plane_parameters, curvature);
+      pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients (*planes_coefficients[p]));
+      Eigen::Vector3f normal (coefficients->values[0], coefficients->values[1], coefficients->values[2]);
+      if (plane_parameters.head<3> ().dot (normal) < 0)
+        plane_parameters = -plane_parameters;
+      coefficients->values.resize (4);
+      for (int i = 0; i < 4; i++)
+        coefficients->values[i] = plane_parameters[i];
+      planes_coefficients[p] = coefficients;
+    }
+  }
+
+  PointCloudConstPtr cloud_;
+  NormalCloudConstPtr normals_;
+
+  Eigen::Vector3f axis_;
+  double eps_angle_;
+  double distance_threshold_;
+  double normal_distance_weight_;
+  int max_iterations_;
+  int min_inliers_;
+  int max_failures_;
+  int nr_hypotheses_;
+  double coplanar_eps_angle_;
+  double coplanar_distance_;
+
+  int nr_rounds_;
+};
+
+}
+
+#endif /* AUTONOMOUS_MAPPING_MULTI_PLANE_EXTRACTION_H_ */
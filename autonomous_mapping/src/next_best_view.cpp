@@ -27,6 +27,11 @@
 #include <visualization_msgs/MarkerArray.h>
 
 #include <vector>
+#include <map>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 
 #include <nodelet/nodelet.h>
 #include <math.h>
@@ -63,6 +68,33 @@ typedef struct
 	int weight;
 }point_2d;
 
+// points rasterized into the costmap grid
+typedef struct
+{
+	int x_dim, y_dim;
+	double scale_x, scale_y; // cells per meter
+	std::vector<int> counts; // number of points in cell id_x*y_dim+id_y
+	std::vector<int> cells; // cells with points
+	std::vector<unsigned char> free; // cells that may be rewarded
+}count_image;
+
+// a pose sampled from the costmap, scored afterwards
+typedef struct
+{
+	geometry_msgs::Pose pose;
+	double x, y, theta;
+	int reward;
+	double score;
+}pose_candidate;
+
+// octree nodes looked up by their key
+typedef boost::unordered_map<boost::uint64_t, octomap::OcTreeNodePCL*> node_cache;
+
+inline boost::uint64_t pack_key (const octomap::OcTreeKey &key)
+{
+	return ((boost::uint64_t)key[0] << 32) | ((boost::uint64_t)key[1] << 16) | (boost::uint64_t)key[2];
+}
+
 void write_pgm (std::string filename, std::vector<std::vector<int> > cm)
 {
 	std::ofstream myfile;
@@ -157,6 +189,8 @@ protected:
 	double sensor_preferred_d_min_;
 	double sensor_preferred_d_max_;
 	double nr_pose_samples_;
+	// cast the beams of a candidate pose together, with one node cache per pose
+	bool batched_ray_casting_;
 	bool received_map_;
 	int number;
 	int fringe_nr_,free_nr_,occupied_nr_;
@@ -166,6 +200,8 @@ protected:
 	//std::vector<std::vector<std::vector<int> > > border_costmap;
 	// kernels for every (discretized) direction
 	std::vector<std::vector<point_2d> > vis_kernel;
+	// directions of the beams of compute_overlap_score for theta = 0
+	std::vector<btVector3> beam_directions_;
 
 	//objects needed
 	tf::TransformListener tf_listener_;
@@ -211,6 +247,7 @@ protected:
 	void visualizeOctree (const sensor_msgs::PointCloud2ConstPtr& pointcloud2_msg, geometry_msgs::Point viewpoint);
 	void castRayAndLabel (pcl::PointCloud<pcl::PointXYZ>& cloud, octomap::pose6d origin);
 	void findBorderPoints (pcl::PointCloud<pcl::PointXYZ>& border_cloud, std::string frame_id);
+	octomap::OcTreeNodePCL *neighbor_node (const octomap::OcTreeKey &key, int dx, int dy, int dz, const node_cache &leaf_nodes, bool search_tree);
 	void findOccupiedPoints(pcl::PointCloud<pcl::PointXYZ>& occupied_cloud, std::string frame_id);
 	void computeBoundaryPoints (pcl::PointCloud<pcl::PointXYZ>& border_cloud, pcl::PointCloud<pcl::Normal>& border_normals, std::vector<pcl::PointIndices>& clusters, pcl::PointCloud<pcl::PointXYZ>* cluster_clouds);
 
@@ -224,12 +261,18 @@ protected:
 
 	void create_kernels ();
 	void find_min_max(pcl::PointCloud<pcl::PointXYZ> border_cloud, geometry_msgs::Point &min, geometry_msgs::Point &max);
-	std::vector<std::vector<std::vector<int> > > create_costmap(double x_dim,double y_dim, int nr_dirs, pcl::PointCloud<pcl::PointXYZ> border_cloud,geometry_msgs::Point &min,geometry_msgs::Point &max);
+	std::vector<std::vector<std::vector<int> > > create_costmap(double x_dim,double y_dim, int nr_dirs, const pcl::PointCloud<pcl::PointXYZ> &border_cloud,geometry_msgs::Point &min,geometry_msgs::Point &max);
+	void convolve_kernel (int dir, const count_image *image, int *costmap);
 	std::vector<std::vector<std::vector<int> > > create_empty_costmap (double x_dim, double y_dim, int nr_dirs);
 	geometry_msgs::Pose find_best_pose(int best_i,int best_j,int best_k,int max_reward,geometry_msgs::Point &min,geometry_msgs::Point &max);
-	geometry_msgs::Pose sample_from_costmap (std::vector<std::vector<std::vector<int> > > costmap, int max_reward, int nr_dirs, int x_dim, int y_dim, geometry_msgs::Point min, geometry_msgs::Point max, int &reward, double &score);
+	pose_candidate sample_from_costmap (const std::vector<std::vector<std::vector<int> > > &costmap, int max_reward, int nr_dirs, int x_dim, int y_dim, geometry_msgs::Point min, geometry_msgs::Point max);
 	//geometry_msgs::PoseArray computedirections(double x, double y, double theta, int reward);
+	void score_candidates (std::vector<pose_candidate> &candidates);
+	void score_candidates_worker (std::vector<pose_candidate> *candidates, int begin, int end);
 	double compute_overlap_score(double x, double y, double theta, int reward);
+	void create_beam_directions ();
+	void cast_beam_bundle (const octomap::point3d &origin, double theta, int &hit, int &miss, int &fringe, int &known);
+	octomap::OcTreeNodePCL *cached_search (const octomap::OcTreeKey &key, node_cache &nodes);
 	std::vector<std::vector<std::vector<int> > > reduced_costmap(std::vector<std::vector<std::vector<int> > > costmap, int best_j, int best_k,geometry_msgs::Point &min,geometry_msgs::Point &max,double &x_dim,double &y_dim);
 	void find_max_indices (int &best_i, int &best_j, int &best_k,
 				int nr_dirs, int x_dim, int y_dim, int &max_reward,
@@ -285,6 +328,7 @@ void NextBestView::onInit()
 	pnh_->param("sensor_preferred_d_min", sensor_preferred_d_min_,1.0);
 	pnh_->param("sensor_preferred_d_max", sensor_preferred_d_max_,3.0);
 	pnh_->param("nr_pose_samples", nr_pose_samples_,100.0);//1 degree
+	pnh_->param("batched_ray_casting", batched_ray_casting_, true);
 	// topic names
 	pnh_->param("ogrid_sub_topic", ogrid_sub_topic_, std::string("/map"));
 	pnh_->param("ogrid_topic", ogrid_topic_, std::string("/nbv_map"));
@@ -333,6 +377,7 @@ void NextBestView::onInit()
 	octree_ = NULL;
    	// finally, precompute visibility kernel points
 	create_kernels ();
+	create_beam_directions ();
 }
 
 void NextBestView::find_max_indices (int &best_i, int &best_j, int &best_k,
@@ -412,48 +457,92 @@ std::vector<std::vector<std::vector<int> > > NextBestView::create_empty_costmap
 }
 
 
-std::vector<std::vector<std::vector<int> > > NextBestView::create_costmap (double x_dim, double y_dim, int nr_dirs, pcl::PointCloud<pcl::PointXYZ> cloud,geometry_msgs::Point &min,geometry_msgs::Point &max)
+std::vector<std::vector<std::vector<int> > > NextBestView::create_costmap (double x_dim, double y_dim, int nr_dirs, const pcl::PointCloud<pcl::PointXYZ> &cloud,geometry_msgs::Point &min,geometry_msgs::Point &max)
 {
-	// initialize vector of costmaps
-	std::vector<std::vector<std::vector<int> > > costmap = create_empty_costmap (x_dim, y_dim, nr_dirs);
+	count_image image;
+	int nx = image.x_dim = (int)x_dim;
+	int ny = image.y_dim = (int)y_dim;
+	image.scale_x = x_dim / (max.x - min.x);
+	image.scale_y = y_dim / (max.y - min.y);
+
+	// rasterize the points into a count image once
+	image.counts.resize (nx * ny, 0);
+	for (unsigned int i = 0; i < cloud.points.size (); i++)
+	{
+		int id_x = (int)(image.scale_x * (cloud.points[i].x - min.x));
+		int id_y = (int)(image.scale_y * (cloud.points[i].y - min.y));
+		if (id_x >= 0 && id_x < nx && id_y >= 0 && id_y < ny)
+			if (image.counts[id_x * ny + id_y]++ == 0)
+				image.cells.push_back (id_x * ny + id_y);
+	}
 
-		// compute costmaps -- convolute with the different kernels
-		for (int dir=0;dir<nr_dirs;dir++)
-		{
-			for (unsigned int i=0;i<cloud.points.size();i++)
+	// cells that may be rewarded: free in the map (looked up at the cell centers), or all if there is no map
+	image.free.resize (nx * ny, 1);
+	if (received_map_)
+	{
+		//  // NOTE: this assumes the "/map" message had no rotation (0,0,0,1)..
+		double min_map_x = (double)map_.info.origin.position.x;
+		double min_map_y = (double)map_.info.origin.position.y;
+		for (int i = 0; i < nx; i++)
+			for (int j = 0; j < ny; j++)
 			{
-				for (unsigned int j=0;j<vis_kernel[dir].size();j++)
-				{
-					double x=(double)cloud.points[i].x + vis_kernel[dir][j].x;
-					double y=(double)cloud.points[i].y + vis_kernel[dir][j].y;
-					int id_x=(int)(x_dim*((x-min.x)/(max.x-min.x)));
-					int id_y=(int)(y_dim*((y-min.y)/(max.y-min.y)));
+				double x = min.x + (i + 0.5) / image.scale_x;
+				double y = min.y + (j + 0.5) / image.scale_y;
+				int id_x_m = (int)floor ((x - min_map_x) / map_.info.resolution);
+				int id_y_m = (int)floor ((y - min_map_y) / map_.info.resolution);
+				image.free[i * ny + j] = id_x_m >= 0 && id_x_m < (int)map_.info.width &&
+						id_y_m >= 0 && id_y_m < (int)map_.info.height &&
+						map_.data[id_y_m * map_.info.width + id_x_m] == 0;
+			}
+	}
 
+	// compute costmaps -- convolute with the different kernels, one thread per direction
+	std::vector<int> flat (nr_dirs * nx * ny, 0);
+	boost::thread_group threads;
+	for (int dir = 0; dir < nr_dirs; dir++)
+		threads.create_thread (boost::bind (&NextBestView::convolve_kernel, this, dir, &image, &flat[dir * nx * ny]));
+	threads.join_all ();
 
-					if (received_map_)
-					{
-						//  // NOTE: this assumes the "/map" message had no rotation (0,0,0,1)..
-						double min_map_x = (double)map_.info.origin.position.x;
-						double min_map_y = (double)map_.info.origin.position.y;
-						double max_map_x = (double)(map_.info.origin.position.x + map_.info.resolution * map_.info.width);
-						double max_map_y = (double)(map_.info.origin.position.y + map_.info.resolution * map_.info.height);
-
-						int id_x_m=(int)(map_.info.width*((x-min_map_x)/(max_map_x-min_map_x)));
-						int id_y_m=(int)(map_.info.height*((y-min_map_y)/(max_map_y-min_map_y)));
-						if (map_.data[id_y_m*map_.info.width+id_x_m] == 0)
-							if (id_x >= 0 && id_x < x_dim &&
-									id_y >= 0 && id_y < y_dim)
-								costmap[dir][id_x][id_y]+=vis_kernel[dir][j].weight;
-					}
-					else
-						if (id_x >= 0 && id_x < x_dim &&
-								id_y >= 0 && id_y < y_dim)
-							costmap[dir][id_x][id_y]+=vis_kernel[dir][j].weight;
-				}
-			}
+	std::vector<std::vector<std::vector<int> > > costmap = create_empty_costmap (x_dim, y_dim, nr_dirs);
+	for (int dir = 0; dir < nr_dirs; dir++)
+		for (int i = 0; i < nx; i++)
+			std::copy (&flat[(dir * nx + i) * ny], &flat[(dir * nx + i) * ny] + ny, costmap[dir][i].begin ());
+	return costmap;
+}
+
+/**
+ * \brief adds the kernel of one direction around every cell of the count image, weighted by the number of points
+ * \param costmap x_dim*y_dim cells of the direction's costmap
+ */
+void NextBestView::convolve_kernel (int dir, const count_image *image, int *costmap)
+{
+	// the kernel in cell offsets, kernel points falling into the same cell add up their weights
+	std::map<std::pair<int, int>, int> offset_weights;
+	for (unsigned int j = 0; j < vis_kernel[dir].size (); j++)
+		offset_weights[std::make_pair ((int)floor (vis_kernel[dir][j].x * image->scale_x + 0.5),
+		                               (int)floor (vis_kernel[dir][j].y * image->scale_y + 0.5))] += vis_kernel[dir][j].weight;
+	std::vector<int> offsets, weights;
+	for (std::map<std::pair<int, int>, int>::iterator it = offset_weights.begin (); it != offset_weights.end (); it++)
+	{
+		offsets.push_back (it->first.first);
+		offsets.push_back (it->first.second);
+		weights.push_back (it->second);
+	}
+
+	int x_dim = image->x_dim, y_dim = image->y_dim;
+	for (unsigned int c = 0; c < image->cells.size (); c++)
+	{
+		int id_x = image->cells[c] / y_dim, id_y = image->cells[c] % y_dim;
+		int count = image->counts[image->cells[c]];
+		for (unsigned int k = 0; k < weights.size (); k++)
+		{
+			int x = id_x + offsets[2*k], y = id_y + offsets[2*k+1];
+			if (x >= 0 && x < x_dim && y >= 0 && y < y_dim && image->free[x * y_dim + y])
+				costmap[x * y_dim + y] += count * weights[k];
 		}
-		return costmap;
+	}
 }
+
 geometry_msgs::Pose NextBestView::find_best_pose(int best_i,int best_j,int best_k,int max_reward,geometry_msgs::Point &min,geometry_msgs::Point &max)
 {
 	    p.position.x = min.x + (best_j + 0.5) * costmap_grid_cell_size_;
@@ -563,7 +652,7 @@ std::vector<std::vector<std::vector<int> > >  NextBestView::reduced_costmap(std:
 	return ret_poses;
 }
 */
-geometry_msgs::Pose NextBestView::sample_from_costmap (std::vector<std::vector<std::vector<int> > > costmap, int max_reward, int nr_dirs, int x_dim, int y_dim, geometry_msgs::Point min, geometry_msgs::Point max, int &reward, double &score)
+pose_candidate NextBestView::sample_from_costmap (const std::vector<std::vector<std::vector<int> > > &costmap, int max_reward, int nr_dirs, int x_dim, int y_dim, geometry_msgs::Point min, geometry_msgs::Point max)
 {
 	int dir, x, y;
 	int c;
@@ -580,33 +669,65 @@ geometry_msgs::Pose NextBestView::sample_from_costmap (std::vector<std::vector<s
 		//c = sqrt((double)max_reward*max_reward/2 - (double)c*c);
 		//ROS_INFO("The c value is: %d",c);
 	} while (costmap [dir][x][y] < c);
-	reward = costmap[dir][x][y];
+	pose_candidate candidate;
+	candidate.reward = costmap[dir][x][y];
 
-	geometry_msgs::Pose pose = find_best_pose(dir, x, y, reward, min, max);
+	candidate.pose = find_best_pose(dir, x, y, candidate.reward, min, max);
 
-	double real_x = min.x + (x + 0.5) * costmap_grid_cell_size_;
-	double real_y = min.y + (y + 0.5) * costmap_grid_cell_size_;
-	double theta = pi+((double)dir)*2.0*pi/(double)nr_costmap_dirs_;
-	score = compute_overlap_score (real_x, real_y, theta, reward);
-     pose.position.z = (double)score / 100;
-        //pose.position.z=0;
-	return (pose);
+	candidate.x = min.x + (x + 0.5) * costmap_grid_cell_size_;
+	candidate.y = min.y + (y + 0.5) * costmap_grid_cell_size_;
+	candidate.theta = pi+((double)dir)*2.0*pi/(double)nr_costmap_dirs_;
+	candidate.score = 0;
+	return (candidate);
 }
-double NextBestView::compute_overlap_score(double x, double y, double theta, int reward)
+
+/**
+ * \brief computes the overlap scores of the candidates, split over one thread per core, and sets pose.position.z
+ */
+void NextBestView::score_candidates (std::vector<pose_candidate> &candidates)
 {
-	std::vector<std::vector<int> > node_map;
-		double node_map_x=(int)(sensor_horizontal_angle_ / sensor_horizontal_resolution_)+1;
-		double node_map_y=(int)(sensor_vertical_angle_/sensor_vertical_resolution_)+1;
-		node_map.resize (node_map_x);
-		for (int i = 0; i<node_map_x; i++)
-			node_map[i].resize(node_map_y);
+	int n = candidates.size ();
+	int nr_threads = std::max (1, std::min (n, (int)boost::thread::hardware_concurrency ()));
+	boost::thread_group threads;
+	for (int t = 0; t < nr_threads; t++)
+		threads.create_thread (boost::bind (&NextBestView::score_candidates_worker, this, &candidates, n * t / nr_threads, n * (t + 1) / nr_threads));
+	threads.join_all ();
 
+	for (int i = 0; i < n; i++)
+	{
+		candidates[i].pose.position.z = (double)candidates[i].score / 100;
+		//pose.position.z=0;
+	}
+}
+
+void NextBestView::score_candidates_worker (std::vector<pose_candidate> *candidates, int begin, int end)
+{
+	for (int i = begin; i < end; i++)
+	{
+		pose_candidate &c = (*candidates)[i];
+		c.score = compute_overlap_score (c.x, c.y, c.theta, c.reward);
+	}
+}
+
+double NextBestView::compute_overlap_score(double x, double y, double theta, int reward)
+{
 		geometry_msgs::Pose pose;
 		pose.position.x = x;
 		pose.position.y = y;
 		pose.position.z = 1.35;
 		octomap::point3d origin (x, y, pose.position.z);
 		int hit = 0, miss = 0, fringe = 0, known = 0;
+		if (batched_ray_casting_)
+			cast_beam_bundle (origin, theta, hit, miss, fringe, known);
+		else
+		{
+		std::vector<std::vector<int> > node_map;
+		double node_map_x=(int)(sensor_horizontal_angle_ / sensor_horizontal_resolution_)+1;
+		double node_map_y=(int)(sensor_vertical_angle_/sensor_vertical_resolution_)+1;
+		node_map.resize (node_map_x);
+		for (int i = 0; i<node_map_x; i++)
+			node_map[i].resize(node_map_y);
+
 		// given a vector, along x axis.
 		btVector3 x_axis (1, 0, 0);
 		// rotate it "down" around y:
@@ -659,6 +780,7 @@ double NextBestView::compute_overlap_score(double x, double y, double theta, int
 	      		//ret_poses.poses.push_back (pose);
 			}
 
+		}
 		}
 		double p_f = (double)fringe/hit;
 		double p_k = (double)known/hit;
@@ -671,6 +793,135 @@ double NextBestView::compute_overlap_score(double x, double y, double theta, int
 				fringe, known, p_f, p_k, entropy, reward * entropy);
 		return reward * entropy;
 }
+/**
+ * \brief the beams of compute_overlap_score for theta = 0, in the same order
+ */
+void NextBestView::create_beam_directions ()
+{
+	beam_directions_.clear ();
+	double node_map_x=(int)(sensor_horizontal_angle_ / sensor_horizontal_resolution_)+1;
+	double node_map_y=(int)(sensor_vertical_angle_/sensor_vertical_resolution_)+1;
+	btQuaternion rot_down (btVector3(0,1,0), 0.3);
+	int countx = 0, county;
+	for (double pid=-sensor_horizontal_angle_*0.5;pid<sensor_horizontal_angle_*0.5 && countx<node_map_x;pid+=sensor_horizontal_resolution_,countx++)
+	{
+		btQuaternion rot_in_laser_plane (btVector3 (0,0,1), pid);
+		county = 0;
+		for (double sid=-sensor_vertical_angle_/2;sid<sensor_vertical_angle_/2 && county<node_map_y;sid+=sensor_vertical_resolution_,county++)
+		{
+			btQuaternion rot_laser_plane (btVector3 (0,1,0), sid);
+			btMatrix3x3 rot (rot_down * rot_laser_plane * rot_in_laser_plane);
+			beam_directions_.push_back (rot * btVector3 (1, 0, 0));
+		}
+	}
+}
+
+octomap::OcTreeNodePCL *NextBestView::cached_search (const octomap::OcTreeKey &key, node_cache &nodes)
+{
+	std::pair<node_cache::iterator, bool> it = nodes.insert (std::make_pair (pack_key (key), (octomap::OcTreeNodePCL*)NULL));
+	if (it.second)
+		it.first->second = octree_->search (key);
+	return it.first->second;
+}
+
+/**
+ * \brief casts all beams of one pose and counts them like compute_overlap_score does with
+ * octree_->castRay (origin, direction, obstacle, true, sensor_d_max_) for every beam. The traversal is the same voxel
+ * walk as castRay, but all beams start in the same cell and share most cells close to the sensor, so every cell is
+ * searched in the octree only once per pose and then taken from a cache.
+ */
+void NextBestView::cast_beam_bundle (const octomap::point3d &origin, double theta, int &hit, int &miss, int &fringe, int &known)
+{
+	// keys of the octree are offset by 2^15 for tree depth 16
+	const int tree_max_val = 32768;
+	const double res = octree_->getResolution ();
+	const double max_range_sq = sensor_d_max_ * sensor_d_max_;
+
+	octomap::OcTreeKey origin_key;
+	if (!octree_->genKey (origin, origin_key))
+	{
+		miss += beam_directions_.size ();
+		return;
+	}
+
+	node_cache nodes;
+	octomap::OcTreeNodePCL *origin_node = cached_search (origin_key, nodes);
+	bool origin_occupied = origin_node != NULL && origin_node->isOccupied ();
+
+	btMatrix3x3 rot_in_xy (btQuaternion (btVector3(0,0,1), theta));
+	for (unsigned int b = 0; b < beam_directions_.size (); b++)
+	{
+		octomap::OcTreeNodePCL *obstacle = origin_occupied ? origin_node : NULL;
+		bool found = origin_occupied;
+
+		btVector3 dir = rot_in_xy * beam_directions_[b];
+		octomap::point3d direction = octomap::point3d (dir.x (), dir.y (), dir.z ()).normalized ();
+		octomap::OcTreeKey key = origin_key;
+		int step[3];
+		double t_max[3], t_delta[3];
+		for (int i = 0; i < 3 && !found; i++)
+		{
+			step[i] = direction(i) > 0.0 ? 1 : (direction(i) < 0.0 ? -1 : 0);
+			if (step[i] != 0)
+			{
+				double voxel_border = (double)((int)key[i] - tree_max_val) * res;
+				if (step[i] > 0)
+					voxel_border += res;
+				t_max[i] = (voxel_border - origin(i)) / direction(i);
+				t_delta[i] = res / fabs (direction(i));
+			}
+			else
+			{
+				t_max[i] = std::numeric_limits<double>::max ();
+				t_delta[i] = std::numeric_limits<double>::max ();
+			}
+		}
+
+		while (!found)
+		{
+			int dim;
+			if (t_max[0] < t_max[1])
+				dim = t_max[0] < t_max[2] ? 0 : 2;
+			else
+				dim = t_max[1] < t_max[2] ? 1 : 2;
+
+			// left the octree
+			if ((step[dim] < 0 && key[dim] == 0) || (step[dim] > 0 && key[dim] == 2 * tree_max_val - 1))
+				break;
+
+			key[dim] += step[dim];
+			t_max[dim] += t_delta[dim];
+
+			double dist_sq = 0;
+			for (int j = 0; j < 3; j++)
+			{
+				float d = (float)((double)((int)key[j] - tree_max_val + 0.5) * res) - origin(j);
+				dist_sq += d * d;
+			}
+			if (sensor_d_max_ > 0 && dist_sq > max_range_sq)
+				break;
+
+			octomap::OcTreeNodePCL *node = cached_search (key, nodes);
+			if (node != NULL && node->isOccupied ())
+			{
+				obstacle = node;
+				found = true;
+			}
+		}
+
+		if (!found)
+		{
+			miss++;
+			continue;
+		}
+		hit++;
+		if (obstacle->getLabel() == occupied_label_)
+			known++;
+		else if (obstacle->getLabel() == fringe_label_)
+			fringe++;
+	}
+}
+
 void NextBestView::grid_cb(const nav_msgs::OccupancyGridConstPtr& grid_msg)
 {
 	map_.header = grid_msg->header;
@@ -923,16 +1174,22 @@ void NextBestView::cloud_cb (const sensor_msgs::PointCloud2ConstPtr& pointcloud2
 	//nbv_pose_array_.poses.push_back (find_best_pose(best_combined_i,best_combined_j,best_combined_k,max_reward,min,max));
 	//geometry_msgs::Pose combined_bose=find_best_pose(best_combined_i,best_combined_j,best_combined_k,max_reward,min,max);
 	std::vector<double> scores;
-	int reward;
 	double score;
 
          marker.markers.resize(nr_pose_samples_);
 	bound_occ_costmap=reduced_costmap(bound_occ_costmap,best_combined_j,best_combined_k,min,max,x_dim,y_dim);
 
+	// sample all poses first, so that the random numbers are drawn in the same order, then score them in parallel
+	std::vector<pose_candidate> candidates;
+	for (int i = 0; i < nr_pose_samples_; i++)
+		candidates.push_back (sample_from_costmap(bound_occ_costmap, max_reward, nr_costmap_dirs_, x_dim, y_dim, min, max));
+	score_candidates (candidates);
+
 	for (int i = 0; i < nr_pose_samples_; i++)
 	{
 
-		geometry_msgs::Pose pose = sample_from_costmap(bound_occ_costmap, max_reward, nr_costmap_dirs_, x_dim, y_dim, min, max, reward,score);
+		geometry_msgs::Pose pose = candidates[i].pose;
+		score = candidates[i].score;
 		if (score == 0)
 			continue;
 		if (scores.size () == 0)
@@ -1304,8 +1561,14 @@ void NextBestView::computeBoundaryPoints(pcl::PointCloud<pcl::PointXYZ>& border_
 	}
 }
 
+/**
+ * \brief labels the end nodes of the rays occupied and the nodes along the rays free, unless they are occupied.
+ * The result does not depend on the order of the rays, so all end nodes are labeled first, and every node that
+ * is shared by several rays (most of them, close to the sensor) is searched and labeled only once.
+ */
 void NextBestView::castRayAndLabel(pcl::PointCloud<pcl::PointXYZ>& cloud, octomap::pose6d origin) {
 	octomap::point3d octomap_point3d;
+	std::vector<octomap::point3d> ends;
 
 	BOOST_FOREACH (const pcl::PointXYZ& pcl_pt, cloud.points) {
 		octomap_point3d(0) = pcl_pt.x;
@@ -1313,36 +1576,39 @@ void NextBestView::castRayAndLabel(pcl::PointCloud<pcl::PointXYZ>& cloud, octoma
 		octomap_point3d(2) = pcl_pt.z;
 		octomap::OcTreeNodePCL * octree_end_node = octree_->search(octomap_point3d);
 		if (octree_end_node != NULL) {
-			// Get the nodes along the ray and label them as free
-			if (octree_->computeRayKeys(origin.trans(), octomap_point3d, ray)) {
-				for(octomap::KeyRay::iterator it=ray.begin(); it != ray.end(); it++) {
-					octomap::OcTreeNodePCL * free_node = octree_->search(*it);
-					if (free_node != NULL) {
-						if (free_node->getLabel() != occupied_label_)
-						{
-							free_node->setLabel(free_label_);
-
-						}
-					}
-
-					else
-						ROS_DEBUG("node in ray not found!");
-				}
-			}
-			else {
-				ROS_DEBUG("could not compute ray from [%f %f %f] to [%f %f %f]", origin.x(), origin.y(), origin.z(), pcl_pt.x, pcl_pt.y, pcl_pt.z);
-			}
 			octree_end_node->set3DPointInliers(0);
 			octree_end_node->setLabel(occupied_label_);
+			ends.push_back(octomap_point3d);
 		}
 		else {
 			ROS_DEBUG("ERROR: node at [%f %f %f] not found", pcl_pt.x, pcl_pt.y, pcl_pt.z);
 		}
 	}
 
+	// Get the nodes along the rays and label them as free
+	boost::unordered_set<boost::uint64_t> visited;
+	for (unsigned int i = 0; i < ends.size(); i++) {
+		if (octree_->computeRayKeys(origin.trans(), ends[i], ray)) {
+			for(octomap::KeyRay::iterator it=ray.begin(); it != ray.end(); it++) {
+				if (!visited.insert(pack_key(*it)).second)
+					continue;
+				octomap::OcTreeNodePCL * free_node = octree_->search(*it);
+				if (free_node != NULL) {
+					if (free_node->getLabel() != occupied_label_)
+					{
+						free_node->setLabel(free_label_);
 
+					}
+				}
 
-
+				else
+					ROS_DEBUG("node in ray not found!");
+			}
+		}
+		else {
+			ROS_DEBUG("could not compute ray from [%f %f %f] to [%f %f %f]", origin.x(), origin.y(), origin.z(), ends[i].x(), ends[i].y(), ends[i].z());
+		}
+	}
 }
 void NextBestView::findOccupiedPoints(pcl::PointCloud<pcl::PointXYZ>& occupied_cloud, std::string frame_id)
 {
@@ -1365,57 +1631,95 @@ void NextBestView::findOccupiedPoints(pcl::PointCloud<pcl::PointXYZ>& occupied_c
 		}
 }
 
+/**
+ * \brief the node at key + (dx, dy, dz), from the leaves indexed by findBorderPoints. Only if the tree has leaves
+ * bigger than the resolution a key can be inside a leaf without being indexed, then the tree is searched.
+ */
+octomap::OcTreeNodePCL *NextBestView::neighbor_node (const octomap::OcTreeKey &key, int dx, int dy, int dz, const node_cache &leaf_nodes, bool search_tree)
+{
+	int k[3] = {(int)key[0] + dx, (int)key[1] + dy, (int)key[2] + dz};
+	octomap::OcTreeKey neighbor_key;
+	for (int i = 0; i < 3; i++)
+	{
+		// outside of the tree
+		if (k[i] < 0 || k[i] > 65535)
+			return NULL;
+		neighbor_key[i] = k[i];
+	}
+	node_cache::const_iterator it = leaf_nodes.find (pack_key (neighbor_key));
+	if (it != leaf_nodes.end ())
+		return it->second;
+	return search_tree ? octree_->search (neighbor_key) : NULL;
+}
+
+/**
+ * \brief labels free leaves with more than 7 unknown neighbours as fringe. The leaves are indexed by their key once,
+ * so the 26 neighbours of a leaf are found by key offsets instead of 26 searches from the root.
+ */
 void NextBestView::findBorderPoints(pcl::PointCloud<pcl::PointXYZ>& border_cloud, std::string frame_id)
 {
 	border_cloud.header.frame_id = frame_id;
 	border_cloud.header.stamp = ros::Time::now();
 	std::list<octomap::OcTreeVolume> leaves;
 	octree_->getLeafNodes(leaves);
+
+	node_cache leaf_nodes;
+	std::vector<std::pair<octomap::OcTreeKey, octomap::point3d> > free_leaves;
+	bool coarse_leaves = false;
 	BOOST_FOREACH(octomap::OcTreeVolume vol, leaves)
 	{
 		octomap::point3d centroid;
 		centroid(0) = vol.first.x(),  centroid(1) = vol.first.y(),  centroid(2) = vol.first.z();
-		octomap::OcTreeNodePCL *octree_node = octree_->search(centroid);
+		octomap::OcTreeKey key;
+		if (!octree_->genKey(centroid, key))
+			continue;
+		octomap::OcTreeNodePCL *octree_node = octree_->search(key);
+		if (octree_node == NULL)
+			continue;
+		if (vol.second > 1.5 * octree_res_)
+			coarse_leaves = true;
+		leaf_nodes[pack_key(key)] = octree_node;
+		if (octree_node->getLabel() == free_label_)
+			free_leaves.push_back(std::make_pair(key, centroid));
+	}
+
+	for (unsigned int i = 0; i < free_leaves.size(); i++)
+	{
+		const octomap::OcTreeKey &key = free_leaves[i].first;
+		const octomap::point3d &centroid = free_leaves[i].second;
+		octomap::OcTreeNodePCL *octree_node = leaf_nodes[pack_key(key)];
 		int found = 0;
-		// if free voxel -> check for unknown neighbors
-		if (octree_node != NULL && octree_node->getLabel() == free_label_)
+		// free voxel -> check for unknown neighbors
+		free_nr_++;
+		for (int x = -1; x <= 1; x++)
 		{
-
-			free_nr_++;
-			for (int x = -1; x <= 1; x++)
+			for (int y = -1; y <= 1; y++)
 			{
-				for (int y = -1; y <= 1; y++)
+				for (int z = -1; z <= 1; z++)
 				{
-					for (int z = -1; z <= 1; z++)
-					{
-						if (x == 0 && y == 0 && z == 0)
-							continue;
-						octomap::point3d neighbor_centroid (
-								centroid.x() + x * octree_res_,
-								centroid.y() + y * octree_res_,
-								centroid.z() + z * octree_res_);
-
-						octomap::OcTreeNodePCL *neighbor = octree_->search(neighbor_centroid);
-						if (neighbor != NULL && neighbor->getLabel() == unknown_label_) {
-							// add to list of border voxels
-							found++;
-							if (found > 7)
-							{
-								pcl::PointXYZ border_pt (centroid.x(), centroid.y(), centroid.z());
-								border_cloud.points.push_back(border_pt);
-								octree_node->setLogOdds (CLAMPING_THRES_MAX);
-								octree_node->setLabel(fringe_label_);
-
-								break;
-							}
+					if (x == 0 && y == 0 && z == 0)
+						continue;
+
+					octomap::OcTreeNodePCL *neighbor = neighbor_node(key, x, y, z, leaf_nodes, coarse_leaves);
+					if (neighbor != NULL && neighbor->getLabel() == unknown_label_) {
+						// add to list of border voxels
+						found++;
+						if (found > 7)
+						{
+							pcl::PointXYZ border_pt (centroid.x(), centroid.y(), centroid.z());
+							border_cloud.points.push_back(border_pt);
+							octree_node->setLogOdds (CLAMPING_THRES_MAX);
+							octree_node->setLabel(fringe_label_);
+
+							break;
 						}
 					}
-					if (found > 7)
-						break;
 				}
 				if (found > 7)
 					break;
 			}
+			if (found > 7)
+				break;
 		}
 	}
 	ROS_INFO("%d points in border cloud", (int)border_cloud.points.size());
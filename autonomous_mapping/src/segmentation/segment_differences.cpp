@@ -57,11 +57,192 @@
 #include "pcl/common/common.h"
 #include "pcl_ros/transforms.h"
 
+#include <boost/unordered_map.hpp>
+
 typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
 typedef pcl::KdTree<pcl::PointXYZ>::Ptr KdTreePtr;
 
 using namespace std;
 
+/*
+ * Change detection on a voxel grid instead of SegmentDifferences: both clouds are hashed into the same voxel keys,
+ * a voxel of one cloud has changed if none of the 27 voxels around it is occupied in the other cloud. Every point
+ * with a neighbour closer than the voxel size in the other cloud is therefore kept, changes between one and
+ * two voxel diagonals away can be missed. The changed points are clustered on a second grid with the cluster
+ * tolerance as voxel size, over face and edge adjacent voxels. Everything is linear in the number of points.
+ * The node sets the voxel size to sqrt (distance_threshold), because distance_threshold is the squared distance
+ * used by SegmentDifferences.
+ */
+class VoxelChangeDetector
+{
+public:
+  typedef boost::unordered_map<boost::uint64_t, int> VoxelMap;
+
+  VoxelChangeDetector () : voxel_size_(0.01)
+  {
+  }
+
+  void setVoxelSize (double voxel_size)
+  {
+    voxel_size_ = voxel_size;
+  }
+
+  // The target is hashed once and compared against every following input cloud
+  void setTargetCloud (const PointCloud &target)
+  {
+    target_voxels_.clear ();
+    hashCloud (target, voxel_size_, target_voxels_);
+    target_ = target;
+  }
+
+  // Points of the input in voxels that are not in the target, and points of the target in voxels that are not in
+  // the input
+  void compare (const PointCloud &input, std::vector<int> &added, std::vector<int> &removed,
+                int &nr_added_voxels, int &nr_removed_voxels) const
+  {
+    VoxelMap input_voxels;
+    hashCloud (input, voxel_size_, input_voxels);
+    nr_added_voxels = changedPoints (input, input_voxels, target_voxels_, added);
+    nr_removed_voxels = changedPoints (target_, target_voxels_, input_voxels, removed);
+  }
+
+  const PointCloud &getTargetCloud () const
+  {
+    return target_;
+  }
+
+  // Connected components of the points over face and edge adjacent voxels of size tolerance, components with less
+  // than min_size points are dropped
+  static void cluster (const PointCloud &cloud, const std::vector<int> &indices, double tolerance, int min_size,
+                       std::vector<pcl::PointIndices> &clusters)
+  {
+    // Points sorted by voxel, and the range of every voxel in this array
+    std::vector<std::pair<boost::uint64_t, int> > keyed;
+    keyed.reserve (indices.size ());
+    for (size_t n = 0; n < indices.size (); n++)
+      keyed.push_back (std::make_pair (key (cloud.points[indices[n]], tolerance), indices[n]));
+    std::sort (keyed.begin (), keyed.end ());
+
+    std::vector<int> voxel_begin;
+    VoxelMap voxels;
+    for (size_t n = 0; n < keyed.size (); n++)
+    {
+      if (n == 0 || keyed[n].first != keyed[n - 1].first)
+      {
+        voxels[keyed[n].first] = voxel_begin.size ();
+        voxel_begin.push_back (n);
+      }
+    }
+    voxel_begin.push_back (keyed.size ());
+
+    clusters.clear ();
+    std::vector<char> visited (voxel_begin.size () - 1, false);
+    std::vector<int> queue;
+    for (size_t v = 0; v + 1 < voxel_begin.size (); v++)
+    {
+      if (visited[v])
+        continue;
+      visited[v] = true;
+      queue.assign (1, v);
+      pcl::PointIndices c;
+      for (size_t q = 0; q < queue.size (); q++)
+      {
+        int u = queue[q];
+        for (int n = voxel_begin[u]; n < voxel_begin[u + 1]; n++)
+          c.indices.push_back (keyed[n].second);
+
+        int i, j, k;
+        decode (keyed[voxel_begin[u]].first, i, j, k);
+        for (int di = -1; di <= 1; di++)
+          for (int dj = -1; dj <= 1; dj++)
+            for (int dk = -1; dk <= 1; dk++)
+            {
+              // 18 neighbourhood, the corners only touch
+              if (abs (di) + abs (dj) + abs (dk) == 3)
+                continue;
+              VoxelMap::const_iterator it = voxels.find (key (i + di, j + dj, k + dk));
+              if (it != voxels.end () && !visited[it->second])
+              {
+                visited[it->second] = true;
+                queue.push_back (it->second);
+              }
+            }
+      }
+      if ((int)c.indices.size () >= min_size)
+      {
+        std::sort (c.indices.begin (), c.indices.end ());
+        clusters.push_back (c);
+      }
+    }
+  }
+
+protected:
+  //21 bits per axis, the voxels are in the cm range so this covers any realistic map:
+  static boost::uint64_t key (int i, int j, int k)
+  {
+    const int offset = 1 << 20;
+    return ((boost::uint64_t)(i + offset) << 42) | ((boost::uint64_t)(j + offset) << 21) | (boost::uint64_t)(k + offset);
+  }
+
+  static boost::uint64_t key (const pcl::PointXYZ &p, double size)
+  {
+    return key ((int)floor (p.x / size), (int)floor (p.y / size), (int)floor (p.z / size));
+  }
+
+  static void decode (boost::uint64_t key, int &i, int &j, int &k)
+  {
+    const int offset = 1 << 20;
+    const boost::uint64_t mask = (1 << 21) - 1;
+    i = (int)((key >> 42) & mask) - offset;
+    j = (int)((key >> 21) & mask) - offset;
+    k = (int)(key & mask) - offset;
+  }
+
+  static bool isFinite (const pcl::PointXYZ &p)
+  {
+    return pcl_isfinite (p.x) && pcl_isfinite (p.y) && pcl_isfinite (p.z);
+  }
+
+  // Number of points in every occupied voxel
+  static void hashCloud (const PointCloud &cloud, double size, VoxelMap &voxels)
+  {
+    for (size_t n = 0; n < cloud.points.size (); n++)
+      if (isFinite (cloud.points[n]))
+        voxels[key (cloud.points[n], size)]++;
+  }
+
+  // Points of cloud in voxels without an occupied voxel of other around them, returns the number of these voxels
+  int changedPoints (const PointCloud &cloud, const VoxelMap &voxels, const VoxelMap &other,
+                     std::vector<int> &indices) const
+  {
+    VoxelMap changed;
+    for (VoxelMap::const_iterator v = voxels.begin (); v != voxels.end (); v++)
+    {
+      int i, j, k;
+      decode (v->first, i, j, k);
+      bool found = false;
+      for (int di = -1; di <= 1 && !found; di++)
+        for (int dj = -1; dj <= 1 && !found; dj++)
+          for (int dk = -1; dk <= 1 && !found; dk++)
+            found = other.find (key (i + di, j + dj, k + dk)) != other.end ();
+      if (!found)
+        changed[v->first] = 1;
+    }
+
+    indices.clear ();
+    if (changed.empty ())
+      return 0;
+    for (size_t n = 0; n < cloud.points.size (); n++)
+      if (isFinite (cloud.points[n]) && changed.find (key (cloud.points[n], voxel_size_)) != changed.end ())
+        indices.push_back (n);
+    return changed.size ();
+  }
+
+  double voxel_size_;
+  VoxelMap target_voxels_;
+  PointCloud target_;
+};
+
 class SegmentDifferencesNode
 {
 protected:
@@ -70,15 +251,20 @@ protected:
 public:
   string output_cloud_topic_, input_cloud_topic_;
   string output_filtered_cloud_topic_;
+  string output_removed_cloud_topic_;
   
   pcl_ros::Publisher<pcl::PointXYZ> pub_diff_;
   pcl_ros::Publisher<pcl::PointXYZ> pub_filtered_;
+  pcl_ros::Publisher<pcl::PointXYZ> pub_removed_;
   ros::Subscriber sub_;
   // Create the segmentation object
   pcl::SegmentDifferences <pcl::PointXYZ> seg_;
   pcl::RadiusOutlierRemoval<pcl::PointXYZ> outrem_;
   pcl::EuclideanClusterExtraction<pcl::PointXYZ> cluster_;
   KdTreePtr clusters_tree_;
+  // "kdtree" for SegmentDifferences, outlier removal and Euclidean clustering, "voxel" for VoxelChangeDetector
+  string change_detection_;
+  VoxelChangeDetector voxel_detector_;
   double rate_;
   int counter_;
   double distance_threshold_;
@@ -95,11 +281,18 @@ public:
     nh_.param("output_filtered_cloud_topic", output_filtered_cloud_topic_, std::string("difference_filtered"));
     nh_.param("distance_threshold", distance_threshold_, 0.01);
     nh_.param("save_segmented_cloud_", save_segmented_cloud_, true);
+    nh_.param("change_detection", change_detection_, std::string("kdtree"));
+    nh_.param("output_removed_cloud_topic", output_removed_cloud_topic_, std::string("difference_removed"));
     ROS_INFO ("Distance threshold set to %lf.", distance_threshold_);
     pub_diff_.advertise (nh_, output_cloud_topic_.c_str (), 1);
     ROS_INFO ("Publishing data on topic %s.", nh_.resolveName (output_cloud_topic_).c_str ());
     pub_filtered_.advertise (nh_, output_filtered_cloud_topic_.c_str (), 1);
     ROS_INFO ("Publishing data on topic %s.", nh_.resolveName (output_filtered_cloud_topic_).c_str ());
+    if (change_detection_ == "voxel")
+    {
+      pub_removed_.advertise (nh_, output_removed_cloud_topic_.c_str (), 1);
+      ROS_INFO ("Publishing data on topic %s.", nh_.resolveName (output_removed_cloud_topic_).c_str ());
+    }
     sub_ = nh_.subscribe (input_cloud_topic_, 1,  &SegmentDifferencesNode::cloud_cb, this);
     ROS_INFO ("Listening for incoming data on topic %s", nh_.resolveName (input_cloud_topic_).c_str ());
     nh_.param("object_cluster_tolerance", object_cluster_tolerance_, 0.1);
@@ -107,6 +300,8 @@ public:
     nh_.param("object_cluster_min_size", object_cluster_min_size_, 500);
     //set PCL classes
     seg_.setDistanceThreshold (distance_threshold_);
+    // SegmentDifferences compares squared distances, the voxels need the length
+    voxel_detector_.setVoxelSize (sqrt (distance_threshold_));
     clusters_tree_ = boost::make_shared<pcl::KdTreeFLANN<pcl::PointXYZ> > ();
     clusters_tree_->setEpsilon (1);
     rate_ = 1;
@@ -129,7 +324,10 @@ public:
     {
       ROS_INFO("Setting target cloud with %ld points", cloud_in.points.size());
       //seg_.setInputCloud (boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(cloud_in));
-      seg_.setTargetCloud(boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(cloud_in));
+      if (change_detection_ == "voxel")
+        voxel_detector_.setTargetCloud (cloud_in);
+      else
+        seg_.setTargetCloud(boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(cloud_in));
       counter_++;
       nh_.setParam("/segment_difference_interactive/take_first_cloud", false);
       pub_diff_.publish (cloud_in);
@@ -137,23 +335,41 @@ public:
     else if (segment_)
     {
       ROS_INFO("Setting input cloud with %ld points", cloud_in.points.size());
-      //seg_.setTargetCloud(boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(cloud_in));
-      seg_.setInputCloud (boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(cloud_in));
-      seg_.segment (output);
-      //counter_ = 0;
-      outrem_.setInputCloud (boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(output));
-      outrem_.setRadiusSearch (0.02);
-      outrem_.setMinNeighborsInRadius (10);
-      outrem_.filter (output_filtered);
-      
-      //cluster
       std::vector<pcl::PointIndices> clusters;
-      cluster_.setInputCloud (boost::make_shared<PointCloud>(output_filtered));
-      cluster_.setClusterTolerance (object_cluster_tolerance_);
-      cluster_.setMinClusterSize (object_cluster_min_size_);
-      //    cluster_.setMaxClusterSize (object_cluster_max_size_);
-      cluster_.setSearchMethod (clusters_tree_);
-      cluster_.extract (clusters);
+      if (change_detection_ == "voxel")
+      {
+        //the clusters index cloud_in directly
+        std::vector<int> added, removed;
+        int nr_added_voxels, nr_removed_voxels;
+        voxel_detector_.compare (cloud_in, added, removed, nr_added_voxels, nr_removed_voxels);
+        ROS_INFO("[SegmentDifferencesNode:] %d voxels added, %d voxels removed", nr_added_voxels, nr_removed_voxels);
+
+        pcl::PointCloud<pcl::PointXYZ> removed_cloud;
+        pcl::copyPointCloud (voxel_detector_.getTargetCloud (), removed, removed_cloud);
+        pub_removed_.publish (removed_cloud);
+
+        VoxelChangeDetector::cluster (cloud_in, added, object_cluster_tolerance_, object_cluster_min_size_, clusters);
+        output_filtered = cloud_in;
+      }
+      else
+      {
+        //seg_.setTargetCloud(boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(cloud_in));
+        seg_.setInputCloud (boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(cloud_in));
+        seg_.segment (output);
+        //counter_ = 0;
+        outrem_.setInputCloud (boost::make_shared<pcl::PointCloud<pcl::PointXYZ> >(output));
+        outrem_.setRadiusSearch (0.02);
+        outrem_.setMinNeighborsInRadius (10);
+        outrem_.filter (output_filtered);
+
+        //cluster
+        cluster_.setInputCloud (boost::make_shared<PointCloud>(output_filtered));
+        cluster_.setClusterTolerance (object_cluster_tolerance_);
+        cluster_.setMinClusterSize (object_cluster_min_size_);
+        //    cluster_.setMaxClusterSize (object_cluster_max_size_);
+        cluster_.setSearchMethod (clusters_tree_);
+        cluster_.extract (clusters);
+      }
       ROS_INFO("[SegmentDifferencesNode:] Found %ld cluster", clusters.size());
 
       //get robot's pose
@@ -56,6 +56,9 @@
 // pcl visualization dependencies
 #include "pcl/visualization/pcl_visualizer.h"
 
+// autonomous mapping dependencies
+#include "autonomous_mapping/multi_plane_extraction.h"
+
 // pcl ias sample consensus dependencies
 #include "pcl_ias_sample_consensus/pcl_sac_model_orientation.h"
 
@@ -81,6 +84,9 @@ double epsilon_angle = 0.010; /// [radians]
 double plane_threshold = 0.100; /// [meters]
 int minimum_plane_inliers = 1000; /// [points]
 int maximum_plane_iterations = 1000; /// [iterations]
+int number_of_plane_hypotheses = 0; /// [hypotheses] fitted in parallel, 0 for one per core
+double coplanar_epsilon_angle = 0.050; /// [radians]
+double coplanar_distance = 0.050; /// [meters]
 
 // Clustering's Parameters
 int minimum_size_of_plane_cluster = 100; /// [points]
@@ -100,6 +106,7 @@ int min_pts_per_cluster = 150; /// [points]
 int fixture_min_pts_per_cluster = 150; /// [points]
 
 // Visualization's Parameters
+bool visualize = true;
 bool step = false;
 bool clean = false;
 bool verbose = false;
@@ -388,8 +395,79 @@ bool findBoxModel (boost::shared_ptr<const pcl::PointCloud <PointT> > cloud, pcl
 
 //*/
 
-void getAxesOrientedSurfaces (pcl::PointCloud<PointT> &input_cloud,
-                              pcl::PointCloud<pcl::Normal> &normals_cloud,
+/** \brief Forwards to a PCLVisualizer if visualization is enabled and does nothing otherwise, so that the segmentation
+ * runs without a display. With -visualize 0 no window is opened and step never waits.
+ */
+class OptionalViewer
+{
+  public:
+    OptionalViewer (const std::string &name, bool enabled)
+    {
+      if (enabled)
+        viewer_.reset (new pcl::visualization::PCLVisualizer (name));
+    }
+
+    void setBackgroundColor (double r, double g, double b)
+    {
+      if (viewer_)
+        viewer_->setBackgroundColor (r, g, b);
+    }
+
+    void addCoordinateSystem (double scale)
+    {
+      if (viewer_)
+        viewer_->addCoordinateSystem (scale);
+    }
+
+    void getCameraParameters (int argc, char **argv)
+    {
+      if (viewer_)
+        viewer_->getCameraParameters (argc, argv);
+    }
+
+    void updateCamera ()
+    {
+      if (viewer_)
+        viewer_->updateCamera ();
+    }
+
+    template <typename CloudPtr> void addPointCloud (const CloudPtr &cloud, const std::string &id)
+    {
+      if (viewer_)
+        viewer_->addPointCloud (cloud, id);
+    }
+
+    void removePointCloud (const std::string &id)
+    {
+      if (viewer_)
+        viewer_->removePointCloud (id);
+    }
+
+    void setPointCloudRenderingProperties (int property, double value, const std::string &id)
+    {
+      if (viewer_)
+        viewer_->setPointCloudRenderingProperties (property, value, id);
+    }
+
+    void setPointCloudRenderingProperties (int property, double value1, double value2, double value3, const std::string &id)
+    {
+      if (viewer_)
+        viewer_->setPointCloudRenderingProperties (property, value1, value2, value3, id);
+    }
+
+    void spin ()
+    {
+      if (viewer_)
+        viewer_->spin ();
+    }
+
+  private:
+    boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer_;
+};
+
+void getAxesOrientedSurfaces (const pcl::PointCloud<PointT>::ConstPtr &input_cloud,
+                              const pcl::PointCloud<pcl::Normal>::ConstPtr &normals_cloud,
+                              std::vector<int> &remaining_indices,
                               Eigen::Vector3f axis,
                               double epsilon_angle,
                               double plane_threshold,
@@ -401,40 +479,34 @@ void getAxesOrientedSurfaces (pcl::PointCloud<PointT> &input_cloud,
                               std::vector<std::string> &planar_surfaces_ids,
                               std::vector<pcl::PointIndices::Ptr> &planar_surfaces_indices,
                               std::vector<pcl::ModelCoefficients::Ptr> &planar_surfaces_coefficients,
-                              pcl::visualization::PCLVisualizer &viewer)
+                              OptionalViewer &viewer)
 {
 
-  // Count number of fitted planes 
-  int plane_fit = 0;
-
-  // Stop condition for fitting
-  bool stop_planes = false;
-
-
-  // Count one hundred mishaps
-  int counter = 0;
-
-  do
+  // Inliers and coefficients of the planes
+  std::vector<pcl::PointIndices::Ptr> planes_inliers;
+  std::vector<pcl::ModelCoefficients::Ptr> planes_coefficients;
+
+  // Create the extraction object and set all the parameters for segmenting the planes
+  autonomous_mapping::MultiPlaneExtraction<PointT> extraction_of_planes;
+  extraction_of_planes.setInputCloud (input_cloud);
+  extraction_of_planes.setInputNormals (normals_cloud);
+  extraction_of_planes.setAxis (axis, epsilon_angle);
+  extraction_of_planes.setDistanceThreshold (plane_threshold);
+  extraction_of_planes.setNormalDistanceWeight (0.05);
+  extraction_of_planes.setMaxIterations (maximum_plane_iterations);
+  extraction_of_planes.setMinInliers (minimum_plane_inliers);
+  extraction_of_planes.setMaxFailures (25);
+  extraction_of_planes.setNumberOfHypotheses (number_of_plane_hypotheses);
+  extraction_of_planes.setCoplanarThresholds (coplanar_epsilon_angle, coplanar_distance);
+
+  // Obtain the inliers and coefficients of all planes, only the indices of the remaining points are updated
+  std::vector<int> indices = remaining_indices;
+  extraction_of_planes.extract (indices, planes_inliers, planes_coefficients, remaining_indices);
+
+  for (int p = 0; p < (int) planes_inliers.size (); p++)
   {
-    // Create the segmentation object and declare variables
-    pcl::SACSegmentationFromNormals<PointT, pcl::Normal> segmentation_of_planes;
-    pcl::PointIndices::Ptr plane_inliers (new pcl::PointIndices ());
-    pcl::ModelCoefficients::Ptr plane_coefficients (new pcl::ModelCoefficients ());
-
-    // Set all the parameters for segmenting vertical planes
-    segmentation_of_planes.setOptimizeCoefficients (true);
-    segmentation_of_planes.setModelType (pcl::SACMODEL_NORMAL_PLANE);
-    segmentation_of_planes.setNormalDistanceWeight (0.05);
-    segmentation_of_planes.setMethodType (pcl::SAC_RANSAC);
-    segmentation_of_planes.setDistanceThreshold (plane_threshold);
-    segmentation_of_planes.setMaxIterations (maximum_plane_iterations);
-    segmentation_of_planes.setAxis (axis);
-    segmentation_of_planes.setEpsAngle (epsilon_angle);
-    segmentation_of_planes.setInputCloud (input_cloud.makeShared());
-    segmentation_of_planes.setInputNormals (normals_cloud.makeShared());
-
-    // Obtain the plane inliers and coefficients
-    segmentation_of_planes.segment (*plane_inliers, *plane_coefficients);
+    pcl::PointIndices::Ptr plane_inliers = planes_inliers.at (p);
+    pcl::ModelCoefficients::Ptr plane_coefficients = planes_coefficients.at (p);
 
     if ( verbose )
     {
@@ -442,86 +514,100 @@ void getAxesOrientedSurfaces (pcl::PointCloud<PointT> &input_cloud,
           plane_coefficients->values [0], plane_coefficients->values [1], plane_coefficients->values [2], plane_coefficients->values [3], maximum_plane_iterations);
     }
 
-    // Check if the fitted circle has enough inliers in order to be accepted
-    if ((int) plane_inliers->indices.size () < minimum_plane_inliers) 
-    {
-      ROS_ERROR ("NOT ACCEPTED !");
+    // ----------------------------------- //
+    // Start processing the accepted plane //
+    // ----------------------------------- //
 
-      counter++;
+    // Point cloud of plane inliers
+    pcl::PointCloud<PointT>::Ptr plane_inliers_cloud (new pcl::PointCloud<PointT> ());
 
-      cerr <<" COUNTER = " << counter << endl ;
+    // Extract the plane inliers from the input cloud
+    pcl::ExtractIndices<PointT> extraction_of_plane_inliers;
+    // Set point cloud from where to extract
+    extraction_of_plane_inliers.setInputCloud (input_cloud);
+    // Set which indices to extract
+    extraction_of_plane_inliers.setIndices (plane_inliers);
+    // Return the points which represent the inliers
+    extraction_of_plane_inliers.setNegative (false);
+    // Call the extraction function
+    extraction_of_plane_inliers.filter (*plane_inliers_cloud);
+
+    // Vector of clusters from inliers
+    std::vector<pcl::PointIndices> plane_clusters;
+    // Build kd-tree structure for clusters
+    pcl::KdTreeFLANN<PointT>::Ptr plane_clusters_tree (new pcl::KdTreeFLANN<PointT> ());
+
+    // Instantiate cluster extraction object
+    pcl::EuclideanClusterExtraction<PointT> clustering_of_plane_inliers;
+    // Set as input the cloud of plane inliers
+    clustering_of_plane_inliers.setInputCloud (plane_inliers_cloud);
+    // Radius of the connnectivity threshold
+    clustering_of_plane_inliers.setClusterTolerance (plane_inliers_clustering_tolerance);
+    // Minimum size of clusters
+    clustering_of_plane_inliers.setMinClusterSize (minimum_size_of_plane_cluster);
+    // Provide pointer to the search method
+    clustering_of_plane_inliers.setSearchMethod (plane_clusters_tree);
+    // Call the extraction function
+    clustering_of_plane_inliers.extract (plane_clusters);
 
-      // TODO limit the number of re-fitting for better computation time
+    // Point clouds which represent the clusters of the plane inliers
+    std::vector<pcl::PointCloud<PointT>::Ptr> plane_clusters_clouds;
 
-      if ( counter == 25 )
-      {
-        // No need for fitting planes anymore
-        stop_planes = true;
-      }
-    }
-    else
+    for (int c = 0; c < (int) plane_clusters.size(); c++)
     {
-      ROS_WARN ("ACCEPTED !");
-
-      // Reset counter
-      counter = 0;
+      // Local variables
+      pcl::PointIndices::Ptr pointer_of_plane_cluster (new pcl::PointIndices (plane_clusters.at(c)));
+      pcl::PointCloud<PointT>::Ptr cluster (new pcl::PointCloud<PointT>);
 
-      // ----------------------------------- //
-      // Start processing the accepted plane //
-      // ----------------------------------- //
-
-      // Point cloud of plane inliers
-      pcl::PointCloud<PointT>::Ptr pivot_input_cloud (new pcl::PointCloud<PointT> ());
-
-      // Point cloud of plane inliers
-      pcl::PointCloud<PointT>::Ptr plane_inliers_cloud (new pcl::PointCloud<PointT> ());
-
-      // Extract the circular inliers from the input cloud
-      pcl::ExtractIndices<PointT> extraction_of_plane_inliers;
+      // Extract the cluster from the cloud of plane inliers
+      pcl::ExtractIndices<PointT> extraction_of_plane_clusters;
       // Set point cloud from where to extract
-      extraction_of_plane_inliers.setInputCloud (input_cloud.makeShared());
+      extraction_of_plane_clusters.setInputCloud (plane_inliers_cloud);
       // Set which indices to extract
-      extraction_of_plane_inliers.setIndices (plane_inliers);
+      extraction_of_plane_clusters.setIndices (pointer_of_plane_cluster);
       // Return the points which represent the inliers
-      extraction_of_plane_inliers.setNegative (false);
-      // Call the extraction function
-      extraction_of_plane_inliers.filter (*plane_inliers_cloud);
-      // Return the remaining points of inliers
-      extraction_of_plane_inliers.setNegative (true);
+      extraction_of_plane_clusters.setNegative (false);
       // Call the extraction function
-      extraction_of_plane_inliers.filter (*pivot_input_cloud);
+      extraction_of_plane_clusters.filter (*cluster);
 
-      // UPDATE input_cloud VARIABLE //
-      input_cloud = *pivot_input_cloud;
+      // Indices of the cluster in the input cloud
+      for (int i = 0; i < (int) pointer_of_plane_cluster->indices.size (); i++)
+        pointer_of_plane_cluster->indices.at (i) = plane_inliers->indices.at (pointer_of_plane_cluster->indices.at (i));
 
-      // Point cloud of plane inliers
-      pcl::PointCloud<pcl::Normal>::Ptr pivot_normals_cloud (new pcl::PointCloud<pcl::Normal> ());
+      // Save cluster
+      plane_clusters_clouds.push_back (cluster);
 
-      // Extract the normals of plane inliers 
-      pcl::ExtractIndices<pcl::Normal> extraction_of_normals;
+      // Save planar surface
+      planar_surfaces.push_back (cluster);
 
-      // Set normals cloud from where to extract
-      extraction_of_normals.setInputCloud (normals_cloud.makeShared());
-      // Return the remaining normals
-      extraction_of_normals.setNegative (true);
-      // Set which indices to extract
-      extraction_of_normals.setIndices (plane_inliers);
-      // Call the extraction function
-      extraction_of_normals.filter (*pivot_normals_cloud);
+      // Save coefficients of plane's planar surface
+      planar_surfaces_coefficients.push_back (plane_coefficients);
+
+      // Save indices of planar surfaces
+      planar_surfaces_indices.push_back (pointer_of_plane_cluster);
+
+      if ( verbose )
+      {
+        ROS_INFO ("  Planar surface %d has %d points", c, (int) cluster->points.size());
+      }
+    }
 
-      // UPDATE input_cloud VARIABLE //
-      normals_cloud = *pivot_normals_cloud;
 
-      /*
 
+    for (int c = 0; c < (int) plane_clusters.size(); c++)
+    {
       // Create ID for visualization
-      std::stringstream id_of_plane;
-      id_of_plane << "PLANE_" << ros::Time::now();
+      std::stringstream id_of_surface;
+      id_of_surface << "SURFACE_" << ros::Time::now();
+
+      // Save id of planar surface
+      planar_surfaces_ids.push_back (id_of_surface.str());
 
       // Add point cloud to viewer
-      viewer.addPointCloud (plane_inliers_cloud, id_of_plane.str());
+      viewer.addPointCloud (plane_clusters_clouds.at(c), id_of_surface.str());
+
       // Set the size of points for cloud
-      viewer.setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, size_of_points, id_of_plane.str()); 
+      viewer.setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, size_of_points, id_of_surface.str()); 
 
       // Wait or not wait
       if ( step )
@@ -534,162 +620,22 @@ void getAxesOrientedSurfaces (pcl::PointCloud<PointT> &input_cloud,
       if ( clean )
       {
         // Remove the point cloud data
-        viewer.removePointCloud (id_of_plane.str());
-
-        // Wait or not wait
-        if ( step )
-        {
-          // And wait until Q key is pressed
-          viewer.spin ();
-        }
-      }
-
-      */
-
-
-
-      ///*
-
-      // Vector of clusters from inliers
-      std::vector<pcl::PointIndices> plane_clusters;
-      // Build kd-tree structure for clusters
-      pcl::KdTreeFLANN<PointT>::Ptr plane_clusters_tree (new pcl::KdTreeFLANN<PointT> ());
-
-      // Instantiate cluster extraction object
-      pcl::EuclideanClusterExtraction<PointT> clustering_of_plane_inliers;
-      // Set as input the cloud of circle inliers
-      clustering_of_plane_inliers.setInputCloud (plane_inliers_cloud);
-      // Radius of the connnectivity threshold
-      clustering_of_plane_inliers.setClusterTolerance (plane_inliers_clustering_tolerance);
-      // Minimum size of clusters
-      clustering_of_plane_inliers.setMinClusterSize (minimum_size_of_plane_cluster);
-      // Provide pointer to the search method
-      clustering_of_plane_inliers.setSearchMethod (plane_clusters_tree);
-      // Call the extraction function
-      clustering_of_plane_inliers.extract (plane_clusters);
-
-      //*/
-
-
-
-      /*
-
-      if ( verbose )
-      {
-        ROS_WARN ("Plane model has %d clusters where", plane_clusters.size());
-        for (int c = 0; c < (int) plane_clusters.size(); c++)
-          ROS_WARN ("  Cluster %d has %d points", c, (int) plane_clusters.at(c).indices.size());
-      }
-
-      */
-
-      // Point clouds which represent the clusters of the plane inliers
-      std::vector<pcl::PointCloud<PointT>::Ptr> plane_clusters_clouds;
-
-      for (int c = 0; c < (int) plane_clusters.size(); c++)
-      {
-        // Local variables
-        pcl::PointIndices::Ptr pointer_of_plane_cluster (new pcl::PointIndices (plane_clusters.at(c)));
-        pcl::PointCloud<PointT>::Ptr cluster (new pcl::PointCloud<PointT>);
-
-        // Extract the circular inliers from the input cloud
-        pcl::ExtractIndices<PointT> extraction_of_plane_clusters;
-        // Set point cloud from where to extract
-        extraction_of_plane_clusters.setInputCloud (plane_inliers_cloud);
-        // Set which indices to extract
-        extraction_of_plane_clusters.setIndices (pointer_of_plane_cluster);
-        // Return the points which represent the inliers
-        extraction_of_plane_clusters.setNegative (false);
-        // Call the extraction function
-        extraction_of_plane_clusters.filter (*cluster);
-
-        // Save cluster
-        plane_clusters_clouds.push_back (cluster);
-
-        // Save planar surface
-        planar_surfaces.push_back (cluster);
-
-        // Save coefficients of plane's planar surface
-        planar_surfaces_coefficients.push_back (plane_coefficients);
-
-        // Save indices of planar surfaces
-        planar_surfaces_indices.push_back (pointer_of_plane_cluster);
-
-        if ( verbose )
-        {
-          ROS_INFO ("  Planar surface %d has %d points", c, (int) cluster->points.size());
-        }
-      }
-
-
-
-      for (int c = 0; c < (int) plane_clusters.size(); c++)
-      {
-        // Create ID for visualization
-        std::stringstream id_of_surface;
-        id_of_surface << "SURFACE_" << ros::Time::now();
-
-        // Save id of planar surface
-        planar_surfaces_ids.push_back (id_of_surface.str());
-
-        // Add point cloud to viewer
-        viewer.addPointCloud (plane_clusters_clouds.at(c), id_of_surface.str());
-
-        // Set the size of points for cloud
-        viewer.setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, size_of_points, id_of_surface.str()); 
-
+        viewer.removePointCloud (id_of_surface.str());
         // Wait or not wait
         if ( step )
         {
           // And wait until Q key is pressed
           viewer.spin ();
         }
-
-        // Remove or not remove the cloud from viewer
-        if ( clean )
-        {
-          // Remove the point cloud data
-          viewer.removePointCloud (id_of_surface.str());
-          // Wait or not wait
-          if ( step )
-          {
-            // And wait until Q key is pressed
-            viewer.spin ();
-          }
-        }
       }
-
-
-      /*
-
-      // Remove the point cloud data
-      viewer.removePointCloud (id_of_plane.str());
-
-      */
-
-      // ------------------------------------- //
-      // End of processing the accepted circle //
-      // ------------------------------------- //
-
     }
 
-    // number of fitted planes
-    plane_fit++;
-
-    // --------------------------------------- //
-    // Check for stop condition and print info //
-    // --------------------------------------- //
-
-    // Print the number of points left for model fitting
-    if ( (int) input_cloud.points.size () < minimum_plane_inliers )
-      ROS_ERROR ("%d < %d | Stop !", (int) input_cloud.points.size (), minimum_plane_inliers);
-    else
-      if ( (int) input_cloud.points.size () > minimum_plane_inliers )
-        ROS_INFO ("%d > %d | Continue... ", (int) input_cloud.points.size (), minimum_plane_inliers);
-      else
-        ROS_INFO ("%d = %d | Continue... ", (int) input_cloud.points.size (), minimum_plane_inliers);
+    // ------------------------------------- //
+    // End of processing the accepted plane  //
+    // ------------------------------------- //
+  }
 
-  } while ((int) input_cloud.points.size () > minimum_plane_inliers && stop_planes == false);
+  ROS_INFO ("%d planes found, %d points remain", (int) planes_inliers.size (), (int) remaining_indices.size ());
 }
 
 
@@ -718,12 +664,16 @@ int main (int argc, char** argv)
     ROS_INFO ("    -plane_threshold X                       = Distance to the fitted plane model.");
     ROS_INFO ("    -minimum_plane_inliers X                 = Minimum number of inliers of the fitted plane in order to be accepted.");
     ROS_INFO ("    -maximum_plane_iterations X              = Maximum number of interations for fitting the plane model.");
+    ROS_INFO ("    -number_of_plane_hypotheses X            = Number of plane models fitted in parallel, 0 for one per core.");
+    ROS_INFO ("    -coplanar_epsilon_angle X                = The maximum difference between the normals of planes that are merged.");
+    ROS_INFO ("    -coplanar_distance X                     = The maximum difference between the distances of planes that are merged.");
     ROS_INFO (" ");
     ROS_INFO ("    -minimum_size_of_plane_cluster           = Minimum cluster size of plane inliers.");
     ROS_INFO ("    -plane_inliers_clustering_tolerance      = The clustering tolerance of plane inliers");
     ROS_INFO ("    -minimum_size_of_handle_cluster          = Minimum cluster size of handle points.");
     ROS_INFO ("    -handle_clustering_tolerance             = The clustering tolerance of handle points.");
     ROS_INFO (" ");
+    ROS_INFO ("    -visualize B                             = Open the viewer or run without display.");
     ROS_INFO ("    -step B                                  = Wait or not wait.");
     ROS_INFO ("    -clean B                                 = Remove or not remove.");
     ROS_INFO ("    -verbose B                               = Display step by step info.");
@@ -750,6 +700,9 @@ int main (int argc, char** argv)
   pcl::console::parse_argument (argc, argv, "-plane_threshold", plane_threshold);
   pcl::console::parse_argument (argc, argv, "-minimum_plane_inliers", minimum_plane_inliers);
   pcl::console::parse_argument (argc, argv, "-maximum_plane_iterations", maximum_plane_iterations);
+  pcl::console::parse_argument (argc, argv, "-number_of_plane_hypotheses", number_of_plane_hypotheses);
+  pcl::console::parse_argument (argc, argv, "-coplanar_epsilon_angle", coplanar_epsilon_angle);
+  pcl::console::parse_argument (argc, argv, "-coplanar_distance", coplanar_distance);
 
   // Parse arguments for clustering
   pcl::console::parse_argument (argc, argv, "-minimum_size_of_plane_cluster", minimum_size_of_plane_cluster);
@@ -769,6 +722,7 @@ int main (int argc, char** argv)
   pcl::console::parse_argument (argc, argv, "-fixture_min_pts_per_cluster", fixture_min_pts_per_cluster);
 
   // Parse arguments for visualization
+  pcl::console::parse_argument (argc, argv, "-visualize", visualize);
   pcl::console::parse_argument (argc, argv, "-step", step);
   pcl::console::parse_argument (argc, argv, "-clean", clean);
   pcl::console::parse_argument (argc, argv, "-verbose", verbose);
@@ -804,8 +758,8 @@ int main (int argc, char** argv)
   // ------------------ Visualize point cloud data ------------------ //
   // ---------------------------------------------------------------- //
 
-  // Open a 3D viewer
-  pcl::visualization::PCLVisualizer viewer ("3D VIEWER");
+  // Open a 3D viewer, or none when running without display
+  OptionalViewer viewer ("3D VIEWER", visualize);
   // Set the background of viewer
   viewer.setBackgroundColor (0.0, 0.0, 0.0);
   // Add system coordiante to viewer
@@ -1300,26 +1254,25 @@ int main (int argc, char** argv)
   // Coefficients of planar surfaces
   std::vector<pcl::ModelCoefficients::Ptr> planar_surfaces_coefficients;
 
-  // Pivot Auxiliary 
-  pcl::PointCloud<PointT>::Ptr pivot_auxiliary_input_cloud (new pcl::PointCloud<PointT> ());
-
-  // Give it some points
-  *pivot_auxiliary_input_cloud = *input_cloud;
+  // Indices of the points which are not part of a planar surface yet
+  std::vector<int> remaining_indices (input_cloud->points.size ());
+  for (int i = 0; i < (int) remaining_indices.size (); i++)
+    remaining_indices.at (i) = i;
 
   ROS_ERROR ("Z axis aligned planes");
 //  Eigen::Vector3f Z = Eigen::Vector3f (0.0, 0.0, 1.0); 
 //  Eigen::Vector3f Z = Eigen::Vector3f (0.0, 0.0, 1.0); 
-  getAxesOrientedSurfaces (*input_cloud, *normals_cloud, Z, epsilon_angle, plane_threshold, minimum_plane_inliers, maximum_plane_iterations, minimum_size_of_plane_cluster, plane_inliers_clustering_tolerance, planar_surfaces, planar_surfaces_ids, planar_surfaces_indices, planar_surfaces_coefficients, viewer);
+  getAxesOrientedSurfaces (input_cloud, normals_cloud, remaining_indices, Z, epsilon_angle, plane_threshold, minimum_plane_inliers, maximum_plane_iterations, minimum_size_of_plane_cluster, plane_inliers_clustering_tolerance, planar_surfaces, planar_surfaces_ids, planar_surfaces_indices, planar_surfaces_coefficients, viewer);
 
   ROS_ERROR ("Y axis aligned planes");
 //  Eigen::Vector3f Y = Eigen::Vector3f (0.0, 1.0, 0.0); 
 //  Eigen::Vector3f Y = Eigen::Vector3f (0.0782345, -0.966764, 0.0);
-  getAxesOrientedSurfaces (*input_cloud, *normals_cloud, Y, epsilon_angle, plane_threshold, minimum_plane_inliers, maximum_plane_iterations, minimum_size_of_plane_cluster, plane_inliers_clustering_tolerance, planar_surfaces, planar_surfaces_ids, planar_surfaces_indices, planar_surfaces_coefficients, viewer);
+  getAxesOrientedSurfaces (input_cloud, normals_cloud, remaining_indices, Y, epsilon_angle, plane_threshold, minimum_plane_inliers, maximum_plane_iterations, minimum_size_of_plane_cluster, plane_inliers_clustering_tolerance, planar_surfaces, planar_surfaces_ids, planar_surfaces_indices, planar_surfaces_coefficients, viewer);
 
   ROS_ERROR ("X axis aligned planes");
 //  Eigen::Vector3f X = Eigen::Vector3f (1.0, 0.0, 0.0); 
 //  Eigen::Vector3f X = Eigen::Vector3f (-0.966764, -0.0782345, 0.0);
-  getAxesOrientedSurfaces (*input_cloud, *normals_cloud, X, epsilon_angle, plane_threshold, minimum_plane_inliers, maximum_plane_iterations, minimum_size_of_plane_cluster, plane_inliers_clustering_tolerance, planar_surfaces, planar_surfaces_ids, planar_surfaces_indices, planar_surfaces_coefficients, viewer);
+  getAxesOrientedSurfaces (input_cloud, normals_cloud, remaining_indices, X, epsilon_angle, plane_threshold, minimum_plane_inliers, maximum_plane_iterations, minimum_size_of_plane_cluster, plane_inliers_clustering_tolerance, planar_surfaces, planar_surfaces_ids, planar_surfaces_indices, planar_surfaces_coefficients, viewer);
 
 
 
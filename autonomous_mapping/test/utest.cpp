@@ -0,0 +1,94 @@
+/*
+ * utest.cpp
+ *
+ *  Tests of the multi-plane extraction on synthetic clouds
+ */
+
+#include <cstdlib>
+#include <autonomous_mapping/multi_plane_extraction.h>
+#include <gtest/gtest.h>
+
+typedef pcl::PointXYZ PointT;
+
+// Adds a horizontal square of 1 x 1 at height z with nr_points random points and normals pointing up
+void addHorizontalPlane (float z, int nr_points, pcl::PointCloud<PointT> &cloud, pcl::PointCloud<pcl::Normal> &normals)
+{
+  for (int i = 0; i < nr_points; i++)
+  {
+    PointT p;
+    p.x = (float)rand() / (float)RAND_MAX;
+    p.y = (float)rand() / (float)RAND_MAX;
+    p.z = z;
+    cloud.points.push_back(p);
+
+    pcl::Normal n;
+    n.normal_x = 0;
+    n.normal_y = 0;
+    n.normal_z = 1;
+    normals.points.push_back(n);
+  }
+}
+
+// Four parallel planes at different heights, with four hypotheses per round
+// Checks that all planes are found and that some rounds accepted more than one
+TEST(MultiPlaneExtractionTest, ParallelPlanesInFewerRounds)
+{
+  pcl::PointCloud<PointT>::Ptr cloud (new pcl::PointCloud<PointT>);
+  pcl::PointCloud<pcl::Normal>::Ptr normals (new pcl::PointCloud<pcl::Normal>);
+  int nr_planes = 4;
+  int nr_points = 2000;
+  for (int i = 0; i < nr_planes; i++)
+    addHorizontalPlane(i, nr_points, *cloud, *normals);
+
+  autonomous_mapping::MultiPlaneExtraction<PointT> extraction;
+  extraction.setInputCloud(cloud);
+  extraction.setInputNormals(normals);
+  extraction.setDistanceThreshold(0.01);
+  extraction.setMinInliers(1000);
+  extraction.setNumberOfHypotheses(4);
+
+  std::vector<pcl::PointIndices::Ptr> planes_inliers;
+  std::vector<pcl::ModelCoefficients::Ptr> planes_coefficients;
+  std::vector<int> remaining;
+  extraction.extract(planes_inliers, planes_coefficients, remaining);
+
+  ASSERT_EQ(nr_planes, (int)planes_inliers.size());
+  for (int i = 0; i < nr_planes; i++)
+    EXPECT_EQ(nr_points, (int)planes_inliers[i]->indices.size()) << "Plane " << i << " is incomplete";
+  EXPECT_TRUE(remaining.empty());
+  EXPECT_LT(extraction.getNumberOfRounds(), nr_planes)
+  << "No round accepted more than one plane";
+}
+
+// Points spread in a cube contain no plane with enough inliers
+// Checks that every round without a plane counts as a single failure, whatever the number of hypotheses
+TEST(MultiPlaneExtractionTest, OneFailurePerRound)
+{
+  pcl::PointCloud<PointT>::Ptr cloud (new pcl::PointCloud<PointT>);
+  pcl::PointCloud<pcl::Normal>::Ptr normals (new pcl::PointCloud<pcl::Normal>);
+  for (int i = 0; i < 100; i++)
+    addHorizontalPlane((float)rand() / (float)RAND_MAX, 50, *cloud, *normals);
+
+  autonomous_mapping::MultiPlaneExtraction<PointT> extraction;
+  extraction.setInputCloud(cloud);
+  extraction.setInputNormals(normals);
+  extraction.setDistanceThreshold(0.001);
+  extraction.setMinInliers(1000);
+  extraction.setMaxFailures(3);
+  extraction.setNumberOfHypotheses(4);
+
+  std::vector<pcl::PointIndices::Ptr> planes_inliers;
+  std::vector<pcl::ModelCoefficients::Ptr> planes_coefficients;
+  std::vector<int> remaining;
+  extraction.extract(planes_inliers, planes_coefficients, remaining);
+
+  EXPECT_TRUE(planes_inliers.empty());
+  EXPECT_EQ(cloud->points.size(), remaining.size());
+  EXPECT_EQ(3, extraction.getNumberOfRounds());
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
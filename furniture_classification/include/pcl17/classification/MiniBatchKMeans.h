@@ -0,0 +1,310 @@
+/*
+ * MiniBatchKMeans.h
+ *
+ * k-means for the codebook of PHVObjectClassifier: k-means++ seeding, mini-batch
+ * updates (Sculley, Web-scale k-means clustering) and a few full Lloyd iterations
+ * at the end. The assignment of points to centers runs on several threads, all
+ * random choices come from one generator with a fixed seed, so the result does not
+ * depend on the number of threads. update() moves an existing codebook towards new
+ * data without clustering the old data again.
+ */
+
+#ifndef MINIBATCHKMEANS_H_
+#define MINIBATCHKMEANS_H_
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include <boost/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <boost/thread.hpp>
+
+namespace pcl17 {
+
+class MiniBatchKMeans {
+public:
+
+	// Points and centers are stored row by row, dimension floats each
+	MiniBatchKMeans(int num_clusters, int dimension) :
+			num_clusters_(num_clusters), dimension_(dimension), batch_size_(
+					1000), max_iterations_(100), refine_iterations_(3), tolerance_(
+					1e-4f), num_threads_(0), rng_(0) {
+	}
+
+	void setBatchSize(int batch_size) {
+		batch_size_ = batch_size;
+	}
+
+	// Mini-batch iterations of compute()
+	void setMaxIterations(int max_iterations) {
+		max_iterations_ = max_iterations;
+	}
+
+	// Full Lloyd iterations at the end of compute()
+	void setRefineIterations(int refine_iterations) {
+		refine_iterations_ = refine_iterations;
+	}
+
+	// compute() stops when the centers moved less than this (squared, summed over all centers) in one iteration
+	void setTolerance(float tolerance) {
+		tolerance_ = tolerance;
+	}
+
+	void setSeed(unsigned int seed) {
+		rng_.seed(seed);
+	}
+
+	// 0 for one thread per core
+	void setNumberOfThreads(int num_threads) {
+		num_threads_ = num_threads;
+	}
+
+	// Codebook to continue with in update(), counts are the number of points each center was computed from
+	void setCenters(const std::vector<float> & centers,
+			const std::vector<int> & counts) {
+		centers_ = centers;
+		counts_ = counts;
+		num_clusters_ = counts.size();
+	}
+
+	const std::vector<float> & getCenters() const {
+		return centers_;
+	}
+
+	const std::vector<int> & getCounts() const {
+		return counts_;
+	}
+
+	// Clusters the points from scratch, labels are the index of the closest center of every point
+	void compute(const std::vector<float> & points, std::vector<int> & labels) {
+		int nr_points = points.size() / dimension_;
+		labels.assign(nr_points, 0);
+		if (nr_points == 0)
+			return;
+
+		seed(points);
+
+		std::vector<int> batch;
+		std::vector<int> batch_labels;
+		boost::uniform_int<int> point_distribution(0, nr_points - 1);
+		for (int it = 0; it < max_iterations_; it++) {
+			batch.resize(std::min(batch_size_, nr_points));
+			for (size_t i = 0; i < batch.size(); i++)
+				batch[i] = point_distribution(rng_);
+
+			if (step(points, batch, batch_labels) < tolerance_)
+				break;
+		}
+
+		// Lloyd iterations, the counts become the sizes of the clusters
+		assign(points, labels);
+		for (int it = 0; it < refine_iterations_; it++) {
+			std::vector<float> sums(centers_.size(), 0);
+			counts_.assign(num_clusters_, 0);
+			for (int i = 0; i < nr_points; i++) {
+				float * sum = &sums[labels[i] * dimension_];
+				const float * p = &points[i * dimension_];
+				for (int j = 0; j < dimension_; j++)
+					sum[j] += p[j];
+				counts_[labels[i]]++;
+			}
+			for (int c = 0; c < num_clusters_; c++) {
+				// Empty clusters keep their center
+				for (int j = 0; counts_[c] > 0 && j < dimension_; j++)
+					centers_[c * dimension_ + j] = sums[c * dimension_ + j]
+							/ counts_[c];
+			}
+
+			std::vector<int> previous_labels = labels;
+			assign(points, labels);
+			if (labels == previous_labels)
+				break;
+		}
+
+		counts_.assign(num_clusters_, 0);
+		for (int i = 0; i < nr_points; i++)
+			counts_[labels[i]]++;
+	}
+
+	// Moves the centers set with setCenters() or computed before towards the new points, in one pass of mini-batches
+	// over the shuffled points, so that every center stays the running mean of the points assigned to it. labels are
+	// the closest center of every new point afterwards
+	void update(const std::vector<float> & points, std::vector<int> & labels) {
+		int nr_points = points.size() / dimension_;
+		labels.assign(nr_points, 0);
+		if (nr_points == 0 || num_clusters_ == 0)
+			return;
+
+		std::vector<int> order(nr_points);
+		for (int i = 0; i < nr_points; i++)
+			order[i] = i;
+
+		for (int i = nr_points - 1; i > 0; i--) {
+			boost::uniform_int<int> distribution(0, i);
+			std::swap(order[i], order[distribution(rng_)]);
+		}
+
+		std::vector<int> batch;
+		std::vector<int> batch_labels;
+		for (int first = 0; first < nr_points; first += batch_size_) {
+			batch.assign(order.begin() + first,
+					order.begin() + std::min(first + batch_size_, nr_points));
+			step(points, batch, batch_labels);
+		}
+
+		assign(points, labels);
+	}
+
+protected:
+
+	// k-means++: every next center is a point chosen with probability proportional to its squared distance to the
+	// closest center so far
+	void seed(const std::vector<float> & points) {
+		int nr_points = points.size() / dimension_;
+		centers_.resize(num_clusters_ * dimension_);
+		counts_.assign(num_clusters_, 1);
+
+		boost::uniform_int<int> point_distribution(0, nr_points - 1);
+		int first = point_distribution(rng_);
+		std::copy(points.begin() + first * dimension_,
+				points.begin() + (first + 1) * dimension_, centers_.begin());
+
+		std::vector<float> min_sqr_distances(nr_points,
+				std::numeric_limits<float>::max());
+		boost::uniform_real<double> unit_distribution(0, 1);
+		for (int c = 1; c < num_clusters_; c++) {
+			parallelFor(nr_points,
+					boost::bind(&MiniBatchKMeans::updateMinDistances, this,
+							boost::cref(points), c - 1,
+							boost::ref(min_sqr_distances), _1, _2));
+
+			double sum = 0;
+			for (int i = 0; i < nr_points; i++)
+				sum += min_sqr_distances[i];
+
+			// All points are centers already, repeat the first one
+			int next = first;
+			if (sum > 0) {
+				double r = unit_distribution(rng_) * sum;
+				for (next = 0; next < nr_points - 1; next++) {
+					r -= min_sqr_distances[next];
+					if (r < 0)
+						break;
+				}
+			}
+			std::copy(points.begin() + next * dimension_,
+					points.begin() + (next + 1) * dimension_,
+					centers_.begin() + c * dimension_);
+		}
+	}
+
+	void updateMinDistances(const std::vector<float> & points, int center,
+			std::vector<float> & min_sqr_distances, int begin, int end) {
+		for (int i = begin; i < end; i++)
+			min_sqr_distances[i] = std::min(min_sqr_distances[i],
+					sqrDistance(&points[i * dimension_],
+							&centers_[center * dimension_]));
+	}
+
+	// Assigns the batch in parallel, then moves every center towards its points with learning rate 1 / count,
+	// returns how far the centers moved (squared)
+	float step(const std::vector<float> & points, const std::vector<int> & batch,
+			std::vector<int> & batch_labels) {
+		batch_labels.resize(batch.size());
+		parallelFor(batch.size(),
+				boost::bind(&MiniBatchKMeans::assignRange, this,
+						boost::cref(points), boost::cref(batch),
+						boost::ref(batch_labels), _1, _2));
+
+		std::vector<float> previous_centers = centers_;
+		for (size_t i = 0; i < batch.size(); i++) {
+			int c = batch_labels[i];
+			counts_[c]++;
+			float eta = 1.0f / counts_[c];
+			float * center = &centers_[c * dimension_];
+			const float * p = &points[batch[i] * dimension_];
+			for (int j = 0; j < dimension_; j++)
+				center[j] += eta * (p[j] - center[j]);
+		}
+
+		float moved = 0;
+		for (size_t j = 0; j < centers_.size(); j++)
+			moved += (centers_[j] - previous_centers[j])
+					* (centers_[j] - previous_centers[j]);
+		return moved;
+	}
+
+	void assign(const std::vector<float> & points, std::vector<int> & labels) {
+		int nr_points = points.size() / dimension_;
+		std::vector<int> all(nr_points);
+		for (int i = 0; i < nr_points; i++)
+			all[i] = i;
+		labels.resize(nr_points);
+		parallelFor(nr_points,
+				boost::bind(&MiniBatchKMeans::assignRange, this,
+						boost::cref(points), boost::cref(all),
+						boost::ref(labels), _1, _2));
+	}
+
+	void assignRange(const std::vector<float> & points,
+			const std::vector<int> & indices, std::vector<int> & labels,
+			int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const float * p = &points[indices[i] * dimension_];
+			float min_sqr_distance = std::numeric_limits<float>::max();
+			for (int c = 0; c < num_clusters_; c++) {
+				float d = sqrDistance(p, &centers_[c * dimension_]);
+				if (d < min_sqr_distance) {
+					min_sqr_distance = d;
+					labels[i] = c;
+				}
+			}
+		}
+	}
+
+	float sqrDistance(const float * a, const float * b) const {
+		float d = 0;
+		for (int j = 0; j < dimension_; j++)
+			d += (a[j] - b[j]) * (a[j] - b[j]);
+		return d;
+	}
+
+	// Calls f(begin, end) on consecutive ranges of [0, n), one per thread
+	template<typename F>
+	void parallelFor(int n, F f) {
+		int num_threads = num_threads_ > 0 ? num_threads_ :
+				boost::thread::hardware_concurrency();
+		num_threads = std::max(1, std::min(num_threads, n / 256));
+		if (num_threads == 1) {
+			f(0, n);
+			return;
+		}
+
+		boost::thread_group threads;
+		for (int t = 0; t < num_threads; t++)
+			threads.create_thread(
+					boost::bind(f, n * t / num_threads,
+							n * (t + 1) / num_threads));
+		threads.join_all();
+	}
+
+	int num_clusters_;
+	int dimension_;
+	int batch_size_;
+	int max_iterations_;
+	int refine_iterations_;
+	float tolerance_;
+	int num_threads_;
+	boost::mt19937 rng_;
+
+	std::vector<float> centers_;
+	std::vector<int> counts_;
+};
+
+}
+
+#endif /* MINIBATCHKMEANS_H_ */
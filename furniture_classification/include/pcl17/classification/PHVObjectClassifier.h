@@ -35,9 +35,13 @@
 
 #include <boost/foreach.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 #include <yaml-cpp/yaml.h>
 
+#include <pcl17/classification/MiniBatchKMeans.h>
+
 #include <map>
 #include <set>
 #include <furniture_classification/Hypothesis.h>
@@ -50,6 +54,43 @@ using std::set;
 
 namespace pcl17 {
 
+// Surface fitted by moving least squares around a query point, see PHVObjectClassifier::fitSurface()
+struct LocalSurface {
+	Eigen::Vector3d origin; // query point projected onto the plane
+	Eigen::Vector3d normal, u, v; // plane normal and axes of the plane
+	Eigen::VectorXd c; // coefficients of the polynomial over (u, v), empty for the plane
+	int order;
+	float curvature;
+
+	// Moves p along the plane normal onto the surface, and returns the (not normalized) surface normal there
+	void project(const Eigen::Vector3d & p, Eigen::Vector3d & point,
+			Eigen::Vector3d & n) const {
+		double pu = (p - origin).dot(u), pv = (p - origin).dot(v);
+		double h = 0, hu = 0, hv = 0;
+		if (c.size() > 0) {
+			int j = 0;
+			double u_pow = 1, u_pow_d = 0;
+			for (int ui = 0; ui <= order; ui++) {
+				double v_pow = 1, v_pow_d = 0;
+				for (int vi = 0; vi <= order - ui; vi++) {
+					h += c[j] * u_pow * v_pow;
+					hu += c[j] * u_pow_d * v_pow;
+					hv += c[j] * u_pow * v_pow_d;
+					v_pow_d = (vi + 1) * v_pow;
+					v_pow *= pv;
+					j++;
+				}
+				u_pow_d = (ui + 1) * u_pow;
+				u_pow *= pu;
+			}
+		}
+		point = origin + pu * u + pv * v + h * normal;
+		n = normal - hu * u - hv * v;
+	}
+};
+
+template<class PointT, class PointNormalT> struct VoxelSmoothingJob;
+
 template<class PointT, class PointNormalT, class FeatureT>
 class PHVObjectClassifier {
 public:
@@ -83,7 +124,9 @@ public:
 					0.01), local_maxima_threshold_(0.5f), window_size_(0.3), ransac_distance_threshold_(
 					0.01f), ransac_vis_score_weight_(5), ransac_num_iter_(200), icp_treshold_(
 					0.03), num_angles_(36), icp_max_iterations_(20), icp_max_correspondence_distance_(
-					0.01), debug_(false), debug_folder_(""), mls_(
+					0.01), voxel_smoothing_(false), voxel_smoothing_tolerance_(
+					0.001f), kmeans_batch_size_(1000), kmeans_iterations_(100), kmeans_seed_(
+					0), num_threads_(0), debug_(false), debug_folder_(""), mls_(
 					new MovingLeastSquares<PointT, PointNormalT>) {
 
 		typedef pcl17::PointCloud<FeatureT> PointFeatureCloud;
@@ -111,15 +154,30 @@ public:
 	}
 
 	virtual void computeClassifier();
+	void updateClassifier();
 	void computeExternalClassifier(const std::string & labels);
 
 	virtual bool isClassifierComputed() {
 		return !this->database_.empty();
 	}
 
+	// Writes the database to database_dir_ (binary, see saveToBinaryFile())
 	void saveToFile();
 
-	void loadFromFile();
+	// Reads the binary database of database_dir_ if there is one, the YAML database otherwise or if the binary
+	// one is corrupt. Returns false if no database could be read, the classifier is unchanged then
+	bool loadFromFile();
+
+	// database.yaml with one ASCII PCD per full model in models/
+	void saveToYAMLFile();
+	void loadFromYAMLFile();
+
+	// database.phvdb, parameters, codebook, votes and full models in one versioned file. For loading the file is
+	// memory mapped only to read it, every section is copied into the classifier, so load time and memory are
+	// still linear in the file size, only the parsing of the YAML database is saved. Nothing is changed if the
+	// file is truncated or corrupt
+	void saveToBinaryFile();
+	bool loadFromBinaryFile();
 
 	void setDebug(bool debug) {
 		debug_ = debug;
@@ -145,6 +203,32 @@ public:
 		return debug_folder_;
 	}
 
+	// Fit the surface only at the centroids of the subsampling voxels instead of at every point, see smoothAtVoxels()
+	void setVoxelSmoothing(bool voxel_smoothing, float tolerance = 0.001f) {
+		voxel_smoothing_ = voxel_smoothing;
+		voxel_smoothing_tolerance_ = tolerance;
+	}
+
+	bool getVoxelSmoothing() {
+		return voxel_smoothing_;
+	}
+
+	// Number of threads for the preprocessing, 0 for one per core
+	void setNumberOfThreads(int num_threads) {
+		num_threads_ = num_threads;
+	}
+
+	int getNumberOfThreads() {
+		return num_threads_;
+	}
+
+	// Mini-batch size, number of mini-batch iterations and random seed of the clustering of the features
+	void setKMeansParameters(int batch_size, int iterations, unsigned int seed) {
+		kmeans_batch_size_ = batch_size;
+		kmeans_iterations_ = iterations;
+		kmeans_seed_ = seed;
+	}
+
 	void setNumberOfClusters(int num_clusters) {
 		num_clusters_ = num_clusters;
 	}
@@ -171,6 +255,13 @@ public:
 
 	virtual void setScene(PointCloudConstPtr model, float cut_off_distance =
 			2.5f) {
+		setPreprocessedScene(preprocessScene(model, cut_off_distance));
+	}
+
+	// First half of setScene(), only uses the parameters and mls_, so it can run on the next
+	// scene while classify() runs on the current one
+	PointNormalCloudPtr preprocessScene(PointCloudConstPtr model,
+			float cut_off_distance = 2.5f) {
 		std::vector<int> idx;
 
 		pcl17::PassThrough<PointT> pass;
@@ -181,7 +272,11 @@ public:
 
 		PointCloudPtr model_cut(new PointCloud(*model, idx));
 
-		scene_ = estimateNormalsAndSubsample(model_cut);
+		return estimateNormalsAndSubsample(model_cut);
+	}
+
+	void setPreprocessedScene(PointNormalCloudPtr scene) {
+		scene_ = scene;
 		pcl17::getMinMax3D<PointNormalT>(*scene_, min_scene_bound_,
 				max_scene_bound_);
 	}
@@ -226,8 +321,13 @@ protected:
 	typename pcl17::PointCloud<PointNormalT>::Ptr
 	estimateNormalsAndSubsample(
 			typename pcl17::PointCloud<PointT>::ConstPtr cloud_orig);
+	PointNormalCloudPtr smoothAtVoxels(PointCloudConstPtr cloud);
+	void smoothAtVoxelsWorker(VoxelSmoothingJob<PointT, PointNormalT> * job);
+	bool fitSurface(const PointCloud & cloud, const Eigen::Vector3f & query,
+			const std::vector<int> & nn_indices, LocalSurface & surface);
 	void getSegmentsFromCloud(PointNormalCloudPtr cloud_with_normals,
-			vector<boost::shared_ptr<vector<int> > > & segment_indices,
+			PointNormalTreePtr tree, vector<int> & segment_points,
+			vector<int> & segment_begin,
 			pcl17::PointCloud<pcl17::PointXYZRGBNormal>::Ptr & colored_segments);
 	void appendFeaturesFromCloud(PointNormalCloudPtr & cloud,
 			const string & class_name, const int i);
@@ -235,6 +335,8 @@ protected:
 	void normalizeFeaturesWithCurrentMinMax(std::vector<FeatureT> & features);
 	void clusterFeatures(vector<FeatureT> & cluster_centers,
 			vector<int> & cluster_labels);
+	void addVotes(const PointCloud & model_centers, const PointT & centroid,
+			float weight, int segment, const string & class_name);
 	void vote();
 	Eigen::MatrixXf projectVotesToGrid(
 			const pcl17::PointCloud<pcl17::PointXYZI> & model_centers,
@@ -284,6 +386,13 @@ public:
 	int icp_max_iterations_;
 	float icp_max_correspondence_distance_;
 
+	bool voxel_smoothing_;
+	float voxel_smoothing_tolerance_;
+	int kmeans_batch_size_;
+	int kmeans_iterations_;
+	unsigned int kmeans_seed_;
+	int num_threads_;
+
 	bool debug_;
 	string debug_folder_;
 	string database_dir_;
@@ -301,7 +410,10 @@ public:
 	PointCloud centroids_;
 	vector<std::string> classes_;
 	vector<PointNormalCloudPtr> segment_pointclouds_;
-	vector<boost::shared_ptr<vector<int> > > segment_indices_;
+	// Points of the segments of the last segmented cloud, segment i is
+	// segment_points_[segment_begin_[i]] ... segment_points_[segment_begin_[i + 1] - 1]
+	vector<int> segment_points_;
+	vector<int> segment_begin_;
 
 	PointNormalCloudPtr scene_;
 	PointNormalT min_scene_bound_, max_scene_bound_;
@@ -403,6 +515,12 @@ YAML::Emitter& operator <<(YAML::Emitter& out,
 	out << YAML::Key << "window_size";
 	out << YAML::Value << h.window_size_;
 
+	out << YAML::Key << "voxel_smoothing";
+	out << YAML::Value << h.voxel_smoothing_;
+
+	out << YAML::Key << "voxel_smoothing_tolerance";
+	out << YAML::Value << h.voxel_smoothing_tolerance_;
+
 	out << YAML::Key << "external_classifier";
 	out << YAML::Value << h.external_classifier_;
 
@@ -664,6 +782,12 @@ void operator >>(const YAML::Node& node,
 	node["icp_max_iterations"] >> h.icp_max_iterations_;
 	node["icp_max_correspondence_distance"] >> h.icp_max_correspondence_distance_;
 
+	// Not in databases written before voxel smoothing was added
+	if (const YAML::Node * n = node.FindValue("voxel_smoothing"))
+		*n >> h.voxel_smoothing_;
+	if (const YAML::Node * n = node.FindValue("voxel_smoothing_tolerance"))
+		*n >> h.voxel_smoothing_tolerance_;
+
 	node["debug"] >> h.debug_;
 	node["debug_folder"] >> h.debug_folder_;
 
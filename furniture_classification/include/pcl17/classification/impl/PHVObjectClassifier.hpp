@@ -9,34 +9,24 @@
 #define PHVOBJECTCLASSIFIER_HPP_
 
 #include <pcl17/classification/PHVObjectClassifier.h>
-#include <opencv2/core/core.hpp>
 #include <pcl17/features/vfh.h>
 
-template<class FeatureT>
-cv::Mat transform_to_mat(const std::vector<FeatureT> & features) {
-	int featureLength = sizeof(features[0].histogram) / sizeof(float);
-
-	cv::Mat res(features.size(), featureLength, CV_32F);
-	for (size_t i = 0; i < features.size(); i++) {
-		for (int j = 0; j < featureLength; j++) {
-			res.at<float>(i, j) = features[i].histogram[j];
-		}
-	}
-
-	return res;
-}
-
-template<class FeatureT>
-void transform_to_features(const cv::Mat & mat,
-		std::vector<FeatureT> & features) {
-	features.clear();
-	for (int i = 0; i < mat.rows; i++) {
-		FeatureT f;
-		for (int j = 0; j < mat.cols; j++) {
-			f.histogram[j] = mat.at<float>(i, j);
-		}
-		features.push_back(f);
-	};
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+inline bool voxelKeyLess(const std::pair<Eigen::Vector3i, int> & a,
+		const std::pair<Eigen::Vector3i, int> & b) {
+	if (a.first[0] != b.first[0])
+		return a.first[0] < b.first[0];
+	if (a.first[1] != b.first[1])
+		return a.first[1] < b.first[1];
+	if (a.first[2] != b.first[2])
+		return a.first[2] < b.first[2];
+	return a.second < b.second;
 }
 
 template<class PointT, class PointNormalT, class FeatureT>
@@ -44,16 +34,124 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::clusterFeatures
 		vector<FeatureT> & cluster_centers, vector<int> & cluster_labels) {
 	int featureLength = sizeof(features_[0].histogram) / sizeof(float);
 
-	cv::Mat feature_vectors = transform_to_mat(features_);
-	cv::Mat centers(num_clusters_, featureLength, feature_vectors.type()),
-			labels;
+	std::vector<float> feature_vectors(features_.size() * featureLength);
+	for (size_t i = 0; i < features_.size(); i++)
+		memcpy(&feature_vectors[i * featureLength], features_[i].histogram,
+				featureLength * sizeof(float));
+
+	MiniBatchKMeans kmeans(num_clusters_, featureLength);
+	kmeans.setBatchSize(kmeans_batch_size_);
+	kmeans.setMaxIterations(kmeans_iterations_);
+	kmeans.setSeed(kmeans_seed_);
+	kmeans.setNumberOfThreads(num_threads_);
+	kmeans.compute(feature_vectors, cluster_labels);
+
+	const std::vector<float> & centers = kmeans.getCenters();
+	cluster_centers.resize(num_clusters_);
+	for (int i = 0; i < num_clusters_; i++)
+		memcpy(cluster_centers[i].histogram, &centers[i * featureLength],
+				featureLength * sizeof(float));
+}
 
-	cv::kmeans(feature_vectors, num_clusters_, labels,
-			cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 10, 1.0), 4,
-			cv::KMEANS_RANDOM_CENTERS, centers);
+// Layout of database.phvdb (native byte order, all sections follow each other):
+//   header      magic "PHVDB", version, byte order mark, floats per feature, floats per model point
+//   parameters  the parameters of the YAML database in the order of writeParameters()
+//   classes     number of class names and the names, votes and models refer to them by index
+//   min/max     feature normalization
+//   codebook    number of cluster centers and their histograms as one float block
+//   votes       for every cluster center the number of classes voted for, and for each one
+//               its index, the number of centroids and their x y z
+//   models      for every class the number of full models, and for each one its number of points
+//               and their x y z normal_x normal_y normal_z curvature
+// Strings are stored as length and characters padded to 4 bytes, so that all floats are aligned.
+namespace phv_database {
+
+static const char magic[8] = { 'P', 'H', 'V', 'D', 'B', 0, 0, 0 };
+static const uint32_t version = 2; // 2: voxel smoothing parameters
+static const uint32_t byte_order_mark = 0x01020304;
+static const uint32_t model_point_size = 7;
+
+class Writer {
+public:
+	Writer(std::ostream & out) :
+			out_(out) {
+	}
+
+	template<typename T>
+	void write(const T & v) {
+		out_.write(reinterpret_cast<const char *>(&v), sizeof(T));
+	}
+
+	void write(const float * v, size_t n) {
+		out_.write(reinterpret_cast<const char *>(v), n * sizeof(float));
+	}
+
+	void write(const std::string & s) {
+		static const char padding[4] = { 0, 0, 0, 0 };
+		write<uint32_t>(s.size());
+		out_.write(s.data(), s.size());
+		out_.write(padding, (4 - s.size() % 4) % 4);
+	}
+
+private:
+	std::ostream & out_;
+};
+
+// Reads from the mapped file, every read fails once the end is reached
+class Reader {
+public:
+	Reader(const char * begin, const char * end) :
+			cur_(begin), end_(end) {
+	}
+
+	template<typename T>
+	bool read(T & v) {
+		if (size_t(end_ - cur_) < sizeof(T)) {
+			cur_ = end_;
+			return false;
+		}
+		memcpy(&v, cur_, sizeof(T));
+		cur_ += sizeof(T);
+		return true;
+	}
+
+	bool read(float * v, size_t n) {
+		if (size_t(end_ - cur_) / sizeof(float) < n) {
+			cur_ = end_;
+			return false;
+		}
+		memcpy(v, cur_, n * sizeof(float));
+		cur_ += n * sizeof(float);
+		return true;
+	}
+
+	bool read(std::string & s) {
+		uint32_t size;
+		if (!read(size) || size_t(end_ - cur_) < size + (4 - size % 4) % 4) {
+			cur_ = end_;
+			return false;
+		}
+		s.assign(cur_, size);
+		cur_ += size + (4 - size % 4) % 4;
+		return true;
+	}
+
+	// Start of the next n floats, NULL if the file is too short
+	const char * floats(size_t n) {
+		if (size_t(end_ - cur_) / sizeof(float) < n) {
+			cur_ = end_;
+			return NULL;
+		}
+		const char * p = cur_;
+		cur_ += n * sizeof(float);
+		return p;
+	}
+
+private:
+	const char * cur_;
+	const char * end_;
+};
 
-	transform_to_features(centers, cluster_centers);
-	cluster_labels = labels;
 }
 
 template<class PointT, class PointNormalT, class FeatureT>
@@ -61,13 +159,39 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::saveToFile() {
 
 	// Delete old and create new directory sturcture for output
 	boost::filesystem::path output_path(database_dir_);
-	boost::filesystem::path output_models_path(database_dir_ + "models/");
 	if (boost::filesystem::exists(output_path)) {
 		boost::filesystem::remove_all(output_path);
 	}
 
 	boost::filesystem::create_directories(output_path);
-	boost::filesystem::create_directories(output_models_path);
+
+	saveToBinaryFile();
+
+}
+
+template<class PointT, class PointNormalT, class FeatureT>
+bool pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::loadFromFile() {
+
+	if (boost::filesystem::exists(database_dir_ + "database.phvdb")) {
+		if (loadFromBinaryFile())
+			return true;
+		if (!boost::filesystem::exists(database_dir_ + "database.yaml"))
+			return false;
+		PCL17_WARN("Loading %sdatabase.yaml instead\n", database_dir_.c_str());
+	} else if (!boost::filesystem::exists(database_dir_ + "database.yaml")) {
+		PCL17_ERROR("No database in %s\n", database_dir_.c_str());
+		return false;
+	}
+
+	loadFromYAMLFile();
+	return true;
+
+}
+
+template<class PointT, class PointNormalT, class FeatureT>
+void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::saveToYAMLFile() {
+
+	boost::filesystem::create_directories(database_dir_ + "models/");
 
 	YAML::Emitter out;
 
@@ -81,7 +205,7 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::saveToFile() {
 }
 
 template<class PointT, class PointNormalT, class FeatureT>
-void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::loadFromFile() {
+void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::loadFromYAMLFile() {
 
 	std::ifstream fin((database_dir_ + "database.yaml").c_str());
 	YAML::Parser parser(fin);
@@ -92,6 +216,370 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::loadFromFile()
 
 }
 
+template<class PointT, class PointNormalT, class FeatureT>
+void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::saveToBinaryFile() {
+
+	const uint32_t feature_size = sizeof(min_.histogram) / sizeof(float);
+
+	boost::filesystem::create_directories(database_dir_);
+	std::ofstream f((database_dir_ + "database.phvdb").c_str(),
+			std::ios::out | std::ios::binary | std::ios::trunc);
+	phv_database::Writer w(f);
+
+	f.write(phv_database::magic, sizeof(phv_database::magic));
+	w.write(phv_database::version);
+	w.write(phv_database::byte_order_mark);
+	w.write(feature_size);
+	w.write(phv_database::model_point_size);
+
+	w.write(subsampling_resolution_);
+	w.write<uint8_t>(mls_polynomial_fit_);
+	w.write<uint8_t>(debug_);
+	w.write<uint16_t>(0);
+	w.write<int32_t>(mls_polynomial_order_);
+	w.write(mls_search_radius_);
+	w.write<int32_t>(min_points_in_segment_);
+	w.write(rg_residual_threshold_);
+	w.write(rg_smoothness_threshold_);
+	w.write(fe_k_neighbours_);
+	w.write<int32_t>(num_clusters_);
+	w.write<int32_t>(num_neighbours_);
+	w.write(cell_size_);
+	w.write(local_maxima_threshold_);
+	w.write(window_size_);
+	w.write(ransac_distance_threshold_);
+	w.write(ransac_vis_score_weight_);
+	w.write<int32_t>(ransac_num_iter_);
+	w.write(icp_treshold_);
+	w.write<int32_t>(num_angles_);
+	w.write<int32_t>(icp_max_iterations_);
+	w.write(icp_max_correspondence_distance_);
+	w.write(debug_folder_);
+	w.write(external_classifier_);
+	w.write<uint8_t>(voxel_smoothing_);
+	w.write<uint8_t>(0);
+	w.write<uint16_t>(0);
+	w.write(voxel_smoothing_tolerance_);
+
+	w.write<uint32_t>(ransac_result_threshold_.size());
+	for (map<string, float>::const_iterator it =
+			ransac_result_threshold_.begin();
+			it != ransac_result_threshold_.end(); it++) {
+		w.write(it->first);
+		w.write(it->second);
+	}
+
+	// Class names of the votes and the full models
+	map<string, uint32_t> class_idx;
+	vector<string> class_names;
+	for (typename DatabaseType::const_iterator it = database_.begin();
+			it != database_.end(); it++) {
+		for (typename map<string, PointCloud>::const_iterator it2 =
+				it->second.begin(); it2 != it->second.end(); it2++) {
+			if (class_idx.insert(std::make_pair(it2->first, class_names.size())).second)
+				class_names.push_back(it2->first);
+		}
+	}
+	for (typename ModelMapType::const_iterator it =
+			class_name_to_full_models_map_.begin();
+			it != class_name_to_full_models_map_.end(); it++) {
+		if (class_idx.insert(std::make_pair(it->first, class_names.size())).second)
+			class_names.push_back(it->first);
+	}
+	w.write<uint32_t>(class_names.size());
+	for (size_t i = 0; i < class_names.size(); i++) {
+		w.write(class_names[i]);
+	}
+
+	w.write(min_.histogram, feature_size);
+	w.write(max_.histogram, feature_size);
+
+	// The codebook first, so that the feature cloud is read in one block
+	w.write<uint32_t>(database_.size());
+	for (typename DatabaseType::const_iterator it = database_.begin();
+			it != database_.end(); it++) {
+		w.write(it->first.histogram, feature_size);
+	}
+
+	for (typename DatabaseType::const_iterator it = database_.begin();
+			it != database_.end(); it++) {
+		w.write<uint32_t>(it->second.size());
+		for (typename map<string, PointCloud>::const_iterator it2 =
+				it->second.begin(); it2 != it->second.end(); it2++) {
+			w.write(class_idx[it2->first]);
+			w.write<uint32_t>(it2->second.points.size());
+			for (size_t i = 0; i < it2->second.points.size(); i++) {
+				const PointT & p = it2->second.points[i];
+				w.write(p.x);
+				w.write(p.y);
+				w.write(p.z);
+			}
+		}
+	}
+
+	w.write<uint32_t>(class_name_to_full_models_map_.size());
+	for (typename ModelMapType::const_iterator it =
+			class_name_to_full_models_map_.begin();
+			it != class_name_to_full_models_map_.end(); it++) {
+		w.write(class_idx[it->first]);
+		w.write<uint32_t>(it->second.size());
+		for (size_t i = 0; i < it->second.size(); i++) {
+			const PointNormalCloud & cloud = *it->second[i];
+			w.write<uint32_t>(cloud.points.size());
+			for (size_t j = 0; j < cloud.points.size(); j++) {
+				const PointNormalT & p = cloud.points[j];
+				float v[phv_database::model_point_size] = { p.x, p.y, p.z,
+						p.normal_x, p.normal_y, p.normal_z, p.curvature };
+				w.write(v, phv_database::model_point_size);
+			}
+		}
+	}
+
+	f.close();
+	if (!f) {
+		PCL17_ERROR("Could not write %sdatabase.phvdb\n", database_dir_.c_str());
+	}
+
+}
+
+template<class PointT, class PointNormalT, class FeatureT>
+bool pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::loadFromBinaryFile() {
+
+	const uint32_t feature_size = sizeof(min_.histogram) / sizeof(float);
+	std::string filename = database_dir_ + "database.phvdb";
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1) {
+		PCL17_ERROR("Could not open %s\n", filename.c_str());
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		::close(fd);
+		PCL17_ERROR("Could not read %s\n", filename.c_str());
+		return false;
+	}
+	size_t size = st.st_size;
+	void * mapped = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapped == MAP_FAILED) {
+		PCL17_ERROR("Could not map %s\n", filename.c_str());
+		return false;
+	}
+	::madvise(mapped, size, MADV_SEQUENTIAL);
+
+	const char * data = static_cast<const char *>(mapped);
+	phv_database::Reader r(data, data + size);
+
+	char file_magic[sizeof(phv_database::magic)];
+	uint32_t file_version = 0, file_byte_order_mark = 0, file_feature_size =
+			0, file_model_point_size = 0;
+	bool ok = r.read(file_magic) && r.read(file_version)
+			&& r.read(file_byte_order_mark) && r.read(file_feature_size)
+			&& r.read(file_model_point_size);
+	if (!ok || memcmp(file_magic, phv_database::magic, sizeof(file_magic)) != 0
+			|| file_byte_order_mark != phv_database::byte_order_mark) {
+		::munmap(mapped, size);
+		PCL17_ERROR("%s is not a database of this platform\n", filename.c_str());
+		return false;
+	}
+	if (file_version < 1 || file_version > phv_database::version
+			|| file_feature_size != feature_size
+			|| file_model_point_size != phv_database::model_point_size) {
+		::munmap(mapped, size);
+		PCL17_ERROR("%s has version %u with features of size %u, expected version %u with features of size %u\n",
+				filename.c_str(), file_version, file_feature_size, phv_database::version, feature_size);
+		return false;
+	}
+
+	// Everything is read into locals first, the classifier is only changed once the whole file was read
+	float subsampling_resolution = 0, mls_search_radius = 0, rg_residual_threshold =
+			0, rg_smoothness_threshold = 0, fe_k_neighbours = 0, cell_size = 0,
+			local_maxima_threshold = 0, window_size = 0, ransac_distance_threshold =
+					0, ransac_vis_score_weight = 0,
+			icp_max_correspondence_distance = 0, voxel_smoothing_tolerance =
+					voxel_smoothing_tolerance_;
+	double icp_treshold = 0;
+	uint8_t mls_polynomial_fit = 0, debug = 0, voxel_smoothing = voxel_smoothing_;
+	uint16_t reserved = 0;
+	int32_t mls_polynomial_order = 0, min_points_in_segment = 0, num_clusters =
+			0, num_neighbours = 0, ransac_num_iter = 0, num_angles = 0,
+			icp_max_iterations = 0;
+	std::string debug_folder, external_classifier;
+	ok = r.read(subsampling_resolution) && r.read(mls_polynomial_fit)
+			&& r.read(debug) && r.read(reserved)
+			&& r.read(mls_polynomial_order) && r.read(mls_search_radius)
+			&& r.read(min_points_in_segment) && r.read(rg_residual_threshold)
+			&& r.read(rg_smoothness_threshold) && r.read(fe_k_neighbours)
+			&& r.read(num_clusters) && r.read(num_neighbours)
+			&& r.read(cell_size) && r.read(local_maxima_threshold)
+			&& r.read(window_size) && r.read(ransac_distance_threshold)
+			&& r.read(ransac_vis_score_weight) && r.read(ransac_num_iter)
+			&& r.read(icp_treshold) && r.read(num_angles)
+			&& r.read(icp_max_iterations)
+			&& r.read(icp_max_correspondence_distance)
+			&& r.read(debug_folder) && r.read(external_classifier);
+	if (file_version >= 2) {
+		uint8_t padding = 0;
+		ok = ok && r.read(voxel_smoothing) && r.read(padding)
+				&& r.read(reserved) && r.read(voxel_smoothing_tolerance);
+	}
+
+	uint32_t n = 0;
+	ok = ok && r.read(n);
+	map<string, float> ransac_result_threshold;
+	for (uint32_t i = 0; ok && i < n; i++) {
+		std::string class_name;
+		float threshold;
+		ok = r.read(class_name) && r.read(threshold);
+		ransac_result_threshold[class_name] = threshold;
+	}
+
+	uint32_t nr_classes = 0;
+	ok = ok && r.read(nr_classes);
+	vector<string> class_names;
+	for (uint32_t i = 0; ok && i < nr_classes; i++) {
+		std::string class_name;
+		ok = r.read(class_name);
+		class_names.push_back(class_name);
+	}
+
+	FeatureT min, max;
+	ok = ok && r.read(min.histogram, feature_size)
+			&& r.read(max.histogram, feature_size);
+
+	// Codebook
+	uint32_t nr_clusters = 0;
+	ok = ok && r.read(nr_clusters);
+	const char * codebook = ok ? r.floats(size_t(nr_clusters) * feature_size) : NULL;
+	ok = ok && codebook;
+
+	pcl17::PointCloud<FeatureT> features;
+	if (ok) {
+		features.points.resize(nr_clusters);
+		for (uint32_t i = 0; i < nr_clusters; i++) {
+			memcpy(features.points[i].histogram,
+					codebook + size_t(i) * feature_size * sizeof(float),
+					feature_size * sizeof(float));
+		}
+	}
+
+	// Votes
+	DatabaseType database;
+	for (uint32_t i = 0; ok && i < nr_clusters; i++) {
+		map<string, PointCloud> & votes = database[features.points[i]];
+		uint32_t nr_entries = 0;
+		ok = r.read(nr_entries);
+		for (uint32_t j = 0; ok && j < nr_entries; j++) {
+			uint32_t idx = 0, nr_points = 0;
+			ok = r.read(idx) && idx < nr_classes && r.read(nr_points);
+			const char * p = ok ? r.floats(size_t(nr_points) * 3) : NULL;
+			ok = ok && p;
+			if (!ok)
+				break;
+
+			PointCloud & centroids = votes[class_names[idx]];
+			centroids.points.resize(nr_points);
+			for (uint32_t k = 0; k < nr_points; k++, p += 3 * sizeof(float)) {
+				memcpy(&centroids.points[k].x, p, sizeof(float));
+				memcpy(&centroids.points[k].y, p + sizeof(float), sizeof(float));
+				memcpy(&centroids.points[k].z, p + 2 * sizeof(float), sizeof(float));
+			}
+			centroids.width = centroids.points.size();
+			centroids.height = 1;
+			centroids.is_dense = true;
+		}
+	}
+
+	// Full models
+	ModelMapType full_models;
+	uint32_t nr_model_classes = 0;
+	ok = ok && r.read(nr_model_classes);
+	for (uint32_t i = 0; ok && i < nr_model_classes; i++) {
+		uint32_t idx = 0, nr_models = 0;
+		ok = r.read(idx) && idx < nr_classes && r.read(nr_models);
+		if (!ok)
+			break;
+
+		vector<PointNormalCloudPtr> & models = full_models[class_names[idx]];
+		for (uint32_t j = 0; ok && j < nr_models; j++) {
+			uint32_t nr_points = 0;
+			ok = r.read(nr_points);
+			const char * p = ok ? r.floats(size_t(nr_points) * phv_database::model_point_size) : NULL;
+			ok = ok && p;
+			if (!ok)
+				break;
+
+			PointNormalCloudPtr cloud(new PointNormalCloud);
+			cloud->points.resize(nr_points);
+			for (uint32_t k = 0; k < nr_points; k++) {
+				float v[phv_database::model_point_size];
+				memcpy(v, p, sizeof(v));
+				p += sizeof(v);
+				PointNormalT & pt = cloud->points[k];
+				pt.x = v[0];
+				pt.y = v[1];
+				pt.z = v[2];
+				pt.normal_x = v[3];
+				pt.normal_y = v[4];
+				pt.normal_z = v[5];
+				pt.curvature = v[6];
+			}
+			cloud->width = cloud->points.size();
+			cloud->height = 1;
+			cloud->is_dense = true;
+			models.push_back(cloud);
+		}
+	}
+
+	::munmap(mapped, size);
+
+	if (!ok) {
+		PCL17_ERROR("%s is truncated or corrupt, the classifier was not changed\n", filename.c_str());
+		return false;
+	}
+
+	subsampling_resolution_ = subsampling_resolution;
+	mls_polynomial_fit_ = mls_polynomial_fit;
+	debug_ = debug;
+	mls_polynomial_order_ = mls_polynomial_order;
+	mls_search_radius_ = mls_search_radius;
+	min_points_in_segment_ = min_points_in_segment;
+	rg_residual_threshold_ = rg_residual_threshold;
+	rg_smoothness_threshold_ = rg_smoothness_threshold;
+	fe_k_neighbours_ = fe_k_neighbours;
+	num_clusters_ = num_clusters;
+	num_neighbours_ = num_neighbours;
+	cell_size_ = cell_size;
+	local_maxima_threshold_ = local_maxima_threshold;
+	window_size_ = window_size;
+	ransac_distance_threshold_ = ransac_distance_threshold;
+	ransac_vis_score_weight_ = ransac_vis_score_weight;
+	ransac_num_iter_ = ransac_num_iter;
+	icp_treshold_ = icp_treshold;
+	num_angles_ = num_angles;
+	icp_max_iterations_ = icp_max_iterations;
+	icp_max_correspondence_distance_ = icp_max_correspondence_distance;
+	debug_folder_ = debug_folder;
+	external_classifier_ = external_classifier;
+	voxel_smoothing_ = voxel_smoothing;
+	voxel_smoothing_tolerance_ = voxel_smoothing_tolerance;
+
+	ransac_result_threshold_.swap(ransac_result_threshold);
+	min_ = min;
+	max_ = max;
+
+	database_features_cloud_->points.swap(features.points);
+	database_features_cloud_->width = database_features_cloud_->points.size();
+	database_features_cloud_->height = 1;
+	database_features_cloud_->is_dense = true;
+	database_.swap(database);
+	class_name_to_full_models_map_.swap(full_models);
+
+	return true;
+
+}
+
 template<class PointT, class PointNormalT, class FeatureT>
 void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::computeClassifier() {
 
@@ -195,6 +683,112 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::computeClassifi
 
 }
 
+// Adds the partial views added since the database was loaded without clustering the old features again:
+// the codebook is moved towards the new features by mini-batch k-means, every center weighted with the
+// number of votes it holds, and the votes of the new segments are added to their closest centers.
+template<class PointT, class PointNormalT, class FeatureT>
+void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::updateClassifier() {
+
+	if (database_.empty()) {
+		computeClassifier();
+		return;
+	}
+
+	features_.clear();
+	centroids_.clear();
+	classes_.clear();
+	segment_pointclouds_.clear();
+
+	BOOST_FOREACH(ModelMapValueType &v, class_name_to_partial_views_map_) {
+		int view_num_counter = 0;
+
+		for (size_t i = 0; i < v.second.size(); i++) {
+			appendFeaturesFromCloud(v.second[i], v.first, view_num_counter);
+			view_num_counter++;
+
+		}
+
+	}
+	class_name_to_partial_views_map_.clear();
+
+	if (features_.empty())
+		return;
+
+	// Transform to model centroinds in local coordinate frame of the segment
+	centroids_.getMatrixXfMap() *= -1;
+
+	// The features of the database are normalized with min_ and max_ of the training data
+	normalizeFeaturesWithCurrentMinMax(features_);
+
+	int featureLength = sizeof(features_[0].histogram) / sizeof(float);
+
+	std::vector<float> centers;
+	std::vector<int> counts;
+	centers.reserve(database_.size() * featureLength);
+	for (typename DatabaseType::const_iterator it = database_.begin();
+			it != database_.end(); it++) {
+		centers.insert(centers.end(), it->first.histogram,
+				it->first.histogram + featureLength);
+		int count = 0;
+		for (typename map<string, PointCloud>::const_iterator it2 =
+				it->second.begin(); it2 != it->second.end(); it2++)
+			count += it2->second.points.size();
+		counts.push_back(std::max(1, count));
+	}
+
+	std::vector<float> feature_vectors(features_.size() * featureLength);
+	for (size_t i = 0; i < features_.size(); i++)
+		memcpy(&feature_vectors[i * featureLength], features_[i].histogram,
+				featureLength * sizeof(float));
+
+	MiniBatchKMeans kmeans(counts.size(), featureLength);
+	kmeans.setBatchSize(kmeans_batch_size_);
+	kmeans.setSeed(kmeans_seed_);
+	kmeans.setNumberOfThreads(num_threads_);
+	kmeans.setCenters(centers, counts);
+
+	vector<int> cluster_labels;
+	kmeans.update(feature_vectors, cluster_labels);
+
+	// Rebuild the database with the moved centers as keys
+	const std::vector<float> & new_centers = kmeans.getCenters();
+	vector<FeatureT> cluster_centers(counts.size());
+	DatabaseType database;
+	int c = 0;
+	for (typename DatabaseType::iterator it = database_.begin();
+			it != database_.end(); it++, c++) {
+		memcpy(cluster_centers[c].histogram, &new_centers[c * featureLength],
+				featureLength * sizeof(float));
+		map<string, PointCloud> & votes = database[cluster_centers[c]];
+		for (typename map<string, PointCloud>::iterator it2 =
+				it->second.begin(); it2 != it->second.end(); it2++)
+			votes[it2->first] += it2->second;
+	}
+
+	for (size_t i = 0; i < cluster_labels.size(); i++) {
+		PointCloud & votes = database[cluster_centers[cluster_labels[i]]][classes_[i]];
+		votes.points.push_back(centroids_[i]);
+		votes.width = votes.points.size();
+		votes.height = 1;
+		votes.is_dense = true;
+	}
+
+	database_.swap(database);
+
+	database_features_cloud_->points.clear();
+	for (typename DatabaseType::const_iterator it = database_.begin();
+			it != database_.end(); it++)
+		database_features_cloud_->points.push_back(it->first);
+	database_features_cloud_->width = database_features_cloud_->points.size();
+	database_features_cloud_->height = 1;
+	database_features_cloud_->is_dense = true;
+
+	if (debug_) {
+		PCL17_INFO("Updated %d cluster centers with %d new features\n",
+				(int) database_.size(), (int) features_.size());
+	}
+}
+
 template<class PointT, class PointNormalT, class FeatureT>
 void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::computeExternalClassifier(
 		const std::string & labels) {
@@ -535,6 +1129,14 @@ template<class PointT, class PointNormalT, class FeatureT> furniture_classificat
 
 template<class PointT, class PointNormalT, class FeatureT>
 void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::classify() {
+	features_.clear();
+	centroids_.clear();
+	classes_.clear();
+
+	votes_.clear();
+	voted_segment_idx_.clear();
+	found_objects_.clear();
+
 	appendFeaturesFromCloud(scene_, "Scene", 0);
 	normalizeFeaturesWithCurrentMinMax(features_);
 	vote();
@@ -550,8 +1152,9 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::classify() {
 			votes_.begin(); it != votes_.end(); it++) {
 
 		std::cerr << "Checking for " << it->first << std::endl;
-		pcl17::io::savePCDFileASCII(debug_folder_ + it->first + "_votes.pcd",
-				it->second);
+		if (debug_)
+			pcl17::io::savePCDFileASCII(debug_folder_ + it->first + "_votes.pcd",
+					it->second);
 
 		int grid_center_x, grid_center_y;
 		Eigen::MatrixXf grid = projectVotesToGrid(it->second, grid_center_x,
@@ -726,6 +1329,290 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::eval_clustering
 
 }
 
+// Voxels of the input of smoothAtVoxels(), and the smoothed point of every voxel
+template<class PointT, class PointNormalT>
+struct pcl17::VoxelSmoothingJob {
+	typename pcl17::PointCloud<PointT>::ConstPtr cloud;
+	typename pcl17::search::KdTree<PointT>::Ptr tree;
+	std::vector<int> indices; // finite points sorted by voxel
+	std::vector<int> voxel_begin; // first index of every voxel, and indices.size()
+	Eigen::Vector3d viewpoint;
+
+	std::vector<PointNormalT, Eigen::aligned_allocator<PointNormalT> > points;
+	std::vector<char> valid; // false if no point of the voxel has enough neighbours
+	size_t next_voxel;
+	int nr_fitted_per_point;
+	boost::mutex mutex;
+};
+
+// Same fit as MovingLeastSquares: plane through the neighbours, and the polynomial over it weighted by distance
+template<class PointT, class PointNormalT, class FeatureT>
+bool pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::fitSurface(
+		const PointCloud & cloud, const Eigen::Vector3f & query,
+		const std::vector<int> & nn_indices, LocalSurface & surface) {
+
+	if (nn_indices.size() < 3)
+		return false;
+
+	EIGEN_ALIGN16 Eigen::Matrix3f covariance_matrix;
+	Eigen::Vector4f xyz_centroid;
+	pcl17::computeMeanAndCovarianceMatrix(cloud, nn_indices, covariance_matrix,
+			xyz_centroid);
+
+	float eigen_value;
+	Eigen::Vector3f eigen_vector;
+	pcl17::eigen33(covariance_matrix, eigen_value, eigen_vector);
+
+	float distance = (query - xyz_centroid.head<3>()).dot(eigen_vector);
+	surface.origin = (query - distance * eigen_vector).cast<double>();
+	surface.normal = eigen_vector.cast<double>();
+	surface.curvature = covariance_matrix.trace();
+	if (surface.curvature != 0)
+		surface.curvature = fabsf(eigen_value / surface.curvature);
+	surface.v = surface.normal.unitOrthogonal();
+	surface.u = surface.normal.cross(surface.v);
+	surface.order = mls_polynomial_order_;
+	surface.c.resize(0);
+
+	int nr_coeff = (mls_polynomial_order_ + 1) * (mls_polynomial_order_ + 2) / 2;
+	if (!mls_polynomial_fit_ || (int) nn_indices.size() < nr_coeff)
+		return true;
+
+	double sqr_gauss_param = mls_search_radius_ * mls_search_radius_;
+	Eigen::VectorXd weight_vec(nn_indices.size());
+	Eigen::MatrixXd P(nr_coeff, nn_indices.size());
+	Eigen::VectorXd f_vec(nn_indices.size());
+	for (size_t ni = 0; ni < nn_indices.size(); ni++) {
+		Eigen::Vector3d de_meaned =
+				cloud.points[nn_indices[ni]].getVector3fMap().template cast<double>()
+						- surface.origin;
+		weight_vec(ni) = exp(-de_meaned.dot(de_meaned) / sqr_gauss_param);
+		double u_coord = de_meaned.dot(surface.u);
+		double v_coord = de_meaned.dot(surface.v);
+		f_vec(ni) = de_meaned.dot(surface.normal);
+
+		int j = 0;
+		double u_pow = 1;
+		for (int ui = 0; ui <= mls_polynomial_order_; ui++) {
+			double v_pow = 1;
+			for (int vi = 0; vi <= mls_polynomial_order_ - ui; vi++) {
+				P(j++, ni) = u_pow * v_pow;
+				v_pow *= v_coord;
+			}
+			u_pow *= u_coord;
+		}
+	}
+
+	Eigen::MatrixXd P_weight = P * weight_vec.asDiagonal();
+	Eigen::MatrixXd P_weight_Pt = P_weight * P.transpose();
+	Eigen::VectorXd c_vec = P_weight * f_vec;
+	P_weight_Pt.llt().solveInPlace(c_vec);
+	if (pcl_isfinite(c_vec[0]))
+		surface.c = c_vec;
+
+	return true;
+}
+
+template<class PointT, class PointNormalT, class FeatureT>
+void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::smoothAtVoxelsWorker(
+		VoxelSmoothingJob<PointT, PointNormalT> * job) {
+
+	const PointCloud & cloud = *job->cloud;
+	const size_t nr_voxels = job->voxel_begin.size() - 1;
+	const size_t chunk_size = 64;
+	std::vector<int> nn_indices;
+	std::vector<float> nn_sqr_distances;
+	LocalSurface surface, own_surface;
+	int nr_fitted_per_point = 0;
+
+	while (true) {
+		size_t begin;
+		{
+			boost::mutex::scoped_lock lock(job->mutex);
+			begin = job->next_voxel;
+			job->next_voxel += chunk_size;
+		}
+		if (begin >= nr_voxels)
+			break;
+
+		for (size_t v = begin; v < std::min(begin + chunk_size, nr_voxels); v++) {
+			int first = job->voxel_begin[v], last = job->voxel_begin[v + 1];
+
+			Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+			for (int i = first; i < last; i++)
+				centroid += cloud.points[job->indices[i]].getVector3fMap();
+			centroid /= last - first;
+
+			// The two points of the voxel whose own surfaces differ the most from the surface at the centroid:
+			// the one farthest from the centroid, and the one farthest from that
+			int extremes[2];
+			Eigen::Vector3f from = centroid;
+			for (int e = 0; e < 2; e++) {
+				float max_sqr_distance = -1;
+				for (int i = first; i < last; i++) {
+					float d = (cloud.points[job->indices[i]].getVector3fMap()
+							- from).squaredNorm();
+					if (d > max_sqr_distance) {
+						max_sqr_distance = d;
+						extremes[e] = job->indices[i];
+					}
+				}
+				from = cloud.points[extremes[0]].getVector3fMap();
+			}
+
+			PointT query;
+			query.x = centroid[0];
+			query.y = centroid[1];
+			query.z = centroid[2];
+			job->tree->radiusSearch(query, mls_search_radius_, nn_indices,
+					nn_sqr_distances);
+			bool fitted = fitSurface(cloud, centroid, nn_indices, surface);
+
+			// Compare both surfaces at the extreme points, the normal deviation is weighted with the voxel size
+			for (int e = 0; e < 2 && fitted && last - first > 1; e++) {
+				const PointT & extreme = cloud.points[extremes[e]];
+				job->tree->radiusSearch(extreme, mls_search_radius_, nn_indices,
+						nn_sqr_distances);
+				fitted = fitSurface(cloud, extreme.getVector3fMap(), nn_indices,
+						own_surface);
+				if (fitted) {
+					Eigen::Vector3d p =
+							extreme.getVector3fMap().template cast<double>();
+					Eigen::Vector3d own_point, own_normal, point, normal;
+					own_surface.project(p, own_point, own_normal);
+					surface.project(p, point, normal);
+					own_normal.normalize();
+					normal.normalize();
+					if (own_normal.dot(normal) < 0)
+						normal = -normal;
+					double deviation = std::max((own_point - point).norm(),
+							(own_normal - normal).norm() * subsampling_resolution_);
+					fitted = deviation <= voxel_smoothing_tolerance_;
+				}
+			}
+
+			Eigen::Vector3d point, normal;
+			float curvature;
+			if (fitted) {
+				surface.project(centroid.cast<double>(), point, normal);
+				curvature = surface.curvature;
+			} else {
+				// Average of the surface points of the voxel, like MovingLeastSquares and VoxelGrid
+				nr_fitted_per_point++;
+				point.setZero();
+				normal.setZero();
+				curvature = 0;
+				int nr_fitted = 0;
+				for (int i = first; i < last; i++) {
+					const PointT & p = cloud.points[job->indices[i]];
+					job->tree->radiusSearch(p, mls_search_radius_, nn_indices,
+							nn_sqr_distances);
+					if (!fitSurface(cloud, p.getVector3fMap(), nn_indices,
+							own_surface))
+						continue;
+					Eigen::Vector3d own_point, own_normal;
+					own_surface.project(p.getVector3fMap().template cast<double>(),
+							own_point, own_normal);
+					if (own_normal.dot(job->viewpoint - own_point) < 0)
+						own_normal = -own_normal;
+					point += own_point;
+					normal += own_normal;
+					curvature += own_surface.curvature;
+					nr_fitted++;
+				}
+				if (nr_fitted == 0) {
+					job->valid[v] = false;
+					continue;
+				}
+				point /= nr_fitted;
+				normal /= nr_fitted;
+				curvature /= nr_fitted;
+			}
+
+			PointNormalT & result = job->points[v];
+			result.x = point[0];
+			result.y = point[1];
+			result.z = point[2];
+			result.normal_x = normal[0];
+			result.normal_y = normal[1];
+			result.normal_z = normal[2];
+			result.curvature = curvature;
+			job->valid[v] = true;
+		}
+	}
+
+	boost::mutex::scoped_lock lock(job->mutex);
+	job->nr_fitted_per_point += nr_fitted_per_point;
+}
+
+// Instead of fitting the surface at every point and averaging the fitted points of every voxel,
+// fits it once at the centroid of every voxel, with the full resolution points as support.
+// Voxels where the surface at the centroid deviates by more than voxel_smoothing_tolerance_
+// from the surfaces at its two extreme points are fitted at every point as before.
+template<class PointT, class PointNormalT, class FeatureT>
+typename pcl17::PointCloud<PointNormalT>::Ptr pcl17::PHVObjectClassifier<PointT,
+		PointNormalT, FeatureT>::smoothAtVoxels(PointCloudConstPtr cloud) {
+
+	VoxelSmoothingJob<PointT, PointNormalT> job;
+	job.cloud = cloud;
+	job.viewpoint = cloud->sensor_origin_.template head<3>().template cast<double>();
+
+	std::vector<std::pair<Eigen::Vector3i, int> > keys;
+	keys.reserve(cloud->points.size());
+	for (size_t i = 0; i < cloud->points.size(); i++) {
+		const PointT & p = cloud->points[i];
+		if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+			continue;
+		Eigen::Vector3i key(floor(p.x / subsampling_resolution_),
+				floor(p.y / subsampling_resolution_),
+				floor(p.z / subsampling_resolution_));
+		keys.push_back(std::make_pair(key, i));
+	}
+	std::sort(keys.begin(), keys.end(), voxelKeyLess);
+
+	job.indices.resize(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		job.indices[i] = keys[i].second;
+		if (i == 0 || keys[i].first != keys[i - 1].first)
+			job.voxel_begin.push_back(i);
+	}
+	job.voxel_begin.push_back(keys.size());
+
+	size_t nr_voxels = job.voxel_begin.size() - 1;
+	job.points.resize(nr_voxels);
+	job.valid.resize(nr_voxels, false);
+	job.next_voxel = 0;
+	job.nr_fitted_per_point = 0;
+
+	job.tree.reset(new PointTree);
+	job.tree->setInputCloud(cloud);
+
+	int num_threads = num_threads_ > 0 ? num_threads_ : boost::thread::hardware_concurrency();
+	boost::thread_group threads;
+	for (int t = 0; t < std::max(1, num_threads); t++) {
+		threads.create_thread(
+				boost::bind(&PHVObjectClassifier::smoothAtVoxelsWorker, this,
+						&job));
+	}
+	threads.join_all();
+
+	if (debug_) {
+		PCL17_INFO("Voxel smoothing: %d of %d voxels fitted at every point\n",
+				job.nr_fitted_per_point, (int) nr_voxels);
+	}
+
+	PointNormalCloudPtr result(new PointNormalCloud);
+	for (size_t v = 0; v < nr_voxels; v++) {
+		if (job.valid[v])
+			result->points.push_back(job.points[v]);
+	}
+	result->width = result->points.size();
+	result->height = 1;
+	result->is_dense = true;
+
+	return result;
+}
+
 template<class PointT, class PointNormalT, class FeatureT>
 typename pcl17::PointCloud<PointNormalT>::Ptr pcl17::PHVObjectClassifier<PointT,
 		PointNormalT, FeatureT>::estimateNormalsAndSubsample(
@@ -743,23 +1630,27 @@ typename pcl17::PointCloud<PointNormalT>::Ptr pcl17::PHVObjectClassifier<PointT,
 	//    grid.setLeafSize(subsampling_resolution_, subsampling_resolution_, subsampling_resolution_);
 	//    grid.filter(*cloud_downsampled);
 
-	PointTreePtr tree(new PointTree);
+	if (voxel_smoothing_) {
+		cloud_downsampled = smoothAtVoxels(cloud_orig);
+	} else {
+		PointTreePtr tree(new PointTree);
 
-	mls_->setComputeNormals(true);
+		mls_->setComputeNormals(true);
 
-	mls_->setInputCloud(cloud_orig);
-	mls_->setPolynomialFit(mls_polynomial_fit_);
-	mls_->setPolynomialOrder(mls_polynomial_order_);
-	mls_->setSearchMethod(tree);
-	mls_->setSearchRadius(mls_search_radius_);
+		mls_->setInputCloud(cloud_orig);
+		mls_->setPolynomialFit(mls_polynomial_fit_);
+		mls_->setPolynomialOrder(mls_polynomial_order_);
+		mls_->setSearchMethod(tree);
+		mls_->setSearchRadius(mls_search_radius_);
 
-	this->mls_->process(*cloud_with_normals);
+		this->mls_->process(*cloud_with_normals);
 
-	pcl17::VoxelGrid<PointNormalT> grid;
-	grid.setInputCloud(cloud_with_normals);
-	grid.setLeafSize(subsampling_resolution_, subsampling_resolution_,
-			subsampling_resolution_);
-	grid.filter(*cloud_downsampled);
+		pcl17::VoxelGrid<PointNormalT> grid;
+		grid.setInputCloud(cloud_with_normals);
+		grid.setLeafSize(subsampling_resolution_, subsampling_resolution_,
+				subsampling_resolution_);
+		grid.filter(*cloud_downsampled);
+	}
 
 	Eigen::Vector4f so = cloud_orig->sensor_origin_;
 	//std::cerr << "Model viewpoint\n" << so << std::endl;
@@ -781,76 +1672,118 @@ typename pcl17::PointCloud<PointNormalT>::Ptr pcl17::PHVObjectClassifier<PointT,
 
 }
 
+// Region growing as RegionGrowing with the smooth mode off and the residual test on, but directly on the
+// points and normals of the cloud, with the tree that is also used for the features. The points of segment i
+// are segment_points[segment_begin[i]] ... segment_points[segment_begin[i + 1] - 1], in increasing order.
 template<class PointT, class PointNormalT, class FeatureT>
 void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::getSegmentsFromCloud(
-		PointNormalCloudPtr cloud_with_normals,
-		vector<boost::shared_ptr<vector<int> > > & segment_indices,
+		PointNormalCloudPtr cloud_with_normals, PointNormalTreePtr tree,
+		vector<int> & segment_points, vector<int> & segment_begin,
 		pcl17::PointCloud<pcl17::PointXYZRGBNormal>::Ptr & colored_segments) {
 
-	segment_indices.clear();
-
-	PointCloudPtr cloud(new PointCloud);
-	pcl17::PointCloud<pcl17::Normal>::Ptr normals(
-			new pcl17::PointCloud<pcl17::Normal>);
-	pcl17::copyPointCloud(*cloud_with_normals, *cloud);
-	pcl17::copyPointCloud(*cloud_with_normals, *normals);
-
-	PointTreePtr tree(new PointTree);
-
-	vector<pcl17::PointIndices> segment_indices_all;
-
-	pcl17::RegionGrowing<PointT, pcl17::Normal> region_growing;
-	region_growing.setMinClusterSize(min_points_in_segment_);
-	//region_growing.setMaxClusterSize (10000);
-	region_growing.setSearchMethod(tree);
-	region_growing.setNumberOfNeighbours(30);
-	region_growing.setInputCloud(cloud);
-	//region_growing.setIndices (indices);
-	region_growing.setInputNormals(normals);
-	region_growing.setSmoothnessThreshold(rg_smoothness_threshold_);
-	region_growing.setResidualThreshold(rg_residual_threshold_);
-	region_growing.setCurvatureThreshold(1.0);
-	region_growing.setCurvatureTestFlag(false);
-	region_growing.setSmoothModeFlag(false);
-	region_growing.setResidualTestFlag(true);
-
-	//segment_indices_all = region_growing.getSegments();
-	region_growing.extract(segment_indices_all);
-
-	BOOST_FOREACH(pcl17::PointIndices & i, segment_indices_all) {
-		if ((int) i.indices.size() > min_points_in_segment_) {
-			boost::shared_ptr<vector<int> > indices(new vector<int>);
-			*indices = i.indices;
-			segment_indices.push_back(indices);
+	const PointNormalCloud & cloud = *cloud_with_normals;
+	const int nr_points = cloud.points.size();
+	const int nr_neighbours = 30;
+	const float cosine_threshold = cos(rg_smoothness_threshold_);
+
+	// Regions are grown from the points with the lowest curvature first
+	std::vector<std::pair<float, int> > seeds(nr_points);
+	for (int i = 0; i < nr_points; i++) {
+		seeds[i].first = cloud.points[i].curvature;
+		seeds[i].second = i;
+	}
+	std::sort(seeds.begin(), seeds.end());
+
+	std::vector<int> labels(nr_points, -1);
+	std::vector<int> region_sizes;
+	std::vector<int> queue;
+	queue.reserve(nr_points);
+	std::vector<int> nn_indices(nr_neighbours);
+	std::vector<float> nn_sqr_distances(nr_neighbours);
+
+	for (int s = 0; s < nr_points; s++) {
+		int initial_seed = seeds[s].second;
+		if (labels[initial_seed] != -1)
+			continue;
+
+		int label = region_sizes.size();
+		Eigen::Vector3f initial_seed_normal =
+				cloud.points[initial_seed].getNormalVector3fMap();
+		labels[initial_seed] = label;
+		region_sizes.push_back(1);
+		queue.clear();
+		queue.push_back(initial_seed);
+
+		for (size_t q = 0; q < queue.size(); q++) {
+			const PointNormalT & point = cloud.points[queue[q]];
+			Eigen::Vector3f normal = point.getNormalVector3fMap();
+			tree->nearestKSearch(point, nr_neighbours, nn_indices,
+					nn_sqr_distances);
+
+			for (size_t n = 0; n < nn_indices.size(); n++) {
+				int nghbr = nn_indices[n];
+				if (labels[nghbr] != -1)
+					continue;
+
+				const PointNormalT & nghbr_point = cloud.points[nghbr];
+				if (fabsf(nghbr_point.getNormalVector3fMap().dot(
+						initial_seed_normal)) < cosine_threshold)
+					continue;
+
+				labels[nghbr] = label;
+				region_sizes[label]++;
+
+				// Points off the plane of the current point belong to the region, but don't grow it
+				float residual = fabsf(normal.dot(
+						point.getVector3fMap() - nghbr_point.getVector3fMap()));
+				if (residual <= rg_residual_threshold_)
+					queue.push_back(nghbr);
+			}
 		}
 	}
 
-	if (debug_) {
-		pcl17::PointCloud<pcl17::PointXYZRGB>::Ptr colored_segments_all;
-		colored_segments_all = region_growing.getColoredCloud();
-
-		vector<int> valid_segment_indices;
-
-		BOOST_FOREACH(boost::shared_ptr<vector<int> > & i, segment_indices) {
-			valid_segment_indices.insert(valid_segment_indices.begin(),
-					i->begin(), i->end());
+	// Regions with enough points become segments, sorted by the label
+	std::vector<int> segment_of_region(region_sizes.size(), -1);
+	segment_begin.clear();
+	segment_begin.push_back(0);
+	for (size_t r = 0; r < region_sizes.size(); r++) {
+		if (region_sizes[r] > min_points_in_segment_) {
+			segment_of_region[r] = segment_begin.size() - 1;
+			segment_begin.push_back(segment_begin.back() + region_sizes[r]);
 		}
+	}
 
-		colored_segments.reset(new pcl17::PointCloud<pcl17::PointXYZRGBNormal>);
+	std::vector<int> next(segment_begin.begin(), segment_begin.end() - 1);
+	segment_points.resize(segment_begin.back());
+	for (int i = 0; i < nr_points; i++) {
+		int segment = labels[i] != -1 ? segment_of_region[labels[i]] : -1;
+		if (segment != -1)
+			segment_points[next[segment]++] = i;
+	}
 
-		for (size_t j = 0; j < valid_segment_indices.size(); j++) {
-			pcl17::PointXYZRGBNormal p;
-			int i = valid_segment_indices[j];
-			p.x = colored_segments_all->points[i].x;
-			p.y = colored_segments_all->points[i].y;
-			p.z = colored_segments_all->points[i].z;
-			p.normal_x = normals->points[i].normal_x;
-			p.normal_y = normals->points[i].normal_y;
-			p.normal_z = normals->points[i].normal_z;
-			p.rgb = colored_segments_all->points[i].rgb;
-			colored_segments->push_back(p);
+	if (debug_) {
+		colored_segments.reset(new pcl17::PointCloud<pcl17::PointXYZRGBNormal>);
+		colored_segments->points.resize(segment_points.size());
+
+		for (size_t segment = 0; segment + 1 < segment_begin.size(); segment++) {
+			uint32_t rgb = (rand() % 256) << 16 | (rand() % 256) << 8
+					| (rand() % 256);
+			for (int j = segment_begin[segment]; j < segment_begin[segment + 1];
+					j++) {
+				const PointNormalT & point = cloud.points[segment_points[j]];
+				pcl17::PointXYZRGBNormal & p = colored_segments->points[j];
+				p.x = point.x;
+				p.y = point.y;
+				p.z = point.z;
+				p.normal_x = point.normal_x;
+				p.normal_y = point.normal_y;
+				p.normal_z = point.normal_z;
+				memcpy(&p.rgb, &rgb, sizeof(float));
+			}
 		}
 
+		colored_segments->width = colored_segments->points.size();
+		colored_segments->height = 1;
 		colored_segments->sensor_origin_ = cloud_with_normals->sensor_origin_;
 		colored_segments->sensor_orientation_ =
 				cloud_with_normals->sensor_orientation_;
@@ -870,13 +1803,13 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::appendFeaturesF
 
 	}
 
-	pcl17::PointCloud<pcl17::PointXYZRGBNormal>::Ptr colored_segments;
-	vector<boost::shared_ptr<vector<int> > > segment_indices;
-	getSegmentsFromCloud(cloud, segment_indices, colored_segments);
-
-	segment_indices_ = segment_indices;
-
+	// One tree for the segmentation and the features
 	PointNormalTreePtr tree(new PointNormalTree);
+	tree->setInputCloud(cloud);
+
+	pcl17::PointCloud<pcl17::PointXYZRGBNormal>::Ptr colored_segments;
+	getSegmentsFromCloud(cloud, tree, segment_points_, segment_begin_,
+			colored_segments);
 
 	feature_estimator_->setSearchMethod(tree);
 	feature_estimator_->setKSearch(fe_k_neighbours_);
@@ -894,10 +1827,12 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::appendFeaturesF
 				cloud->sensor_origin_[2]);
 	}
 
-	BOOST_FOREACH(const boost::shared_ptr<vector<int> > & idx, segment_indices) { // compute deature for segment
-		pcl17::PointCloud<FeatureT> feature;
-		//PointNormalCloudPtr p(new PointNormalCloud(*cloud, *idx));
-		//feature_estimator_->setInputCloud(p);
+	// The indices of each segment are copied to the same vector, the feature estimator keeps a pointer to it
+	boost::shared_ptr<vector<int> > idx(new vector<int>);
+	pcl17::PointCloud<FeatureT> feature;
+	for (size_t s = 0; s + 1 < segment_begin_.size(); s++) { // compute deature for segment
+		idx->assign(segment_points_.begin() + segment_begin_[s],
+				segment_points_.begin() + segment_begin_[s + 1]);
 		feature_estimator_->setIndices(idx);
 		feature_estimator_->compute(feature);
 
@@ -998,6 +1933,29 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::normalizeFeatur
 
 }
 
+// Appends the model centers translated to the segment centroid to the votes of the class
+template<class PointT, class PointNormalT, class FeatureT>
+void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::addVotes(
+		const PointCloud & model_centers, const PointT & centroid, float weight,
+		int segment, const string & class_name) {
+
+	pcl17::PointCloud<pcl17::PointXYZI> & votes = votes_[class_name];
+	vector<int> & voted_segment_idx = voted_segment_idx_[class_name];
+
+	size_t first = votes.points.size();
+	votes.points.resize(first + model_centers.points.size());
+	voted_segment_idx.resize(first + model_centers.points.size(), segment);
+	for (size_t k = 0; k < model_centers.points.size(); k++) {
+		pcl17::PointXYZI & vote = votes.points[first + k];
+		vote.x = model_centers.points[k].x + centroid.x;
+		vote.y = model_centers.points[k].y + centroid.y;
+		vote.z = model_centers.points[k].z + centroid.z;
+		vote.intensity = weight;
+	}
+	votes.width = votes.points.size();
+	votes.height = 1;
+}
+
 template<class PointT, class PointNormalT, class FeatureT>
 void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::vote() {
 
@@ -1013,49 +1971,41 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::vote() {
 		if (debug_) {
 			std::stringstream ss;
 			ss << debug_folder_ << "Segment" << i << ".pcd";
-			PointNormalCloud p(*scene_, *segment_indices_[i]);
+			std::vector<int> segment(segment_points_.begin() + segment_begin_[i],
+					segment_points_.begin() + segment_begin_[i + 1]);
+			PointNormalCloud p(*scene_, segment);
 			pcl17::io::savePCDFileASCII(ss.str(), p);
 		}
 
 		for (size_t j = 0; j < indices.size(); j++) {
 
-			FeatureT closest_cluster = database_features_cloud_->at(indices[j]);
+			const FeatureT & closest_cluster = database_features_cloud_->at(
+					indices[j]);
 			for (std::map<std::string, pcl17::PointCloud<pcl17::PointXYZ> >::const_iterator it =
 					database_[closest_cluster].begin();
 					it != database_[closest_cluster].end(); it++) {
 
-				std::string class_name = it->first;
-				PointCloud model_centers = it->second;
-				PointCloud model_centers_transformed;
-				pcl17::PointCloud<pcl17::PointXYZI> model_centers_transformed_weighted;
-
-				Eigen::Affine3f transform;
-				transform.setIdentity();
-				transform.translate(centroids_[i].getVector3fMap());
-				pcl17::transformPointCloud(model_centers,
-						model_centers_transformed, transform);
-
-				pcl17::copyPointCloud(model_centers_transformed,
-						model_centers_transformed_weighted);
+				const std::string & class_name = it->first;
+				const PointCloud & model_centers = it->second;
+				size_t first_vote = votes_[class_name].points.size();
 
 				// TODO revise weighting function
-				for (size_t k = 0;
-						k < model_centers_transformed_weighted.size(); k++) {
-					model_centers_transformed_weighted.points[k].intensity =
-							exp(-(distances[j] * distances[j]))
-									* (1.0 / model_centers.size());
-					voted_segment_idx_[class_name].push_back(i);
-				}
+				addVotes(model_centers, centroids_[i],
+						exp(-(distances[j] * distances[j]))
+								* (1.0 / model_centers.size()), i, class_name);
 
 				if (debug_) {
 					std::stringstream ss;
 					ss << debug_folder_ << "Segment" << i << "_neighbour" << j
 							<< "_" << class_name << "_votes.pcd";
-					pcl17::io::savePCDFileASCII(ss.str(),
-							model_centers_transformed_weighted);
+					pcl17::PointCloud<pcl17::PointXYZI> segment_votes;
+					segment_votes.points.assign(
+							votes_[class_name].points.begin() + first_vote,
+							votes_[class_name].points.end());
+					segment_votes.width = segment_votes.points.size();
+					segment_votes.height = 1;
+					pcl17::io::savePCDFileASCII(ss.str(), segment_votes);
 				}
-
-				votes_[class_name] += model_centers_transformed_weighted;
 			}
 		}
 
@@ -1171,7 +2121,9 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::vote_external(
 		if (debug_) {
 			std::stringstream ss;
 			ss << debug_folder_ << "Segment" << i << ".pcd";
-			PointNormalCloud p(*scene_, *segment_indices_[i]);
+			std::vector<int> segment(segment_points_.begin() + segment_begin_[i],
+					segment_points_.begin() + segment_begin_[i + 1]);
+			PointNormalCloud p(*scene_, segment);
 			pcl17::io::savePCDFileASCII(ss.str(), p);
 		}
 
@@ -1182,27 +2134,11 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::vote_external(
 		for (std::map<std::string, pcl17::PointCloud<pcl17::PointXYZ> >::const_iterator it =
 				database_[ff].begin(); it != database_[ff].end(); it++) {
 
-			std::string class_name = it->first;
-			PointCloud model_centers = it->second;
-			PointCloud model_centers_transformed;
-			pcl17::PointCloud<pcl17::PointXYZI> model_centers_transformed_weighted;
-
-			Eigen::Affine3f transform;
-			transform.setIdentity();
-			transform.translate(centroids_[i].getVector3fMap());
-			pcl17::transformPointCloud(model_centers, model_centers_transformed,
-					transform);
-
-			pcl17::copyPointCloud(model_centers_transformed,
-					model_centers_transformed_weighted);
+			const PointCloud & model_centers = it->second;
 
 			// TODO revise weighting function
-			for (size_t k = 0; k < model_centers_transformed_weighted.size();
-					k++) {
-				model_centers_transformed_weighted.points[k].intensity = prob
-						* (1.0 / model_centers.size());
-				voted_segment_idx_[class_name].push_back(i);
-			}
+			addVotes(model_centers, centroids_[i],
+					prob * (1.0 / model_centers.size()), i, it->first);
 
 			//          if (debug_)
 			//          {
@@ -1211,7 +2147,6 @@ void pcl17::PHVObjectClassifier<PointT, PointNormalT, FeatureT>::vote_external(
 			//            pcl17::io::savePCDFileASCII(ss.str(), model_centers_transformed_weighted);
 			//          }
 
-			votes_[class_name] += model_centers_transformed_weighted;
 			//}
 		}
 
@@ -1405,8 +2340,8 @@ vector<boost::shared_ptr<std::vector<int> > > pcl17::PHVObjectClassifier<PointT,
 				it != segment_combinations[i].end(); it++) {
 			//PointNormalCloud segment(*scene_, *segment_indices_[*it]);
 			cloud_idx->insert(cloud_idx->begin(),
-					segment_indices_[*it]->begin(),
-					segment_indices_[*it]->end());
+					segment_points_.begin() + segment_begin_[*it],
+					segment_points_.begin() + segment_begin_[*it + 1]);
 
 			//*cloud += segment;
 		}
@@ -44,7 +44,11 @@ template<class FeatureType, class FeatureEstimatorType>
 
     oc.setDebug(true);
     oc.setDatabaseDir(database_dir);
-    oc.loadFromFile();
+    if (!oc.loadFromFile())
+    {
+      PCL17_ERROR("Could not load the database from %s\n", database_dir.c_str());
+      return;
+    }
 
     oc.setDebugFolder(debug_folder);
 
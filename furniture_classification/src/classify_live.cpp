@@ -7,12 +7,129 @@
 #include <pcl17/features/vfh.h>
 #include <pcl17/features/esf.h>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Hands values from one thread to the next, only the newest one is kept. Values that are replaced
+// before they were taken are counted as dropped.
+template<class T>
+  class LatestValue
+  {
+  public:
+    LatestValue() :
+      has_value(false), closed(false), dropped(0)
+    {
+    }
+
+    void put(const T & v)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      if (has_value)
+        dropped++;
+      value = v;
+      has_value = true;
+      cond.notify_one();
+    }
+
+    // Waits for a value, returns false once close() was called
+    bool take(T & v)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      while (!has_value && !closed)
+        cond.wait(lock);
+      if (closed)
+        return false;
+      v = value;
+      value = T();
+      has_value = false;
+      return true;
+    }
+
+    void close()
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      closed = true;
+      cond.notify_all();
+    }
+
+    int getDropped()
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      return dropped;
+    }
+
+  private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    T value;
+    bool has_value;
+    bool closed;
+    int dropped;
+  };
+
+// Number of frames and latency of one pipeline stage since the last report
+class StageStatistics
+{
+public:
+  StageStatistics(const std::string & name) :
+    name(name), frames(0), total_ms(0), max_ms(0)
+  {
+  }
+
+  void add(const boost::posix_time::ptime & start)
+  {
+    double ms = (boost::posix_time::microsec_clock::local_time() - start).total_microseconds() / 1000.0;
+    boost::mutex::scoped_lock lock(mutex);
+    frames++;
+    total_ms += ms;
+    max_ms = std::max(max_ms, ms);
+  }
+
+  void report(double seconds)
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    if (frames > 0)
+      PCL17_INFO ("%-12s %6.2f frames/s, latency %8.1f ms mean %8.1f ms max\n", name.c_str(), frames / seconds,
+          total_ms / frames, max_ms);
+    frames = 0;
+    total_ms = 0;
+    max_ms = 0;
+  }
+
+private:
+  boost::mutex mutex;
+  std::string name;
+  int frames;
+  double total_ms;
+  double max_ms;
+};
+
+// The grabber callback only stores the newest frame. One thread aligns it to the floor and estimates
+// the normals, a second one segments, votes and fits the models, so the preprocessing of the next
+// frame overlaps with the classification of the current one. Frames that arrive while a stage is busy
+// are dropped instead of queued, so the result is never older than two stages.
 template<class FeatureType, class FeatureEstimatorType>
   class SimpleOpenNIViewer
   {
   public:
-    SimpleOpenNIViewer(std::string database) :
-      viewer("PCL OpenNI Viewer"), classify(false), classificaton_running(false), interface(new pcl17::OpenNIGrabber())
+    typedef pcl17::PointCloud<pcl17::PointXYZRGBA> Cloud;
+    typedef pcl17::PointCloud<pcl17::PointNormal> NormalCloud;
+
+    struct Frame
+    {
+      Cloud::ConstPtr cloud;
+      boost::posix_time::ptime stamp;
+    };
+
+    struct Scene
+    {
+      Cloud::Ptr cloud_transformed;
+      NormalCloud::Ptr scene;
+      boost::posix_time::ptime stamp;
+    };
+
+    SimpleOpenNIViewer(std::string database, bool debug) :
+      viewer("PCL OpenNI Viewer"), classify(false), interface(new pcl17::OpenNIGrabber()), preprocessing_stats(
+          "preprocess"), classification_stats("classify"), total_stats("total")
     {
       std::string database_dir = database;
       std::string debug_folder = "debug_classification/";
@@ -21,29 +138,42 @@ template<class FeatureType, class FeatureEstimatorType>
       oc.setFeatureEstimator(feature_estimator);
 
       oc.setDatabaseDir(database_dir);
-      oc.loadFromFile();
+      if (!oc.loadFromFile())
+      {
+        PCL17_ERROR("Could not load the database from %s\n", database_dir.c_str());
+        exit(-1);
+      }
 
       oc.setDebugFolder(debug_folder);
-      oc.setDebug(true);
+      oc.setDebug(debug);
 
     }
 
-    void cloud_cb_(const pcl17::PointCloud<pcl17::PointXYZRGBA>::ConstPtr &cloud)
+    void cloud_cb_(const Cloud::ConstPtr &cloud)
     {
       if (viewer.wasStopped())
         return;
 
-      if (!classify && !classificaton_running)
-      {
-        viewer.showCloud(convert(cloud, 30));
-      }
-      else if (classify && !classificaton_running)
+      Frame frame;
+      frame.cloud = cloud;
+      frame.stamp = boost::posix_time::microsec_clock::local_time();
+      frames.put(frame);
+    }
+
+    void preprocess()
+    {
+      Frame frame;
+      while (frames.take(frame))
       {
-        classificaton_running = true;
-        interface->stop();
-        //viewer.showCloud(cloud);
+        Cloud::Ptr cloud_transformed = convert(frame.cloud, 30);
 
-        pcl17::PointCloud<pcl17::PointXYZRGBA>::Ptr cloud_transformed = convert(cloud, 30);
+        if (!classify)
+        {
+          viewer.showCloud(cloud_transformed);
+          preprocessing_stats.add(frame.stamp);
+          total_stats.add(frame.stamp);
+          continue;
+        }
 
         pcl17::PointCloud<pcl17::PointXYZ>::Ptr scene(new pcl17::PointCloud<pcl17::PointXYZ>);
 
@@ -52,19 +182,33 @@ template<class FeatureType, class FeatureEstimatorType>
         scene->sensor_origin_ = cloud_transformed->sensor_origin_;
         scene->sensor_orientation_ = cloud_transformed->sensor_orientation_;
 
-        std::cerr << "Added scene" << std::endl;
-        oc.setScene(scene);
-        std::cerr << "Classifying" << std::endl;
+        Scene s;
+        s.cloud_transformed = cloud_transformed;
+        s.scene = oc.preprocessScene(scene);
+        s.stamp = frame.stamp;
+        preprocessing_stats.add(frame.stamp);
+        scenes.put(s);
+      }
+    }
+
+    void classifyScenes()
+    {
+      Scene s;
+      while (scenes.take(s))
+      {
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+
+        oc.setPreprocessedScene(s.scene);
         oc.classify();
 
-        map<string, vector<pcl17::PointCloud<pcl17::PointNormal>::Ptr> > objects = oc.getFoundObjects();
+        map<string, vector<NormalCloud::Ptr> > objects = oc.getFoundObjects();
 
-        typedef typename map<string, vector<pcl17::PointCloud<pcl17::PointNormal>::Ptr> >::value_type vt;
+        typedef typename map<string, vector<NormalCloud::Ptr> >::value_type vt;
 
         BOOST_FOREACH(vt &v, objects)
 {        for(size_t i=0; i<v.second.size(); i++)
         {
-          pcl17::PointCloud<pcl17::PointXYZRGBA>::Ptr model(new pcl17::PointCloud<pcl17::PointXYZRGBA>);
+          Cloud::Ptr model(new Cloud);
           pcl17::copyPointCloud(*v.second[i], *model);
 
           for(size_t i=0; i<model->points.size(); i++)
@@ -74,13 +218,14 @@ template<class FeatureType, class FeatureEstimatorType>
             model->points[i].b = 0;
           }
 
-          *cloud_transformed += *model;
+          *s.cloud_transformed += *model;
 
         }
       }
 
-      viewer.showCloud(cloud_transformed);
-
+      viewer.showCloud(s.cloud_transformed);
+      classification_stats.add(start);
+      total_stats.add(s.stamp);
     }
   }
 
@@ -88,14 +233,14 @@ template<class FeatureType, class FeatureEstimatorType>
   {
     if (event.getKeySym() == "c" && event.keyDown())
     {
-      classify = true;
+      classify = !classify;
     }
   }
 
   void run()
   {
 
-    boost::function<void(const pcl17::PointCloud<pcl17::PointXYZRGBA>::ConstPtr&)> f =
+    boost::function<void(const Cloud::ConstPtr&)> f =
     boost::bind(&SimpleOpenNIViewer::cloud_cb_, this, _1);
 
     //boost::function<void (const pcl17::visualization::KeyboardEvent&)> k =
@@ -104,20 +249,39 @@ template<class FeatureType, class FeatureEstimatorType>
     interface->registerCallback(f);
     viewer.registerKeyboardCallback(&SimpleOpenNIViewer::keyboard_cb, *this, NULL);
 
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(&SimpleOpenNIViewer::preprocess, this));
+    threads.create_thread(boost::bind(&SimpleOpenNIViewer::classifyScenes, this));
+
     interface->start();
 
+    const int report_interval = 5;
+    int seconds = 0;
     while (!viewer.wasStopped())
     {
       boost::this_thread::sleep(boost::posix_time::seconds(1));
+
+      if (++seconds == report_interval)
+      {
+        preprocessing_stats.report(report_interval);
+        classification_stats.report(report_interval);
+        total_stats.report(report_interval);
+        PCL17_INFO ("dropped      %d frames before preprocessing, %d scenes before classification\n",
+            frames.getDropped(), scenes.getDropped());
+        seconds = 0;
+      }
     }
 
     interface->stop();
+    frames.close();
+    scenes.close();
+    threads.join_all();
   }
 
-  pcl17::PointCloud<pcl17::PointXYZRGBA>::Ptr convert(pcl17::PointCloud<pcl17::PointXYZRGBA>::ConstPtr scene, int tilt)
+  Cloud::Ptr convert(Cloud::ConstPtr scene, int tilt)
   {
 
-    pcl17::PointCloud<pcl17::PointXYZRGBA>::Ptr cloud_transformed(new pcl17::PointCloud<pcl17::PointXYZRGBA>), cloud_aligned(new pcl17::PointCloud<pcl17::PointXYZRGBA>);
+    Cloud::Ptr cloud_transformed(new Cloud), cloud_aligned(new Cloud);
 
     Eigen::Affine3f view_transform;
     view_transform.matrix() << 0, 0, 1, 0, -1, 0, 0, 0, 0, -1, 0, 0, 0, 0, 0, 1;
@@ -171,11 +335,16 @@ template<class FeatureType, class FeatureEstimatorType>
 
   pcl17::visualization::CloudViewer viewer;
 
-  bool classify;
-  bool classificaton_running;
+  volatile bool classify;
   pcl17::PHVObjectClassifier<pcl17::PointXYZ, pcl17::PointNormal, FeatureType> oc;
   pcl17::Grabber* interface;
 
+  LatestValue<Frame> frames;
+  LatestValue<Scene> scenes;
+  StageStatistics preprocessing_stats;
+  StageStatistics classification_stats;
+  StageStatistics total_stats;
+
 };
 
 int main(int argc, char **argv)
@@ -183,7 +352,8 @@ int main(int argc, char **argv)
 
   if (argc < 5)
   {
-    PCL17_INFO ("Usage %s -database /path/to/database -features sgf | esf | vfh \n", argv[0]);
+    PCL17_INFO ("Usage %s -database /path/to/database -features sgf | esf | vfh [-debug]\n", argv[0]);
+    PCL17_INFO ("Press c in the viewer to start and stop the classification\n");
     return -1;
   }
 
@@ -192,22 +362,23 @@ int main(int argc, char **argv)
 
   pcl17::console::parse_argument(argc, argv, "-database", database);
   pcl17::console::parse_argument(argc, argv, "-features", features);
+  bool debug = pcl17::console::find_switch(argc, argv, "-debug");
 
   if (features == "sgf")
   {
     SimpleOpenNIViewer<pcl17::Histogram<pcl17::SGFALL_SIZE>, pcl17::SGFALLEstimation<pcl17::PointNormal, pcl17::Histogram<
-        pcl17::SGFALL_SIZE> > > v(database);
+        pcl17::SGFALL_SIZE> > > v(database, debug);
     v.run();
   }
   else if (features == "esf")
   {
-    SimpleOpenNIViewer<pcl17::ESFSignature640, pcl17::ESFEstimation<pcl17::PointNormal, pcl17::ESFSignature640> > v(database);
+    SimpleOpenNIViewer<pcl17::ESFSignature640, pcl17::ESFEstimation<pcl17::PointNormal, pcl17::ESFSignature640> > v(database, debug);
     v.run();
   }
   else if (features == "vfh")
   {
     SimpleOpenNIViewer<pcl17::VFHSignature308, pcl17::VFHEstimation<pcl17::PointNormal, pcl17::PointNormal,
-        pcl17::VFHSignature308> > v(database);
+        pcl17::VFHSignature308> > v(database, debug);
     v.run();
   }
   else
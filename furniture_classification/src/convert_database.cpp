@@ -0,0 +1,87 @@
+/*
+ * convert_database.cpp
+ *
+ * Converts classifier databases between the YAML layout (database.yaml and models/*.pcd)
+ * and the binary database.phvdb.
+ */
+
+#include <pcl17/console/print.h>
+#include <pcl17/point_types.h>
+#include <pcl17/features/sgfall.h>
+#include <pcl17/console/parse.h>
+#include <pcl17/classification/PHVObjectClassifier.h>
+#include <pcl17/features/vfh.h>
+
+template<class FeatureType>
+  bool convert(const std::string & database_dir, const std::string & output_dir, const std::string & to)
+  {
+    pcl17::PHVObjectClassifier<pcl17::PointXYZ, pcl17::PointNormal, FeatureType> oc;
+    oc.setDatabaseDir(database_dir);
+
+    if (to == "binary")
+    {
+      oc.loadFromYAMLFile();
+      oc.setDatabaseDir(output_dir);
+      oc.saveToBinaryFile();
+    }
+    else if (to == "yaml")
+    {
+      if (!oc.loadFromBinaryFile())
+        return false;
+      oc.setDatabaseDir(output_dir);
+      oc.saveToYAMLFile();
+    }
+    else
+    {
+      std::cerr << "Unknown database format " << to << " specified" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+int main(int argc, char **argv)
+{
+
+  if (argc < 5)
+  {
+    PCL17_INFO ("Usage %s -database_dir /dir/with/database -to <binary|yaml> [options]\n", argv[0]);
+    PCL17_INFO (" * where options are:\n"
+        "         -output_dir <X>             : where to put the converted database. Default : database_dir\n"
+        "         -features <X>               : which features the database has (sgf, vfh, esf). Default : sgf\n"
+        "");
+    return -1;
+  }
+
+  std::string database_dir;
+  std::string output_dir;
+  std::string to;
+  std::string features = "sgf";
+
+  pcl17::console::parse_argument(argc, argv, "-database_dir", database_dir);
+  pcl17::console::parse_argument(argc, argv, "-output_dir", output_dir);
+  pcl17::console::parse_argument(argc, argv, "-to", to);
+  pcl17::console::parse_argument(argc, argv, "-features", features);
+
+  if (output_dir == "")
+    output_dir = database_dir;
+
+  bool ok = false;
+  if (features == "sgf")
+  {
+    ok = convert<pcl17::Histogram<pcl17::SGFALL_SIZE> > (database_dir, output_dir, to);
+  }
+  else if (features == "esf")
+  {
+    ok = convert<pcl17::ESFSignature640> (database_dir, output_dir, to);
+  }
+  else if (features == "vfh")
+  {
+    ok = convert<pcl17::VFHSignature308> (database_dir, output_dir, to);
+  }
+  else
+  {
+    std::cerr << "Unknown feature type " << features << " specified" << std::endl;
+  }
+
+  return ok ? 0 : -1;
+}
@@ -39,7 +39,11 @@ template<class FeatureType, class FeatureEstimatorType>
       oc.setFeatureEstimator(feature_estimator);
 
       oc.setDatabaseDir(database_dir);
-      oc.loadFromFile();
+      if (!oc.loadFromFile())
+      {
+        PCL17_ERROR("Could not load the database from %s\n", database_dir.c_str());
+        return;
+      }
 
       oc.setDebugFolder(debug_folder);
       oc.setDebug(false);
@@ -20,7 +20,12 @@ template<class FeatureType, class FeatureEstimatorType>
       oc.setFeatureEstimator(feature_estimator);
 
       oc.setDatabaseDir(database_dir);
-      oc.loadFromFile();
+      if (!oc.loadFromFile())
+      {
+        ROS_FATAL("Could not load the database from %s", database_dir.c_str());
+        ros::shutdown();
+        return;
+      }
 
       //oc.setDebugFolder(debug_folder);
       oc.setDebug(false);
@@ -13,10 +13,24 @@
 #include <pcl17/features/vfh.h>
 
 template<class FeatureType, class FeatureEstimatorType>
-  void train(string input_dir, string output_dir, int num_clusters, const std::string & extermal_classifier_file)
+  void train(string input_dir, string output_dir, int num_clusters, const std::string & extermal_classifier_file,
+             float voxel_smoothing_tolerance, bool update)
   {
     pcl17::PHVObjectClassifier<pcl17::PointXYZ, pcl17::PointNormal, FeatureType> oc;
     oc.setDebugFolder("debug/");
+    if (update)
+    {
+      // Parameters, codebook and full models of the existing database
+      // Without one there is no codebook to update and -num_clusters would be ignored
+      oc.setDatabaseDir(output_dir);
+      if (!oc.loadFromFile() || !oc.isClassifierComputed())
+      {
+        PCL17_ERROR("-update needs an existing database in %s, train without -update first\n", output_dir.c_str());
+        return;
+      }
+    }
+    if (voxel_smoothing_tolerance >= 0)
+      oc.setVoxelSmoothing(true, voxel_smoothing_tolerance);
     //oc.setDebug(true);
 
     typename pcl17::Feature<pcl17::PointNormal, FeatureType>::Ptr feature_estimator(new FeatureEstimatorType);
@@ -54,13 +68,18 @@ template<class FeatureType, class FeatureEstimatorType>
     }
 
   }
-  oc.setNumberOfClusters(num_clusters);
-  if (extermal_classifier_file != "")
+  if (update)
+  {
+    oc.updateClassifier();
+  }
+  else if (extermal_classifier_file != "")
   {
+    oc.setNumberOfClusters(num_clusters);
     oc.computeExternalClassifier(extermal_classifier_file);
   }
   else
   {
+    oc.setNumberOfClusters(num_clusters);
     oc.computeClassifier();
   }
   oc.setDatabaseDir(output_dir);
@@ -77,6 +96,9 @@ int main(int argc, char **argv)
         "         -min_points_in_segment <X>  : set minimal number of points in segment to X. Default : 300\n"
         "         -num_clusters <X>           : set Number of clusters. Default : 5\n"
         "         -features <X>               : which features to use (sgf, vfh, esf). Default : sgf\n"
+        "         -voxel_smoothing_tolerance <X> : fit surfaces at the voxels only, with X meters tolerance. Default : off\n"
+        "         -update                     : add the views of input_dir to the database in output_dir without\n"
+        "                                       clustering its features again\n"
         "");
     return -1;
   }
@@ -86,12 +108,15 @@ int main(int argc, char **argv)
   int num_clusters = 40;
   std::string features = "sgf";
   std::string extermal_classifier_file = "";
+  float voxel_smoothing_tolerance = -1;
 
   pcl17::console::parse_argument(argc, argv, "-input_dir", input_dir);
   pcl17::console::parse_argument(argc, argv, "-output_dir", output_dir);
   pcl17::console::parse_argument(argc, argv, "-num_clusters", num_clusters);
   pcl17::console::parse_argument(argc, argv, "-features", features);
   pcl17::console::parse_argument(argc, argv, "-extermal_classifier_file", extermal_classifier_file);
+  pcl17::console::parse_argument(argc, argv, "-voxel_smoothing_tolerance", voxel_smoothing_tolerance);
+  bool update = pcl17::console::find_switch(argc, argv, "-update");
 
   if (features == "sgf")
   {
@@ -99,13 +124,15 @@ int main(int argc, char **argv)
                                                                                                                           input_dir,
                                                                                                                           output_dir,
                                                                                                                           num_clusters,
-                                                                                                                          extermal_classifier_file);
+                                                                                                                          extermal_classifier_file,
+                                                                                                                          voxel_smoothing_tolerance, update);
   }
   else if (features == "esf")
   {
     train<pcl17::ESFSignature640, pcl17::ESFEstimation<pcl17::PointNormal, pcl17::ESFSignature640> > (input_dir, output_dir,
                                                                                               num_clusters,
-                                                                                              extermal_classifier_file);
+                                                                                              extermal_classifier_file,
+                                                                                              voxel_smoothing_tolerance, update);
   }
   else if (features == "vfh")
   {
@@ -113,7 +140,8 @@ int main(int argc, char **argv)
                                                                                                                 input_dir,
                                                                                                                 output_dir,
                                                                                                                 num_clusters,
-                                                                                                                extermal_classifier_file);
+                                                                                                                extermal_classifier_file,
+                                                                                                                voxel_smoothing_tolerance, update);
   }
   else
   {
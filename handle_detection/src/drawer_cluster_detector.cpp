@@ -64,6 +64,7 @@
 #include <pcl/common/angles.h>
 #include "pcl/common/common.h"
 #include <pcl_ros/publisher.h>
+#include <pcl_cloud_tools/crop_box_voxel_grid.h>
 
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_listener.h>
@@ -151,6 +152,8 @@ public:
 
     nh_.param("min_table_inliers", min_table_inliers_, 100);
     nh_.param("voxel_size", voxel_size_, 0.01);
+    vgrid_.setLeafSize (voxel_size_, voxel_size_, voxel_size_);
+    vgrid_.setBox (x_min_limit_, x_max_limit_, y_min_limit_, y_max_limit_, z_min_limit_, z_max_limit_);
     nh_.param("point_cloud_topic", point_cloud_topic_, std::string("/shoulder_cloud2"));
     nh_.param("output_handle_topic", output_handle_topic_,
     std::string("handle_projected_inliers/output"));
@@ -186,26 +189,10 @@ private:
       pcl::fromROSMsg (*cloud_in, cloud_raw);
 
       PointCloudPtr cloud_raw_ptr (new PointCloud(cloud_raw));
-      PointCloudPtr cloud_x_ptr (new PointCloud());
-      PointCloudPtr cloud_y_ptr (new PointCloud());
       PointCloudPtr cloud_z_ptr (new PointCloud());
 
-      //Downsample
+      //Crop to the x/y/z limits and downsample in one pass
       vgrid_.setInputCloud (cloud_raw_ptr);
-      vgrid_.setLeafSize (voxel_size_, voxel_size_, voxel_size_);
-      //Filter x
-      vgrid_.setFilterFieldName ("x");
-      vgrid_.setFilterLimits (x_min_limit_, x_max_limit_);
-      vgrid_.filter (*cloud_x_ptr);
-      //Filter y
-      vgrid_.setInputCloud (cloud_x_ptr);
-      vgrid_.setFilterFieldName ("y");
-      vgrid_.setFilterLimits (y_min_limit_, y_max_limit_);
-      vgrid_.filter (*cloud_y_ptr);
-      //Filter z
-      vgrid_.setInputCloud (cloud_y_ptr);
-      vgrid_.setFilterFieldName ("z");
-      vgrid_.setFilterLimits (z_min_limit_, z_max_limit_);
       vgrid_.filter (*cloud_z_ptr);
       //For Debug
       //cloud_pub_.publish(cloud_z_ptr);
@@ -440,7 +427,7 @@ private:
 
   // PCL objects
   //pcl::PassThrough<Point> vgrid_;                   // Filtering + downsampling object
-  pcl::VoxelGrid<Point> vgrid_;                   // Filtering + downsampling object
+  pcl::CropBoxVoxelGrid<Point> vgrid_;            // Filtering + downsampling object
   pcl::NormalEstimation<Point, pcl::Normal> n3d_;   //Normal estimation
   // The resultant estimated point cloud normals for \a cloud_filtered_
   pcl::PointCloud<pcl::Normal>::ConstPtr cloud_normals_;
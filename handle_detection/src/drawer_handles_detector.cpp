@@ -64,6 +64,8 @@
 #include <pcl/common/angles.h>
 #include "pcl/common/common.h"
 #include <pcl_ros/publisher.h>
+#include <pcl_cloud_tools/crop_box_voxel_grid.h>
+#include <pcl_cloud_tools/latest_frame_buffer.h>
 
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_listener.h>
@@ -83,6 +85,17 @@ typedef pcl::KdTree<Point>::Ptr KdTreePtr;
 const tf::Vector3 wp_normal(1, 0, 0);
 const double wp_offset = -1.45;
 
+// Frame-level products, computed once per incoming cloud
+struct DrawerHandlesFrame {
+	PointCloudConstPtr cloud_raw; // cloud as received
+	PointCloudConstPtr cloud_filtered; // cropped + downsampled
+	pcl::PointCloud<pcl::Normal>::ConstPtr cloud_normals;
+	// biggest furniture face, unset if not segmented yet
+	pcl::ModelCoefficients::ConstPtr table_coeff;
+	pcl::PointIndices::ConstPtr table_inliers;
+};
+typedef pcl_cloud_tools::LatestFrameBuffer<DrawerHandlesFrame> FrameBuffer;
+
 // Waits for a point cloud with pan-tilt close to (0,0) and deduces the position of ptu_base
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 class DrawerHandlesDetector {
@@ -92,9 +105,6 @@ public:
 			nh_(nh), as_(nh, "detect",
 					boost::bind(&DrawerHandlesDetector::executeCB, this, _1),
 					false) {
-		// start the actionlib server
-		as_.start();
-
 		nh_.param("z_min_limit", z_min_limit_, 0.1);
 		nh_.param("z_max_limit", z_max_limit_, 3.0);
 		nh_.param("y_min_limit", y_min_limit_, -0.5);
@@ -161,6 +171,9 @@ public:
 
 		nh_.param("min_table_inliers", min_table_inliers_, 100);
 		nh_.param("voxel_size", voxel_size_, 0.01);
+		vgrid_.setLeafSize(voxel_size_, voxel_size_, voxel_size_);
+		vgrid_.setBox(x_min_limit_, x_max_limit_, y_min_limit_, y_max_limit_,
+				z_min_limit_, z_max_limit_);
 		nh_.param("point_cloud_topic", point_cloud_topic_,
 				std::string("/shoulder_cloud2"));
 		nh_.param("output_handle_topic", output_handle_topic_,
@@ -172,6 +185,17 @@ public:
 		cloud_handle_pub_.advertise(nh_, output_handle_topic_, 10);
 		handle_pose_pub_ = nh_.advertise<geometry_msgs::PoseStamped>(
 				handle_pose_topic_, 1);
+
+		// keep the latest clouds and (optionally) segment the furniture face
+		// as they arrive instead of waiting for a new cloud on every goal
+		nh_.param("precompute_frames", precompute_frames_, true);
+		nh_.param("max_frame_age", max_frame_age_, 1.0);
+		nh_.param("frame_timeout", frame_timeout_, 5.0);
+		frames_.reset(new FrameBuffer(nh_, point_cloud_topic_,
+				boost::bind(&DrawerHandlesDetector::processFrame, this, _1, _2)));
+
+		// start the actionlib server
+		as_.start();
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -180,47 +204,23 @@ public:
 
 private:
 	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	void executeCB(const handle_detection::HandleDetectionGoalConstPtr &goal) {
-		// if weird number of handles is requested do not do anything
-		if (goal->number_of_handles < 1) {
-			ROS_ERROR(
-					"[DrawerHandlesDetector] Negativ or zero number given as desired number of handles.");
-			as_.setAborted();
-			return;
-		}
-
-		// get the point cloud in
-		sensor_msgs::PointCloud2ConstPtr cloud_in;
-		cloud_in = ros::topic::waitForMessage<sensor_msgs::PointCloud2>(
-				point_cloud_topic_, nh_);
+	// runs in the frame buffer's spinner thread for every incoming cloud
+	bool processFrame(const sensor_msgs::PointCloud2ConstPtr &cloud_in,
+			DrawerHandlesFrame &frame) {
+		PointCloudPtr cloud_raw_ptr(new PointCloud());
+		pcl::fromROSMsg(*cloud_in, *cloud_raw_ptr);
+		frame.cloud_raw = cloud_raw_ptr;
+		if (precompute_frames_)
+			segmentFrame(frame);
+		return true;
+	}
 
-		ROS_INFO_STREAM(
-				"[" << getName ().c_str () << "] Received cloud: cloud time " << cloud_in->header.stamp);
-		PointCloud cloud_raw, cloud;
-		// Downsample + filter the input dataser
-		pcl::fromROSMsg(*cloud_in, cloud_raw);
-
-		PointCloudPtr cloud_raw_ptr(new PointCloud(cloud_raw));
-		PointCloudPtr cloud_x_ptr(new PointCloud());
-		PointCloudPtr cloud_y_ptr(new PointCloud());
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	void segmentFrame(DrawerHandlesFrame &frame) {
 		PointCloudPtr cloud_z_ptr(new PointCloud());
 
-		//Downsample
-		vgrid_.setInputCloud(cloud_raw_ptr);
-		vgrid_.setLeafSize(voxel_size_, voxel_size_, voxel_size_);
-		//Filter x
-		vgrid_.setFilterFieldName("x");
-		vgrid_.setFilterLimits(x_min_limit_, x_max_limit_);
-		vgrid_.filter(*cloud_x_ptr);
-		//Filter y
-		vgrid_.setInputCloud(cloud_x_ptr);
-		vgrid_.setFilterFieldName("y");
-		vgrid_.setFilterLimits(y_min_limit_, y_max_limit_);
-		vgrid_.filter(*cloud_y_ptr);
-		//Filter z
-		vgrid_.setInputCloud(cloud_y_ptr);
-		vgrid_.setFilterFieldName("z");
-		vgrid_.setFilterLimits(z_min_limit_, z_max_limit_);
+		//Crop to the x/y/z limits and downsample in one pass
+		vgrid_.setInputCloud(frame.cloud_raw);
 		vgrid_.filter(*cloud_z_ptr);
 		//For Debug
 		//cloud_pub_.publish(cloud);
@@ -238,6 +238,44 @@ private:
 		seg_.setInputCloud(cloud_z_ptr);
 		seg_.setInputNormals(cloud_normals);
 		seg_.segment(*table_inliers, *table_coeff);
+
+		frame.cloud_filtered = cloud_z_ptr;
+		frame.cloud_normals = cloud_normals;
+		frame.table_coeff = table_coeff;
+		frame.table_inliers = table_inliers;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	void executeCB(const handle_detection::HandleDetectionGoalConstPtr &goal) {
+		// if weird number of handles is requested do not do anything
+		if (goal->number_of_handles < 1) {
+			ROS_ERROR(
+					"[DrawerHandlesDetector] Negativ or zero number given as desired number of handles.");
+			as_.setAborted();
+			return;
+		}
+
+		// get the latest (already segmented) point cloud in
+		FrameBuffer::FrameConstPtr frame = frames_->getLatest(
+				ros::Duration(max_frame_age_), ros::Duration(frame_timeout_));
+		if (!frame) {
+			ROS_ERROR("[%s] No recent point cloud available.", getName ().c_str ());
+			as_.setAborted();
+			return;
+		}
+		if (!frame->table_inliers) {
+			boost::shared_ptr<DrawerHandlesFrame> segmented(
+					new DrawerHandlesFrame(*frame));
+			segmentFrame(*segmented);
+			frame = segmented;
+		}
+
+		ROS_INFO_STREAM(
+				"[" << getName ().c_str () << "] Received cloud: cloud time " << frame->cloud_raw->header.stamp);
+		PointCloudConstPtr cloud_raw_ptr = frame->cloud_raw;
+		PointCloudConstPtr cloud_z_ptr = frame->cloud_filtered;
+		pcl::ModelCoefficients::ConstPtr table_coeff = frame->table_coeff;
+		pcl::PointIndices::ConstPtr table_inliers = frame->table_inliers;
 		ROS_INFO(
 				"[%s] Table model: [%f, %f, %f, %f] with %d inliers.", getName ().c_str (), table_coeff->values[0], table_coeff->values[1], table_coeff->values[2], table_coeff->values[3], (int)table_inliers->indices.size ());
 
@@ -356,8 +394,8 @@ private:
 			//stamped, change topic name
 			pcl::PointXYZ point_center;
 			geometry_msgs::PoseStamped handle_pose;
-			std::string frame(cloud_in->header.frame_id);
-			getHandlePose(line_projected, table_coeff, frame, handle_pose);
+			std::string frame_id(cloud_raw_ptr->header.frame_id);
+			getHandlePose(line_projected, table_coeff, frame_id, handle_pose);
 			handle_pose_pub_.publish(handle_pose);
 			ROS_INFO(
 					"Handle pose published: x %f, y %f, z %f, ox %f, oy \
@@ -378,7 +416,7 @@ private:
 	}
 
 	void getHandlePose(pcl::PointCloud<Point>::Ptr line_projected,
-			pcl::ModelCoefficients::Ptr table_coeff, std::string & frame,
+			pcl::ModelCoefficients::ConstPtr table_coeff, std::string & frame,
 			geometry_msgs::PoseStamped & pose) {
 		//Calculate the centroid of the line
 		pcl::PointXYZ point_min;
@@ -444,13 +482,18 @@ private:
 	//whether to publish the pose of the largest handle found or all of them
 	bool publish_largest_handle_pose_;
 
+	// latest clouds received on point_cloud_topic_
+	boost::shared_ptr<FrameBuffer> frames_;
+	bool precompute_frames_;
+	double max_frame_age_, frame_timeout_;
+
 	pcl_ros::Publisher<Point> cloud_pub_;
 	pcl_ros::Publisher<Point> cloud_handle_pub_;
 	ros::Publisher handle_pose_pub_;
 
 	// PCL objects
 	//pcl::PassThrough<Point> vgrid_;                   // Filtering + downsampling object
-	pcl::VoxelGrid<Point> vgrid_; // Filtering + downsampling object
+	pcl::CropBoxVoxelGrid<Point> vgrid_; // Filtering + downsampling object
 	pcl::NormalEstimation<Point, pcl::Normal> n3d_; //Normal estimation
 	// The resultant estimated point cloud normals for \a cloud_filtered_
 	pcl::PointCloud<pcl::Normal>::ConstPtr cloud_normals_;
@@ -75,6 +75,10 @@
 #include "visualization_msgs/Marker.h"
 //local service
 #include <handle_detection2D/getHandlesNAN.h>
+//persistent subscriber with background frame processing
+#include <pcl_cloud_tools/latest_frame_buffer.h>
+//normals, planes and NaN mask on the image grid
+#include <pcl_cloud_tools/organized.h>
 
 //for find function
 #include <algorithm>
@@ -90,6 +94,17 @@ typedef pcl::KdTree<PointT>::Ptr KdTreePtr;
 #include <algorithm>
 using namespace std;
 using namespace cv;
+
+/** \brief Frame-level products computed once per incoming cloud, independently of any service request. */
+struct HandleDetectorNANFrame
+{
+  PointCloudConstPtr cloud;              // organized cloud as received
+  cv::Mat nan_image;                     // 255 where the cloud is NaN
+  pcl::PointIndices indices_biggest_plane;
+  bool has_plane;                        // whether indices_biggest_plane was computed and is valid
+};
+typedef pcl_cloud_tools::LatestFrameBuffer<HandleDetectorNANFrame> FrameBuffer;
+
 class HandleDetectorNANNode
 {
 protected:
@@ -105,7 +120,7 @@ public:
   sensor_msgs::PointCloud2 output_cloud_;
 
   Mat nan_image, dst, canny_img, roi_image;
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcl_cloud_;
+  PointCloudConstPtr pcl_cloud_;
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr biggest_plane_cloud_;
   pcl::NormalEstimation<pcl::PointXYZRGB, pcl::Normal> n3d_;   //Normal estimation
   KdTreePtr normals_tree_, clusters_tree_;
@@ -126,6 +141,14 @@ public:
   pcl::PCDWriter pcd_writer_;
   pcl::ConvexHull<pcl::PointXYZ> chull_;
   std::string kinect_rgb_optical_frame_;
+  //organized fast path for normals and plane segmentation
+  bool use_organized_;
+  pcl_cloud_tools::OrganizedNormalEstimation<PointT, pcl::Normal> organized_n3d_;
+  pcl_cloud_tools::OrganizedPlaneSegmentation<PointT, pcl::Normal> organized_seg_;
+  //latest frames received on the input topic
+  boost::shared_ptr<FrameBuffer> frames_;
+  bool precompute_frames_;
+  double max_frame_age_, frame_timeout_;
   ////////////////////////////////////////////////////////////////////////////////
   HandleDetectorNANNode  (ros::NodeHandle &n) : nh_(n)
   {
@@ -142,9 +165,6 @@ public:
     ROS_INFO ("[%s:] Listening for incoming data on topic %s", getName ().c_str (), nh_.resolveName (input_cloud_topic_).c_str ());
     pub_.advertise (nh_, output_cloud_topic_, 1);
     ROS_INFO ("[%s:] Will be publishing data on topic %s.", getName ().c_str (), nh_.resolveName (output_cloud_topic_).c_str ());
-    nan_image = Mat::zeros (480, 640, CV_8UC1);
-    roi_image = Mat::zeros (480, 640, CV_8UC1);
-    pcl_cloud_.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
     biggest_plane_cloud_.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
     //3D handle length
     nh_.param("handle_length", handle_length_, 0.1);
@@ -171,6 +191,16 @@ public:
     seg_.setEpsAngle(pcl::deg2rad(eps_angle_));
     seg_.setMethodType (pcl::SAC_RANSAC);
     seg_.setProbability (seg_prob_);
+    //organized clouds: integral image normals and connected planes instead of kd-tree normals, RANSAC and clustering
+    nh_.param("use_organized", use_organized_, true);
+    int normal_rect_size;
+    double plane_angular_threshold;
+    nh_.param("normal_rect_size", normal_rect_size, 7);
+    nh_.param("plane_angular_threshold", plane_angular_threshold, 5.0);
+    organized_n3d_.setRectSize (normal_rect_size);
+    organized_seg_.setAngularThreshold (pcl::deg2rad (plane_angular_threshold));
+    organized_seg_.setDistanceThreshold (sac_distance_);
+    organized_seg_.setMinInliers (min_table_inliers_);
     //clustering of planes
     nh_.param("plane_cluster_tolerance", plane_cluster_tolerance_, 0.03);
     nh_.param("plane_cluster_min_size", plane_cluster_min_size_, 200);
@@ -196,6 +226,13 @@ public:
     //expected height of handle in base_link
     nh_.param("z_handle_position", z_handle_position_, 0.75);
     nh_.param("kinect_rgb_optical_frame", kinect_rgb_optical_frame_, std::string("/openni_rgb_optical_frame"));
+
+    //keep the latest frames and (optionally) find the biggest plane as frames arrive, not per request
+    nh_.param("precompute_frames", precompute_frames_, true);
+    nh_.param("max_frame_age", max_frame_age_, 1.0);
+    nh_.param("frame_timeout", frame_timeout_, 5.0);
+    frames_.reset (new FrameBuffer (nh_, "/kinect_head/camera/rgb/points",
+                                    boost::bind (&HandleDetectorNANNode::processFrame, this, _1, _2)));
   }
 
   ////////////////////////////////////////////////////////////////////////////////
@@ -215,27 +252,73 @@ public:
   /** \brief Get a string representation of the name of this class. */
   std::string getName () const { return ("HandleDetectorNAN"); }
 
-  int findBiggestPlane(pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcl_cloud, Rect & roi, pcl::PointIndices & indices_biggest_plane)
+  ////////////////////////////////////////////////////////////////////////////////
+  // processFrame (!)
+  // runs in the frame buffer's spinner thread for every incoming cloud
+  bool processFrame (const sensor_msgs::PointCloud2ConstPtr & pc, HandleDetectorNANFrame & frame)
+  {
+    PointCloudPtr cloud (new PointCloud);
+    pcl::fromROSMsg(*pc, *cloud);
+    frame.cloud = cloud;
+    frame.nan_image = Mat::zeros (cloud->height, cloud->width, CV_8UC1);
+    pcl_cloud_tools::computeNaNMask (*cloud, frame.nan_image.data, frame.nan_image.step);
+    frame.has_plane = false;
+    if (precompute_frames_)
+    {
+      Rect roi;
+      frame.has_plane = (findBiggestPlane(cloud, roi, frame.indices_biggest_plane) == 0);
+    }
+    return true;
+  }
+
+  int findBiggestPlane(PointCloudConstPtr pcl_cloud, Rect & roi, pcl::PointIndices & indices_biggest_plane)
   {
     //transform point cloud into base_link
     bool found_transform = tf_listener_.waitForTransform(pcl_cloud->header.frame_id, "base_link",
 							 pcl_cloud->header.stamp, ros::Duration(1.0));
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_temp (new pcl::PointCloud<pcl::PointXYZRGB>());
+    tf::StampedTransform transform;
     if (found_transform)
     {
       //ROS_ASSERT_MSG(found_transform, "Could not transform to camera frame");
-      tf::StampedTransform transform;
       tf_listener_.lookupTransform("base_link", pcl_cloud->header.frame_id, pcl_cloud->header.stamp, transform);
       pcl_ros::transformPointCloud(*pcl_cloud, *cloud_temp, transform);
+      cloud_temp->header.frame_id = "base_link";
+      cloud_temp->header.stamp = ros::Time::now();
       pcl_cloud = cloud_temp;
-      pcl_cloud->header.frame_id = "base_link";
-      pcl_cloud->header.stamp = ros::Time::now();
     }
     else
       {
         ROS_INFO("[%s:] No transform found between %s and base_link", getName().c_str(), pcl_cloud->header.frame_id.c_str());
         return -1;
       }
+      //Organized cloud: the largest connected plane is the cabinet face
+      if (use_organized_ && pcl_cloud_tools::isOrganized (*pcl_cloud))
+      {
+        pcl::PointCloud<pcl::Normal> normals;
+        //normals are flipped towards the camera, whose origin moved with the transform
+        organized_n3d_.setViewPoint (transform.getOrigin ().x (), transform.getOrigin ().y (), transform.getOrigin ().z ());
+        organized_n3d_.compute (*pcl_cloud, normals);
+        std::vector<pcl::ModelCoefficients> planes;
+        std::vector<pcl::PointIndices> plane_inliers;
+        organized_seg_.segment (*pcl_cloud, normals, planes, plane_inliers);
+        if (plane_inliers.empty ())
+        {
+          ROS_ERROR ("[%s:] No plane with more than %d inliers found", getName().c_str(), min_table_inliers_);
+          return -1;
+        }
+        ROS_INFO ("[%s] Cabinet face model: [%f, %f, %f, %f] with %d inliers.", getName ().c_str (), 
+                  planes[0].values[0], planes[0].values[1], planes[0].values[2], planes[0].values[3], 
+                  (int)plane_inliers[0].indices.size ());
+        indices_biggest_plane = plane_inliers[0];
+        PointCloudPtr biggest_face (new PointCloud());
+        pcl::copyPointCloud (*pcl_cloud, indices_biggest_plane, *biggest_face);
+        biggest_face->header = pcl_cloud->header;
+        biggest_plane_cloud_ = biggest_face;
+        pub_.publish(*biggest_face);
+        return 0;
+      }
+
       //Estimate Point Normals
       pcl::PointCloud<pcl::Normal>::Ptr cloud_normals (new pcl::PointCloud<pcl::Normal>());
       n3d_.setInputCloud (pcl_cloud);
@@ -399,54 +482,14 @@ public:
       }
   }
   ////////////////////////////////////////////////////////////////////////////////
-  // drawNANs (!)
-  void drawNANs(cv::Mat & nan_image, const Rect roi, double padding = 0.0)
+  // drawROI (!)
+  void drawROI(cv::Mat & roi_image, const pcl::PointIndices & roi_indices)
   {
-      // go over cols
-    for (size_t i = 0; i <  pcl_cloud_->height; i++)
+    roi_image = Mat::zeros (pcl_cloud_->height, pcl_cloud_->width, CV_8UC1);
+    for (size_t i = 0; i < roi_indices.indices.size(); i++)
     {
-      // go over rows          
-      for (size_t j = 0; j < pcl_cloud_->width; j++)
-      {
-        if (isnan (pcl_cloud_->points[i * 640 + j].x) ||
-            isnan (pcl_cloud_->points[i * 640 + j].y) ||
-            isnan (pcl_cloud_->points[i * 640 + j].z))
-        {
-          // if ((int)j > (roi.x + roi.width * padding) && (int)j < (roi.x + roi.width) && 
-	  //     (int)i > (roi.y - roi.width * padding) && (int)i < (roi.y + roi.height))
-	    nan_image.at <uint8_t>(i, j) = 255;
-        }
-      }
-    }
-  }
-
- void drawROI(cv::Mat & nan_image, pcl::PointIndices & roi_indices)
-  {
-      // go over cols
-    for (size_t i = 0; i <  pcl_cloud_->height; i++)
-    {
-      // go over rows          
-      for (size_t j = 0; j < pcl_cloud_->width; j++)
-	{
-	  vector<int>::iterator it = find(roi_indices.indices.begin(), roi_indices.indices.end(), i * 640 + j);
-	    if (it != roi_indices.indices.end()) 
-	   {
-	      // found it
-	      //if (isnan (pcl_cloud_->points[i * 640 + j].x) ||
-		  // isnan (pcl_cloud_->points[i * 640 + j].y) ||
-		  // isnan (pcl_cloud_->points[i * 640 + j].z))
-		//	{
-		  // if ((int)j > (roi.x + roi.width * padding) && (int)j < (roi.x + roi.width) && 
-		  //     (int)i > (roi.y - roi.width * padding) && (int)i < (roi.y + roi.height))
-		  nan_image.at <uint8_t>(i, j) = 255;
-		  //	}
-	      } 
-	       else 
-	       {
-	      //does not exist
-	      continue;
-	       }
-      }
+      int idx = roi_indices.indices[i];
+      roi_image.at <uint8_t>(idx / pcl_cloud_->width, idx % pcl_cloud_->width) = 255;
     }
   }
 
@@ -712,19 +755,26 @@ public:
   bool cloud_cb (handle_detection2D::getHandlesNAN::Request & req, 
 		 handle_detection2D::getHandlesNAN::Response & res)
   {
-    sensor_msgs::PointCloud2ConstPtr pc;
-    pc = ros::topic::waitForMessage<sensor_msgs::PointCloud2> ("/kinect_head/camera/rgb/points");
-    pcl::fromROSMsg(*pc, *pcl_cloud_);
+    //latest frame from the persistent subscriber, instead of waiting for a new message
+    FrameBuffer::FrameConstPtr frame = frames_->getLatest (ros::Duration (max_frame_age_), ros::Duration (frame_timeout_));
+    if (!frame)
+    {
+      ROS_ERROR ("[%s:] No recent point cloud available.", getName().c_str());
+      return false;
+    }
+    pcl_cloud_ = frame->cloud;
     ROS_INFO_STREAM("[" << getName ().c_str () << ":] Got PC with height: width: " << pcl_cloud_->height << " " 
                     <<  pcl_cloud_->width << " frame: " << pcl_cloud_->header.frame_id);
     
-    //image of nans
-    nan_image = Mat::zeros (480, 640, CV_8UC1);
+    //image of nans (copied, as it gets eroded/dilated below)
+    frame->nan_image.copyTo (nan_image);
     //find roi from 3D plane
     Rect roi;
 
     pcl::PointIndices indices_biggest_plane;
-    if (findBiggestPlane(pcl_cloud_, roi, indices_biggest_plane) < 0)
+    if (frame->has_plane)
+      indices_biggest_plane = frame->indices_biggest_plane;
+    else if (precompute_frames_ || findBiggestPlane(pcl_cloud_, roi, indices_biggest_plane) < 0)
       return false;
     
     ROS_INFO_STREAM(getName() << " indices_biggest_plane with size:  " << indices_biggest_plane.indices.size());
@@ -742,8 +792,7 @@ public:
 
     //TODO: average over 10 measurements
 
-    //draw NANs on the image
-    drawNANs(nan_image, roi);
+    //draw NANs on the image (done in processFrame)
     drawROI(roi_image, indices_biggest_plane);
 
     //drawHandles
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2010, Florian Zacherl <Florian.Zacherl1860@mytum.de>, Dejan Pangercic <dejan.pangercic@cs.tum.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IAS_PROJECTED_LIGHT_IMAGE_KERNELS_H
+#define IAS_PROJECTED_LIGHT_IMAGE_KERNELS_H
+
+#include <stddef.h>
+#include <vector>
+
+/*
+ * Pixel kernels used by the projected light nodes (blur estimation, ROI detection, exposure adjustment).
+ *
+ * All kernels work on contiguous rows given by a pointer to the first pixel and a row step in BYTES, so they can
+ * be called directly on the data of an IplImage (imageData + ROI offset, widthStep) or of one of the buffers below.
+ * 8 bit images are single channel. The inner loops use SSE2 where available and fall back to plain C otherwise.
+ */
+namespace ias_projected_light
+{
+
+/*
+ * Heap allocated image buffer with 16 byte aligned rows. create() only reallocates if the buffer has to grow,
+ * so a node can keep its buffers as members and reuse them frame after frame.
+ */
+template<typename T>
+  class ImageBuffer
+  {
+  public:
+    ImageBuffer() :
+      width_(0), height_(0), step_(0), data_(NULL)
+    {
+    }
+
+    ImageBuffer(int width, int height) :
+      width_(0), height_(0), step_(0), data_(NULL)
+    {
+      create(width, height);
+    }
+
+    void create(int width, int height)
+    {
+      //Pad rows to a multiple of 16 bytes:
+      size_t row_bytes = ((width * sizeof(T) + 15) / 16) * 16;
+      size_t needed = row_bytes * height + 16;
+      if (storage_.size() < needed)
+        storage_.resize(needed);
+
+      size_t offset = (16 - reinterpret_cast<size_t> (&storage_[0]) % 16) % 16;
+      data_ = &storage_[offset];
+      width_ = width;
+      height_ = height;
+      step_ = row_bytes;
+    }
+
+    T* row(int y)
+    {
+      return reinterpret_cast<T*> (data_ + y * step_);
+    }
+    const T* row(int y) const
+    {
+      return reinterpret_cast<const T*> (data_ + y * step_);
+    }
+
+    T* data()
+    {
+      return row(0);
+    }
+    const T* data() const
+    {
+      return row(0);
+    }
+
+    //Row step in bytes
+    size_t step() const
+    {
+      return step_;
+    }
+    int width() const
+    {
+      return width_;
+    }
+    int height() const
+    {
+      return height_;
+    }
+
+  private:
+    int width_, height_;
+    size_t step_;
+    unsigned char* data_;
+    std::vector<unsigned char> storage_;
+
+    //Not copyable, data_ points into storage_
+    ImageBuffer(const ImageBuffer&);
+    ImageBuffer& operator=(const ImageBuffer&);
+  };
+
+typedef ImageBuffer<float> FloatImage;
+typedef ImageBuffer<unsigned char> ByteImage;
+
+/*
+ * Normalized image of a pattern frame with respect to a white (fully lit) and a black (unlit) frame:
+ *   norm = (image - black) / (white - black), clamped to [0, 1]
+ * Pixels with white - black < threshold are not illuminated by the projector and get NaN.
+ */
+void normalizedDifference(const unsigned char* image, size_t image_step, const unsigned char* white,
+                          size_t white_step, const unsigned char* black, size_t black_step, int width, int height,
+                          float threshold, float* norm, size_t norm_step);
+
+/*
+ * Absolute first derivative in vertical direction, |src(y, x) - src(y - 1, x)|.
+ * The first row and pixels next to a NaN get 0.
+ */
+void verticalDerivative(const float* src, size_t src_step, int width, int height, float* dst, size_t dst_step);
+
+/*
+ * Absolute first derivative in horizontal direction, |src(y, x) - src(y, x - 1)|.
+ * The first column and pixels next to a NaN get 0.
+ */
+void horizontalDerivative(const float* src, size_t src_step, int width, int height, float* dst, size_t dst_step);
+
+/*
+ * dst = (src > threshold) ? value : 0. NaN pixels are never above the threshold.
+ */
+void threshold(const float* src, size_t src_step, int width, int height, float threshold, unsigned char value,
+               unsigned char* dst, size_t dst_step);
+
+/*
+ * dst = (src > threshold) ? value : 0 for 8 bit images.
+ */
+void threshold(const unsigned char* src, size_t src_step, int width, int height, unsigned char threshold,
+               unsigned char value, unsigned char* dst, size_t dst_step);
+
+/*
+ * Saturating difference dst = max(0, a - b) of two 8 bit images.
+ * Returns the maximal difference.
+ */
+unsigned char subtractSaturate(const unsigned char* a, size_t a_step, const unsigned char* b, size_t b_step,
+                               int width, int height, unsigned char* dst, size_t dst_step);
+
+/*
+ * 256 bin histogram of an 8 bit image. hist is overwritten.
+ */
+void histogram(const unsigned char* src, size_t src_step, int width, int height, unsigned int hist[256]);
+
+/*
+ * Sum of all pixel values counted in a histogram.
+ */
+inline unsigned long histogramSum(const unsigned int hist[256])
+{
+  unsigned long sum = 0;
+  for (int i = 1; i < 256; i++)
+    sum += (unsigned long)i * hist[i];
+  return sum;
+}
+
+}
+
+#endif
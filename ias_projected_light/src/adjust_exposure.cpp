@@ -36,6 +36,7 @@
 #include <sensor_msgs/RegionOfInterest.h>
 #include <cv_bridge/CvBridge.h>
 #include "ias_projected_light/cp.h"
+#include "ias_projected_light/image_kernels.h"
 #include <math.h>
 
 //#include <find_roi.h>
@@ -142,27 +143,24 @@ private:
 
       default: //Compute the exposure time:
       {
-        int w = roi.width;
-        int h = roi.height;
+        //Clip the ROI to the image:
+        int x0 = max(0, roi.x), y0 = max(0, roi.y);
+        int x1 = min(image->width, roi.x + roi.width), y1 = min(image->height, roi.y + roi.height);
+        int w = max(0, x1 - x0);
+        int h = max(0, y1 - y0);
+
+        //Compute the average brightness of the whole image and of the ROI from their histograms:
+        const unsigned char* data = (const unsigned char*)image->imageData;
+        unsigned int hist[256];
+        ias_projected_light::histogram(data, image->widthStep, image->width, image->height, hist);
+        int avg_image = ias_projected_light::histogramSum(hist) / (image->width * image->height);
 
-        //Compute sum of brightnesses for the whole image and the part that is not ROI, together with
-        //the average brightness in the ROI:
-        int avg_image = 0;
         int avg_roi = 0;
-
-        for (int i = 0; i < image->width; i++)
+        if (w > 0 && h > 0)
         {
-          for (int j = 0; j < image->height; j++)
-          {
-            if (i >= roi.x && i <= roi.x + roi.width && j >= roi.y && j <= roi.y + roi.height)
-            {
-              avg_roi += cvGet2D(image, j, i).val[0];
-            }
-            avg_image += cvGet2D(image, j, i).val[0];
-          }
+          ias_projected_light::histogram(data + y0 * image->widthStep + x0, image->widthStep, w, h, hist);
+          avg_roi = ias_projected_light::histogramSum(hist) / (w * h);
         }
-        avg_roi /= (w * h);
-        avg_image /= (image->width * image->height);
 
         int avg_brightness_wanted = avg_image + avg_brightness_auto - avg_roi;
 
@@ -39,6 +39,7 @@
 #include <cv_bridge/CvBridge.h>
 
 #include "ias_projected_light/cp.h"
+#include "ias_projected_light/image_kernels.h"
 
 /*If TEST_MODE is defined a test image is produced and published instead of the normal one
  * If NORMALIZED is defined to, it's the normalized image with non-roi illuminated pixels in green
@@ -76,11 +77,22 @@ protected:
 
   int pattern_number; //0 = white pattern, 1 = black pattern, 2 = normal pattern
 
+  //Per-frame buffers, reused between frames:
+  ias_projected_light::FloatImage norm, derv, hderv;
+  ias_projected_light::ByteImage sharp, hsharp;
+
   /*How long to wait while switching through the patterns
    * Should be be bigger than publishing delay of the image topic
    */
   const static int wait_time = 1000;
 
+  //Pointer to the first ROI pixel of an 8 bit mono image:
+  static const unsigned char* roiPtr(const IplImage* img)
+  {
+    CvRect r = cvGetImageROI(img);
+    return (const unsigned char*)(img->imageData + r.y * img->widthStep) + r.x;
+  }
+
   void changeROI(const sensor_msgs::RegionOfInterestConstPtr& r)
   {
     CvRect roi_new;
@@ -179,128 +191,85 @@ protected:
         cvSetImageROI(image, roi);
         cvSetImageROI(col, roi);
 
-        unsigned int width = roi.width;
-        unsigned int height = roi.height;
-
-        //Normalized image and derivations in both directions:
-        float norm[height][width];
-        float derv[height][width];
-        float hderv[height][width];
-
-        for (unsigned int y = 0; y < height; y++)
+        int width = roi.width;
+        int height = roi.height;
+
+        //Row pointers to the ROI of the 8 bit mono input images:
+        const unsigned char* image_roi = roiPtr(image);
+        const unsigned char* white_roi = roiPtr(white_image);
+        const unsigned char* gray_roi = roiPtr(gray_image);
+
+        //Normalized image and derivations in both directions, NaN-value for pixels that are in the ROI but NOT
+        //illuminated (no derivations for them):
+        norm.create(width, height);
+        derv.create(width, height);
+        ias_projected_light::normalizedDifference(image_roi, image->widthStep, white_roi, white_image->widthStep,
+                                                  gray_roi, gray_image->widthStep, width, height, threshold,
+                                                  norm.data(), norm.step());
+        ias_projected_light::verticalDerivative(norm.data(), norm.step(), width, height, derv.data(), derv.step());
+        if (blocks) //Block pattern
         {
-          for (unsigned int x = 0; x < width; x++)
-          {
-            //Compute normalized image:
-            float c = cvGet2D(image, y, x).val[0] - cvGet2D(gray_image, y, x).val[0];
-            float d = cvGet2D(white_image, y, x).val[0] - cvGet2D(gray_image, y, x).val[0];
-
-            //NaN-value for pixels that are in the ROI but NOT illuminated:
-            if (d < threshold)
-            {
-              norm[y][x] = numeric_limits<float>::quiet_NaN();
-            }
-            else
-            {
-              norm[y][x] = c / d;
-
-              //Values should be between 0 and 1, all others are measurement errors:
-              if (norm[y][x] < 0)
-                norm[y][x] = 0;
-              if (norm[y][x] > 1)
-                norm[y][x] = 1;
-            }
-
-            //No derivations possible in the first row
-            if (y == 0)
-            {
-              derv[y][x] = 0;
-            }
-            //No dervations for non-illuminated pixels:
-            else if (isnan(norm[y][x]) || isnan(norm[y - 1][x]))
-            {
-              derv[y][x] = 0;
-            }
-            else
-            {
-              //Compute first derivative in vertical direction
-              derv[y][x] = abs(norm[y][x] - norm[y - 1][x]);
-            }
-            if (blocks) //Block pattern
-            {
-              //No derivations possible in the first column
-              if (x == 0)
-              {
-                hderv[y][x] = 0;
-              }
-              //No derivations for non-illuminated pixels:
-              else if (isnan(norm[y][x]) || isnan(norm[y ][x - 1]))
-              {
-                hderv[y][x] = 0;
-              }
-              else
-              {
-                //Compute first derivative in horizontal direction
-                hderv[y][x] = abs(norm[y][x] - norm[y][x - 1]);
-              }
-
-            }
-          }
+          hderv.create(width, height);
+          ias_projected_light::horizontalDerivative(norm.data(), norm.step(), width, height, hderv.data(),
+                                                    hderv.step());
         }
 
 #ifdef TEST_MODE
         IplImage* test = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
 
-        for (unsigned int y = 0; y < height; y++)
+        for (int y = 0; y < height; y++)
         {
-          for (unsigned int x = 0; x < width; x++)
+          unsigned char* t = (unsigned char*)(test->imageData + y * test->widthStep);
+          for (int x = 0; x < width; x++, t += 3)
           {
 #ifdef NORMALIZED
-            if (isnan(norm[y][x]))
+            float n = norm.row(y)[x];
+            if (isnan(n))
             {
-              cvSet2D(test, y, x, cvScalar(0, 255, 0));
+              t[0] = 0; t[1] = 255; t[2] = 0;
             }
             else
             {
-              cvSet2D(test, y, x, cvScalar(norm[y][x] * 255, norm[y][x] * 255, norm[y][x] * 255));
+              t[0] = t[1] = t[2] = (unsigned char)(n * 255);
             }
 #else
-            cvSet2D(test, y, x, cvScalar(derv[y][x] * 255,derv[y][x] * 255,derv[y][x] * 255));
+            t[0] = t[1] = t[2] = (unsigned char)(derv.row(y)[x] * 255);
 #endif
           }
         }
 #endif
 
-        float blur[height][width];
-        float hblur[height][width];
+        //The blur of an edge is 1 / (derv * sqrt(2 * pi)), so it is sharp (blur < max_blur) for
+        //derv > 1 / (max_blur * sqrt(2 * pi)):
+        float min_derv = max_blur > 0 ? 1 / (max_blur * sqrt(2 * M_PI)) : numeric_limits<float>::infinity();
 
-        //Blur in vertical direction:
-        for (unsigned int x = 0; x < width; x++)
+        sharp.create(width, height);
+        ias_projected_light::threshold(derv.data(), derv.step(), width, height, min_derv, 255, sharp.data(),
+                                       sharp.step());
+        if (blocks)
         {
-          for (unsigned int y = 0; y < height; y++)
-          {
-            blur[y][x] = 1 / (derv[y][x] * sqrt(2 * M_PI));
+          hsharp.create(width, height);
+          ias_projected_light::threshold(hderv.data(), hderv.step(), width, height, min_derv, 255, hsharp.data(),
+                                         hsharp.step());
+        }
 
-            //Edge is sharp:
-            if (blur[y][x] < max_blur)
+        //Mark sharp edges, vertical ones in blue, horizontal ones in red (red wins where both are sharp, as the
+        //horizontal pass always wrote last):
+        int channels = col->nChannels;
+        for (int y = 0; y < height; y++)
+        {
+          unsigned char* c = (unsigned char*)(col->imageData + (roi.y + y) * col->widthStep) + roi.x * channels;
+          const unsigned char* v = sharp.row(y);
+          const unsigned char* h = blocks ? hsharp.row(y) : NULL;
+          for (int x = 0; x < width; x++, c += channels)
+          {
+            if (h && h[x])
             {
-              cvSet2D(col, y, x, cvScalar(255, 0, 0, 0));
+              c[0] = 0; c[1] = 0; c[2] = 255;
             }
-          }
-
-          if (blocks)
-          {
-            //Blur in horzontal direction:
-            for (unsigned int x = 0; x < width; x++)
+            else if (v[x])
             {
-              for (unsigned int y = 0; y < height; y++)
-              {
-                hblur[y][x] = 1 / (hderv[y][x] * sqrt(2 * M_PI));
-
-                //Edge is sharp:
-                if (hblur[y][x] < max_blur)
-                  cvSet2D(col, y, x, cvScalar(0, 0, 255, 0));
-              }
+              c[0] = 255; c[1] = 0; c[2] = 0;
             }
           }
         }
@@ -29,37 +29,207 @@
  */
 
 #include <ros/ros.h>
-#include <sensor_msgs/PointCloud.h>
-#include <sensor_msgs/PointCloud2.h>
 #include <opencv/cv.h>
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
 #include <pcl/registration/icp.h>
-#include <sensor_msgs/point_cloud_conversion.h>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
+#include <algorithm>
 
 //#define OUTPUT_RAW; //If defined, just the pure values without any description are returned
 
 using namespace std;
 
+static double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/*
+ * Finds out if a point has a model point within a given tolerance in x, y and z.
+ * The model is hashed once into cubic cells with the tolerance as edge length, so only the 27 cells around a
+ * query point have to be searched instead of the whole model.
+ */
+class ToleranceMatcher
+{
+protected:
+  float tol;
+  float inv_tol;
+
+  //Model point indices sorted by cell, and the range of every occupied cell in this array:
+  vector<int> sorted;
+  boost::unordered_map<boost::uint64_t, pair<int, int> > cells;
+
+  const pcl::PointCloud<pcl::PointXYZ>& model;
+
+  static bool isFinite(const pcl::PointXYZ& p)
+  {
+    return !isnan(p.x) && !isnan(p.y) && !isnan(p.z) && !isinf(p.x) && !isinf(p.y) && !isinf(p.z);
+  }
+
+  //21 bits per axis, the tolerance is in the mm range so this covers any realistic scene:
+  static boost::uint64_t key(int i, int j, int k)
+  {
+    const int offset = 1 << 20;
+    return ((boost::uint64_t)(i + offset) << 42) | ((boost::uint64_t)(j + offset) << 21) | (boost::uint64_t)(k + offset);
+  }
+
+  void cell(const pcl::PointXYZ& p, int& i, int& j, int& k) const
+  {
+    i = (int)floor(p.x * inv_tol);
+    j = (int)floor(p.y * inv_tol);
+    k = (int)floor(p.z * inv_tol);
+  }
+
+public:
+  ToleranceMatcher(const pcl::PointCloud<pcl::PointXYZ>& m, float t) :
+    tol(t), inv_tol(1 / t), model(m)
+  {
+    vector<pair<boost::uint64_t, int> > keyed;
+    keyed.reserve(model.points.size());
+    for (unsigned int n = 0; n < model.points.size(); n++)
+    {
+      if (!isFinite(model.points[n]))
+        continue;
+      int i, j, k;
+      cell(model.points[n], i, j, k);
+      keyed.push_back(make_pair(key(i, j, k), (int)n));
+    }
+    sort(keyed.begin(), keyed.end());
+
+    sorted.resize(keyed.size());
+    for (unsigned int n = 0; n < keyed.size(); n++)
+    {
+      sorted[n] = keyed[n].second;
+      if (n == 0 || keyed[n].first != keyed[n - 1].first)
+        cells[keyed[n].first] = make_pair((int)n, (int)n + 1);
+      else
+        cells[keyed[n].first].second = n + 1;
+    }
+  }
+
+  bool hasMatch(const pcl::PointXYZ& p) const
+  {
+    if (!isFinite(p))
+      return false;
+
+    int i, j, k;
+    cell(p, i, j, k);
+    for (int di = -1; di <= 1; di++)
+    {
+      for (int dj = -1; dj <= 1; dj++)
+      {
+        for (int dk = -1; dk <= 1; dk++)
+        {
+          boost::unordered_map<boost::uint64_t, pair<int, int> >::const_iterator c = cells.find(key(i + di, j + dj, k + dk));
+          if (c == cells.end())
+            continue;
+          for (int n = c->second.first; n < c->second.second; n++)
+          {
+            const pcl::PointXYZ& q = model.points[sorted[n]];
+            if (fabs(q.x - p.x) < tol && fabs(q.y - p.y) < tol && fabs(q.z - p.z) < tol)
+              return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+  int countMatches(const pcl::PointCloud<pcl::PointXYZ>& cloud) const
+  {
+    int point_count = 0;
+    for (unsigned int i = 0; i < cloud.points.size(); i++)
+    {
+      if (hasMatch(cloud.points[i]))
+        point_count++;
+    }
+    return point_count;
+  }
+};
+
 class PCLCompare
 {
 protected:
   pcl::PointCloud<pcl::PointXYZ> model;
-  pcl::PointCloud<pcl::PointXYZ> cloud;
 
   const static float tol = 0.008;
 
+  ToleranceMatcher matcher;
+
   int output;
 
   int number;
 
+  unsigned int threads;
+
+  //Result of the evaluation of one file:
+  struct FileResult
+  {
+    string path;
+    bool ok;
+    int val[3];
+    double time;
+  };
+
+  //Files of the folder currently evaluated, and the next one to be taken by a worker:
+  vector<FileResult> jobs;
+  unsigned int next_job;
+  boost::mutex job_mutex;
+
+  //Only the compare modes needed for the requested output are computed:
+  bool needsMode(int mode) const
+  {
+    switch (mode)
+    {
+      case 0:
+        return true; //Needed for the percentage of matching points as well
+      case 1:
+        return output == 1 || output == 3;
+      case 2:
+        return output == 2 || output == 3;
+      default:
+        return false;
+    }
+  }
+
+  void evaluate(FileResult& r)
+  {
+    double start = now();
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    r.ok = pcl::io::loadPCDFile(r.path, cloud) != -1;
+    for (int i = 0; i < 3; i++)
+      r.val[i] = (r.ok && needsMode(i)) ? compare(cloud, i) : 0;
+    r.time = now() - start;
+  }
+
+  void worker()
+  {
+    while (true)
+    {
+      unsigned int job;
+      {
+        boost::mutex::scoped_lock lock(job_mutex);
+        if (next_job >= jobs.size())
+          return;
+        job = next_job++;
+      }
+      evaluate(jobs[job]);
+    }
+  }
+
 public:
-  int compare(int compare_mode)
+  int compare(const pcl::PointCloud<pcl::PointXYZ>& cloud, int compare_mode) const
   {
     switch (compare_mode)
     {
@@ -75,20 +245,7 @@ public:
         //Therefore the point clouds have to be in the exactly same coordinate frame!!
       case 1:
       {
-        int point_count = 0;
-        for (unsigned int i = 0; i < cloud.points.size(); i++)
-        {
-          for (unsigned int j = 0; j < model.points.size(); j++)
-          {
-            if (abs(model.points[j].x - cloud.points[i].x) < tol && abs(model.points[j].y - cloud.points[i].y) < tol
-                && abs(model.points[j].z - cloud.points[i].z) < tol)
-            {
-              point_count++;
-              break;
-            }
-          }
-        }
-        return point_count;
+        return matcher.countMatches(cloud);
       }
         break;
 
@@ -121,6 +278,7 @@ public:
 
     if ((pDIR = opendir(path.c_str()))) //Given folder was found
     {
+      vector<string> folders, files;
       while ((entry = readdir(pDIR))) //Read all entries in the folder
       {
         stringstream stst;
@@ -130,33 +288,66 @@ public:
         {
           if (S_ISDIR(s.st_mode)) //If entry is a folder:
           {
-            cout << stst.str() << ":" << endl; //Return folder name
-            getFiles(stst.str()); //Recursive call
+            folders.push_back(stst.str());
           }
           else //If entry is no folder
           {
             string file(entry->d_name);
-            if (strcmp(file.substr(file.size() - 3, 3).c_str(), "pcd") == 0) //Use just .pcd files
-            {
-              //Read point cloud:
-              sensor_msgs::PointCloud2 cloud_mess1;
-              if (pcl::io::loadPCDFile(stst.str(), cloud_mess1) == -1)
-              {
-                ROS_ERROR("Couldn't read file!");
-                return;
-              }
-              pcl::fromROSMsg(cloud_mess1, cloud);
-              number++;
-
-              //Save values for all three compare modes:
-              for (int i = 0; i < 3; i++)
-              {
-                val[i].push_back(compare(i));
-              }
-            }
+            if (file.size() >= 3 && strcmp(file.substr(file.size() - 3, 3).c_str(), "pcd") == 0) //Use just .pcd files
+              files.push_back(stst.str());
           }
         }
       }
+      closedir(pDIR);
+      sort(folders.begin(), folders.end());
+      sort(files.begin(), files.end());
+
+      for (unsigned int i = 0; i < folders.size(); i++)
+      {
+        cout << folders[i] << ":" << endl; //Return folder name
+        getFiles(folders[i]); //Recursive call
+      }
+
+      //Evaluate all point clouds of this folder in parallel:
+      double start = now();
+      jobs.resize(files.size());
+      for (unsigned int i = 0; i < files.size(); i++)
+        jobs[i].path = files[i];
+      next_job = 0;
+
+      boost::thread_group workers;
+      for (unsigned int i = 1; i < min<size_t>(threads, files.size()); i++)
+        workers.create_thread(boost::bind(&PCLCompare::worker, this));
+      worker();
+      workers.join_all();
+      double wall_time = now() - start;
+
+      double file_time = 0;
+      for (unsigned int j = 0; j < jobs.size(); j++)
+      {
+        if (!jobs[j].ok)
+        {
+          ROS_ERROR("Couldn't read file %s!", jobs[j].path.c_str());
+          continue;
+        }
+        number++;
+        file_time += jobs[j].time;
+
+        //Save values for all three compare modes:
+        for (int i = 0; i < 3; i++)
+        {
+          val[i].push_back(jobs[j].val[i]);
+        }
+#ifndef OUTPUT_RAW
+        cout << "  " << jobs[j].path << ": " << jobs[j].val[0] << " points";
+        if (needsMode(1))
+          cout << ", " << jobs[j].val[1] << " matching";
+        if (needsMode(2))
+          cout << ", ICP-Value " << jobs[j].val[2];
+        cout << " (" << jobs[j].time * 1000 << " ms)" << endl;
+#endif
+      }
+      jobs.clear();
 
       //Compute average value and standard deviation:
       if (val[0].size() > 0)
@@ -194,7 +385,9 @@ public:
           cout << "Average matching points: " << avg[1] << "(" << (int)((float)avg[1] / avg[0] * 100) << "%)"
               << ", Standard deviation: " << sd[1] << endl;
         if (output == 2 || output == 3)
-          cout << "Average ICP-Value: " << avg[2] << ", Standard deviation: " << sd[2] << "\n" << endl;
+          cout << "Average ICP-Value: " << avg[2] << ", Standard deviation: " << sd[2] << endl;
+        cout << "Evaluated " << val[0].size() << " files in " << wall_time << " s (" << file_time / val[0].size() * 1000
+            << " ms per file, " << threads << " threads)\n" << endl;
 #endif
       }
     }
@@ -205,11 +398,16 @@ public:
     }
   }
 
-  PCLCompare(pcl::PointCloud<pcl::PointXYZ>& m, int o) :
-    model(m), output(o), number(0)
+  PCLCompare(pcl::PointCloud<pcl::PointXYZ>& m, int o, unsigned int t) :
+    model(m), matcher(model, tol), output(o), number(0), threads(max(1u, t)), next_job(0)
   {
 
   }
+
+  int getNumber() const
+  {
+    return number;
+  }
 };
 
 int main(int argc, char** argv)
@@ -217,24 +415,29 @@ int main(int argc, char** argv)
   string model_path;
   if (argc < 4)
   {
-    cout << "Usage " << argv[0] << " [Path to model] [Point cloud folder] [Compare mode]" << endl;
+    cout << "Usage " << argv[0] << " [Path to model] [Point cloud folder] [Compare mode] [Number of threads (optional)]" << endl;
     return -1;
   }
 
-  sensor_msgs::PointCloud2 cloud_mess2;
   pcl::PointCloud < pcl::PointXYZ > cloud2;
 
-  if (pcl::io::loadPCDFile(argv[1], cloud_mess2) == -1)
+  if (pcl::io::loadPCDFile(argv[1], cloud2) == -1)
   {
     ROS_ERROR("Couldn't read file %s!", argv[1]);
 
     return (-1);
   }
 
-  pcl::fromROSMsg(cloud_mess2, cloud2);
-  PCLCompare t(cloud2, atoi(argv[3]));
+  unsigned int threads = boost::thread::hardware_concurrency();
+  if (argc > 4)
+    threads = atoi(argv[4]);
+
+  PCLCompare t(cloud2, atoi(argv[3]), threads);
 
+  double start = now();
   t.getFiles(argv[2]);
+#ifndef OUTPUT_RAW
+  cout << "Total: " << t.getNumber() << " files in " << now() - start << " s" << endl;
+#endif
 
 }
-
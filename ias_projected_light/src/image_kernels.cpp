@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2010, Florian Zacherl <Florian.Zacherl1860@mytum.de>, Dejan Pangercic <dejan.pangercic@cs.tum.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ias_projected_light/image_kernels.h"
+
+#include <math.h>
+#include <string.h>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ias_projected_light
+{
+
+namespace
+{
+
+template<typename T>
+  inline const T* rowPtr(const T* base, size_t step, int y)
+  {
+    return reinterpret_cast<const T*> (reinterpret_cast<const unsigned char*> (base) + y * step);
+  }
+
+template<typename T>
+  inline T* rowPtr(T* base, size_t step, int y)
+  {
+    return reinterpret_cast<T*> (reinterpret_cast<unsigned char*> (base) + y * step);
+  }
+
+inline float absDiffOrdered(float a, float b)
+{
+  //Comparisons with NaN are false, so this is 0 as soon as one of the values is NaN:
+  return (a == a && b == b) ? fabsf(a - b) : 0.0f;
+}
+
+#ifdef __SSE2__
+//Convert 16 unsigned bytes into 4 vectors of 4 floats:
+inline void unpackU8(__m128i v, __m128& f0, __m128& f1, __m128& f2, __m128& f3)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_unpacklo_epi8(v, zero);
+  __m128i hi = _mm_unpackhi_epi8(v, zero);
+  f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+  f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+  f2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+  f3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+}
+
+inline __m128 normalize4(__m128 img, __m128 white, __m128 black, __m128 thresh)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 nan = _mm_set1_ps(std::numeric_limits<float>::quiet_NaN());
+
+  __m128 c = _mm_sub_ps(img, black);
+  __m128 d = _mm_sub_ps(white, black);
+  __m128 lit = _mm_cmpge_ps(d, thresh);
+  __m128 n = _mm_min_ps(_mm_max_ps(_mm_div_ps(c, d), zero), one);
+  return _mm_or_ps(_mm_and_ps(lit, n), _mm_andnot_ps(lit, nan));
+}
+
+inline __m128 absDiffOrdered4(__m128 a, __m128 b)
+{
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  return _mm_and_ps(_mm_cmpord_ps(a, b), _mm_andnot_ps(sign, _mm_sub_ps(a, b)));
+}
+#endif
+
+}
+
+void normalizedDifference(const unsigned char* image, size_t image_step, const unsigned char* white,
+                          size_t white_step, const unsigned char* black, size_t black_step, int width, int height,
+                          float threshold, float* norm, size_t norm_step)
+{
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+
+  for (int y = 0; y < height; y++)
+  {
+    const unsigned char* i_row = rowPtr(image, image_step, y);
+    const unsigned char* w_row = rowPtr(white, white_step, y);
+    const unsigned char* b_row = rowPtr(black, black_step, y);
+    float* n_row = rowPtr(norm, norm_step, y);
+
+    int x = 0;
+#ifdef __SSE2__
+    const __m128 thresh = _mm_set1_ps(threshold);
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128 i0, i1, i2, i3, w0, w1, w2, w3, b0, b1, b2, b3;
+      unpackU8(_mm_loadu_si128(reinterpret_cast<const __m128i*> (i_row + x)), i0, i1, i2, i3);
+      unpackU8(_mm_loadu_si128(reinterpret_cast<const __m128i*> (w_row + x)), w0, w1, w2, w3);
+      unpackU8(_mm_loadu_si128(reinterpret_cast<const __m128i*> (b_row + x)), b0, b1, b2, b3);
+
+      _mm_storeu_ps(n_row + x, normalize4(i0, w0, b0, thresh));
+      _mm_storeu_ps(n_row + x + 4, normalize4(i1, w1, b1, thresh));
+      _mm_storeu_ps(n_row + x + 8, normalize4(i2, w2, b2, thresh));
+      _mm_storeu_ps(n_row + x + 12, normalize4(i3, w3, b3, thresh));
+    }
+#endif
+    for (; x < width; x++)
+    {
+      float c = (float)i_row[x] - (float)b_row[x];
+      float d = (float)w_row[x] - (float)b_row[x];
+
+      if (d < threshold)
+      {
+        n_row[x] = nan;
+      }
+      else
+      {
+        float n = c / d;
+        n_row[x] = n < 0 ? 0 : (n > 1 ? 1 : n);
+      }
+    }
+  }
+}
+
+void verticalDerivative(const float* src, size_t src_step, int width, int height, float* dst, size_t dst_step)
+{
+  if (height > 0)
+    memset(dst, 0, width * sizeof(float));
+
+  for (int y = 1; y < height; y++)
+  {
+    const float* prev = rowPtr(src, src_step, y - 1);
+    const float* cur = rowPtr(src, src_step, y);
+    float* d_row = rowPtr(dst, dst_step, y);
+
+    int x = 0;
+#ifdef __SSE2__
+    for (; x + 4 <= width; x += 4)
+      _mm_storeu_ps(d_row + x, absDiffOrdered4(_mm_loadu_ps(cur + x), _mm_loadu_ps(prev + x)));
+#endif
+    for (; x < width; x++)
+      d_row[x] = absDiffOrdered(cur[x], prev[x]);
+  }
+}
+
+void horizontalDerivative(const float* src, size_t src_step, int width, int height, float* dst, size_t dst_step)
+{
+  for (int y = 0; y < height; y++)
+  {
+    const float* s_row = rowPtr(src, src_step, y);
+    float* d_row = rowPtr(dst, dst_step, y);
+
+    if (width > 0)
+      d_row[0] = 0;
+
+    int x = 1;
+#ifdef __SSE2__
+    for (; x + 4 <= width; x += 4)
+      _mm_storeu_ps(d_row + x, absDiffOrdered4(_mm_loadu_ps(s_row + x), _mm_loadu_ps(s_row + x - 1)));
+#endif
+    for (; x < width; x++)
+      d_row[x] = absDiffOrdered(s_row[x], s_row[x - 1]);
+  }
+}
+
+void threshold(const float* src, size_t src_step, int width, int height, float threshold, unsigned char value,
+               unsigned char* dst, size_t dst_step)
+{
+  for (int y = 0; y < height; y++)
+  {
+    const float* s_row = rowPtr(src, src_step, y);
+    unsigned char* d_row = rowPtr(dst, dst_step, y);
+
+    int x = 0;
+#ifdef __SSE2__
+    const __m128 thresh = _mm_set1_ps(threshold);
+    const __m128i val = _mm_set1_epi8((char)value);
+    for (; x + 16 <= width; x += 16)
+    {
+      //Comparison masks are all ones or all zeros, so signed packing keeps them intact:
+      __m128i m0 = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(s_row + x), thresh));
+      __m128i m1 = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(s_row + x + 4), thresh));
+      __m128i m2 = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(s_row + x + 8), thresh));
+      __m128i m3 = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(s_row + x + 12), thresh));
+      __m128i m = _mm_packs_epi16(_mm_packs_epi32(m0, m1), _mm_packs_epi32(m2, m3));
+      _mm_storeu_si128(reinterpret_cast<__m128i*> (d_row + x), _mm_and_si128(m, val));
+    }
+#endif
+    for (; x < width; x++)
+      d_row[x] = s_row[x] > threshold ? value : 0;
+  }
+}
+
+void threshold(const unsigned char* src, size_t src_step, int width, int height, unsigned char threshold,
+               unsigned char value, unsigned char* dst, size_t dst_step)
+{
+  for (int y = 0; y < height; y++)
+  {
+    const unsigned char* s_row = rowPtr(src, src_step, y);
+    unsigned char* d_row = rowPtr(dst, dst_step, y);
+
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i thresh = _mm_set1_epi8((char)threshold);
+    const __m128i val = _mm_set1_epi8((char)value);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16)
+    {
+      //No unsigned byte compare in SSE2: src > threshold <=> saturating src - threshold != 0
+      __m128i d = _mm_subs_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*> (s_row + x)), thresh);
+      __m128i below = _mm_cmpeq_epi8(d, zero);
+      _mm_storeu_si128(reinterpret_cast<__m128i*> (d_row + x), _mm_andnot_si128(below, val));
+    }
+#endif
+    for (; x < width; x++)
+      d_row[x] = s_row[x] > threshold ? value : 0;
+  }
+}
+
+unsigned char subtractSaturate(const unsigned char* a, size_t a_step, const unsigned char* b, size_t b_step,
+                               int width, int height, unsigned char* dst, size_t dst_step)
+{
+  unsigned char max_diff = 0;
+#ifdef __SSE2__
+  __m128i max_v = _mm_setzero_si128();
+#endif
+
+  for (int y = 0; y < height; y++)
+  {
+    const unsigned char* a_row = rowPtr(a, a_step, y);
+    const unsigned char* b_row = rowPtr(b, b_step, y);
+    unsigned char* d_row = rowPtr(dst, dst_step, y);
+
+    int x = 0;
+#ifdef __SSE2__
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i d = _mm_subs_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*> (a_row + x)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*> (b_row + x)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*> (d_row + x), d);
+      max_v = _mm_max_epu8(max_v, d);
+    }
+#endif
+    for (; x < width; x++)
+    {
+      unsigned char d = a_row[x] > b_row[x] ? a_row[x] - b_row[x] : 0;
+      d_row[x] = d;
+      if (d > max_diff)
+        max_diff = d;
+    }
+  }
+
+#ifdef __SSE2__
+  unsigned char lanes[16];
+  _mm_storeu_si128(reinterpret_cast<__m128i*> (lanes), max_v);
+  for (int i = 0; i < 16; i++)
+    if (lanes[i] > max_diff)
+      max_diff = lanes[i];
+#endif
+  return max_diff;
+}
+
+void histogram(const unsigned char* src, size_t src_step, int width, int height, unsigned int hist[256])
+{
+  //Four interleaved partial histograms, so that runs of equal pixels don't serialize on the same counter:
+  std::vector<unsigned int> partial(4 * 256, 0);
+  unsigned int* h0 = &partial[0];
+  unsigned int* h1 = h0 + 256;
+  unsigned int* h2 = h1 + 256;
+  unsigned int* h3 = h2 + 256;
+
+  for (int y = 0; y < height; y++)
+  {
+    const unsigned char* s_row = rowPtr(src, src_step, y);
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+      h0[s_row[x]]++;
+      h1[s_row[x + 1]]++;
+      h2[s_row[x + 2]]++;
+      h3[s_row[x + 3]]++;
+    }
+    for (; x < width; x++)
+      h0[s_row[x]]++;
+  }
+
+  for (int i = 0; i < 256; i++)
+    hist[i] = h0[i] + h1[i] + h2[i] + h3[i];
+}
+
+}
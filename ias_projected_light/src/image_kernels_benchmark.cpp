@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2010, Florian Zacherl <Florian.Zacherl1860@mytum.de>, Dejan Pangercic <dejan.pangercic@cs.tum.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the per-frame cost of the blur estimation, ROI detection and exposure adjustment pixel work,
+ * once with the per pixel cvGet2D loops the nodes used before and once with the image kernels.
+ * Frames are synthetic (random black/white/pattern images) at full camera resolution.
+ *
+ * Usage: image_kernels_benchmark [width height [iterations]]
+ */
+
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#include <opencv/cv.h>
+
+#include "ias_projected_light/image_kernels.h"
+
+using namespace std;
+
+static double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void fillRandom(IplImage* img, int lo, int hi)
+{
+  for (int y = 0; y < img->height; y++)
+  {
+    unsigned char* row = (unsigned char*)(img->imageData + y * img->widthStep);
+    for (int x = 0; x < img->width; x++)
+      row[x] = lo + rand() % (hi - lo + 1);
+  }
+}
+
+//Blur estimation as in blur_estimation.cpp before, with heap buffers instead of stack arrays:
+static int blurCvGet2D(IplImage* image, IplImage* white, IplImage* gray, float max_blur, vector<float>& norm,
+                       vector<float>& derv)
+{
+  int width = image->width, height = image->height;
+  int sharp = 0;
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      float c = cvGet2D(image, y, x).val[0] - cvGet2D(gray, y, x).val[0];
+      float d = cvGet2D(white, y, x).val[0] - cvGet2D(gray, y, x).val[0];
+      float& n = norm[y * width + x];
+      n = d < 10 ? numeric_limits<float>::quiet_NaN() : min(1.0f, max(0.0f, c / d));
+
+      float& dv = derv[y * width + x];
+      if (y == 0 || isnan(n) || isnan(norm[(y - 1) * width + x]))
+        dv = 0;
+      else
+        dv = fabs(n - norm[(y - 1) * width + x]);
+
+      if (1 / (dv * sqrt(2 * M_PI)) < max_blur)
+        sharp++;
+    }
+  }
+  return sharp;
+}
+
+static int blurKernels(IplImage* image, IplImage* white, IplImage* gray, float max_blur,
+                       ias_projected_light::FloatImage& norm, ias_projected_light::FloatImage& derv,
+                       ias_projected_light::ByteImage& mask)
+{
+  int width = image->width, height = image->height;
+  norm.create(width, height);
+  derv.create(width, height);
+  mask.create(width, height);
+
+  ias_projected_light::normalizedDifference((unsigned char*)image->imageData, image->widthStep,
+                                            (unsigned char*)white->imageData, white->widthStep,
+                                            (unsigned char*)gray->imageData, gray->widthStep, width, height, 10,
+                                            norm.data(), norm.step());
+  ias_projected_light::verticalDerivative(norm.data(), norm.step(), width, height, derv.data(), derv.step());
+  ias_projected_light::threshold(derv.data(), derv.step(), width, height, 1 / (max_blur * sqrt(2 * M_PI)), 1,
+                                 mask.data(), mask.step());
+
+  int sharp = 0;
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      sharp += mask.row(y)[x];
+  return sharp;
+}
+
+//ROI detection as in roi_diff_image.cpp before:
+static int roiCvGet2D(IplImage* white, IplImage* black, IplImage* diff, float percentage)
+{
+  int max_diff = 0;
+  for (int x = 0; x < white->width; x++)
+  {
+    for (int y = 0; y < white->height; y++)
+    {
+      float d = max(0.0, cvGet2D(white, y, x).val[0] - cvGet2D(black, y, x).val[0]);
+      cvSet2D(diff, y, x, cvScalar(d));
+      if (d > max_diff)
+        max_diff = d;
+    }
+  }
+  int count = 0;
+  for (int x = 0; x < white->width; x++)
+    for (int y = 0; y < white->height; y++)
+      if (cvGet2D(diff, y, x).val[0] > max_diff * percentage)
+        count++;
+  return count;
+}
+
+static int roiKernels(IplImage* white, IplImage* black, ias_projected_light::ByteImage& diff,
+                      ias_projected_light::ByteImage& mask, float percentage)
+{
+  int width = white->width, height = white->height;
+  diff.create(width, height);
+  mask.create(width, height);
+  unsigned char max_diff = ias_projected_light::subtractSaturate((unsigned char*)white->imageData, white->widthStep,
+                                                                 (unsigned char*)black->imageData, black->widthStep,
+                                                                 width, height, diff.data(), diff.step());
+  ias_projected_light::threshold(diff.data(), diff.step(), width, height,
+                                 (unsigned char)floor(max_diff * percentage), 1, mask.data(), mask.step());
+  int count = 0;
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      count += mask.row(y)[x];
+  return count;
+}
+
+//Average brightness as in adjust_exposure.cpp before:
+static int exposureCvGet2D(IplImage* image)
+{
+  int sum = 0;
+  for (int i = 0; i < image->width; i++)
+    for (int j = 0; j < image->height; j++)
+      sum += cvGet2D(image, j, i).val[0];
+  return sum / (image->width * image->height);
+}
+
+static int exposureKernels(IplImage* image)
+{
+  unsigned int hist[256];
+  ias_projected_light::histogram((unsigned char*)image->imageData, image->widthStep, image->width, image->height,
+                                 hist);
+  return ias_projected_light::histogramSum(hist) / (image->width * image->height);
+}
+
+int main(int argc, char** argv)
+{
+  int width = 640, height = 480, iterations = 20;
+  if (argc > 2)
+  {
+    width = atoi(argv[1]);
+    height = atoi(argv[2]);
+  }
+  if (argc > 3)
+    iterations = atoi(argv[3]);
+
+  IplImage* black = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+  IplImage* white = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+  IplImage* image = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+  IplImage* diff = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+  fillRandom(black, 0, 60);
+  fillRandom(white, 40, 255);
+  fillRandom(image, 0, 255);
+
+  vector<float> norm_v(width * height), derv_v(width * height);
+  ias_projected_light::FloatImage norm, derv;
+  ias_projected_light::ByteImage mask, diff_k;
+
+  cout << "Frame size " << width << "x" << height << ", " << iterations << " iterations" << endl;
+
+  double t0, t_old, t_new;
+  int r_old = 0, r_new = 0;
+
+  t0 = now();
+  for (int i = 0; i < iterations; i++)
+    r_old = blurCvGet2D(image, white, black, 1.0f, norm_v, derv_v);
+  t_old = (now() - t0) / iterations;
+  t0 = now();
+  for (int i = 0; i < iterations; i++)
+    r_new = blurKernels(image, white, black, 1.0f, norm, derv, mask);
+  t_new = (now() - t0) / iterations;
+  cout << "blur estimation:  cvGet2D " << t_old * 1000 << " ms, kernels " << t_new * 1000 << " ms, speedup "
+      << t_old / t_new << " (sharp pixels " << r_old << " / " << r_new << ")" << endl;
+
+  t0 = now();
+  for (int i = 0; i < iterations; i++)
+    r_old = roiCvGet2D(white, black, diff, 0.3f);
+  t_old = (now() - t0) / iterations;
+  t0 = now();
+  for (int i = 0; i < iterations; i++)
+    r_new = roiKernels(white, black, diff_k, mask, 0.3f);
+  t_new = (now() - t0) / iterations;
+  cout << "roi detection:    cvGet2D " << t_old * 1000 << " ms, kernels " << t_new * 1000 << " ms, speedup "
+      << t_old / t_new << " (roi pixels " << r_old << " / " << r_new << ")" << endl;
+
+  t0 = now();
+  for (int i = 0; i < iterations; i++)
+    r_old = exposureCvGet2D(image);
+  t_old = (now() - t0) / iterations;
+  t0 = now();
+  for (int i = 0; i < iterations; i++)
+    r_new = exposureKernels(image);
+  t_new = (now() - t0) / iterations;
+  cout << "exposure average: cvGet2D " << t_old * 1000 << " ms, kernels " << t_new * 1000 << " ms, speedup "
+      << t_old / t_new << " (average " << r_old << " / " << r_new << ")" << endl;
+
+  cvReleaseImage(&black);
+  cvReleaseImage(&white);
+  cvReleaseImage(&image);
+  cvReleaseImage(&diff);
+  return 0;
+}
@@ -37,6 +37,7 @@
 #include <sensor_msgs/RegionOfInterest.h>
 #include <cv_bridge/CvBridge.h>
 #include "ias_projected_light/cp.h"
+#include "ias_projected_light/image_kernels.h"
 
 using namespace std;
 
@@ -58,6 +59,10 @@ sensor_msgs::RegionOfInterest r;
 IplImage* black;
 IplImage* white;
 
+//Difference image and mask of strongly lit pixels, reused if the roi is recomputed:
+ias_projected_light::ByteImage diff;
+ias_projected_light::ByteImage mask;
+
 int pattern = 0;
 
 //Equality function for partitioning:
@@ -110,44 +115,41 @@ void getImageRoi(const sensor_msgs::ImageConstPtr& ms)
   {
     if (pattern == 2 || recompute)
     {
+      if (white)
+        cvReleaseImage(&white);
       white = cvCreateImage(cvSize(image->width, image->height), image->depth, 1);
       cvCopy(image, white);
 
 
-    IplImage* diff = cvCreateImage(cvSize(white->width, white->height), IPL_DEPTH_8U, 1);
+    int width = white->width;
+    int height = white->height;
+    diff.create(width, height);
+    mask.create(width, height);
 
     //Get differences between image with black and white pattern:
-    int max_diff = 0;
-    for (int x = 0; x < white->width; x++)
-    {
-      for (int y = 0; y < white->height; y++)
-      {
-        float d = max(0.0, cvGet2D(white, y, x).val[0] - cvGet2D(black, y, x).val[0]);
-        cvSet2D(diff, y, x, cvScalar(d));
-
-        if (abs(d) > max_diff)
-          max_diff = abs(d);
-      }
-    }
+    unsigned char max_diff = ias_projected_light::subtractSaturate((const unsigned char*)white->imageData,
+                                                                   white->widthStep,
+                                                                   (const unsigned char*)black->imageData,
+                                                                   black->widthStep, width, height, diff.data(),
+                                                                   diff.step());
 
     //Find all points that have a difference bigger then a certain percentage of the maximal difference
+    //(differences are integers, so d > max_diff * percentage <=> d > floor(max_diff * percentage)):
+    float limit = max_diff * percentage;
+    unsigned char t = limit < 0 ? 0 : (limit >= 255 ? 255 : (unsigned char)floor(limit));
+    ias_projected_light::threshold(diff.data(), diff.step(), width, height, t, 1, mask.data(), mask.step());
+
     vector<CvPoint> pv;
-    for (int x = 0; x < white->width; x++)
+    for (int y = 0; y < height; y++)
     {
-      for (int y = 0; y < white->height; y++)
+      const unsigned char* m = mask.row(y);
+      for (int x = 0; x < width; x++)
       {
-        if (abs(cvGet2D(diff, y, x).val[0]) > max_diff * percentage)
-        {
-          CvPoint p;
-          p.x = x;
-          p.y = y;
-          pv.push_back(p);
-        }
+        if (m[x])
+          pv.push_back(cvPoint(x, y));
       }
     }
 
-    cvReleaseImage(&diff);
-
     vector<int> labels;
     int pmax = 0;
 
@@ -158,11 +160,7 @@ void getImageRoi(const sensor_msgs::ImageConstPtr& ms)
       unsigned int partition_count = cv::partition(pv, labels, equals);
 
       //Find biggest partition:
-      unsigned int number_of_points[partition_count];
-      for (unsigned int i = 0; i < partition_count; i++)
-      {
-        number_of_points[i] = 0;
-      }
+      vector<unsigned int> number_of_points(partition_count, 0);
       for (unsigned int i = 0; i < pv.size(); i++)
       {
         number_of_points[labels[i]]++;
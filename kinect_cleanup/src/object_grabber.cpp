@@ -63,6 +63,9 @@
 #include <pcl_ros/publisher.h>
 #include <pcl_ros/transforms.h>
 
+#include <pcl_cloud_tools/crop_box_voxel_grid.h>
+#include <pcl_cloud_tools/organized.h>
+
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_listener.h>
 #include <tf/message_filter.h>
@@ -102,6 +105,9 @@ class ObjectGrabber
       nh_.param("min_table_inliers", min_table_inliers_, 100);
       nh_.param("cluster_min_height", cluster_min_height_, 0.01);
       nh_.param("cluster_max_height", cluster_max_height_, 0.4);
+      nh_.param("use_organized", use_organized_, true);
+      nh_.param("normal_rect_size", normal_rect_size_, 7);
+      nh_.param("plane_angular_threshold", plane_angular_threshold_, 5.0);
 
       hull_pub_.advertise (nh_, "/hull", 10);
       object_pub_ = nh_.advertise<sensor_msgs::PointCloud2> ("/moved_object", 10);
@@ -132,6 +138,14 @@ class ObjectGrabber
 
       n3d_.setKSearch (k_); // TODO use radius search
       n3d_.setSearchMethod (normals_tree_);
+
+      // Organized clouds: crop without losing the image structure, then integral image normals and connected planes
+      organized_crop_.setBox (-FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX, z_min_limit_, z_max_limit_);
+      organized_crop_.setKeepOrganized (true);
+      organized_n3d_.setRectSize (normal_rect_size_);
+      organized_seg_.setAngularThreshold (pcl::deg2rad (plane_angular_threshold_));
+      organized_seg_.setDistanceThreshold (sac_distance_);
+      organized_seg_.setMinInliers (min_table_inliers_);
     }
 
     //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -180,8 +194,17 @@ class ObjectGrabber
       // Filter the input dataser
       PointCloud cloud_raw, cloud;
       pcl::fromROSMsg (*cloud_in, cloud_raw);
-      vgrid_.setInputCloud (boost::make_shared<PointCloud> (cloud_raw));
-      vgrid_.filter (cloud);
+      bool organized = use_organized_ && pcl_cloud_tools::isOrganized (cloud_raw);
+      if (organized)
+      {
+        organized_crop_.setInputCloud (boost::make_shared<PointCloud> (cloud_raw));
+        organized_crop_.filter (cloud);
+      }
+      else
+      {
+        vgrid_.setInputCloud (boost::make_shared<PointCloud> (cloud_raw));
+        vgrid_.filter (cloud);
+      }
 
       // Fit a plane (the table)
       pcl::ModelCoefficients table_coeff;
@@ -191,8 +214,13 @@ class ObjectGrabber
 
       // ---[ Estimate the point normals
       pcl::PointCloud<pcl::Normal> cloud_normals;
-      n3d_.setInputCloud (boost::make_shared<PointCloud> (cloud));
-      n3d_.compute (cloud_normals);
+      if (organized)
+        organized_n3d_.compute (cloud, cloud_normals);
+      else
+      {
+        n3d_.setInputCloud (boost::make_shared<PointCloud> (cloud));
+        n3d_.compute (cloud_normals);
+      }
       cloud_normals_.reset (new pcl::PointCloud<pcl::Normal> (cloud_normals));
 
       // TODO fabs? ... use parallel to Z.cross(X)!
@@ -204,11 +232,29 @@ class ObjectGrabber
       btVector3 axis2 = axis.rotate(btVector3(1.0, 0.0, 0.0), btScalar(base_link_head_tilt_link_angle_ + pcl::deg2rad(90.0)));
       //std::cerr << "axis: " << fabs(axis2.getX()) << " " << fabs(axis2.getY()) << " " << fabs(axis2.getZ()) << std::endl;
 
-      seg_.setInputCloud (boost::make_shared<PointCloud> (cloud));
-      seg_.setInputNormals (cloud_normals_);
-      seg_.setAxis (Eigen::Vector3f(fabs(axis2.getX()), fabs(axis2.getY()), fabs(axis2.getZ())));
-      // seg_.setIndices (boost::make_shared<pcl::PointIndices> (selection));
-      seg_.segment (table_inliers, table_coeff);
+      if (organized)
+      {
+        // the largest connected plane perpendicular to the axis is the table
+        std::vector<pcl::ModelCoefficients> planes;
+        std::vector<pcl::PointIndices> plane_inliers;
+        organized_seg_.setAxis (Eigen::Vector3f(fabs(axis2.getX()), fabs(axis2.getY()), fabs(axis2.getZ())), pcl::deg2rad(eps_angle_));
+        organized_seg_.segment (cloud, cloud_normals, planes, plane_inliers);
+        if (planes.empty ())
+          table_coeff.values.assign (4, 0);
+        else
+        {
+          table_coeff = planes[0];
+          table_inliers = plane_inliers[0];
+        }
+      }
+      else
+      {
+        seg_.setInputCloud (boost::make_shared<PointCloud> (cloud));
+        seg_.setInputNormals (cloud_normals_);
+        seg_.setAxis (Eigen::Vector3f(fabs(axis2.getX()), fabs(axis2.getY()), fabs(axis2.getZ())));
+        // seg_.setIndices (boost::make_shared<pcl::PointIndices> (selection));
+        seg_.segment (table_inliers, table_coeff);
+      }
       ROS_INFO ("[%s] Table model: [%f, %f, %f, %f] with %d inliers.", getName ().c_str (),
                 table_coeff.values[0], table_coeff.values[1], table_coeff.values[2], table_coeff.values[3], (int)table_inliers.indices.size ());
       if ((int)table_inliers.indices.size () <= min_table_inliers_)
@@ -446,6 +492,9 @@ class ObjectGrabber
     double eps_angle_, seg_prob_, base_link_head_tilt_link_angle_;
     int k_, max_iter_, min_table_inliers_;
     double normal_search_radius_;
+    bool use_organized_;
+    int normal_rect_size_;
+    double plane_angular_threshold_;
     
     // PCL objects
     pcl::PassThrough<Point> vgrid_;                   // Filtering object
@@ -458,6 +507,9 @@ class ObjectGrabber
     pcl::PointCloud<Point> cloud_objects_;
     pcl::EuclideanClusterExtraction<Point> cluster_;
     KdTreePtr clusters_tree_, normals_tree_;
+    pcl::CropBoxVoxelGrid<Point> organized_crop_;      // z limits, keeping organized clouds organized
+    pcl_cloud_tools::OrganizedNormalEstimation<Point, pcl::Normal> organized_n3d_;
+    pcl_cloud_tools::OrganizedPlaneSegmentation<Point, pcl::Normal> organized_seg_;
 
     // Grabbed object in right_hand frame
     //pcl::PointCloud<Point> output_cloud_;
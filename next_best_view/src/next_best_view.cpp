@@ -39,6 +39,8 @@
 @par Parameters
 - \b input_cloud_topic
 - \b output_octree_topic
+- \b implicit_unknown if true, cells inside the bounding box of the octree that have no node are unknown,
+  instead of creating a node labeled unknown for each of them
 */
 
 
@@ -57,6 +59,10 @@ protected:
   int level_, free_label_, occupied_label_, unknown_label_;
   bool check_centroids_;
   bool visualize_octree_;
+  bool implicit_unknown_;
+
+  //centers of the first and the last cell of the bounding box that is unknown where there are no nodes
+  octomap::point3d unknown_min_, unknown_max_;
 
   double normal_search_radius_;
   int min_pts_per_cluster_;
@@ -96,6 +102,7 @@ protected:
 
   void cloud_cb (const sensor_msgs::PointCloud2ConstPtr& pointcloud2_msg);
   void createOctree (pcl::PointCloud<pcl::PointXYZ>& pointcloud2_pcl, octomap::pose6d laser_pose);
+  bool isUnknown (const octomap::point3d& centroid);
   void visualizeOctree(const sensor_msgs::PointCloud2ConstPtr& pointcloud2_msg, geometry_msgs::Point viewpoint);
   void castRayAndLabel(pcl::PointCloud<pcl::PointXYZ>& cloud, octomap::pose6d origin);
   void findBorderPoints(pcl::PointCloud<pcl::PointXYZ>& border_cloud, std::string frame_id);
@@ -130,6 +137,7 @@ Nbv::Nbv (ros::NodeHandle &anode) : nh_(anode) {
   nh_.param("occupied_label", occupied_label_, 1);
   nh_.param("unknown_label", unknown_label_, -1);
   nh_.param("visualize_octree", visualize_octree_, true);
+  nh_.param("implicit_unknown", implicit_unknown_, false);
 
   nh_.param("normal_search_radius", normal_search_radius_, 0.6);
   nh_.param("min_pts_per_cluster", min_pts_per_cluster_, 10);
@@ -444,8 +452,7 @@ void Nbv::findBorderPoints(pcl::PointCloud<pcl::PointXYZ>& border_cloud, std::st
 	octomap::point3d neighbor_centroid = centroid;
 	for (int j=-1; j<2; j+=2) {
 	  neighbor_centroid(i) += j * octree_res_;
-	  octomap::OcTreeNodePCL *neighbor = octree_->search(neighbor_centroid);
-	  if (neighbor != NULL && neighbor->getLabel() == unknown_label_) {
+	  if (isUnknown(neighbor_centroid)) {
 	    // add to list of border voxels
 	    pcl::PointXYZ border_pt (centroid.x(), centroid.y(), centroid.z());
 	    border_cloud.points.push_back(border_pt);
@@ -458,6 +465,23 @@ void Nbv::findBorderPoints(pcl::PointCloud<pcl::PointXYZ>& border_cloud, std::st
   ROS_INFO("%d points in border cloud", (int)border_cloud.points.size());
 }
 
+/**
+* a cell is unknown if its node is labeled unknown, or with implicit_unknown_ if it has no node but lies
+* inside the bounding box that createOctree would have filled with unknown nodes
+*/
+bool Nbv::isUnknown (const octomap::point3d& centroid) {
+  octomap::OcTreeNodePCL *node = octree_->search(centroid);
+  if (node != NULL)
+    return node->getLabel() == unknown_label_;
+  if (!implicit_unknown_)
+    return false;
+  for (int i = 0; i < 3; i++) {
+    if (centroid(i) < unknown_min_(i) - octree_res_/2 || centroid(i) > unknown_max_(i) + octree_res_/2)
+      return false;
+  }
+  return true;
+}
+
 /**
 * creating an octree from pcl data
 */
@@ -483,7 +507,8 @@ void Nbv::createOctree (pcl::PointCloud<pcl::PointXYZ>& pointcloud2_pcl, octomap
   // Converting from octomap graph to octomap tree (octree)
   octree_->insertScan(*scan_node, octree_maxrange_, false);
 
-  octree_->expand();
+  if (!implicit_unknown_)
+    octree_->expand();
 
   //
   // create nodes that are unknown
@@ -503,8 +528,32 @@ void Nbv::createOctree (pcl::PointCloud<pcl::PointXYZ>& pointcloud2_pcl, octomap
   //ROS_DEBUG("octree min bounds [%f %f %f]", min(0), min(1), min(2));
   //ROS_DEBUG("octree max bounds [%f %f %f]", max(0), max(1), max(2));
 
+  if (implicit_unknown_) {
+    //the same cells as the loop below, but only the first and the last center along each axis are kept
+    for (int i = 0; i < 3; i++) {
+      double c, last = min(i)+octree_res_/2;
+      for (c = min(i)+octree_res_/2; c < max(i)-octree_res_/2; c+=octree_res_)
+	last = c;
+      unknown_min_(i) = min(i)+octree_res_/2;
+      unknown_max_(i) = last;
+      //no cell along this axis: nothing is unknown
+      if (!(min(i)+octree_res_/2 < max(i)-octree_res_/2))
+	unknown_max_(i) = unknown_min_(i) - 2*octree_res_;
+    }
+
+    //only the observed leaves get their centroid
+    std::list<octomap::OcTreeVolume> leaves;
+    octree_->getLeafNodes(leaves);
+    BOOST_FOREACH(octomap::OcTreeVolume vol, leaves) {
+      octomap::point3d centroid (vol.first.x(), vol.first.y(), vol.first.z());
+      octomap::OcTreeNodePCL *octree_node = octree_->search(centroid);
+      if (octree_node != NULL)
+	octree_node->setCentroid(centroid);
+    }
+  }
+
   double x,y,z;
-  for (x = min(0)+octree_res_/2; x < max(0)-octree_res_/2; x+=octree_res_) {
+  for (x = min(0)+octree_res_/2; !implicit_unknown_ && x < max(0)-octree_res_/2; x+=octree_res_) {
     for (y = min(1)+octree_res_/2; y < max(1)-octree_res_/2; y+=octree_res_) {
       for (z = min(2)+octree_res_/2; z < max(2)-octree_res_/2; z+=octree_res_) {
 	octomap::point3d centroid (x, y, z);
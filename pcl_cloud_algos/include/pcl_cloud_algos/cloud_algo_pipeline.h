@@ -0,0 +1,314 @@
+#ifndef CLOUD_ALGOS_PIPELINE_H
+#define CLOUD_ALGOS_PIPELINE_H
+
+#include <deque>
+#include <set>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+
+#include <pcl_cloud_algos/cloud_algos.h>
+
+namespace pcl_cloud_algos
+{
+
+/**
+ * \brief Runs a chain of cloud algos in one process instead of one CloudAlgoNode per algo.
+ *
+ * Stages are connected by their requires () / provides () declarations: the input of a new stage is the output of
+ * the latest added stage that provides all fields it requires (and whose output type is its input type), or the
+ * pipeline input if none does. Outputs are passed on as shared const pointers, nothing gets serialized or copied
+ * between the stages. Stages that don't depend on each other run concurrently on the worker threads, and the
+ * latency of every stage is measured.
+ *
+ * \code
+ * std::vector<std::string> fields; // x y z index
+ * CloudAlgoPipeline pipeline (nh, fields);
+ * boost::shared_ptr<DepthImageTriangulation> dit = pipeline.addStage<DepthImageTriangulation> ("depth_image_triangulation");
+ * boost::shared_ptr<BoxEstimation> box = pipeline.addStage<BoxEstimation> ("box_fit");
+ * pipeline.run (cloud);
+ * boost::shared_ptr<const triangle_mesh_msgs::TriangleMesh> mesh = pipeline.getOutput<triangle_mesh_msgs::TriangleMesh> ("depth_image_triangulation");
+ * \endcode
+ */
+class CloudAlgoPipeline
+{
+ public:
+  typedef boost::shared_ptr<const void> DataPtr;
+
+  //! \brief latency of a stage, in seconds
+  struct StageStatistics
+  {
+    std::string name;
+    std::string result; // return value of the last process () call, or why the stage was skipped
+    int runs;
+    double last_latency, total_latency;
+  };
+
+  /**
+   * \param nh node handle, the parameters of a stage are read from its name in this namespace
+   * \param input_fields fields of the clouds passed to run ()
+   * \param nr_threads number of worker threads (0: one per core)
+   */
+  CloudAlgoPipeline (ros::NodeHandle &nh, const std::vector<std::string> &input_fields, int nr_threads = 0)
+  : nh_ (nh), input_fields_ (input_fields.begin (), input_fields.end ()), shutdown_ (false), nr_done_ (0)
+  {
+    if (nr_threads <= 0)
+      nr_threads = boost::thread::hardware_concurrency ();
+    for (int t = 0; t < std::max (1, nr_threads); t++)
+      workers_.create_thread (boost::bind (&CloudAlgoPipeline::worker, this));
+  }
+
+  ~CloudAlgoPipeline ()
+  {
+    {
+      boost::mutex::scoped_lock lock (mutex_);
+      shutdown_ = true;
+    }
+    work_cond_.notify_all ();
+    workers_.join_all ();
+  }
+
+  /**
+   * \brief creates an algo, initializes it and connects it to the pipeline
+   * \param name name of the stage, also the namespace of its parameters
+   * \param keeps_input_fields whether the output of the algo contains the fields of its input besides the ones it provides
+   * \return the algo for further configuration, or NULL if its requirements can't be met
+   */
+  template <class algo>
+    boost::shared_ptr<algo> addStage (const std::string &name, bool keeps_input_fields = false)
+  {
+    boost::shared_ptr<algo> a = boost::make_shared<algo> ();
+    boost::shared_ptr<Stage> stage (new AlgoStage<algo> (a));
+    stage->name = name;
+
+    // Connect to the latest stage providing everything that is needed
+    std::vector<std::string> requires = a->requires ();
+    stage->parent = -2;
+    for (int s = (int)stages_.size () - 1; s >= 0 && stage->parent == -2; s--)
+      if (stages_[s]->outputType () == stage->inputType () && contains (stages_[s]->fields, requires))
+        stage->parent = s;
+    if (stage->parent == -2 && contains (input_fields_, requires))
+      stage->parent = -1;
+    if (stage->parent == -2)
+    {
+      ROS_ERROR ("[CloudAlgoPipeline] No stage or pipeline input provides what %s requires!", name.c_str ());
+      return boost::shared_ptr<algo> ();
+    }
+
+    std::vector<std::string> provides = a->provides ();
+    stage->fields.insert (provides.begin (), provides.end ());
+    if (keeps_input_fields)
+    {
+      const std::set<std::string> &input = stage->parent == -1 ? input_fields_ : stages_[stage->parent]->fields;
+      stage->fields.insert (input.begin (), input.end ());
+    }
+
+    ros::NodeHandle stage_nh (nh_, name);
+    a->init (stage_nh);
+
+    boost::mutex::scoped_lock lock (mutex_);
+    if (stage->parent >= 0)
+      stages_[stage->parent]->children.push_back (stages_.size ());
+    else
+      roots_.push_back (stages_.size ());
+    stage->statistics.name = name;
+    stage->statistics.runs = 0;
+    stage->statistics.last_latency = stage->statistics.total_latency = 0;
+    stages_.push_back (stage);
+    ROS_INFO ("[CloudAlgoPipeline] Added %s after %s.", name.c_str (), stage->parent == -1 ? "the input" : stages_[stage->parent]->name.c_str ());
+    return a;
+  }
+
+  /**
+   * \brief runs all stages on a cloud and waits for them to finish
+   * \return false if a stage didn't produce a valid output (its descendants are skipped)
+   */
+  template <class T>
+    bool run (const boost::shared_ptr<const T> &input)
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    for (size_t r = 0; r < roots_.size (); r++)
+      if (stages_[roots_[r]]->inputType () != typeid (T))
+      {
+        ROS_ERROR ("[CloudAlgoPipeline] %s can't process the pipeline input type!", stages_[roots_[r]]->name.c_str ());
+        return false;
+      }
+
+    ros::WallTime start = ros::WallTime::now ();
+    input_ = input;
+    valid_ = true;
+    nr_done_ = 0;
+    for (size_t s = 0; s < stages_.size (); s++)
+      stages_[s]->output.reset ();
+    for (size_t r = 0; r < roots_.size (); r++)
+      ready_.push_back (roots_[r]);
+    work_cond_.notify_all ();
+    while (nr_done_ < stages_.size ())
+      done_cond_.wait (lock);
+    input_.reset ();
+    latency_ = (ros::WallTime::now () - start).toSec ();
+    return valid_;
+  }
+
+  //! \brief output of a stage after run (), NULL if the stage was skipped or T is not its output type
+  template <class T>
+    boost::shared_ptr<const T> getOutput (const std::string &name) const
+  {
+    for (size_t s = 0; s < stages_.size (); s++)
+      if (stages_[s]->name == name && stages_[s]->outputType () == typeid (T))
+        return boost::static_pointer_cast<const T> (stages_[s]->output);
+    return boost::shared_ptr<const T> ();
+  }
+
+  //! \brief latencies of all stages
+  std::vector<StageStatistics> getStatistics () const
+  {
+    std::vector<StageStatistics> statistics;
+    for (size_t s = 0; s < stages_.size (); s++)
+      statistics.push_back (stages_[s]->statistics);
+    return statistics;
+  }
+
+  //! \brief wall time of the last run (), in seconds
+  double getLatency () const
+  {
+    return latency_;
+  }
+
+  //! \brief prints the latencies of the last run ()
+  void printStatistics () const
+  {
+    ROS_INFO ("[CloudAlgoPipeline] Pipeline finished in %g seconds.", latency_);
+    for (size_t s = 0; s < stages_.size (); s++)
+    {
+      const StageStatistics &st = stages_[s]->statistics;
+      ROS_INFO ("[CloudAlgoPipeline]   %-30s %10.4f s (average %10.4f s over %d runs): %s", st.name.c_str (), st.last_latency,
+                st.runs > 0 ? st.total_latency / st.runs : 0.0, st.runs, st.result.c_str ());
+    }
+  }
+
+ private:
+  struct Stage
+  {
+    virtual ~Stage () {}
+    // pre (), process (), output (), post (); NULL if the output is not valid
+    virtual DataPtr run (const DataPtr &input, std::string &result) = 0;
+    virtual const std::type_info& inputType () const = 0;
+    virtual const std::type_info& outputType () const = 0;
+
+    std::string name;
+    int parent; // -1 for the pipeline input
+    std::vector<int> children;
+    std::set<std::string> fields;
+    DataPtr output;
+    StageStatistics statistics;
+  };
+
+  template <class algo>
+    struct AlgoStage : public Stage
+  {
+    AlgoStage (const boost::shared_ptr<algo> &a) : a_ (a) {}
+
+    DataPtr run (const DataPtr &input, std::string &result)
+    {
+      a_->pre ();
+      result = a_->process (boost::static_pointer_cast<const typename algo::InputType> (input));
+      DataPtr output;
+      if (a_->output_valid_)
+        output = a_->output ();
+      a_->post ();
+      return output;
+    }
+    const std::type_info& inputType () const
+    {
+      return typeid (typename algo::InputType);
+    }
+    const std::type_info& outputType () const
+    {
+      return typeid (typename algo::OutputType);
+    }
+
+    boost::shared_ptr<algo> a_;
+  };
+
+  static bool contains (const std::set<std::string> &fields, const std::vector<std::string> &requires)
+  {
+    for (size_t i = 0; i < requires.size (); i++)
+      if (fields.find (requires[i]) == fields.end ())
+        return false;
+    return true;
+  }
+
+  // Runs the stages that are ready, and queues their children
+  void worker ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    while (true)
+    {
+      while (ready_.empty () && !shutdown_)
+        work_cond_.wait (lock);
+      if (shutdown_)
+        return;
+      int s = ready_.front ();
+      ready_.pop_front ();
+      Stage &stage = *stages_[s];
+      DataPtr input = stage.parent == -1 ? input_ : stages_[stage.parent]->output;
+      lock.unlock ();
+
+      // run the stage
+      DataPtr output;
+      std::string result;
+      double latency = 0;
+      if (input)
+      {
+        ros::WallTime start = ros::WallTime::now ();
+        output = stage.run (input, result);
+        latency = (ros::WallTime::now () - start).toSec ();
+      }
+      else
+        result = "skipped, no valid input";
+
+      lock.lock ();
+      stage.output = output;
+      stage.statistics.result = result;
+      if (input)
+      {
+        stage.statistics.runs++;
+        stage.statistics.last_latency = latency;
+        stage.statistics.total_latency += latency;
+      }
+      if (!output)
+        valid_ = false;
+      // children of an invalid stage are queued as well, to be skipped
+      for (size_t c = 0; c < stage.children.size (); c++)
+        ready_.push_back (stage.children[c]);
+      if (!stage.children.empty ())
+        work_cond_.notify_all ();
+      if (++nr_done_ == stages_.size ())
+        done_cond_.notify_all ();
+    }
+  }
+
+  ros::NodeHandle nh_;
+  std::set<std::string> input_fields_;
+  std::vector<boost::shared_ptr<Stage> > stages_;
+  std::vector<int> roots_; // stages processing the pipeline input
+
+  // state of the current run (), guarded by mutex_
+  boost::mutex mutex_;
+  boost::condition_variable work_cond_, done_cond_;
+  boost::thread_group workers_;
+  bool shutdown_;
+  std::deque<int> ready_;
+  size_t nr_done_;
+  DataPtr input_;
+  bool valid_;
+  double latency_;
+};
+
+}
+#endif
@@ -54,12 +54,6 @@ namespace pcl_cloud_algos
 class DepthImageTriangulation : public CloudAlgo
 {
  public:
-  //! \brief triangle points
-  struct triangle 
-  {  
-    int a,b,c;
-  };
-
   // Input/Output type
   typedef sensor_msgs::PointCloud2 InputType;
   typedef triangle_mesh_msgs::TriangleMesh OutputType;
@@ -105,14 +99,19 @@ class DepthImageTriangulation : public CloudAlgo
    */
   float dist_3d (const pcl::PointCloud<pcl::PointXYZINormalScanLine> &cloud_in, int a, int b);
 
+  /**
+   * \brief  triangulates a cloud with line and index set (see get_scan_and_point_id) into mesh, in parallel over the scan lines
+   * \param cloud_in
+   * \param mesh output mesh, points and triangles are overwritten
+   */
+  void triangulate (const pcl::PointCloud<pcl::PointXYZINormalScanLine> &cloud_in, OutputType &mesh);
+
   /**
    * \brief  writes triangulation result to a VTK file for visualization purposes
    * \param output[] output vtk file
-   * \param triangles vector of triangles
-   * \param &cloud_in
-   * \param nr_tr number of triangles
+   * \param mesh triangulated mesh
    */
-  void write_vtk_file (std::string output, std::vector<triangle> triangles, const pcl::PointCloud<pcl::PointXYZINormalScanLine> &cloud_in, int nr_tr);
+  void write_vtk_file (std::string output, const OutputType &mesh);
 
   // Constructor-Destructor
   DepthImageTriangulation () : CloudAlgo ()
@@ -122,6 +121,7 @@ class DepthImageTriangulation : public CloudAlgo
     write_to_vtk_ = true;
     save_pcd_ = false;
     line_nr_in_channel_ = index_nr_in_channel_ = -1;
+    nr_threads_ = 0;
   }
 
   // DepthImageTriangulation () { }
@@ -153,6 +153,45 @@ private:
   //! \brief write output to vtk yes/no, save PCD file yes/no
   bool write_to_vtk_, save_pcd_;
 
+  //! \brief number of threads used for triangulation (0: one per core)
+  int nr_threads_;
+
+  //! \brief (line, index) -> point lookup image, -1 for missing points
+  std::vector<int> lookup_;
+
+  //! \brief first point of each line (points are ordered by line)
+  std::vector<int> line_start_;
+
+  //! \brief triangles emitted at each point (as top left corner), see TriangleBits
+  std::vector<unsigned char> triangle_mask_;
+
+  enum TriangleBits { TRIANGLE_ACE = 1, TRIANGLE_ABC = 2, TRIANGLE_BCD = 4, TRIANGLE_ACD = 8, TRIANGLE_ABD = 16 };
+
+  //! \brief point at (line, index) or -1
+  inline int
+    lookup (int line, int index) const
+  {
+    if (line > max_line_ || index < 0 || index > max_index_)
+      return -1;
+    return lookup_[line * (max_index_ + 1) + index];
+  }
+
+  //! \brief sets triangle_mask_ for the points of lines [first_line, last_line) and counts their triangles
+  void markTriangles (const pcl::PointCloud<pcl::PointXYZINormalScanLine> *cloud_in, int first_line, int last_line, int *nr_triangles);
+
+  //! \brief writes the triangles marked for lines [first_line, last_line) to mesh->triangles, starting at offset
+  void emitTriangles (const pcl::PointCloud<pcl::PointXYZINormalScanLine> *cloud_in, int first_line, int last_line, int offset, OutputType *mesh);
+
+  //! \brief squared distance between 2 points
+  inline float
+    sqr_dist_3d (const pcl::PointCloud<pcl::PointXYZINormalScanLine> &cloud_in, int a, int b) const
+  {
+    float dx = cloud_in.points[a].x - cloud_in.points[b].x;
+    float dy = cloud_in.points[a].y - cloud_in.points[b].y;
+    float dz = cloud_in.points[a].z - cloud_in.points[b].z;
+    return dx * dx + dy * dy + dz * dz;
+  }
+
   //! \brief resultant output triangulated map
   boost::shared_ptr<OutputType> mesh_;
 };
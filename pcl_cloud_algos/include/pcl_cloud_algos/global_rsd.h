@@ -3,6 +3,9 @@
 
 #include <float.h>
 
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+
 // Eigen
 //#include <Eigen/StdVector>
 //#include <Eigen/Array>
@@ -50,6 +53,58 @@ struct IntersectedLeaf
   octomap::point3d centroid; // leaf center coordinates
 };
 
+// Grid of the cell labels, x varying fastest. Dense over the bounding box of the cells, unless that would take more
+// than MAX_DENSE_CELLS bytes (large scenes, far outliers), then hashed by cell index
+struct LabelGrid
+{
+  static const boost::uint64_t MAX_DENSE_CELLS = 1 << 28;
+
+  int size[3];
+  bool dense;
+  std::vector<signed char> labels;
+  boost::unordered_map<boost::uint64_t, signed char> sparse_labels;
+
+  // allocates the grid, all cells labeled -1
+  void
+    resize (int x, int y, int z)
+  {
+    size[0] = x; size[1] = y; size[2] = z;
+    boost::uint64_t nr_cells = (boost::uint64_t) x * y * z;
+    dense = nr_cells <= MAX_DENSE_CELLS;
+    labels.clear ();
+    sparse_labels.clear ();
+    if (dense)
+      labels.assign (nr_cells, -1);
+  }
+
+  inline boost::uint64_t
+    index (int x, int y, int z) const
+  {
+    return ((boost::uint64_t) z * size[1] + y) * size[0] + x;
+  }
+
+  inline void
+    setLabel (int x, int y, int z, int label)
+  {
+    if (dense)
+      labels[index (x, y, z)] = label;
+    else
+      sparse_labels[index (x, y, z)] = label;
+  }
+
+  // label of a cell, -1 outside the grid
+  inline int
+    label (int x, int y, int z) const
+  {
+    if (x < 0 || y < 0 || z < 0 || x >= size[0] || y >= size[1] || z >= size[2])
+      return -1;
+    if (dense)
+      return labels[index (x, y, z)];
+    boost::unordered_map<boost::uint64_t, signed char>::const_iterator it = sparse_labels.find (index (x, y, z));
+    return it == sparse_labels.end () ? -1 : it->second;
+  }
+};
+
 inline bool
   histogramElementCompare (const std::pair<int, IntersectedLeaf> &p1, const std::pair<int, IntersectedLeaf> &p2)
 {
@@ -78,6 +133,11 @@ class GlobalRSD : public CloudAlgo
   double min_radius_noise_, max_radius_noise_;
   double max_min_radius_diff_;
   bool publish_octree_;
+  int nr_threads_; // number of threads used to annotate the cells and count transitions (0: one per core)
+  // fraction of the cell pairs whose rays are traced (1: all), the others are skipped at random and the counts
+  // scaled accordingly; a bin receiving n transitions from all pairs has a relative standard error of about
+  // sqrt((1-ratio)/(ratio*n)) for independent pairs
+  double pair_sampling_ratio_;
   // Intermediary results for convenient access
   pcl::PointCloud<pcl::PointNormal> cloud_centroids_; 
   pcl::PointCloud<pcl::PointNormal> cloud_vrsd_; 
@@ -123,6 +183,8 @@ class GlobalRSD : public CloudAlgo
     max_min_radius_diff_ = 0.01;
     min_radius_edge_ = 0.030;
     publish_octree_ = false;
+    nr_threads_ = 0;
+    pair_sampling_ratio_ = 1.0;
   }
   ~GlobalRSD ()
   {
@@ -134,6 +196,15 @@ class GlobalRSD : public CloudAlgo
     return p;
   }
 
+  // Scratch buffers of setSurfaceType, kept by the caller to avoid reallocating them for every cell
+  struct SurfaceTypeBuffers
+  {
+    std::vector<double> nx, ny, nz; // normals
+    std::vector<float> x, y, z; // coordinates
+    std::vector<double> abs_cosine; // |cos| of the normal angles in the current row of pairs
+    std::vector<int> bin; // distance bins in the current row of pairs
+  };
+
   ////////////////////////////////////////////////////////////////////////////////
   // Compute the min and maximum variation of normal angles by distance and
   // estimates local minimum and maximum radius of surface curvature, then
@@ -146,76 +217,98 @@ class GlobalRSD : public CloudAlgo
   //    3 - circle (corner?)
   //    4 - edge
   inline int
-    setSurfaceType (pcl::PointCloud<pcl::PointNormal> cloud, std::vector<int> *indices, std::vector<int> *neighbors, double max_dist)
+    setSurfaceType (const pcl::PointCloud<pcl::PointNormal> &cloud, std::vector<int> *indices, std::vector<int> *neighbors, double max_dist) const
+  {
+    SurfaceTypeBuffers buffers;
+    return setSurfaceType (cloud, *neighbors, max_dist, buffers);
+  }
+
+  // Same as above, with caller provided scratch buffers (safe to call in parallel with different buffers)
+  inline int
+    setSurfaceType (const pcl::PointCloud<pcl::PointNormal> &cloud, const std::vector<int> &neighbors, double max_dist, SurfaceTypeBuffers &buffers) const
   {
     // Fixing binning to 5 and plane radius to 0.2
-    int div_d = 5;
+    const int div_d = 5;
     double plane_radius = 0.2;
 
-    // Initialize minimum and maximum angle values in each distance bin
-    std::vector<std::vector<double> > min_max_angle_by_dist (div_d);
+    // Gather the neighborhood into flat arrays
+    /// @NOTE: normals are taken from the first neighbors->size () points of the cloud, not from the neighbors themselves, as in the original version
+    size_t n = neighbors.size ();
+    size_t size = std::max<size_t> (n, 1); // for taking the address of the first element
+    buffers.nx.resize (size); buffers.ny.resize (size); buffers.nz.resize (size);
+    buffers.x.resize (size); buffers.y.resize (size); buffers.z.resize (size);
+    buffers.abs_cosine.resize (size);
+    buffers.bin.resize (size);
+    for (size_t i = 0; i < n; i++)
+    {
+      buffers.nx[i] = cloud.points[i].normal[0];
+      buffers.ny[i] = cloud.points[i].normal[1];
+      buffers.nz[i] = cloud.points[i].normal[2];
+      const pcl::PointNormal &p = cloud.points[neighbors[i]];
+      buffers.x[i] = p.x; buffers.y[i] = p.y; buffers.z[i] = p.z;
+    }
+
+    // Squared distance limits of the bins: bin_d = floor (div_d * dist / max_dist) >= k <=> dist^2 >= (k * max_dist / div_d)^2
+    float sqr_limit[div_d-1];
+    for (int k = 1; k < div_d; k++)
+      sqr_limit[k-1] = _sqr (k * max_dist / div_d);
+
+    // The angle between the two lines going through normals (disregarding orientation) is acos (|cosine|),
+    // which decreases monotonically, so the minimum angle of a bin is taken at its maximum |cosine| and the
+    // maximum angle at its minimum |cosine|: only those are tracked, acos is evaluated once per bin at the end
+    double min_abs_cosine[div_d], max_abs_cosine[div_d];
     for (int di=0; di<div_d; di++)
     {
-      min_max_angle_by_dist[di].resize (2);
-      min_max_angle_by_dist[di][0] = +DBL_MAX;
-      min_max_angle_by_dist[di][1] = -DBL_MAX;
+      min_abs_cosine[di] = +DBL_MAX;
+      max_abs_cosine[di] = -DBL_MAX;
     }
 
     // Compute distance by normal angle distribution for points
-    for (unsigned int i = 0; i < neighbors->size (); i++)
-      for (unsigned int j = i; j < neighbors->size (); j++)
+    const double *nx = &buffers.nx[0], *ny = &buffers.ny[0], *nz = &buffers.nz[0];
+    const float *x = &buffers.x[0], *y = &buffers.y[0], *z = &buffers.z[0];
+    double *abs_cosine = &buffers.abs_cosine[0];
+    int *bin = &buffers.bin[0];
+    for (size_t i = 0; i < n; i++)
+    {
+      // branch free row of pairs (i, j >= i), vectorized by the compiler
+      for (size_t j = i; j < n; j++)
       {
-        // compute angle between the two lines going through normals (disregard orientation!)
-        double cosine = cloud.points[i].normal[0] * cloud.points[j].normal[0] +
-          cloud.points[i].normal[1] * cloud.points[j].normal[1] +
-          cloud.points[i].normal[2] * cloud.points[j].normal[2];
-        if (cosine > 1) 
-          cosine = 1;
-        if (cosine < -1) 
-          cosine = -1;
-        double angle  = acos (cosine);
-        if (angle > M_PI/2) 
-          angle = M_PI - angle;
-        //cerr << round(RAD2DEG(angle)) << " and ";
-
-        // Compute point to point distance
-        //@TODO: check neighbors->at(i)
-        double dist = sqrt ((cloud.points[neighbors->at(i)].x - cloud.points[neighbors->at(j)].x) * (cloud.points[neighbors->at(i)].x - cloud.points[neighbors->at(j)].x) +
-                            (cloud.points[neighbors->at(i)].y - cloud.points[neighbors->at(j)].y) * (cloud.points[neighbors->at(i)].y - cloud.points[neighbors->at(j)].y) +
-                            (cloud.points[neighbors->at(i)].z - cloud.points[neighbors->at(j)].z) * (cloud.points[neighbors->at(i)].z - cloud.points[neighbors->at(j)].z));
-        //cerr << dist << ": ";
-
-        // compute bins and increase
-        int bin_d = (int) floor (div_d * dist / max_dist);
-
-        // update min-max values for distance bins
-        if (min_max_angle_by_dist[bin_d][0] > angle) 
-          min_max_angle_by_dist[bin_d][0] = angle;
-        if (min_max_angle_by_dist[bin_d][1] < angle) 
-          min_max_angle_by_dist[bin_d][1] = angle;
+        abs_cosine[j] = fabs (nx[i] * nx[j] + ny[i] * ny[j] + nz[i] * nz[j]);
+        float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+        float sqr_dist = dx * dx + dy * dy + dz * dz;
+        int b = 0;
+        for (int k = 0; k < div_d-1; k++)
+          b += (sqr_dist >= sqr_limit[k]);
+        bin[j] = b;
       }
 
+      // update min-max values for distance bins
+      for (size_t j = i; j < n; j++)
+      {
+        if (min_abs_cosine[bin[j]] > abs_cosine[j])
+          min_abs_cosine[bin[j]] = abs_cosine[j];
+        if (max_abs_cosine[bin[j]] < abs_cosine[j])
+          max_abs_cosine[bin[j]] = abs_cosine[j];
+      }
+    }
+
     // Estimate radius from min and max lines
     double Amint_Amin = 0, Amint_d = 0;
     double Amaxt_Amax = 0, Amaxt_d = 0;
     for (int di=0; di<div_d; di++)
     {
-      //cerr << di << ": " << min_max_angle_by_dist[di][0] << " - " << min_max_angle_by_dist[di][1] << endl;
       // combute the members of A'*A*r = A'*D
-      if (min_max_angle_by_dist[di][1] >= 0)
+      if (max_abs_cosine[di] >= 0)
       {
-        double p_min = min_max_angle_by_dist[di][0];
-        double p_max = min_max_angle_by_dist[di][1];
-        //cerr << p_min << " " << p_max << endl;
+        double p_min = acos (std::min (max_abs_cosine[di], 1.0));
+        double p_max = acos (std::min (min_abs_cosine[di], 1.0));
         double f = (di+0.5)*max_dist/div_d;
-        //cerr << f << endl;
         Amint_Amin += p_min * p_min;
         Amint_d += p_min * f;
         Amaxt_Amax += p_max * p_max;
         Amaxt_d += p_max * f;
       }
     }
-    //cerr << Amint_Amin << " " << Amint_d << " " << Amaxt_Amax << " " << Amaxt_d << endl;
     double max_radius;
     if (Amint_Amin == 0) 
       max_radius = plane_radius;
@@ -249,9 +342,13 @@ class GlobalRSD : public CloudAlgo
     return type;
   }
 
+  // Sets the surface type of a batch of cells given by their neighborhoods, in parallel
+  void
+    setSurfaceTypes (const pcl::PointCloud<pcl::PointNormal> &cloud, const std::vector<std::vector<int> > &neighbors, double max_dist, std::vector<int> &types, int nr_threads) const;
+
   // Sets up the OcTree
   void
-    setOctree (pcl::PointCloud<pcl::PointNormal> pointcloud_msg, double octree_res, int initial_label, double laser_offset = 0, double octree_maxrange = -1)
+    setOctree (const pcl::PointCloud<pcl::PointNormal> &pointcloud_msg, double octree_res, int initial_label, double laser_offset = 0, double octree_maxrange = -1)
   {
     octomap_server::OctomapBinary octree_msg;
 
@@ -341,6 +438,14 @@ class GlobalRSD : public CloudAlgo
 
   // OcTree stuff
   octomap::OcTreePCL* octree_;
+
+  // Annotates every nr_threads-th cell starting with the first one
+  void
+    setSurfaceTypesWorker (const pcl::PointCloud<pcl::PointNormal> *cloud, const std::vector<std::vector<int> > *neighbors, double max_dist, std::vector<int> *types, int first, int nr_threads) const;
+
+  // Counts the label transitions along the rays from every nr_threads-th cell (given by its grid key and centroid) to all the following ones
+  void
+    countTransitionsWorker (const LabelGrid *grid, const std::vector<int> *keys, const std::vector<float> *centroids, const std::vector<int> *labels, int first, int nr_threads, std::vector<int> *transitions) const;
 };
 
 }
@@ -20,7 +20,9 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
+#include <boost/thread.hpp>
 #include <libsvm/svm.h>
+#include <sensor_msgs/PointCloud.h>
 // #include <pcl/io/pcd_io.h>
 #include <pcl_cloud_algos/cloud_algos.h>
 #include <pcl_cloud_algos/pcl_cloud_algos_point_types.h>
@@ -33,16 +35,16 @@ class SVMClassification : public CloudAlgo
  public:
 
   // Input/output type
-  // typedef sensor_msgs::PointCloud OutputType;
-  // typedef sensor_msgs::PointCloud InputType;
-    typedef pcl::PointCloud<GRSDSignature21> InputType;
-    typedef pcl::PointCloud<GRSDSignature21> OutputType;
+  typedef sensor_msgs::PointCloud OutputType;
+  typedef sensor_msgs::PointCloud InputType;
 
   // Options
   std::string model_file_name_; // filename where the model should be loaded from
   std::string scale_file_name_; // filename where the scale parameters should be loaded from
   bool scale_self_;             // should features be scaled with their maximum to 1 and minimum to -1 or not (also see: scale_file_)
   bool scale_file_;             // if scale_self_ disabled, sets if scale parameters from scale_file_name_ should be used or not
+  int nr_threads_;              // number of threads used for prediction (0: one per core)
+  bool copy_channels_;          // copy all channels of the input to the output, or only point_label (if present) besides point_class
 
   // Default names
   static std::string default_input_topic ()
@@ -69,6 +71,16 @@ class SVMClassification : public CloudAlgo
     scale_file_name_ = std::string ("svm/teapot_smooth_fpfh.scp");
     scale_self_ = false;
     scale_file_ = true; // gets considered only if scale_self is false
+    nr_threads_ = 0;
+    copy_channels_ = true;
+    model_ = NULL;
+    dense_ = false;
+    sv_dim_ = 0;
+  }
+  ~SVMClassification ()
+  {
+    if (model_ != NULL)
+      svm_destroy_model (model_);
   }
 
   static inline double
@@ -197,6 +209,35 @@ class SVMClassification : public CloudAlgo
 
   // ROS messages
   boost::shared_ptr<sensor_msgs::PointCloud> cloud_svm_;
+
+  // Loads the model and the scale parameters if the file names changed since they were last loaded
+  bool loadModel ();
+  bool loadScaleParameters ();
+
+  // Classifies the points in chunks until there are none left
+  void predictWorker (const sensor_msgs::PointCloud *cloud, int fIdx, int nr_values, double **value_ranges, double lower, double upper, std::vector<float> *point_class);
+
+  // Same as svm_predict for C-SVC and nu-SVC models with linear or RBF kernel, on a dense feature vector
+  double predictDense (const double *x, int nr_values, double *kvalue, int *vote) const;
+
+  // The model, loaded from loaded_model_file_name_
+  struct svm_model* model_;
+  std::string loaded_model_file_name_;
+
+  // Dense copy of the support vectors (one row of sv_dim_ values each) if predictDense can be used
+  bool dense_;
+  int sv_dim_;
+  std::vector<double> sv_;
+  std::vector<int> sv_start_; // index of the first support vector of each class
+
+  // Scale parameters, loaded from loaded_scale_file_name_
+  std::string loaded_scale_file_name_;
+  double scale_lower_, scale_upper_;
+  std::vector<double> scale_min_, scale_max_;
+
+  // Next chunk of points to be classified
+  size_t next_point_;
+  boost::mutex next_point_mutex_;
 };
 
 }
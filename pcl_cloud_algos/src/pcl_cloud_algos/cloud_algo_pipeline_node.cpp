@@ -0,0 +1,67 @@
+/*
+ * Runs DepthImageTriangulation and BoxEstimation on the same point cloud messages in one process: both only
+ * depend on the input cloud, so they are processed concurrently and get the received message without copies.
+ * Parameters of the algos are read from ~depth_image_triangulation and ~box_fit.
+ */
+
+#include <sstream>
+
+#include <pcl_cloud_algos/cloud_algo_pipeline.h>
+#include <pcl_cloud_algos/depth_image_triangulation.h>
+#include <pcl_cloud_algos/box_fit_algo.h>
+
+using namespace pcl_cloud_algos;
+
+class PipelineNode
+{
+ public:
+  PipelineNode (ros::NodeHandle &nh, const std::vector<std::string> &input_fields, int nr_threads)
+  : pipeline_ (nh, input_fields, nr_threads)
+  {
+    pipeline_.addStage<DepthImageTriangulation> ("depth_image_triangulation");
+    pipeline_.addStage<BoxEstimation> ("box_fit");
+    mesh_pub_ = nh.advertise<DepthImageTriangulation::OutputType> (DepthImageTriangulation::default_output_topic (), 5);
+    box_pub_ = nh.advertise<BoxEstimation::OutputType> (BoxEstimation::default_output_topic (), 5);
+    sub_ = nh.subscribe (DepthImageTriangulation::default_input_topic (), 1, &PipelineNode::input_cb, this);
+  }
+
+  void input_cb (const boost::shared_ptr<const sensor_msgs::PointCloud2> &input)
+  {
+    if (!pipeline_.run (input))
+      ROS_WARN ("[PipelineNode] Not all stages produced a valid output.");
+    pipeline_.printStatistics ();
+
+    boost::shared_ptr<const DepthImageTriangulation::OutputType> mesh = pipeline_.getOutput<DepthImageTriangulation::OutputType> ("depth_image_triangulation");
+    if (mesh)
+      mesh_pub_.publish (mesh);
+    boost::shared_ptr<const BoxEstimation::OutputType> box = pipeline_.getOutput<BoxEstimation::OutputType> ("box_fit");
+    if (box)
+      box_pub_.publish (box);
+  }
+
+ private:
+  CloudAlgoPipeline pipeline_;
+  ros::Publisher mesh_pub_, box_pub_;
+  ros::Subscriber sub_;
+};
+
+int main (int argc, char* argv[])
+{
+  ros::init (argc, argv, "cloud_algo_pipeline_node");
+  ros::NodeHandle nh ("~");
+
+  // fields of the incoming clouds, separated by spaces
+  std::string fields;
+  int nr_threads;
+  nh.param ("input_fields", fields, std::string ("x y z index"));
+  nh.param ("nr_threads", nr_threads, 0);
+  std::vector<std::string> input_fields;
+  std::istringstream iss (fields);
+  std::string field;
+  while (iss >> field)
+    input_fields.push_back (field);
+
+  PipelineNode node (nh, input_fields, nr_threads);
+  ros::spin ();
+  return (0);
+}
@@ -39,6 +39,7 @@
 
 #include <ros/this_node.h>
 #include <pcl/io/pcd_io.h>
+#include <boost/thread.hpp>
 
 #include <pcl_cloud_algos/cloud_algos.h>
 #include <pcl_cloud_algos/depth_image_triangulation.h>
@@ -56,20 +57,22 @@ void DepthImageTriangulation::get_scan_and_point_id (pcl::PointCloud<pcl::PointX
 
   ros::Time ts = ros::Time::now ();
 
-  // TODO try it w/ and w/o -1 //
-  for (unsigned int k = 0; k < cloud_in.points.size()-1; k++)
+  max_index_ = 0;
+  for (unsigned int k = 0; k < cloud_in.points.size(); k++)
   {
     cloud_in.points[k].line = line_id;
     point_id = cloud_in.points[k].index;
-    temp_point_id = cloud_in.points[k+1].index;
-    
+
+    // find max point index in the whole point cloud
+    if (point_id > max_index_)
+      max_index_ = point_id;
+
     // new line found
-    if (temp_point_id < point_id)
+    if (k+1 < cloud_in.points.size())
     {
-      line_id++;
-      // find max point index in the whole point cloud
-      if (point_id > max_index_)
-        max_index_ = point_id;
+      temp_point_id = cloud_in.points[k+1].index;
+      if (temp_point_id < point_id)
+        line_id++;
     }
   }
   
@@ -103,6 +106,7 @@ void DepthImageTriangulation::init (ros::NodeHandle &nh)
   nh_ = nh; 
   ROS_INFO ("Depth Image Triangulation Node initialized");
   nh_.param("save_pcd", save_pcd_, save_pcd_);
+  nh_.param("nr_threads", nr_threads_, nr_threads_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -164,226 +168,10 @@ std::string DepthImageTriangulation::process (const boost::shared_ptr<const Dept
   // print the size of point cloud 
   if (verbosity_level_ > 0) ROS_INFO ("max line: %d, max index: %d", max_line_, max_index_);
 
-  std::vector<triangle> tr;
-  tr.resize (2*max_line_*max_index_);  
   mesh_ = boost::shared_ptr<DepthImageTriangulation::OutputType>(new DepthImageTriangulation::OutputType);
-  mesh_->points.resize (0);
-  mesh_->triangles.resize (0);
-  mesh_->intensities.resize (0);
-
-  // number of triangles
-  int nr = 0; 
-  int nr_tr;
-   
-  int a = 0, b, c, d, e;
-  bool skipped = false;
-    
-  // scan line in a point cloud 
-  for (int i = 0; i <=  max_line_; i++)
-  {
-    // laser beam in a scan line
-    for (int j = 0; j <= max_index_; j++)
-    {
-      if (cloud_with_line_.points[a].line == i && cloud_with_line_.points[a].index == j)
-      {
-        // ROS_INFO ("found point a = %d\n", a);
-
-        b = -1;
-        c = -1;
-        d = -1;
-        e = -1;
-        
-        // find top right corner
-        if ((unsigned int)a+1 < cloud_with_line_.points.size() && cloud_with_line_.points[a+1].line == i && cloud_with_line_.points[a+1].index == j+1)
-          b = a+1;
-
-        // ROS_INFO ("resolved point b = %d\n", b);
-
-        // go to next line
-        int test = a;
-        while ((unsigned int)test < cloud_with_line_.points.size() &&  cloud_with_line_.points[test].line < i+1)
-          test++;
-
-        // ROS_INFO ("resolved next line\n");
-
-        // if next line exists
-        if ((unsigned int)test < cloud_with_line_.points.size() && cloud_with_line_.points[test].line == i+1)
-        {
-          // a skipped triangle exists because of missing 'a'
-          if (skipped)
-          {
-            // reset var
-            skipped = false;
-
-            // go to column j-1
-            while ((unsigned int)test < cloud_with_line_.points.size() &&  cloud_with_line_.points[test].index < j-1)
-              test++;
-
-            // if not at the end of dataset
-            if ((unsigned int)test <  cloud_with_line_.points.size())
-            {
-              // if column exists
-              if (cloud_with_line_.points[test].line == i+1 && cloud_with_line_.points[test].index)
-              {
-                e = test;
-                test++;
-              }
-            }
-          }
-          else
-          {
-            // go to column j
-            while ((unsigned int)test < cloud_with_line_.points.size() && cloud_with_line_.points[test].index < j)
-              test++;
-          }
-
-          // if not at the end of dataset
-          if ((unsigned int)test < cloud_with_line_.points.size())
-          {
-          // if column exists
-            if (cloud_with_line_.points[test].line == i+1 && cloud_with_line_.points[test].index == j)
-            {
-              c = test;
-              if ((unsigned int)c+1 < cloud_with_line_.points.size() && cloud_with_line_.points[c+1].line == i+1 && cloud_with_line_.points[c+1].index == j+1)
-                d = c+1;
-            }
-            // if next column was found
-            else if (cloud_with_line_.points[test].line == i+1 && cloud_with_line_.points[test].index == j+1)
-              d = test;
-          }
-        }
-
-        if (c != -1)
-        {
-          float AC = dist_3d (cloud_with_line_, a, c);
-          if (e != -1)
-          {
-            // a c e
-            // ROS_INFO ("a c e\n");
-            float AE = dist_3d (cloud_with_line_, a, e);
-            float CE = dist_3d (cloud_with_line_, c, e);
-            if (AC < max_length && CE < max_length && AE < max_length)
-            {
-              tr[nr].a = a;
-              tr[nr].b = c;
-              tr[nr].c = e;
-              nr++;
-            }
-          }
-
-          if (b != -1)
-          {
-            // a b c
-            // ROS_INFO ("a b c\n");
-            float AB = dist_3d (cloud_with_line_, a, b);
-            float BC = dist_3d (cloud_with_line_, b, c);
-            float AC = dist_3d (cloud_with_line_, a, c);
-            if (AB < max_length && BC < max_length && AC < max_length)
-            {
-              tr[nr].a = a;
-              tr[nr].b = b;
-              tr[nr].c = c;
-              nr++;
-            }
-
-            if (d != -1)
-            {
-              // b c d
-              // ROS_INFO ("b c d\n");
-              float BD = dist_3d (cloud_with_line_, b, d);
-              float CD = dist_3d (cloud_with_line_, c, d);
-              if (BD < max_length && BC < max_length && CD < max_length)
-              {
-                tr[nr].a = b;
-                tr[nr].b = c;
-                tr[nr].c = d;
-                nr++;
-              }
-            }
-          }
-          else if (d != -1)
-          {
-            // a c d
-            // ROS_INFO ("a c d\n");
-            float AD = dist_3d (cloud_with_line_, a, d);
-            float CD = dist_3d (cloud_with_line_, c, d);
-            if (AD < max_length && CD < max_length && AC < max_length)
-            {
-              tr[nr].a = a;
-              tr[nr].b = c;
-              tr[nr].c = d;
-              nr++;
-            }
-          }
-        }
-        else if (b != -1 && d != -1)
-        {
-          // a b d
-          // ROS_INFO ("a b d\n");
-          float AB = dist_3d (cloud_with_line_, a, b);
-          float AD = dist_3d (cloud_with_line_, a, d);
-          float BD = dist_3d (cloud_with_line_, b, d);
-          if (AD < max_length && BD < max_length && AB < max_length)
-          {
-            tr[nr].a = a;
-            tr[nr].b = b;
-            tr[nr].c = d;
-            nr++;
-          }
-        }
-
-        // move to next point
-        a++;
-
-        // skipped = false;
-        if ((unsigned int)a >= cloud_with_line_.points.size())
-          break;
-      } // END OF : top left corner found 
-      else
-        skipped = true;
-      } // END OF : number of indexes 
-    if ((unsigned int)a >= cloud_with_line_.points.size())
-      break;
-  } // END OF : number of lines 
-
-  nr_tr = nr;
-  tr.resize(nr);
+  triangulate (cloud_with_line_, *mesh_);
   mesh_->header = cloud_with_line_.header;   
   mesh_->sending_node = ros::this_node::getName();   
-  triangle_mesh_msgs::Triangle tr_mesh;
-
-#ifdef DEBUG  
-  if (verbosity_level_ > 1) ROS_INFO ("Triangle a: %d, b: %d, c: %d", tr[i].a, tr[i].b, tr[i].c);
-#endif
-
-  // fill up triangular mesh msg and send it on the topic
-  geometry_msgs::Point32 p;
-  for (unsigned int i = 0; i < cloud_with_line_.points.size(); i++)
-  {
-    p.x = cloud_with_line_.points[i].x;
-    p.y = cloud_with_line_.points[i].y;
-    p.z = cloud_with_line_.points[i].z;
-    mesh_->points.push_back (p);
-  }
-  
-  for (int i = 0; i < nr; i++)
-  {
-    if ((unsigned int)tr[i].a >= cloud_with_line_.points.size() || tr[i].a < 0 || isnan(tr[i].a)); 
-      // printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, tr[i].a, tr[i].b, tr[i].c, cloud_with_line_.points.size());
-    else if ((unsigned int)tr[i].b >= cloud_with_line_.points.size() || tr[i].b < 0 || isnan(tr[i].b));
-      // printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, tr[i].a, tr[i].b, tr[i].c, cloud_with_line_.points.size());
-    else if ((unsigned int)tr[i].c >= cloud_with_line_.points.size() || tr[i].c < 0 || isnan(tr[i].c)); 
-      // printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, tr[i].a, tr[i].b, tr[i].c, cloud_with_line_.points.size());
-    else if (tr[i].a == tr[i].b || tr[i].a == tr[i].c || tr[i].b == tr[i].c);
-      // printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, tr[i].a, tr[i].b, tr[i].c, cloud_with_line_.points.size());
-    else
-    {
-      tr_mesh.i = tr[i].a;
-      tr_mesh.j = tr[i].c;
-      tr_mesh.k = tr[i].b;
-      mesh_->triangles.push_back(tr_mesh);
-    } 
-  }
 
   // fill in intensities (needed e.g. laser-to-camera calibration)
   std::vector<sensor_msgs::PointField> fields;
@@ -401,47 +189,187 @@ std::string DepthImageTriangulation::process (const boost::shared_ptr<const Dept
 
   // write to vtk file for display in e.g. vtk viewer
   if (write_to_vtk_)
-    write_vtk_file ("data/triangles.vtk", tr, cloud_with_line_, nr);
-  if (verbosity_level_ > 0) ROS_INFO ("Triangulation with %d triangles completed in %g seconds", tr.size(), (ros::Time::now() - ts).toSec());
+    write_vtk_file ("data/triangles.vtk", *mesh_);
+  if (verbosity_level_ > 0) ROS_INFO ("Triangulation with %d triangles completed in %g seconds", (int)mesh_->triangles.size(), (ros::Time::now() - ts).toSec());
   return std::string("");
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void DepthImageTriangulation::triangulate (const pcl::PointCloud<pcl::PointXYZINormalScanLine> &cloud_in, OutputType &mesh)
+{
+  int nr_points = cloud_in.points.size ();
+
+  // build the (line, index) -> point lookup image; points are ordered by line, so the lines are contiguous ranges
+  lookup_.assign ((max_line_ + 1) * (max_index_ + 1), -1);
+  line_start_.assign (max_line_ + 2, nr_points);
+  for (int p = nr_points - 1; p >= 0; p--)
+  {
+    int line = (int) cloud_in.points[p].line;
+    int index = (int) cloud_in.points[p].index;
+    line_start_[line] = p;
+    // duplicates: the first point of a cell is kept
+    if (index >= 0 && index <= max_index_)
+      lookup_[line * (max_index_ + 1) + index] = p;
+  }
+  for (int line = max_line_; line >= 0; line--)
+    line_start_[line] = std::min (line_start_[line], line_start_[line + 1]);
+  triangle_mask_.resize (nr_points);
+
+  // copy the points
+  mesh.points.resize (nr_points);
+  for (int p = 0; p < nr_points; p++)
+  {
+    mesh.points[p].x = cloud_in.points[p].x;
+    mesh.points[p].y = cloud_in.points[p].y;
+    mesh.points[p].z = cloud_in.points[p].z;
+  }
+
+  // split the lines into one block per thread: mark the triangles of each block, then write them to their final
+  // position in the mesh (blocks in line order, so the result doesn't depend on the number of threads)
+  int nr_threads = nr_threads_ > 0 ? nr_threads_ : boost::thread::hardware_concurrency ();
+  nr_threads = std::max (1, std::min (nr_threads, max_line_ + 1));
+  std::vector<int> block_start (nr_threads + 1);
+  for (int t = 0; t <= nr_threads; t++)
+    block_start[t] = (int) ((long)(max_line_ + 1) * t / nr_threads);
+  std::vector<int> block_triangles (nr_threads, 0);
+  {
+    boost::thread_group workers;
+    for (int t = 1; t < nr_threads; t++)
+      workers.create_thread (boost::bind (&DepthImageTriangulation::markTriangles, this, &cloud_in, block_start[t], block_start[t+1], &block_triangles[t]));
+    markTriangles (&cloud_in, block_start[0], block_start[1], &block_triangles[0]);
+    workers.join_all ();
+  }
+  std::vector<int> block_offset (nr_threads + 1, 0);
+  for (int t = 0; t < nr_threads; t++)
+    block_offset[t+1] = block_offset[t] + block_triangles[t];
+  mesh.triangles.resize (block_offset[nr_threads]);
+  {
+    boost::thread_group workers;
+    for (int t = 1; t < nr_threads; t++)
+      workers.create_thread (boost::bind (&DepthImageTriangulation::emitTriangles, this, &cloud_in, block_start[t], block_start[t+1], block_offset[t], &mesh));
+    emitTriangles (&cloud_in, block_start[0], block_start[1], block_offset[0], &mesh);
+    workers.join_all ();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DepthImageTriangulation::markTriangles (const pcl::PointCloud<pcl::PointXYZINormalScanLine> *cloud_in, int first_line, int last_line, int *nr_triangles)
+{
+  const pcl::PointCloud<pcl::PointXYZINormalScanLine> &cloud = *cloud_in;
+  float sqr_max_length = max_length * max_length;
+  int nr = 0;
+
+  for (int i = first_line; i < last_line; i++)
+  {
+    for (int a = line_start_[i]; a < line_start_[i+1]; a++)
+    {
+      unsigned char &mask = triangle_mask_[a];
+      mask = 0;
+      int j = (int) cloud.points[a].index;
+      if (lookup (i, j) != a)
+        continue;
+
+      //      j-1  j   j+1
+      // i          a   b
+      // i+1   e    c   d
+      int b = lookup (i, j+1);
+      int c = lookup (i+1, j);
+      int d = lookup (i+1, j+1);
+      // the triangle left of a-c, if its top left corner is missing
+      int e = (j > 0 && lookup (i, j-1) == -1) ? lookup (i+1, j-1) : -1;
+
+      if (c != -1)
+      {
+        bool AC = sqr_dist_3d (cloud, a, c) < sqr_max_length;
+        if (e != -1 && AC && sqr_dist_3d (cloud, a, e) < sqr_max_length && sqr_dist_3d (cloud, c, e) < sqr_max_length)
+          mask |= TRIANGLE_ACE;
+
+        if (b != -1)
+        {
+          bool BC = sqr_dist_3d (cloud, b, c) < sqr_max_length;
+          if (AC && BC && sqr_dist_3d (cloud, a, b) < sqr_max_length)
+            mask |= TRIANGLE_ABC;
+          if (d != -1 && BC && sqr_dist_3d (cloud, b, d) < sqr_max_length && sqr_dist_3d (cloud, c, d) < sqr_max_length)
+            mask |= TRIANGLE_BCD;
+        }
+        else if (d != -1 && AC && sqr_dist_3d (cloud, a, d) < sqr_max_length && sqr_dist_3d (cloud, c, d) < sqr_max_length)
+          mask |= TRIANGLE_ACD;
+      }
+      else if (b != -1 && d != -1)
+      {
+        if (sqr_dist_3d (cloud, a, b) < sqr_max_length && sqr_dist_3d (cloud, a, d) < sqr_max_length && sqr_dist_3d (cloud, b, d) < sqr_max_length)
+          mask |= TRIANGLE_ABD;
+      }
+
+      for (unsigned char m = mask; m; m &= m - 1)
+        nr++;
+    }
+  }
+  *nr_triangles = nr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void DepthImageTriangulation::emitTriangles (const pcl::PointCloud<pcl::PointXYZINormalScanLine> *cloud_in, int first_line, int last_line, int offset, OutputType *mesh)
+{
+  triangle_mesh_msgs::Triangle *tr = mesh->triangles.empty () ? NULL : &mesh->triangles[0] + offset;
+
+  for (int i = first_line; i < last_line; i++)
+  {
+    for (int a = line_start_[i]; a < line_start_[i+1]; a++)
+    {
+      unsigned char mask = triangle_mask_[a];
+      if (!mask)
+        continue;
+      int j = (int) cloud_in->points[a].index;
+      int b = lookup (i, j+1);
+      int c = lookup (i+1, j);
+      int d = lookup (i+1, j+1);
+      int e = lookup (i+1, j-1);
+
+      // triangles (p, q, r) are stored as (p, r, q)
+      if (mask & TRIANGLE_ACE)
+        tr->i = a, tr->j = e, tr->k = c, tr++;
+      if (mask & TRIANGLE_ABC)
+        tr->i = a, tr->j = c, tr->k = b, tr++;
+      if (mask & TRIANGLE_BCD)
+        tr->i = b, tr->j = d, tr->k = c, tr++;
+      if (mask & TRIANGLE_ACD)
+        tr->i = a, tr->j = d, tr->k = c, tr++;
+      if (mask & TRIANGLE_ABD)
+        tr->i = a, tr->j = d, tr->k = b, tr++;
+    }
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////////
-void DepthImageTriangulation::write_vtk_file (std::string output, std::vector<triangle> triangles, const pcl::PointCloud<pcl::PointXYZINormalScanLine> &cloud_in, int nr_tr)
+void DepthImageTriangulation::write_vtk_file (std::string output, const OutputType &mesh)
 {
   /* writing VTK file */
 
   FILE *f;
   f = fopen(output.c_str(),"w");
-  fprintf (f, "# vtk DataFile Version 3.0\nvtk output\nASCII\nDATASET POLYDATA\nPOINTS %d float\n", cloud_with_line_.points.size());
+  if (f == NULL)
+  {
+    ROS_WARN ("[DepthImageTriangulation] Couldn't open %s for writing", output.c_str ());
+    return;
+  }
+  fprintf (f, "# vtk DataFile Version 3.0\nvtk output\nASCII\nDATASET POLYDATA\nPOINTS %d float\n", (int)mesh.points.size());
 
-  for (unsigned int i = 0; i < cloud_with_line_.points.size(); i++)
+  for (unsigned int i = 0; i < mesh.points.size(); i++)
   {
-    fprintf (f,"%f %f %f ", cloud_with_line_.points[i].x, cloud_with_line_.points[i].y,
-        cloud_with_line_.points[i].z);
+    fprintf (f,"%f %f %f ", mesh.points[i].x, mesh.points[i].y, mesh.points[i].z);
     fprintf (f,"\n");
   }
 
-  fprintf(f,"VERTICES %d %d\n", cloud_with_line_.points.size(), 2*cloud_with_line_.points.size());
-  for (unsigned int i = 0; i < cloud_with_line_.points.size(); i++)
+  fprintf(f,"VERTICES %d %d\n", (int)mesh.points.size(), 2*(int)mesh.points.size());
+  for (unsigned int i = 0; i < mesh.points.size(); i++)
     fprintf(f,"1 %d\n", i);
 
-  if (verbosity_level_ > 0) ROS_INFO ("vector: %d, nr: %d  ", triangles.size(), nr_tr);
-
+  int nr_tr = mesh.triangles.size ();
   fprintf(f,"\nPOLYGONS %d %d\n", nr_tr, 4*nr_tr);
   for (int i = 0; i < nr_tr; i++)
-  {
-    if ((unsigned int)triangles[i].a >= cloud_with_line_.points.size() || triangles[i].a < 0 || isnan(triangles[i].a));
-      //printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, triangles[i].a, triangles[i].b, triangles[i].c, cloud_with_line_.points.size());
-    else if ((unsigned int)triangles[i].b >= cloud_with_line_.points.size() || triangles[i].b < 0 || isnan(triangles[i].b));
-      // printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, triangles[i].a, triangles[i].b, triangles[i].c, cloud_with_line_.points.size());
-    else if ((unsigned int)triangles[i].c >= cloud_with_line_.points.size() || triangles[i].c < 0 || isnan(triangles[i].c));
-      // printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, triangles[i].a, triangles[i].b, triangles[i].c, cloud_with_line_.points.size());
-    else if (triangles[i].a == triangles[i].b || triangles[i].a == triangles[i].c || triangles[i].b == triangles[i].c);
-      // printf("triangle %d/%d: %d %d %d / %d\n", i, nr_tr, triangles[i].a, triangles[i].b, triangles[i].c, cloud_with_line_.points.size());
-    else
-      fprintf(f,"3 %d %d %d\n",triangles[i].a, triangles[i].c, triangles[i].b);
-  }
+    fprintf(f,"3 %d %d %d\n", mesh.triangles[i].i, mesh.triangles[i].j, mesh.triangles[i].k);
+  fclose (f);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1,4 +1,5 @@
 #include <pcl_cloud_algos/global_rsd.h>
+#include <boost/thread.hpp>
 
 using namespace std;
 using namespace pcl_cloud_algos;
@@ -24,9 +25,122 @@ void GlobalRSD::pre ()
   nh_.param("max_min_radius_diff", max_min_radius_diff_,  max_min_radius_diff_);
   nh_.param("min_radius_edge", min_radius_edge_,  min_radius_edge_);
   nh_.param("publish_octree", publish_octree_,  publish_octree_);
+  nh_.param("nr_threads", nr_threads_,  nr_threads_);
+  nh_.param("pair_sampling_ratio", pair_sampling_ratio_,  pair_sampling_ratio_);
+  // A ratio <= 0 would sample no pair and weight the counts with 1/ratio
+  if (!(pair_sampling_ratio_ > 0 && pair_sampling_ratio_ <= 1))
+  {
+    ROS_WARN ("[GlobalRSD] pair_sampling_ratio %g is not in (0, 1], using 1 (all pairs)", pair_sampling_ratio_);
+    pair_sampling_ratio_ = 1.0;
+  }
   cloud_grsd_.points.resize(1);
 }
 
+void GlobalRSD::setSurfaceTypes (const pcl::PointCloud<pcl::PointNormal> &cloud, const std::vector<std::vector<int> > &neighbors, double max_dist, std::vector<int> &types, int nr_threads) const
+{
+  types.resize (neighbors.size ());
+  if (nr_threads <= 0)
+    nr_threads = boost::thread::hardware_concurrency ();
+  nr_threads = std::max (1, std::min (nr_threads, (int)neighbors.size ()));
+
+  // Cells are dealt out round robin, as neighborhood sizes tend to vary smoothly over the cell list
+  boost::thread_group workers;
+  for (int t = 1; t < nr_threads; t++)
+    workers.create_thread (boost::bind (&GlobalRSD::setSurfaceTypesWorker, this, &cloud, &neighbors, max_dist, &types, t, nr_threads));
+  setSurfaceTypesWorker (&cloud, &neighbors, max_dist, &types, 0, nr_threads);
+  workers.join_all ();
+}
+
+void GlobalRSD::setSurfaceTypesWorker (const pcl::PointCloud<pcl::PointNormal> *cloud, const std::vector<std::vector<int> > *neighbors, double max_dist, std::vector<int> *types, int first, int nr_threads) const
+{
+  SurfaceTypeBuffers buffers;
+  for (size_t c = first; c < neighbors->size (); c += nr_threads)
+    (*types)[c] = setSurfaceType (*cloud, (*neighbors)[c], max_dist, buffers);
+}
+
+void GlobalRSD::countTransitionsWorker (const LabelGrid *grid, const std::vector<int> *keys, const std::vector<float> *centroids, const std::vector<int> *labels, int first, int nr_threads, std::vector<int> *transitions) const
+{
+  const int nr_labels = NR_CLASS+1;
+  transitions->assign (nr_labels * nr_labels, 0);
+  int *trans = &(*transitions)[0];
+  int nr_cells = labels->size ();
+  const int *key = keys->empty () ? NULL : &(*keys)[0];
+  const float *centroid = centroids->empty () ? NULL : &(*centroids)[0];
+  bool sample = pair_sampling_ratio_ < 1;
+  int threshold = (int) (pair_sampling_ratio_ * RAND_MAX);
+
+  for (int i = first; i < nr_cells; i += nr_threads)
+  {
+    int label_i = (*labels)[i] + 1;
+    // seeded by the source cell, so that the sampled pairs do not depend on the number of threads
+    unsigned int seed = 2654435761u * (i+1);
+    for (int j = i+1; j < nr_cells; j++)
+    {
+      if (sample && rand_r (&seed) > threshold)
+        continue;
+
+      // The source leaf is counted twice, as computeRay returned it in addition to the first voxel added explicitly
+      trans[label_i*nr_labels + label_i] += 2;
+
+      // 3D-DDA from the center of cell i to the center of cell j (Amanatides & Woo), stepping over grid keys but with the
+      // same floating point arithmetic and tie breaking as OcTree::computeRayKeys, so rays through cell edges take the same cells
+      int current[3], end[3], step[3];
+      float direction[3], sqr_length = 0;
+      double t_max[3], t_delta[3];
+      for (int d = 0; d < 3; d++)
+      {
+        current[d] = key[3*i+d];
+        end[d] = key[3*j+d];
+        direction[d] = centroid[3*j+d] - centroid[3*i+d];
+        sqr_length += direction[d] * direction[d];
+      }
+      float length = (float) sqrt (sqr_length);
+      for (int d = 0; d < 3; d++)
+      {
+        direction[d] /= length;
+        step[d] = direction[d] > 0 ? 1 : (direction[d] < 0 ? -1 : 0);
+        if (step[d] != 0)
+        {
+          // corner point of the voxel in the direction of the ray
+          double border = centroid[3*i+d];
+          border += (float) (step[d] * width_ * 0.5);
+          t_max[d] = (border - centroid[3*i+d]) / direction[d];
+          t_delta[d] = width_ / fabs (direction[d]);
+        }
+        else
+          t_max[d] = t_delta[d] = DBL_MAX;
+      }
+
+      int previous = label_i;
+      while (true)
+      {
+        int dim;
+        if (t_max[0] < t_max[1])
+          dim = t_max[0] < t_max[2] ? 0 : 2;
+        else
+          dim = t_max[1] < t_max[2] ? 1 : 2;
+        current[dim] += step[dim];
+        t_max[dim] += t_delta[dim];
+        if (current[0] == end[0] && current[1] == end[1] && current[2] == end[2])
+          break;
+        // guards against rounding errors
+        if (std::min (std::min (t_max[0], t_max[1]), t_max[2]) > length)
+          break;
+
+        int label = grid->label (current[0], current[1], current[2]) + 1;
+        trans[label*nr_labels + previous]++;
+        trans[previous*nr_labels + label]++;
+        previous = label;
+      }
+
+      // Add the last voxel
+      int label_j = (*labels)[j] + 1;
+      trans[label_j*nr_labels + previous]++;
+      trans[previous*nr_labels + label_j]++;
+    }
+  }
+}
+
 void GlobalRSD::post ()
 {
 
@@ -105,9 +219,11 @@ std::string GlobalRSD::process (const boost::shared_ptr<const GlobalRSD::InputTy
   std::list<octomap::OcTreeVolume> cells;
   octree_->getOccupied(cells, 0);
 
-  // Set surface type for each cell in advance
+  // Set surface type for each cell in advance: collect the neighborhoods of the cells first, then annotate them in parallel
   ts = ros::Time::now ();
-  int cnt_centroids = 0;
+  std::vector<octomap::OcTreeNodePCL*> annotated_nodes;
+  std::vector<octomap::point3d> annotated_centroids;
+  std::vector<std::vector<int> > annotated_neighbors;
   double x_min, y_min, z_min, x_max, y_max, z_max;
   octree_->getMetricMin(x_min, y_min, z_min);
   octree_->getMetricMax(x_max, y_max, z_max);
@@ -126,7 +242,10 @@ std::string GlobalRSD::process (const boost::shared_ptr<const GlobalRSD::InputTy
       continue;
 
     // Iterating through neighbors
-    vector<int> neighbors;
+    annotated_nodes.push_back (node_i);
+    annotated_centroids.push_back (centroid_i);
+    annotated_neighbors.push_back (vector<int> ());
+    vector<int> &neighbors = annotated_neighbors.back ();
     if (step_ == 0)
     {
       Eigen::Vector4f central_point;
@@ -164,9 +283,17 @@ std::string GlobalRSD::process (const boost::shared_ptr<const GlobalRSD::InputTy
         } // j
       } // k
     }
+  }
 
-    // Mark all points with result
-    int type = setSurfaceType (cloud_vrsd_, &indices_i, &neighbors, max_dist);
+  std::vector<int> types;
+  setSurfaceTypes (cloud_vrsd_, annotated_neighbors, max_dist, types, nr_threads_);
+
+  int cnt_centroids = 0;
+  for (size_t c = 0; c < annotated_nodes.size (); c++)
+  {
+    int type = types[c];
+    octomap::OcTreeNodePCL *node_i = annotated_nodes[c];
+    const octomap::point3d &centroid_i = annotated_centroids[c];
 
     // Mark the node label as well
     node_i->label = type;
@@ -186,102 +313,53 @@ std::string GlobalRSD::process (const boost::shared_ptr<const GlobalRSD::InputTy
     ROS_INFO ("[GlobalRSD] Cells annotated in %g seconds.", (ros::Time::now () - ts).toSec ());
 
   //GLOBAL part
-  // Initialize transition matrix for counting
-  vector<vector<int> > transitions (NR_CLASS+1);
-  for (size_t i = 0; i < transitions.size (); i++)
-    transitions[i].resize (NR_CLASS+1);
-
-  /// Iterate over all cells
+  // Label grid over the bounding box of the annotated cells; free, unknown and sparse cells keep the initial -1 label as in the octree
   ts = ros::Time::now ();
-  float line_p1[3], line_p2[3], box_bounds[6];
-  for (std::list<octomap::OcTreeVolume>::iterator it_i = cells.begin (); it_i != cells.end (); ++it_i)
+  LabelGrid grid;
+  std::vector<int> keys (3*annotated_centroids.size ());
+  std::vector<float> centroids (3*annotated_centroids.size ());
+  std::vector<int> labels (annotated_centroids.size ());
+  float c_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+  for (size_t c = 0; c < annotated_centroids.size (); c++)
+    for (int d = 0; d < 3; d++)
+      c_min[d] = std::min (c_min[d], annotated_centroids[c](d));
+  int grid_size[3] = {0, 0, 0};
+  for (size_t c = 0; c < annotated_centroids.size (); c++)
   {
-    // Get a cell
-    octomap::point3d centroid_i;
-    centroid_i(0) = it_i->first.x();
-    centroid_i(1) = it_i->first.y();
-    centroid_i(2) = it_i->first.z();
-    octomap::OcTreeNodePCL *node_i = octree_->search(centroid_i);
-
-    // Get its contents
-    vector<int> indices_i = node_i->get3DPointInliers ();
-    if (indices_i.size () < min_voxel_pts_)
-      continue;
-
-    // Connect current cell to all the remaining ones
-    for (std::list<octomap::OcTreeVolume>::iterator it_j = it_i; it_j != cells.end (); ++it_j)
+    for (int d = 0; d < 3; d++)
     {
-      /// TODO: just start for from it_i+1
-      if (it_i == it_j)
-       continue;
-
-      // Get a cell
-      octomap::point3d centroid_j;
-      centroid_j(0) = it_j->first.x();
-      centroid_j(1) = it_j->first.y();
-      centroid_j(2) = it_j->first.z();
-      octomap::OcTreeNodePCL *node_j = octree_->search(centroid_j);
-
-      // Get its contents
-      vector<int> indices_j = node_j->get3DPointInliers ();
-      if (indices_j.size () < min_voxel_pts_)
-        continue;
-
-      // Create a paired histogram vector which holds: a) the actual centroid value of the intersected voxel, b) the distance from start_voxel to voxel_i
-      vector<pair<int, IntersectedLeaf> > histogram_values;
-
-      // Get the leaves along the ray
-      vector<octomap::point3d> ray;
-      octree_->computeRay(centroid_i, centroid_j, ray);
-
-      // Iterate over leaves
-      for (vector<octomap::point3d>::iterator centroid_ray = ray.begin (); centroid_ray != ray.end (); centroid_ray++)
-      {
-        // Compute the distance to the start leaf
-        pair<int, IntersectedLeaf> histogram_pair;
-        histogram_pair.second.centroid = *centroid_ray;
-        histogram_pair.second.sqr_distance = _sqr_dist (*centroid_ray, centroid_i);
-
-        // Save the label of the cell
-        octomap::OcTreeNodePCL *node_ray = octree_->search(*centroid_ray);
-        if (node_ray == NULL) // @TODO: this should never happen, the octree_ should be fully expanded!
-          histogram_pair.first = -1;
-        else
-          histogram_pair.first = node_ray->label;
-
-        // Save data about cell
-        histogram_values.push_back (histogram_pair);
-      }
-
-      // Add the first voxel
-      pair<int, IntersectedLeaf> histogram_pair1;
-      histogram_pair1.second.sqr_distance = _sqr_dist (centroid_i, centroid_i); // 0.0
-      histogram_pair1.second.centroid = centroid_i;
-      histogram_pair1.first = node_i->label;
-      //histogram_pair1.first = (int)(cloud_vrsd.channels[regIdx].values[indices_i.at (0)]);
-      histogram_values.push_back (histogram_pair1);
-
-      // Add the last voxel
-      pair<int, IntersectedLeaf> histogram_pair2;
-      histogram_pair2.second.sqr_distance = _sqr_dist (centroid_j, centroid_i); // line length
-      histogram_pair2.second.centroid = centroid_j;
-      histogram_pair2.first = node_j->label;
-      //histogram_pair2.first = (int)(cloud_vrsd.channels[regIdx].values[indices_j.at (0)]);
-      histogram_values.push_back (histogram_pair2);
-
-      // Sort the histogram according to the distance of the leaves to the start leaf
-      sort (histogram_values.begin (), histogram_values.end (), histogramElementCompare);
-
-      // Count transitions between the first and last voxel
-      for (unsigned int hi = 1; hi < histogram_values.size (); hi++)
-      {
-        // transition matrix has to be symmetrical
-        transitions[histogram_values[hi].first+1][histogram_values[hi-1].first+1]++;
-        transitions[histogram_values[hi-1].first+1][histogram_values[hi].first+1]++;
-        //cerr << "transition: " << histogram_values[hi].first-EMPTY_VALUE << " => " << histogram_values[hi-1].first-EMPTY_VALUE << endl;
-      }
+      centroids[3*c+d] = annotated_centroids[c](d);
+      keys[3*c+d] = (int) floor ((annotated_centroids[c](d) - c_min[d]) / width_ + 0.5);
+      grid_size[d] = std::max (grid_size[d], keys[3*c+d] + 1);
     }
+    labels[c] = types[c];
   }
+  grid.resize (grid_size[0], grid_size[1], grid_size[2]);
+  if (!grid.dense && verbosity_level_ > 0)
+    ROS_INFO ("[GlobalRSD] Bounding box of %d x %d x %d cells is too large for a dense grid, hashing the cells.", grid_size[0], grid_size[1], grid_size[2]);
+  for (size_t c = 0; c < annotated_centroids.size (); c++)
+    grid.setLabel (keys[3*c], keys[3*c+1], keys[3*c+2], labels[c]);
+
+  /// Connect every cell to all the remaining ones, source cells dealt out round robin to the threads
+  int nr_threads = nr_threads_ > 0 ? nr_threads_ : boost::thread::hardware_concurrency ();
+  nr_threads = std::max (1, std::min (nr_threads, (int)annotated_centroids.size ()));
+  std::vector<std::vector<int> > thread_transitions (nr_threads);
+  boost::thread_group workers;
+  for (int t = 1; t < nr_threads; t++)
+    workers.create_thread (boost::bind (&GlobalRSD::countTransitionsWorker, this, &grid, &keys, &centroids, &labels, t, nr_threads, &thread_transitions[t]));
+  countTransitionsWorker (&grid, &keys, &centroids, &labels, 0, nr_threads, &thread_transitions[0]);
+  workers.join_all ();
+
+  // Initialize transition matrix for counting
+  vector<vector<double> > transitions (NR_CLASS+1);
+  for (size_t i = 0; i < transitions.size (); i++)
+    transitions[i].resize (NR_CLASS+1);
+  // Sampled pairs are weighted by the inverse of the sampling ratio
+  double weight = pair_sampling_ratio_ < 1 ? 1 / pair_sampling_ratio_ : 1;
+  for (int t = 0; t < nr_threads; t++)
+    for (int i=0; i<NR_CLASS+1; i++)
+      for (int j=0; j<NR_CLASS+1; j++)
+        transitions[i][j] += weight * thread_transitions[t][i*(NR_CLASS+1)+j];
   if (verbosity_level_ > 0) 
     ROS_INFO ("[GlobalRSD] Transitions counted in %g seconds.", (ros::Time::now () - ts).toSec ());
 
@@ -2,11 +2,14 @@
 #include <pcl_cloud_algos/cloud_algos.h>
 #include <pcl_cloud_algos/svm_classification.h>
 
-using namespace cloud_algos;
+using namespace pcl_cloud_algos;
 
 void SVMClassification::init (ros::NodeHandle& nh)
 {
   nh_ = nh;
+
+  // Load the model and scale parameters once, pre () reloads them only if the file names change
+  pre ();
 }
 
 void SVMClassification::pre ()
@@ -17,6 +20,199 @@ void SVMClassification::pre ()
   nh_.param("scale_file_name", scale_file_name_, scale_file_name_);
   nh_.param("scale_self", scale_self_, scale_self_);
   nh_.param("scale_file", scale_file_, scale_file_);
+  nh_.param("nr_threads", nr_threads_, nr_threads_);
+  nh_.param("copy_channels", copy_channels_, copy_channels_);
+  loadModel ();
+  if (!scale_self_ && scale_file_)
+    loadScaleParameters ();
+}
+
+bool SVMClassification::loadModel ()
+{
+  if (model_ != NULL && loaded_model_file_name_ == model_file_name_)
+    return true;
+  if (model_ != NULL)
+    svm_destroy_model (model_);
+  dense_ = false;
+  sv_.clear ();
+  loaded_model_file_name_ = model_file_name_;
+  if ((model_ = svm_load_model (model_file_name_.c_str ())) == 0)
+  {
+    if (verbosity_level_ > -2) ROS_ERROR ("[SVMClassification] Couldn't load SVM model from %s", model_file_name_.c_str ());
+    return false;
+  }
+  ROS_INFO ("[SVMClassification] SVM model type: %d with %d output classes (read from %s).", svm_get_svm_type (model_), svm_get_nr_class (model_), model_file_name_.c_str ());
+
+  // Classification models with linear or RBF kernel are evaluated on dense copies of the support vectors
+  int svm_type = svm_get_svm_type (model_);
+  int kernel_type = model_->param.kernel_type;
+  if ((svm_type == C_SVC || svm_type == NU_SVC) && (kernel_type == LINEAR || kernel_type == RBF))
+  {
+    sv_dim_ = 0;
+    for (int i = 0; i < model_->l; i++)
+      for (const svm_node *n = model_->SV[i]; n->index != -1; n++)
+        sv_dim_ = std::max (sv_dim_, n->index);
+    sv_.assign (model_->l * sv_dim_, 0.0);
+    for (int i = 0; i < model_->l; i++)
+      for (const svm_node *n = model_->SV[i]; n->index != -1; n++)
+        sv_[i * sv_dim_ + n->index - 1] = n->value;
+    sv_start_.resize (model_->nr_class);
+    sv_start_[0] = 0;
+    for (int i = 1; i < model_->nr_class; i++)
+      sv_start_[i] = sv_start_[i-1] + model_->nSV[i-1];
+    dense_ = true;
+    if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] Using dense prediction with %d support vectors of %d values.", model_->l, sv_dim_);
+  }
+  return true;
+}
+
+bool SVMClassification::loadScaleParameters ()
+{
+  if (loaded_scale_file_name_ == scale_file_name_ && !scale_min_.empty ())
+    return true;
+  loaded_scale_file_name_ = scale_file_name_;
+  scale_min_.clear ();
+  scale_max_.clear ();
+
+  // Same format as parseScaleParameterFile, but the number of values is taken from the file
+  std::ifstream fs (scale_file_name_.c_str ());
+  if (!fs.is_open ())
+  {
+    ROS_ERROR ("Couldn't open %s for reading!", scale_file_name_.c_str ());
+    return false;
+  }
+  std::string mystring;
+  fs >> mystring;
+  if (mystring.substr (0, 1) != "x")
+  {
+    ROS_WARN ("X scaling not found in %s or unknown!", scale_file_name_.c_str ());
+    return false;
+  }
+  fs >> scale_lower_ >> scale_upper_;
+  int idx;
+  float fmin, fmax;
+  while (fs >> idx >> fmin >> fmax)
+  {
+    if (idx < 1)
+      continue;
+    if ((int)scale_min_.size () < idx)
+    {
+      scale_min_.resize (idx, 0.0);
+      scale_max_.resize (idx, 0.0);
+    }
+    scale_min_[idx-1] = fmin;
+    scale_max_[idx-1] = fmax;
+  }
+  return !scale_min_.empty ();
+}
+
+double SVMClassification::predictDense (const double *x, int nr_values, double *kvalue, int *vote) const
+{
+  // Kernel values, summing in increasing index order like libsvm's sparse dot/distance
+  int dim = std::min (nr_values, sv_dim_);
+  if (model_->param.kernel_type == LINEAR)
+  {
+    for (int i = 0; i < model_->l; i++)
+    {
+      const double *sv = &sv_[i * sv_dim_];
+      double sum = 0;
+      for (int d = 0; d < dim; d++)
+        sum += x[d] * sv[d];
+      kvalue[i] = sum;
+    }
+  }
+  else
+  {
+    for (int i = 0; i < model_->l; i++)
+    {
+      const double *sv = &sv_[i * sv_dim_];
+      double sum = 0;
+      for (int d = 0; d < dim; d++)
+        sum += (x[d] - sv[d]) * (x[d] - sv[d]);
+      for (int d = dim; d < sv_dim_; d++)
+        sum += sv[d] * sv[d];
+      for (int d = dim; d < nr_values; d++)
+        sum += x[d] * x[d];
+      kvalue[i] = exp (-model_->param.gamma * sum);
+    }
+  }
+
+  // One-against-one voting, as svm_predict_values
+  int nr_class = model_->nr_class;
+  for (int i = 0; i < nr_class; i++)
+    vote[i] = 0;
+  int p = 0;
+  for (int i = 0; i < nr_class; i++)
+    for (int j = i+1; j < nr_class; j++)
+    {
+      double sum = 0;
+      int si = sv_start_[i], sj = sv_start_[j];
+      const double *coef1 = model_->sv_coef[j-1];
+      const double *coef2 = model_->sv_coef[i];
+      for (int k = 0; k < model_->nSV[i]; k++)
+        sum += coef1[si+k] * kvalue[si+k];
+      for (int k = 0; k < model_->nSV[j]; k++)
+        sum += coef2[sj+k] * kvalue[sj+k];
+      sum -= model_->rho[p++];
+      if (sum > 0)
+        ++vote[i];
+      else
+        ++vote[j];
+    }
+  int vote_max_idx = 0;
+  for (int i = 1; i < nr_class; i++)
+    if (vote[i] > vote[vote_max_idx])
+      vote_max_idx = i;
+  return model_->label[vote_max_idx];
+}
+
+void SVMClassification::predictWorker (const sensor_msgs::PointCloud *cloud, int fIdx, int nr_values, double **value_ranges, double lower, double upper, std::vector<float> *point_class)
+{
+  const size_t chunk_size = 256;
+
+  // Per thread buffers
+  std::vector<double> x (nr_values);
+  std::vector<svm_node> node (nr_values+1);
+  std::vector<double> kvalue (model_->l);
+  std::vector<int> vote (model_->nr_class);
+
+  while (true)
+  {
+    size_t begin, end;
+    {
+      boost::mutex::scoped_lock lock (next_point_mutex_);
+      begin = next_point_;
+      end = next_point_ = std::min (begin + chunk_size, cloud->points.size ());
+    }
+    if (begin >= end)
+      break;
+
+    for (size_t cp = begin; cp < end; cp++)
+    {
+      for (int i = 0; i < nr_values; i++)
+      {
+        double feature_value = cloud->channels[fIdx + i].values[cp];
+        if (value_ranges != NULL)
+          x[i] = scaleFeature (i, feature_value, value_ranges, lower, upper);
+        else
+          x[i] = feature_value;
+      }
+
+      // Predict
+      if (dense_)
+        (*point_class)[cp] = predictDense (&x[0], nr_values, &kvalue[0], &vote[0]);
+      else
+      {
+        for (int i = 0; i < nr_values; i++)
+        {
+          node[i].index = i+1;
+          node[i].value = x[i];
+        }
+        node[nr_values].index = -1;
+        (*point_class)[cp] = svm_predict (model_, &node[0]);
+      }
+    }
+  }
 }
 
 void SVMClassification::post ()
@@ -76,41 +272,42 @@ std::string SVMClassification::process (const boost::shared_ptr<const SVMClassif
   if (plIdx == -1)
     if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] NOTE: Points are not labeled with the expected classification results. If you want to evaluate the results please add point_label channel.");
 
-  /// Load the SVM model
-  struct svm_node* node;
-  struct svm_model* model;
-  if ((model = svm_load_model (model_file_name_.c_str ())) == 0)
+  /// The SVM model is loaded in init / pre
+  if (model_ == NULL)
   {
-    if (verbosity_level_ > -2) ROS_ERROR ("[SVMClassification] Couldn't load SVM model from %s", model_file_name_.c_str ());
     output_valid_ = false;
     return std::string("incorrect model file");
   }
-  node = (struct svm_node*) malloc ((nr_values+1) * sizeof (struct svm_node));
-  ROS_INFO ("[SVMClassification] SVM model type: %d with %d output classes (read from %s).", svm_get_svm_type (model), svm_get_nr_class (model), model_file_name_.c_str ());
 
   // If scale enabled....
-  double lower, upper;
+  double lower = -1, upper = +1;
   double** value_ranges = NULL;
+  double* file_ranges[2];
   if (scale_self_)
   {
-    lower = -1;
-    upper = +1;
     value_ranges = computeScaleParameters (cloud, fIdx, nr_values);
     if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] Scaling data to the interval (%g,%g) enabled.", lower, upper);
   }
   else if (scale_file_)
   {
-    value_ranges = parseScaleParameterFile (scale_file_name_.c_str (), lower, upper, nr_values);
-    if (value_ranges == NULL)
+    if (scale_min_.empty ())
     {
       if (verbosity_level_ > -2) ROS_ERROR ("[SVMClassification] Scaling requested from file %s but it is not possible!", scale_file_name_.c_str ());
       output_valid_ = false;
       return std::string("incorrect scale parameter file");
     }
-    else
+    // values without limits in the file are not scaled (set to 0)
+    if ((int)scale_min_.size () < nr_values)
     {
-      if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] Scaling according to the limits from %s to the interval (%g,%g) enabled.", scale_file_name_.c_str (), lower, upper);
+      scale_min_.resize (nr_values, 0.0);
+      scale_max_.resize (nr_values, 0.0);
     }
+    lower = scale_lower_;
+    upper = scale_upper_;
+    file_ranges[0] = &scale_min_[0];
+    file_ranges[1] = &scale_max_[0];
+    value_ranges = file_ranges;
+    if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] Scaling according to the limits from %s to the interval (%g,%g) enabled.", scale_file_name_.c_str (), lower, upper);
   }
 
   // Timers
@@ -121,7 +318,13 @@ std::string SVMClassification::process (const boost::shared_ptr<const SVMClassif
   cloud_svm_ = boost::shared_ptr<sensor_msgs::PointCloud> (new sensor_msgs::PointCloud());
   cloud_svm_->header   = cloud->header;
   cloud_svm_->points   = cloud->points;
-  cloud_svm_->channels = cloud->channels;
+  if (copy_channels_)
+    cloud_svm_->channels = cloud->channels;
+  else if (plIdx != -1)
+  {
+    cloud_svm_->channels.push_back (cloud->channels[plIdx]);
+    plIdx = 0;
+  }
 
   // Allocate the extra needed channels
   if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] Saving classification results to point_class channel.");
@@ -131,36 +334,32 @@ std::string SVMClassification::process (const boost::shared_ptr<const SVMClassif
   cloud_svm_->channels[pcIdx].values.resize (cloud_svm_->points.size (), 0.0);
   if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] Added channel: %s", cloud_svm_->channels[pcIdx].name.c_str ());
 
-  // Go through all the points and classify them
-  int success = 0;
-  for (size_t cp = 0; cp < cloud_svm_->points.size (); cp++)
-  {
-    // Construct node
-    int i = 0;
-    for (i = 0; i < nr_values; i++)
-    {
-      node[i].index = i+1;
-      double feature_value = cloud_svm_->channels[fIdx + i].values[cp];
-      if (value_ranges != NULL)
-        node[i].value = scaleFeature (i, feature_value, value_ranges, lower, upper);
-      else
-        node[i].value = feature_value; //points[cp][fIdx + i];
-    }
-    node[i].index = -1;
-
-    // Predict
-    cloud_svm_->channels[pcIdx].values[cp] = svm_predict (model, node);
+  // Go through all the points and classify them, in chunks distributed to the threads
+  int nr_threads = nr_threads_ > 0 ? nr_threads_ : boost::thread::hardware_concurrency ();
+  nr_threads = std::max (1, nr_threads);
+  next_point_ = 0;
+  boost::thread_group workers;
+  for (int t = 1; t < nr_threads; t++)
+    workers.create_thread (boost::bind (&SVMClassification::predictWorker, this, cloud.get (), fIdx, nr_values, value_ranges, lower, upper, &cloud_svm_->channels[pcIdx].values));
+  predictWorker (cloud.get (), fIdx, nr_values, value_ranges, lower, upper, &cloud_svm_->channels[pcIdx].values);
+  workers.join_all ();
 
-    // If labels were provided count the number of successful classifications
-    if (plIdx != -1 && cloud_svm_->channels[pcIdx].values[cp] == cloud_svm_->channels[plIdx].values[cp])
-      success++;
-  }
+  // If labels were provided count the number of successful classifications
   if (plIdx != -1)
+  {
+    int success = 0;
+    for (size_t cp = 0; cp < cloud_svm_->points.size (); cp++)
+      if (cloud_svm_->channels[pcIdx].values[cp] == cloud_svm_->channels[plIdx].values[cp])
+        success++;
     if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] Accuracy: %d/%d (%g%%).", success, (int)(cloud_svm_->points.size ()), success * 100.0 / cloud_svm_->points.size ());
+  }
 
   // Deallocate
-  svm_destroy_model (model);
-  free (node);
+  if (scale_self_)
+  {
+    delete[] value_ranges[0];
+    delete[] value_ranges;
+  }
 
   // Finish
   if (verbosity_level_ > 0) ROS_INFO ("[SVMClassification] SVM classification done in %g seconds.", (ros::Time::now () - global_time).toSec ());
@@ -0,0 +1,200 @@
+/*
+ * Measures the throughput of DepthImageTriangulation on synthetic tilting laser sweeps (a room seen by a
+ * Hokuyo-like scanner, with random dropouts), once with the former forward-scanning triangulation loop and
+ * once with the lookup image based, parallel triangulate ().
+ *
+ * Usage: depth_image_triangulation_benchmark [nr_lines nr_beams [dropout_ratio [iterations]]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <ros/time.h>
+#include <pcl_cloud_algos/depth_image_triangulation.h>
+
+using namespace pcl_cloud_algos;
+
+typedef pcl::PointCloud<pcl::PointXYZINormalScanLine> Cloud;
+
+// One sweep: beams from -135 to 135 deg in each line, lines tilting from -45 to 45 deg, inside a 8x6x3 m box
+void createSweep (Cloud &cloud, int nr_lines, int nr_beams, double dropout_ratio)
+{
+  cloud.points.clear ();
+  for (int l = 0; l < nr_lines; l++)
+  {
+    double tilt = (-45 + 90.0 * l / nr_lines) * M_PI / 180;
+    for (int b = 0; b < nr_beams; b++)
+    {
+      if (rand () < dropout_ratio * RAND_MAX)
+        continue;
+      double pan = (-135 + 270.0 * b / nr_beams) * M_PI / 180;
+      double dx = cos (tilt) * cos (pan), dy = cos (tilt) * sin (pan), dz = sin (tilt);
+      // distance to the walls of the box centered at the scanner
+      double t = 1e9;
+      if (fabs (dx) > 1e-9) t = std::min (t, 4.0 / fabs (dx));
+      if (fabs (dy) > 1e-9) t = std::min (t, 3.0 / fabs (dy));
+      if (fabs (dz) > 1e-9) t = std::min (t, 1.5 / fabs (dz));
+      pcl::PointXYZINormalScanLine p;
+      p.x = t * dx; p.y = t * dy; p.z = t * dz;
+      p.intensities = 1000;
+      p.normal[0] = p.normal[1] = p.normal[2] = 0;
+      p.index = b;
+      p.line = 0;
+      cloud.points.push_back (p);
+    }
+  }
+  cloud.width = cloud.points.size ();
+  cloud.height = 1;
+}
+
+struct triangle
+{
+  int a, b, c;
+};
+
+// The triangulation loop of DepthImageTriangulation::process () before the lookup image, returns the number of triangles
+int triangulateForward (const Cloud &cloud_with_line_, int max_line_, int max_index_, float max_length)
+{
+  std::vector<triangle> tr (2*max_line_*max_index_);
+  int nr = 0;
+  int a = 0, b, c, d, e;
+  bool skipped = false;
+  for (int i = 0; i <= max_line_; i++)
+  {
+    for (int j = 0; j <= max_index_; j++)
+    {
+      if (cloud_with_line_.points[a].line == i && cloud_with_line_.points[a].index == j)
+      {
+        b = c = d = e = -1;
+        if ((unsigned int)a+1 < cloud_with_line_.points.size() && cloud_with_line_.points[a+1].line == i && cloud_with_line_.points[a+1].index == j+1)
+          b = a+1;
+        int test = a;
+        while ((unsigned int)test < cloud_with_line_.points.size() && cloud_with_line_.points[test].line < i+1)
+          test++;
+        if ((unsigned int)test < cloud_with_line_.points.size() && cloud_with_line_.points[test].line == i+1)
+        {
+          if (skipped)
+          {
+            skipped = false;
+            while ((unsigned int)test < cloud_with_line_.points.size() && cloud_with_line_.points[test].index < j-1)
+              test++;
+            if ((unsigned int)test < cloud_with_line_.points.size())
+              if (cloud_with_line_.points[test].line == i+1 && cloud_with_line_.points[test].index)
+              {
+                e = test;
+                test++;
+              }
+          }
+          else
+          {
+            while ((unsigned int)test < cloud_with_line_.points.size() && cloud_with_line_.points[test].index < j)
+              test++;
+          }
+          if ((unsigned int)test < cloud_with_line_.points.size())
+          {
+            if (cloud_with_line_.points[test].line == i+1 && cloud_with_line_.points[test].index == j)
+            {
+              c = test;
+              if ((unsigned int)c+1 < cloud_with_line_.points.size() && cloud_with_line_.points[c+1].line == i+1 && cloud_with_line_.points[c+1].index == j+1)
+                d = c+1;
+            }
+            else if (cloud_with_line_.points[test].line == i+1 && cloud_with_line_.points[test].index == j+1)
+              d = test;
+          }
+        }
+
+#define DIST(p, q) sqrt ((cloud_with_line_.points[p].x - cloud_with_line_.points[q].x) * (cloud_with_line_.points[p].x - cloud_with_line_.points[q].x) + \
+                         (cloud_with_line_.points[p].y - cloud_with_line_.points[q].y) * (cloud_with_line_.points[p].y - cloud_with_line_.points[q].y) + \
+                         (cloud_with_line_.points[p].z - cloud_with_line_.points[q].z) * (cloud_with_line_.points[p].z - cloud_with_line_.points[q].z))
+        if (c != -1)
+        {
+          float AC = DIST (a, c);
+          if (e != -1 && AC < max_length && DIST (c, e) < max_length && DIST (a, e) < max_length)
+          {
+            tr[nr].a = a; tr[nr].b = c; tr[nr].c = e; nr++;
+          }
+          if (b != -1)
+          {
+            float BC = DIST (b, c);
+            if (DIST (a, b) < max_length && BC < max_length && AC < max_length)
+            {
+              tr[nr].a = a; tr[nr].b = b; tr[nr].c = c; nr++;
+            }
+            if (d != -1 && DIST (b, d) < max_length && BC < max_length && DIST (c, d) < max_length)
+            {
+              tr[nr].a = b; tr[nr].b = c; tr[nr].c = d; nr++;
+            }
+          }
+          else if (d != -1 && DIST (a, d) < max_length && DIST (c, d) < max_length && AC < max_length)
+          {
+            tr[nr].a = a; tr[nr].b = c; tr[nr].c = d; nr++;
+          }
+        }
+        else if (b != -1 && d != -1 && DIST (a, d) < max_length && DIST (b, d) < max_length && DIST (a, b) < max_length)
+        {
+          tr[nr].a = a; tr[nr].b = b; tr[nr].c = d; nr++;
+        }
+#undef DIST
+
+        a++;
+        if ((unsigned int)a >= cloud_with_line_.points.size())
+          break;
+      }
+      else
+        skipped = true;
+    }
+    if ((unsigned int)a >= cloud_with_line_.points.size())
+      break;
+  }
+  return nr;
+}
+
+int main (int argc, char** argv)
+{
+  int nr_lines = 1000, nr_beams = 1081, iterations = 3;
+  double dropout_ratio = 0.05;
+  if (argc > 2)
+  {
+    nr_lines = atoi (argv[1]);
+    nr_beams = atoi (argv[2]);
+  }
+  if (argc > 3)
+    dropout_ratio = atof (argv[3]);
+  if (argc > 4)
+    iterations = atoi (argv[4]);
+  ros::Time::init ();
+
+  Cloud cloud;
+  createSweep (cloud, nr_lines, nr_beams, dropout_ratio);
+  printf ("%d lines x %d beams, %.0f%% dropouts: %d points, %d iterations\n", nr_lines, nr_beams, dropout_ratio * 100, (int)cloud.points.size (), iterations);
+
+  DepthImageTriangulation dit;
+  dit.verbosity_level_ = 0;
+
+  // the line numbers and max line/index are set up the same way for both
+  dit.get_scan_and_point_id (cloud);
+  int max_line = 0, max_index = 0;
+  for (size_t p = 0; p < cloud.points.size (); p++)
+  {
+    max_line = std::max (max_line, (int)cloud.points[p].line);
+    max_index = std::max (max_index, (int)cloud.points[p].index);
+  }
+
+  ros::WallTime t0 = ros::WallTime::now ();
+  int nr_forward = 0;
+  for (int i = 0; i < iterations; i++)
+    nr_forward = triangulateForward (cloud, max_line, max_index, 0.05);
+  double t_forward = (ros::WallTime::now () - t0).toSec () / iterations;
+
+  DepthImageTriangulation::OutputType mesh;
+  t0 = ros::WallTime::now ();
+  for (int i = 0; i < iterations; i++)
+    dit.triangulate (cloud, mesh);
+  double t_lookup = (ros::WallTime::now () - t0).toSec () / iterations;
+
+  printf ("forward scanning: %8.2f ms/sweep, %6.2f Mpoints/s, %d triangles\n", t_forward * 1000, cloud.points.size () / t_forward * 1e-6, nr_forward);
+  printf ("lookup image:     %8.2f ms/sweep, %6.2f Mpoints/s, %d triangles (%.2fx)\n", t_lookup * 1000, cloud.points.size () / t_lookup * 1e-6, (int)mesh.triangles.size (), t_forward / t_lookup);
+  return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2009, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Willow Garage, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCL_CLOUD_TOOLS_CROP_BOX_VOXEL_GRID_H_
+#define PCL_CLOUD_TOOLS_CROP_BOX_VOXEL_GRID_H_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/filters/filter.h>
+
+#include <boost/unordered_map.hpp>
+#include <boost/cstdint.hpp>
+
+#include <Eigen/Geometry>
+
+#include <cfloat>
+#include <vector>
+
+namespace pcl
+{
+  /** \brief @b CropBoxVoxelGrid crops a point cloud with a (possibly oriented) box and downsamples the surviving
+    * points on a voxel grid in a single pass over the data.
+    *
+    * Replaces chains of VoxelGrid/PassThrough filters with per-axis field limits, which produce one intermediate
+    * cloud per axis. Occupied voxels are accumulated in a hash map keyed by the packed integer voxel coordinates,
+    * so memory grows with the number of occupied voxels and not with the extent of the box.
+    *
+    * The box is given by its minimum and maximum corners in the box frame. By default the box frame is the frame
+    * of the input cloud (axis-aligned crop); use \a setBoxPose to crop with an arbitrarily oriented box. The voxel
+    * grid is always aligned with the frame of the input cloud, just like the one of pcl::VoxelGrid.
+    *
+    * NaN points, as present in organized (Kinect) clouds, are skipped. The downsampled output is unorganized. If
+    * the leaf size is zero only the crop is performed, and with \a setKeepOrganized (true) an organized input
+    * keeps its width/height with the cropped points set to NaN.
+    *
+    * \note each output point is a copy of the first input point that fell into its voxel (so that color,
+    * intensity etc. are preserved), with x/y/z replaced by the centroid of the voxel.
+    */
+  template <typename PointT>
+  class CropBoxVoxelGrid : public Filter<PointT>
+  {
+    using Filter<PointT>::filter_name_;
+    using Filter<PointT>::input_;
+    using Filter<PointT>::indices_;
+
+    typedef typename Filter<PointT>::PointCloud PointCloud;
+
+    public:
+      typedef boost::shared_ptr<CropBoxVoxelGrid<PointT> > Ptr;
+      typedef boost::shared_ptr<const CropBoxVoxelGrid<PointT> > ConstPtr;
+
+      /** \brief Empty constructor. No cropping and no downsampling until configured. */
+      CropBoxVoxelGrid () :
+        min_pt_ (-FLT_MAX, -FLT_MAX, -FLT_MAX), max_pt_ (FLT_MAX, FLT_MAX, FLT_MAX),
+        box_pose_ (Eigen::Affine3f::Identity ()), box_pose_inverse_ (Eigen::Affine3f::Identity ()),
+        has_box_pose_ (false), leaf_size_ (Eigen::Vector3f::Zero ()), inverse_leaf_size_ (Eigen::Vector3f::Zero ()),
+        keep_organized_ (false)
+      {
+        filter_name_ = "CropBoxVoxelGrid";
+      }
+
+      /** \brief Set the corners of the crop box, expressed in the box frame.
+        * \param min_pt the minimum x/y/z corner
+        * \param max_pt the maximum x/y/z corner
+        */
+      inline void
+      setBox (const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt)
+      {
+        min_pt_ = min_pt;
+        max_pt_ = max_pt;
+      }
+
+      /** \brief Convenience wrapper for an axis-aligned box given by per-axis limits, as set up with
+        * setFilterFieldName/setFilterLimits on a pcl::VoxelGrid. */
+      inline void
+      setBox (double x_min, double x_max, double y_min, double y_max, double z_min, double z_max)
+      {
+        setBox (Eigen::Vector3f (x_min, y_min, z_min), Eigen::Vector3f (x_max, y_max, z_max));
+      }
+
+      /** \brief Get the minimum corner of the crop box. */
+      inline Eigen::Vector3f getBoxMin () const { return (min_pt_); }
+
+      /** \brief Get the maximum corner of the crop box. */
+      inline Eigen::Vector3f getBoxMax () const { return (max_pt_); }
+
+      /** \brief Set the pose of the box frame with respect to the frame of the input cloud.
+        * \param pose transforms points from the box frame into the cloud frame
+        */
+      inline void
+      setBoxPose (const Eigen::Affine3f &pose)
+      {
+        box_pose_ = pose;
+        box_pose_inverse_ = pose.inverse ();
+        has_box_pose_ = !pose.matrix ().isIdentity ();
+      }
+
+      /** \brief Get the pose of the box frame with respect to the frame of the input cloud. */
+      inline Eigen::Affine3f getBoxPose () const { return (box_pose_); }
+
+      /** \brief Set the voxel grid leaf size. A leaf size of 0 on any axis disables downsampling.
+        * \param lx the leaf size for X
+        * \param ly the leaf size for Y
+        * \param lz the leaf size for Z
+        */
+      inline void
+      setLeafSize (float lx, float ly, float lz)
+      {
+        leaf_size_ = Eigen::Vector3f (lx, ly, lz);
+        for (int d = 0; d < 3; ++d)
+          inverse_leaf_size_[d] = (leaf_size_[d] > 0) ? 1.0f / leaf_size_[d] : 0.0f;
+      }
+
+      /** \brief Get the voxel grid leaf size. */
+      inline Eigen::Vector3f getLeafSize () const { return (leaf_size_); }
+
+      /** \brief Keep the structure of an organized input when only cropping (leaf size 0). Cropped points are
+        * set to NaN instead of being removed.
+        * \param keep_organized true to keep the input width/height
+        */
+      inline void setKeepOrganized (bool keep_organized) { keep_organized_ = keep_organized; }
+
+      /** \brief Get whether organized inputs are kept organized when only cropping. */
+      inline bool getKeepOrganized () const { return (keep_organized_); }
+
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    protected:
+      /** \brief Per-voxel accumulator. */
+      struct Leaf
+      {
+        float sum[3];
+        int nr_points;
+        int first_index;
+      };
+
+      /** \brief Crop and downsample the input cloud in a single pass.
+        * \param output the resultant point cloud
+        */
+      void
+      applyFilter (PointCloud &output);
+
+      /** \brief Check whether a (finite) point lies inside the crop box. */
+      inline bool
+      isInside (const PointT &p) const
+      {
+        Eigen::Vector3f q (p.x, p.y, p.z);
+        if (has_box_pose_)
+          q = box_pose_inverse_ * q;
+        return (q[0] >= min_pt_[0] && q[0] <= max_pt_[0] &&
+                q[1] >= min_pt_[1] && q[1] <= max_pt_[1] &&
+                q[2] >= min_pt_[2] && q[2] <= max_pt_[2]);
+      }
+
+      /** \brief Pack the integer voxel coordinates of a point into a single 64 bit hash key (21 bits per axis).
+        * \return false if the point falls outside of the addressable grid
+        */
+      inline bool
+      getVoxelKey (const PointT &p, boost::uint64_t &key) const
+      {
+        static const int offset = 1 << 20;
+        int ijk[3] = { static_cast<int> (floor (p.x * inverse_leaf_size_[0])),
+                       static_cast<int> (floor (p.y * inverse_leaf_size_[1])),
+                       static_cast<int> (floor (p.z * inverse_leaf_size_[2])) };
+        key = 0;
+        for (int d = 0; d < 3; ++d)
+        {
+          if (ijk[d] < -offset || ijk[d] >= offset)
+            return (false);
+          key = (key << 21) | static_cast<boost::uint64_t> (ijk[d] + offset);
+        }
+        return (true);
+      }
+
+      /** \brief The minimum and maximum corners of the crop box in the box frame. */
+      Eigen::Vector3f min_pt_, max_pt_;
+
+      /** \brief The pose of the box frame in the cloud frame, and its inverse. */
+      Eigen::Affine3f box_pose_, box_pose_inverse_;
+
+      /** \brief Whether the box frame differs from the cloud frame. */
+      bool has_box_pose_;
+
+      /** \brief The voxel grid leaf size and its inverse (0 on disabled axes). */
+      Eigen::Vector3f leaf_size_, inverse_leaf_size_;
+
+      /** \brief Keep organized inputs organized when only cropping. */
+      bool keep_organized_;
+
+      /** \brief Voxel accumulators, kept between calls to avoid reallocations on every frame. */
+      std::vector<Leaf> leaves_;
+
+      /** \brief Maps a packed voxel key to its accumulator in \a leaves_. */
+      boost::unordered_map<boost::uint64_t, int> leaf_map_;
+  };
+}
+
+#include "pcl_cloud_tools/crop_box_voxel_grid.hpp"
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2009, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Willow Garage, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCL_CLOUD_TOOLS_CROP_BOX_VOXEL_GRID_HPP_
+#define PCL_CLOUD_TOOLS_CROP_BOX_VOXEL_GRID_HPP_
+
+#include <limits>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+pcl::CropBoxVoxelGrid<PointT>::applyFilter (PointCloud &output)
+{
+  output.header = input_->header;
+  const bool downsample = (leaf_size_.minCoeff () > 0);
+
+  // ---[ Crop only: keep the organized structure if requested
+  if (!downsample && keep_organized_ && input_->height > 1)
+  {
+    const float bad_point = std::numeric_limits<float>::quiet_NaN ();
+    output = *input_;
+    output.is_dense = false;
+    std::vector<bool> keep (input_->points.size (), false);
+    for (size_t i = 0; i < indices_->size (); ++i)
+    {
+      const PointT &p = input_->points[(*indices_)[i]];
+      if (pcl_isfinite (p.x) && pcl_isfinite (p.y) && pcl_isfinite (p.z) && isInside (p))
+        keep[(*indices_)[i]] = true;
+    }
+    for (size_t i = 0; i < output.points.size (); ++i)
+      if (!keep[i])
+        output.points[i].x = output.points[i].y = output.points[i].z = bad_point;
+    return;
+  }
+
+  output.points.clear ();
+  output.points.reserve (indices_->size () / 4);
+
+  // ---[ Crop only: copy the surviving points
+  if (!downsample)
+  {
+    for (size_t i = 0; i < indices_->size (); ++i)
+    {
+      const PointT &p = input_->points[(*indices_)[i]];
+      if (pcl_isfinite (p.x) && pcl_isfinite (p.y) && pcl_isfinite (p.z) && isInside (p))
+        output.points.push_back (p);
+    }
+    output.width = output.points.size ();
+    output.height = 1;
+    output.is_dense = true;
+    return;
+  }
+
+  // ---[ Crop and accumulate the surviving points into their voxels
+  leaves_.clear ();
+  leaf_map_.clear ();
+  boost::uint64_t key;
+  for (size_t i = 0; i < indices_->size (); ++i)
+  {
+    const int idx = (*indices_)[i];
+    const PointT &p = input_->points[idx];
+    if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+      continue;
+    if (!isInside (p) || !getVoxelKey (p, key))
+      continue;
+
+    std::pair<boost::unordered_map<boost::uint64_t, int>::iterator, bool> it =
+      leaf_map_.insert (std::make_pair (key, static_cast<int> (leaves_.size ())));
+    if (it.second)
+    {
+      Leaf leaf;
+      leaf.sum[0] = p.x; leaf.sum[1] = p.y; leaf.sum[2] = p.z;
+      leaf.nr_points = 1;
+      leaf.first_index = idx;
+      leaves_.push_back (leaf);
+    }
+    else
+    {
+      Leaf &leaf = leaves_[it.first->second];
+      leaf.sum[0] += p.x; leaf.sum[1] += p.y; leaf.sum[2] += p.z;
+      ++leaf.nr_points;
+    }
+  }
+
+  // ---[ One output point per occupied voxel, in order of first occurrence
+  output.points.resize (leaves_.size ());
+  for (size_t i = 0; i < leaves_.size (); ++i)
+  {
+    const Leaf &leaf = leaves_[i];
+    const float norm = 1.0f / static_cast<float> (leaf.nr_points);
+    output.points[i] = input_->points[leaf.first_index];
+    output.points[i].x = leaf.sum[0] * norm;
+    output.points[i].y = leaf.sum[1] * norm;
+    output.points[i].z = leaf.sum[2] * norm;
+  }
+  output.width = output.points.size ();
+  output.height = 1;
+  output.is_dense = true;
+}
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2009, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Willow Garage, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCL_CLOUD_TOOLS_LATEST_FRAME_BUFFER_H_
+#define PCL_CLOUD_TOOLS_LATEST_FRAME_BUFFER_H_
+
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <boost/circular_buffer.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <string>
+#include <vector>
+
+namespace pcl_cloud_tools
+{
+  /** \brief @b LatestFrameBuffer keeps a persistent subscription to a point cloud topic and a ring buffer of the
+    * most recent frames, so that services and action servers can answer requests from an already received (and
+    * already preprocessed) frame instead of calling ros::topic::waitForMessage on every request.
+    *
+    * Every incoming message is handed to a user supplied process function which fills a \a FrameT. This is where
+    * the expensive frame-level products (conversion, NaN masks, normals, dominant plane, ...) should be computed.
+    * The subscription is served by its own callback queue and spinner thread, so processing happens in the
+    * background as frames arrive and never blocks (nor is blocked by) the callbacks of the node's main queue. The
+    * subscriber queue has length 1: frames arriving while the previous one is still being processed are dropped
+    * in favour of the newest one.
+    *
+    * Frames are stored as shared const pointers and must not be modified by the requests using them.
+    */
+  template <typename FrameT>
+  class LatestFrameBuffer
+  {
+    public:
+      typedef boost::shared_ptr<FrameT> FramePtr;
+      typedef boost::shared_ptr<const FrameT> FrameConstPtr;
+
+      /** \brief Fills a frame from an incoming message. Returning false discards the frame. */
+      typedef boost::function<bool (const sensor_msgs::PointCloud2ConstPtr &, FrameT &)> ProcessFunction;
+
+      /** \brief Subscribe to \a topic and start processing frames in the background.
+        * \param nh the node handle to subscribe with
+        * \param topic the point cloud topic
+        * \param process the function computing a frame from a message
+        * \param capacity the number of most recent frames to keep
+        */
+      LatestFrameBuffer (const ros::NodeHandle &nh, const std::string &topic, const ProcessFunction &process,
+                         size_t capacity = 3) :
+        nh_ (nh), topic_ (topic), process_ (process), frames_ (capacity), spinner_ (1, &queue_)
+      {
+        nh_.setCallbackQueue (&queue_);
+        sub_ = nh_.subscribe (topic_, 1, &LatestFrameBuffer::cloudCallback, this);
+        spinner_.start ();
+      }
+
+      virtual ~LatestFrameBuffer ()
+      {
+        spinner_.stop ();
+        sub_.shutdown ();
+      }
+
+      /** \brief Get the most recent frame, waiting for a new one if the latest frame is older than \a max_age.
+        * \param max_age the staleness bound with respect to ros::Time::now (); zero or negative accepts any frame
+        * \param timeout how long to wait for a fresh enough frame
+        * \return the frame, or an empty pointer if no fresh enough frame arrived within \a timeout
+        */
+      FrameConstPtr
+      getLatest (const ros::Duration &max_age, const ros::Duration &timeout)
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        boost::system_time deadline = boost::get_system_time () +
+                                      boost::posix_time::microseconds (static_cast<long> (timeout.toSec () * 1e6));
+        do
+        {
+          if (isFresh (max_age))
+            return (frames_.back ().frame);
+        }
+        while (cond_.timed_wait (lock, deadline));
+
+        if (isFresh (max_age))
+          return (frames_.back ().frame);
+        ROS_WARN ("[LatestFrameBuffer] No frame younger than %f s received on %s within %f s.",
+                  max_age.toSec (), nh_.resolveName (topic_).c_str (), timeout.toSec ());
+        return (FrameConstPtr ());
+      }
+
+      /** \brief Get all buffered frames, oldest first. */
+      void
+      getRecent (std::vector<FrameConstPtr> &frames)
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        frames.clear ();
+        for (typename boost::circular_buffer<Entry>::const_iterator it = frames_.begin (); it != frames_.end (); ++it)
+          frames.push_back (it->frame);
+      }
+
+      /** \brief Get the number of buffered frames. */
+      size_t
+      size ()
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        return (frames_.size ());
+      }
+
+    protected:
+      /** \brief A processed frame together with the stamp of the message it was computed from. */
+      struct Entry
+      {
+        Entry (const ros::Time &s, const FrameConstPtr &f) : stamp (s), frame (f) {}
+        ros::Time stamp;
+        FrameConstPtr frame;
+      };
+
+      /** \brief Process an incoming message (spinner thread) and append the result to the ring buffer. */
+      void
+      cloudCallback (const sensor_msgs::PointCloud2ConstPtr &msg)
+      {
+        FramePtr frame (new FrameT);
+        if (!process_ (msg, *frame))
+          return;
+
+        boost::mutex::scoped_lock lock (mutex_);
+        frames_.push_back (Entry (msg->header.stamp, frame));
+        cond_.notify_all ();
+      }
+
+      /** \brief Check whether the latest frame respects the staleness bound. The mutex must be held. */
+      inline bool
+      isFresh (const ros::Duration &max_age) const
+      {
+        if (frames_.empty ())
+          return (false);
+        if (max_age <= ros::Duration (0))
+          return (true);
+        return (ros::Time::now () - frames_.back ().stamp <= max_age);
+      }
+
+      ros::NodeHandle nh_;
+      std::string topic_;
+      ProcessFunction process_;
+
+      /** \brief The most recent frames, newest at the back. */
+      boost::circular_buffer<Entry> frames_;
+      boost::mutex mutex_;
+      boost::condition_variable cond_;
+
+      /** \brief Private callback queue and spinner serving the subscription. */
+      ros::CallbackQueue queue_;
+      ros::AsyncSpinner spinner_;
+      ros::Subscriber sub_;
+  };
+}
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2009, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Willow Garage, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCL_CLOUD_TOOLS_ORGANIZED_H_
+#define PCL_CLOUD_TOOLS_ORGANIZED_H_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/PointIndices.h>
+#include <pcl/ModelCoefficients.h>
+
+#include <Eigen/Core>
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+/** Fast paths for organized (width x height, e.g. Kinect) point clouds, working directly on the image grid
+  * instead of building a kd-tree and running k-NN queries. All of them work for any resolution.
+  */
+namespace pcl_cloud_tools
+{
+  /** \brief Write \a value into an 8 bit image for every point of an organized cloud with a NaN coordinate.
+    * Other pixels are left untouched.
+    * \param cloud the organized input cloud
+    * \param mask pointer to the first row of a cloud.height x cloud.width 8 bit image (e.g. cv::Mat::data)
+    * \param step the size of an image row in bytes (e.g. cv::Mat::step)
+    * \param value the value to mark NaN points with
+    */
+  template <typename PointT> void
+  computeNaNMask (const pcl::PointCloud<PointT> &cloud, unsigned char *mask, size_t step, unsigned char value = 255);
+
+  /** \brief Check whether a cloud can be processed on its image grid. */
+  template <typename PointT> inline bool
+  isOrganized (const pcl::PointCloud<PointT> &cloud)
+  {
+    return (cloud.height > 1 && cloud.width * cloud.height == cloud.points.size ());
+  }
+
+  /** \brief @b OrganizedNormalEstimation estimates surface normals of an organized cloud from the covariance
+    * matrix of a fixed size pixel window around each point. The window sums are read from integral images, so the
+    * cost per point is constant and independent of the window size.
+    *
+    * Points with a NaN coordinate get NaN normals, as do points with less than 3 valid points in their window.
+    * Normals are flipped towards the viewpoint (by default the origin of the cloud frame, i.e. the camera).
+    */
+  template <typename PointT, typename NormalT>
+  class OrganizedNormalEstimation
+  {
+    public:
+      OrganizedNormalEstimation () : rect_size_ (7), vpx_ (0), vpy_ (0), vpz_ (0) {}
+
+      /** \brief Set the size (in pixels) of the square window used to estimate each normal. */
+      inline void setRectSize (int rect_size) { rect_size_ = rect_size; }
+
+      /** \brief Get the size (in pixels) of the square window used to estimate each normal. */
+      inline int getRectSize () const { return (rect_size_); }
+
+      /** \brief Set the viewpoint the normals are flipped towards. */
+      inline void
+      setViewPoint (float vpx, float vpy, float vpz)
+      {
+        vpx_ = vpx; vpy_ = vpy; vpz_ = vpz;
+      }
+
+      /** \brief Estimate the normals of an organized cloud.
+        * \param cloud the organized input cloud
+        * \param normals the resultant normals, organized like \a cloud
+        */
+      void
+      compute (const pcl::PointCloud<PointT> &cloud, pcl::PointCloud<NormalT> &normals);
+
+    protected:
+      /** \brief Number of accumulated values per integral image cell: count, x, y, z, xx, xy, xz, yy, yz, zz. */
+      static const int NR_SUMS = 10;
+
+      /** \brief Fill integral_ with the running sums of the (centered) point coordinates and their products. */
+      void
+      computeIntegralImages (const pcl::PointCloud<PointT> &cloud, const Eigen::Vector3d &center);
+
+      /** \brief Window size in pixels. */
+      int rect_size_;
+
+      /** \brief The viewpoint. */
+      float vpx_, vpy_, vpz_;
+
+      /** \brief (height+1) x (width+1) integral images, NR_SUMS values per cell. Kept to avoid reallocations. */
+      std::vector<double> integral_;
+  };
+
+  /** \brief @b OrganizedPlaneSegmentation finds all planes of an organized cloud by connected component labeling
+    * on the image grid. Two 4-neighbours belong to the same component if their normals differ by less than the
+    * angular threshold and the neighbour lies within the distance threshold of the point's tangent plane. A plane is
+    * fitted to every component with at least \a min_inliers points; components which are not planar enough (or, if
+    * an axis is given, whose normal deviates too much from it) are discarded.
+    *
+    * This replaces the RANSAC plane fit + Euclidean clustering of the inliers (and the kd-trees behind them), and
+    * yields connected planes directly.
+    */
+  template <typename PointT, typename NormalT>
+  class OrganizedPlaneSegmentation
+  {
+    public:
+      OrganizedPlaneSegmentation () :
+        cos_angular_threshold_ (cos (M_PI / 36.0)), distance_threshold_ (0.02), min_inliers_ (1000),
+        max_curvature_ (0.01), axis_ (Eigen::Vector3f::Zero ()), cos_eps_angle_ (-1)
+      {}
+
+      /** \brief Set the maximum angle (in radians) between the normals of neighbouring points of a plane. */
+      inline void setAngularThreshold (double angle) { cos_angular_threshold_ = cos (angle); }
+
+      /** \brief Set the maximum distance of a point from the tangent plane of its neighbour. */
+      inline void setDistanceThreshold (double distance) { distance_threshold_ = distance; }
+
+      /** \brief Set the minimum number of points of a plane. */
+      inline void setMinInliers (int min_inliers) { min_inliers_ = min_inliers; }
+
+      /** \brief Set the maximum curvature (smallest eigenvalue / sum of eigenvalues) of a plane. */
+      inline void setMaxCurvature (double max_curvature) { max_curvature_ = max_curvature; }
+
+      /** \brief Only keep planes whose normal is (anti-)parallel to \a axis within \a eps_angle radians.
+        * An \a eps_angle < 0 disables the check.
+        */
+      inline void
+      setAxis (const Eigen::Vector3f &axis, double eps_angle)
+      {
+        axis_ = axis.normalized ();
+        cos_eps_angle_ = (eps_angle < 0) ? -1 : cos (eps_angle);
+      }
+
+      /** \brief Segment the planes of an organized cloud.
+        * \param cloud the organized input cloud
+        * \param normals the normals of \a cloud (e.g. from OrganizedNormalEstimation)
+        * \param model_coefficients the resultant plane coefficients [a b c d], one per plane
+        * \param inlier_indices the resultant point indices of each plane, largest plane first
+        */
+      void
+      segment (const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<NormalT> &normals,
+               std::vector<pcl::ModelCoefficients> &model_coefficients,
+               std::vector<pcl::PointIndices> &inlier_indices);
+
+      /** \brief Get the per-point plane label of the last segmentation (index into the output vectors, -1 if the
+        * point does not belong to a plane). */
+      inline const std::vector<int>& getLabels () const { return (labels_); }
+
+    protected:
+      /** \brief Check whether point \a q can join the component of its neighbour \a p. */
+      inline bool
+      isConnected (const PointT &p, const NormalT &np, const PointT &q, const NormalT &nq) const
+      {
+        if (np.normal_x * nq.normal_x + np.normal_y * nq.normal_y + np.normal_z * nq.normal_z < cos_angular_threshold_)
+          return (false);
+        return (fabs (np.normal_x * (q.x - p.x) + np.normal_y * (q.y - p.y) + np.normal_z * (q.z - p.z)) <= distance_threshold_);
+      }
+
+      double cos_angular_threshold_, distance_threshold_;
+      int min_inliers_;
+      double max_curvature_;
+      Eigen::Vector3f axis_;
+      double cos_eps_angle_;
+
+      /** \brief Per-point labels of the last segmentation. */
+      std::vector<int> labels_;
+  };
+}
+
+#include "pcl_cloud_tools/organized.hpp"
+
+#endif
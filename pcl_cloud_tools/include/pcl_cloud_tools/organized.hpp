@@ -0,0 +1,331 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2009, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Willow Garage, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCL_CLOUD_TOOLS_ORGANIZED_HPP_
+#define PCL_CLOUD_TOOLS_ORGANIZED_HPP_
+
+#include <Eigen/Eigenvalues>
+
+#include <algorithm>
+#include <limits>
+
+namespace pcl_cloud_tools
+{
+  namespace detail
+  {
+    /** \brief Smallest eigenvalue and corresponding eigenvector of a symmetric 3x3 matrix, computed in closed form
+      * (much cheaper than an iterative solver when called once per pixel).
+      * \param m the symmetric input matrix
+      * \param eigenvector the resultant unit eigenvector of the smallest eigenvalue
+      * \param eigenvalue the smallest eigenvalue
+      */
+    inline void
+    smallestEigenVector (const Eigen::Matrix3d &m, Eigen::Vector3d &eigenvector, double &eigenvalue)
+    {
+      const double q = m.trace () / 3.0;
+      const double p1 = m (0, 1) * m (0, 1) + m (0, 2) * m (0, 2) + m (1, 2) * m (1, 2);
+      const double p2 = (m (0, 0) - q) * (m (0, 0) - q) + (m (1, 1) - q) * (m (1, 1) - q) +
+                        (m (2, 2) - q) * (m (2, 2) - q) + 2.0 * p1;
+      const double p = sqrt (p2 / 6.0);
+      if (p <= std::numeric_limits<double>::min ())
+      {
+        // isotropic matrix, any direction is an eigenvector
+        eigenvalue = q;
+        eigenvector = Eigen::Vector3d::UnitZ ();
+        return;
+      }
+      Eigen::Matrix3d b = (m - q * Eigen::Matrix3d::Identity ()) / p;
+      double r = b.determinant () / 2.0;
+      r = std::min (1.0, std::max (-1.0, r));
+      const double phi = acos (r) / 3.0;
+      eigenvalue = q + 2.0 * p * cos (phi + 2.0 * M_PI / 3.0);
+
+      // the eigenvector is orthogonal to the rows of (m - eigenvalue * I)
+      Eigen::Matrix3d a = m - eigenvalue * Eigen::Matrix3d::Identity ();
+      Eigen::Vector3d r0 = a.row (0), r1 = a.row (1), r2 = a.row (2);
+      Eigen::Vector3d c[3] = { r0.cross (r1), r0.cross (r2), r1.cross (r2) };
+      double n[3] = { c[0].squaredNorm (), c[1].squaredNorm (), c[2].squaredNorm () };
+      int best = (n[0] > n[1]) ? (n[0] > n[2] ? 0 : 2) : (n[1] > n[2] ? 1 : 2);
+      if (n[best] > 1e-20 * p2 * p2)
+      {
+        eigenvector = c[best] / sqrt (n[best]);
+        return;
+      }
+      // repeated smallest eigenvalue: fall back to the iterative solver
+      Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver (m);
+      eigenvalue = solver.eigenvalues () (0);
+      eigenvector = solver.eigenvectors ().col (0);
+    }
+
+    /** \brief Check whether all three coordinates of a point are finite. */
+    template <typename PointT> inline bool
+    isFinite (const PointT &p)
+    {
+      return (pcl_isfinite (p.x) && pcl_isfinite (p.y) && pcl_isfinite (p.z));
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+pcl_cloud_tools::computeNaNMask (const pcl::PointCloud<PointT> &cloud, unsigned char *mask, size_t step,
+                                 unsigned char value)
+{
+  for (size_t v = 0; v < cloud.height; ++v)
+  {
+    const PointT *row = &cloud.points[v * cloud.width];
+    unsigned char *mask_row = mask + v * step;
+    for (size_t u = 0; u < cloud.width; ++u)
+      if (!detail::isFinite (row[u]))
+        mask_row[u] = value;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT, typename NormalT> void
+pcl_cloud_tools::OrganizedNormalEstimation<PointT, NormalT>::computeIntegralImages (
+    const pcl::PointCloud<PointT> &cloud, const Eigen::Vector3d &center)
+{
+  const size_t width = cloud.width, height = cloud.height;
+  const size_t stride = (width + 1) * NR_SUMS;
+  integral_.assign ((height + 1) * stride, 0.0);
+
+  for (size_t v = 0; v < height; ++v)
+  {
+    double row_sum[NR_SUMS] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const double *above = &integral_[v * stride + NR_SUMS];
+    double *cell = &integral_[(v + 1) * stride + NR_SUMS];
+    for (size_t u = 0; u < width; ++u, above += NR_SUMS, cell += NR_SUMS)
+    {
+      const PointT &p = cloud.points[v * width + u];
+      if (detail::isFinite (p))
+      {
+        // centered coordinates keep the second order sums well conditioned
+        const double x = p.x - center[0], y = p.y - center[1], z = p.z - center[2];
+        row_sum[0] += 1;
+        row_sum[1] += x;     row_sum[2] += y;     row_sum[3] += z;
+        row_sum[4] += x * x; row_sum[5] += x * y; row_sum[6] += x * z;
+        row_sum[7] += y * y; row_sum[8] += y * z; row_sum[9] += z * z;
+      }
+      for (int s = 0; s < NR_SUMS; ++s)
+        cell[s] = above[s] + row_sum[s];
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT, typename NormalT> void
+pcl_cloud_tools::OrganizedNormalEstimation<PointT, NormalT>::compute (const pcl::PointCloud<PointT> &cloud,
+                                                                       pcl::PointCloud<NormalT> &normals)
+{
+  const float bad_value = std::numeric_limits<float>::quiet_NaN ();
+  const int width = cloud.width, height = cloud.height;
+  normals.header = cloud.header;
+  normals.width = width;
+  normals.height = height;
+  normals.is_dense = false;
+  normals.points.resize (cloud.points.size ());
+
+  // any valid point serves as the center for the integral images
+  Eigen::Vector3d center = Eigen::Vector3d::Zero ();
+  for (size_t i = 0; i < cloud.points.size (); ++i)
+    if (detail::isFinite (cloud.points[i]))
+    {
+      center = Eigen::Vector3d (cloud.points[i].x, cloud.points[i].y, cloud.points[i].z);
+      break;
+    }
+  computeIntegralImages (cloud, center);
+
+  const size_t stride = (width + 1) * NR_SUMS;
+  const int half = rect_size_ / 2;
+  for (int v = 0; v < height; ++v)
+  {
+    const int v0 = std::max (0, v - half), v1 = std::min (height, v + half + 1);
+    for (int u = 0; u < width; ++u)
+    {
+      const PointT &p = cloud.points[v * width + u];
+      NormalT &n = normals.points[v * width + u];
+      n.normal_x = n.normal_y = n.normal_z = n.curvature = bad_value;
+      if (!detail::isFinite (p))
+        continue;
+
+      const int u0 = std::max (0, u - half), u1 = std::min (width, u + half + 1);
+      const double *s11 = &integral_[v1 * stride + u1 * NR_SUMS], *s01 = &integral_[v0 * stride + u1 * NR_SUMS];
+      const double *s10 = &integral_[v1 * stride + u0 * NR_SUMS], *s00 = &integral_[v0 * stride + u0 * NR_SUMS];
+      double s[NR_SUMS];
+      for (int k = 0; k < NR_SUMS; ++k)
+        s[k] = s11[k] - s01[k] - s10[k] + s00[k];
+      if (s[0] < 3)
+        continue;
+
+      const double inv = 1.0 / s[0];
+      const double mx = s[1] * inv, my = s[2] * inv, mz = s[3] * inv;
+      Eigen::Matrix3d covariance;
+      covariance (0, 0) = s[4] * inv - mx * mx;
+      covariance (0, 1) = covariance (1, 0) = s[5] * inv - mx * my;
+      covariance (0, 2) = covariance (2, 0) = s[6] * inv - mx * mz;
+      covariance (1, 1) = s[7] * inv - my * my;
+      covariance (1, 2) = covariance (2, 1) = s[8] * inv - my * mz;
+      covariance (2, 2) = s[9] * inv - mz * mz;
+
+      Eigen::Vector3d normal;
+      double eigenvalue;
+      detail::smallestEigenVector (covariance, normal, eigenvalue);
+      const double trace = covariance.trace ();
+
+      // flip towards the viewpoint
+      if (normal[0] * (vpx_ - p.x) + normal[1] * (vpy_ - p.y) + normal[2] * (vpz_ - p.z) < 0)
+        normal = -normal;
+      n.normal_x = normal[0];
+      n.normal_y = normal[1];
+      n.normal_z = normal[2];
+      n.curvature = (trace > 0) ? std::max (0.0, eigenvalue) / trace : 0;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT, typename NormalT> void
+pcl_cloud_tools::OrganizedPlaneSegmentation<PointT, NormalT>::segment (
+    const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<NormalT> &normals,
+    std::vector<pcl::ModelCoefficients> &model_coefficients, std::vector<pcl::PointIndices> &inlier_indices)
+{
+  const int width = cloud.width, height = cloud.height;
+  const int nr_points = width * height;
+  model_coefficients.clear ();
+  inlier_indices.clear ();
+  labels_.assign (nr_points, -1);
+  if ((int)normals.points.size () != nr_points)
+    return;
+
+  // valid: finite point and normal; components are collected with an explicit stack
+  std::vector<unsigned char> valid (nr_points, 0);
+  for (int i = 0; i < nr_points; ++i)
+    valid[i] = detail::isFinite (cloud.points[i]) && pcl_isfinite (normals.points[i].normal_x);
+
+  std::vector<int> component_of (nr_points, -1);
+  std::vector<std::vector<int> > components;
+  std::vector<int> stack;
+  const int du[4] = { 1, -1, 0, 0 }, dv[4] = { 0, 0, 1, -1 };
+  for (int seed = 0; seed < nr_points; ++seed)
+  {
+    if (!valid[seed] || component_of[seed] != -1)
+      continue;
+    const int label = components.size ();
+    components.push_back (std::vector<int> ());
+    std::vector<int> &members = components.back ();
+    component_of[seed] = label;
+    stack.push_back (seed);
+    while (!stack.empty ())
+    {
+      const int idx = stack.back ();
+      stack.pop_back ();
+      members.push_back (idx);
+      const int u = idx % width, v = idx / width;
+      for (int k = 0; k < 4; ++k)
+      {
+        const int nu = u + du[k], nv = v + dv[k];
+        if (nu < 0 || nu >= width || nv < 0 || nv >= height)
+          continue;
+        const int nidx = nv * width + nu;
+        if (!valid[nidx] || component_of[nidx] != -1)
+          continue;
+        if (!isConnected (cloud.points[idx], normals.points[idx], cloud.points[nidx], normals.points[nidx]))
+          continue;
+        component_of[nidx] = label;
+        stack.push_back (nidx);
+      }
+    }
+  }
+
+  // fit a plane to every large enough component, largest first
+  std::vector<std::pair<int, int> > order;
+  for (size_t c = 0; c < components.size (); ++c)
+    if ((int)components[c].size () >= min_inliers_)
+      order.push_back (std::make_pair (-(int)components[c].size (), (int)c));
+  std::sort (order.begin (), order.end ());
+
+  for (size_t o = 0; o < order.size (); ++o)
+  {
+    const std::vector<int> &members = components[order[o].second];
+    const PointT &ref = cloud.points[members[0]];
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero ();
+    Eigen::Matrix3d sum_sq = Eigen::Matrix3d::Zero ();
+    for (size_t i = 0; i < members.size (); ++i)
+    {
+      const PointT &p = cloud.points[members[i]];
+      Eigen::Vector3d d (p.x - ref.x, p.y - ref.y, p.z - ref.z);
+      sum += d;
+      sum_sq += d * d.transpose ();
+    }
+    const double inv = 1.0 / members.size ();
+    Eigen::Vector3d mean = sum * inv;
+    Eigen::Matrix3d covariance = sum_sq * inv - mean * mean.transpose ();
+    Eigen::Vector3d normal;
+    double eigenvalue;
+    detail::smallestEigenVector (covariance, normal, eigenvalue);
+    const double trace = covariance.trace ();
+    if (trace <= 0 || eigenvalue / trace > max_curvature_)
+      continue;
+    if (cos_eps_angle_ >= 0 && fabs (normal.cast<float> ().dot (axis_)) < cos_eps_angle_)
+      continue;
+
+    // orient the plane normal like the point normals
+    const NormalT &nref = normals.points[members[0]];
+    if (normal[0] * nref.normal_x + normal[1] * nref.normal_y + normal[2] * nref.normal_z < 0)
+      normal = -normal;
+    Eigen::Vector3d centroid = mean + Eigen::Vector3d (ref.x, ref.y, ref.z);
+
+    pcl::ModelCoefficients coefficients;
+    coefficients.header = cloud.header;
+    coefficients.values.resize (4);
+    coefficients.values[0] = normal[0];
+    coefficients.values[1] = normal[1];
+    coefficients.values[2] = normal[2];
+    coefficients.values[3] = -normal.dot (centroid);
+    model_coefficients.push_back (coefficients);
+
+    const int label = inlier_indices.size ();
+    inlier_indices.push_back (pcl::PointIndices ());
+    pcl::PointIndices &indices = inlier_indices.back ();
+    indices.header = cloud.header;
+    indices.indices = members;
+    std::sort (indices.indices.begin (), indices.indices.end ());
+    for (size_t i = 0; i < members.size (); ++i)
+      labels_[members[i]] = label;
+  }
+}
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2009, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of Willow Garage, Inc. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * @b crop_box_voxel_grid_benchmark compares the throughput of the fused
+ * CropBoxVoxelGrid filter against the chain of three pcl::VoxelGrid filters
+ * with x/y/z field limits, on (Kinect) frames loaded from PCD files.
+ */
+#include <pcl/point_types.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/common/time.h>
+#include <pcl/console/parse.h>
+#include <pcl/console/print.h>
+
+#include <pcl_cloud_tools/crop_box_voxel_grid.h>
+
+typedef pcl::PointXYZ Point;
+typedef pcl::PointCloud<Point> PointCloud;
+
+int
+main (int argc, char** argv)
+{
+  std::vector<int> pcd_indices = pcl::console::parse_file_extension_argument (argc, argv, ".pcd");
+  if (pcd_indices.empty ())
+  {
+    pcl::console::print_info ("Syntax is: %s <frame1.pcd> [frame2.pcd ...] <options>\n", argv[0]);
+    pcl::console::print_info ("  where options are:\n");
+    pcl::console::print_info ("    -leaf L        : voxel leaf size (default 0.01)\n");
+    pcl::console::print_info ("    -x min,max     : x limits (default 0.0,1.0)\n");
+    pcl::console::print_info ("    -y min,max     : y limits (default -0.5,0.5)\n");
+    pcl::console::print_info ("    -z min,max     : z limits (default 0.1,3.0)\n");
+    pcl::console::print_info ("    -iter N        : repetitions per frame (default 20)\n");
+    return (-1);
+  }
+
+  double leaf = 0.01;
+  double x_min = 0.0, x_max = 1.0, y_min = -0.5, y_max = 0.5, z_min = 0.1, z_max = 3.0;
+  int iterations = 20;
+  pcl::console::parse_argument (argc, argv, "-leaf", leaf);
+  pcl::console::parse_2x_arguments (argc, argv, "-x", x_min, x_max);
+  pcl::console::parse_2x_arguments (argc, argv, "-y", y_min, y_max);
+  pcl::console::parse_2x_arguments (argc, argv, "-z", z_min, z_max);
+  pcl::console::parse_argument (argc, argv, "-iter", iterations);
+
+  pcl::VoxelGrid<Point> vgrid;
+  vgrid.setLeafSize (leaf, leaf, leaf);
+
+  pcl::CropBoxVoxelGrid<Point> crop_grid;
+  crop_grid.setLeafSize (leaf, leaf, leaf);
+  crop_grid.setBox (x_min, x_max, y_min, y_max, z_min, z_max);
+
+  double total_chain = 0, total_fused = 0;
+  size_t total_points = 0;
+  for (size_t f = 0; f < pcd_indices.size (); ++f)
+  {
+    PointCloud::Ptr cloud (new PointCloud);
+    if (pcl::io::loadPCDFile (argv[pcd_indices[f]], *cloud) == -1)
+    {
+      pcl::console::print_error ("Couldn't read file %s\n", argv[pcd_indices[f]]);
+      continue;
+    }
+
+    PointCloud::Ptr cloud_x (new PointCloud), cloud_y (new PointCloud), cloud_z (new PointCloud);
+    PointCloud cloud_fused;
+
+    double start = pcl::getTime ();
+    for (int it = 0; it < iterations; ++it)
+    {
+      vgrid.setInputCloud (cloud);
+      vgrid.setFilterFieldName ("x");
+      vgrid.setFilterLimits (x_min, x_max);
+      vgrid.filter (*cloud_x);
+      vgrid.setInputCloud (cloud_x);
+      vgrid.setFilterFieldName ("y");
+      vgrid.setFilterLimits (y_min, y_max);
+      vgrid.filter (*cloud_y);
+      vgrid.setInputCloud (cloud_y);
+      vgrid.setFilterFieldName ("z");
+      vgrid.setFilterLimits (z_min, z_max);
+      vgrid.filter (*cloud_z);
+    }
+    double chain = (pcl::getTime () - start) / iterations;
+
+    start = pcl::getTime ();
+    for (int it = 0; it < iterations; ++it)
+    {
+      crop_grid.setInputCloud (cloud);
+      crop_grid.filter (cloud_fused);
+    }
+    double fused = (pcl::getTime () - start) / iterations;
+
+    pcl::console::print_info ("%s (%d x %d): VoxelGrid x3 %.2f ms (%d points), CropBoxVoxelGrid %.2f ms (%d points), speedup %.2fx\n",
+                              argv[pcd_indices[f]], (int)cloud->width, (int)cloud->height,
+                              chain * 1000.0, (int)cloud_z->points.size (),
+                              fused * 1000.0, (int)cloud_fused.points.size (), chain / fused);
+    total_chain += chain;
+    total_fused += fused;
+    total_points += cloud->points.size ();
+  }
+
+  if (total_fused > 0)
+    pcl::console::print_info ("Throughput: VoxelGrid x3 %.1f Mpoints/s, CropBoxVoxelGrid %.1f Mpoints/s\n",
+                              total_points / total_chain * 1e-6, total_points / total_fused * 1e-6);
+  return (0);
+}
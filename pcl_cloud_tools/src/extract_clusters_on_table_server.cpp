@@ -65,6 +65,9 @@
 
 #include <pcl_ros/publisher.h>
 
+#include "pcl_cloud_tools/crop_box_voxel_grid.h"
+#include "pcl_cloud_tools/organized.h"
+
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_listener.h>
 #include <tf/message_filter.h>
@@ -113,6 +116,9 @@ public:
       nh_.param("publish_token", publish_token_, false);
       nh_.param("padding", padding_, 0.85);
       nh_.param("target_frame", target_frame_, std::string("base_link"));
+      nh_.param("use_organized", use_organized_, true);
+      nh_.param("normal_rect_size", normal_rect_size_, 7);
+      nh_.param("plane_angular_threshold", plane_angular_threshold_, 5.0);
 
       service_ = nh_.advertiseService("cluster_tracking", &ExtractClustersServer::clustersCallback, this);
 
@@ -141,6 +147,14 @@ public:
 
       n3d_.setKSearch (k_);
       n3d_.setSearchMethod (normals_tree_);
+
+      // Organized clouds are not downsampled: crop them in place, then integral image normals and connected planes
+      organized_crop_.setBox (-FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX, z_min_limit_, z_max_limit_);
+      organized_crop_.setKeepOrganized (true);
+      organized_n3d_.setRectSize (normal_rect_size_);
+      organized_seg_.setAngularThreshold (pcl::deg2rad (plane_angular_threshold_));
+      organized_seg_.setDistanceThreshold (sac_distance_);
+      organized_seg_.setMinInliers (min_table_inliers_);
       //plane prior (for seg_.setAxis)
       //      base_link_head_tilt_link_angle_ = 0.9;
     }
@@ -193,8 +207,17 @@ private:
         // Downsample + filter the input dataser
         PointCloud cloud_raw, cloud;
         pcl::fromROSMsg (cloud_in, cloud_raw);
-        vgrid_.setInputCloud (boost::make_shared<PointCloud> (cloud_raw));
-        vgrid_.filter (cloud);
+        bool organized = use_organized_ && pcl_cloud_tools::isOrganized (cloud_raw);
+        if (organized)
+        {
+          organized_crop_.setInputCloud (boost::make_shared<PointCloud> (cloud_raw));
+          organized_crop_.filter (cloud);
+        }
+        else
+        {
+          vgrid_.setInputCloud (boost::make_shared<PointCloud> (cloud_raw));
+          vgrid_.filter (cloud);
+        }
         //cloud_pub_.publish(cloud);
         //return;
       
@@ -205,23 +228,46 @@ private:
         pcl::PointCloud<Point> cloud_hull;
         // ---[ Estimate the point normals
         pcl::PointCloud<pcl::Normal> cloud_normals;
-        n3d_.setInputCloud (boost::make_shared<PointCloud> (cloud));
-        n3d_.compute (cloud_normals);
+        if (organized)
+          organized_n3d_.compute (cloud, cloud_normals);
+        else
+        {
+          n3d_.setInputCloud (boost::make_shared<PointCloud> (cloud));
+          n3d_.compute (cloud_normals);
+        }
         //cloud_pub_.publish(cloud_normals);
         //return;
         cloud_normals_.reset (new pcl::PointCloud<pcl::Normal> (cloud_normals));
       
-        seg_.setInputCloud (boost::make_shared<PointCloud> (cloud));
-        seg_.setInputNormals (cloud_normals_);
         //z axis in Kinect frame
         btVector3 axis(0.0, 0.0, 1.0);
         //rotate axis around x in Kinect frame for an angle between base_link and head_tilt_link + 90deg
         //todo: get angle automatically
         btVector3 axis2 = axis.rotate(btVector3(1.0, 0.0, 0.0), btScalar(base_link_head_tilt_link_angle_ + pcl::deg2rad(90.0)));
         //std::cerr << "axis: " << fabs(axis2.getX()) << " " << fabs(axis2.getY()) << " " << fabs(axis2.getZ()) << std::endl;
-        seg_.setAxis (Eigen::Vector3f(fabs(axis2.getX()), fabs(axis2.getY()), fabs(axis2.getZ())));
-        // seg_.setIndices (boost::make_shared<pcl::PointIndices> (selection));
-        seg_.segment (table_inliers, table_coeff);
+        if (organized)
+        {
+          // the largest connected plane perpendicular to the axis is the table
+          std::vector<pcl::ModelCoefficients> planes;
+          std::vector<pcl::PointIndices> plane_inliers;
+          organized_seg_.setAxis (Eigen::Vector3f(fabs(axis2.getX()), fabs(axis2.getY()), fabs(axis2.getZ())), pcl::deg2rad(eps_angle_));
+          organized_seg_.segment (cloud, cloud_normals, planes, plane_inliers);
+          if (planes.empty ())
+            table_coeff.values.assign (4, 0);
+          else
+          {
+            table_coeff = planes[0];
+            table_inliers = plane_inliers[0];
+          }
+        }
+        else
+        {
+          seg_.setInputCloud (boost::make_shared<PointCloud> (cloud));
+          seg_.setInputNormals (cloud_normals_);
+          seg_.setAxis (Eigen::Vector3f(fabs(axis2.getX()), fabs(axis2.getY()), fabs(axis2.getZ())));
+          // seg_.setIndices (boost::make_shared<pcl::PointIndices> (selection));
+          seg_.segment (table_inliers, table_coeff);
+        }
         ROS_INFO ("[%s] Table model: [%f, %f, %f, %f] with %d inliers.", getName ().c_str (), 
                   table_coeff.values[0], table_coeff.values[1], table_coeff.values[2], table_coeff.values[3], (int)table_inliers.indices.size ());
         if ((int)table_inliers.indices.size () <= min_table_inliers_)
@@ -325,6 +371,9 @@ private:
   double sac_distance_, normal_distance_weight_, z_min_limit_, z_max_limit_;
   double eps_angle_, seg_prob_, base_link_head_tilt_link_angle_;
   int k_, max_iter_, min_table_inliers_, nr_cluster_;
+  bool use_organized_;
+  int normal_rect_size_;
+  double plane_angular_threshold_;
   
   ros::Subscriber point_cloud_sub_;
 
@@ -349,6 +398,9 @@ private:
   pcl::PointCloud<Point> cloud_objects_;
   pcl::EuclideanClusterExtraction<Point> cluster_;
   KdTreePtr clusters_tree_, normals_tree_;
+  pcl::CropBoxVoxelGrid<Point> organized_crop_;     // z limits, keeping organized clouds organized
+  pcl_cloud_tools::OrganizedNormalEstimation<Point, pcl::Normal> organized_n3d_;
+  pcl_cloud_tools::OrganizedPlaneSegmentation<Point, pcl::Normal> organized_seg_;
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   /** \brief Get a string representation of the name of this class. */
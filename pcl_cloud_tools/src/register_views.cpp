@@ -29,6 +29,8 @@
 #include <Eigen/Geometry>
 #include <Eigen/SVD>
 
+#include <boost/thread.hpp>
+
 // for srand init
 #include <time.h>
 
@@ -83,47 +85,149 @@ inline Matrix4f computeTransformation (const ANNpoint target, const ANNpoint sou
   return transform;
 }
 
-ANNpointArray evaluateTransformation (Matrix4f transform, vector<PCD>::iterator model, double sqr_threshold, int step, int limit_match, int limit_inliers, vector<int> &match_idx, vector<int> &tmp_inliers)
+// Uniform grid over the scan points with cells as large as the inlier threshold: a fixed radius search only has to
+// look at the 27 cells around the query, and unlike the ANN searches it can be used from several threads
+struct RadiusGrid
 {
-  int nr_check = model->header.nr_points / step;
+  void build (ANNpointArray pts, int nr_points, double radius)
+  {
+    points = pts;
+    inv_cell_size = 1.0 / radius;
+    vector<pair<long long, int> > keyed (nr_points);
+    for (int i = 0; i < nr_points; i++)
+      keyed[i] = make_pair (key ((int)floor (points[i][0] * inv_cell_size), (int)floor (points[i][1] * inv_cell_size), (int)floor (points[i][2] * inv_cell_size)), i);
+    sort (keyed.begin (), keyed.end ());
+    cell_keys.clear (); cell_start.clear (); indices.resize (nr_points);
+    for (int i = 0; i < nr_points; i++)
+    {
+      if (i == 0 || keyed[i].first != keyed[i-1].first)
+      {
+        cell_keys.push_back (keyed[i].first);
+        cell_start.push_back (i);
+      }
+      indices[i] = keyed[i].second;
+    }
+    cell_start.push_back (nr_points);
+  }
+
+  // returns the number of points within sqrt(sqr_radius) of q (at most the cell size), and the closest one in nn
+  int search (const double q[3], double sqr_radius, int &nn) const
+  {
+    int cx = (int)floor (q[0] * inv_cell_size), cy = (int)floor (q[1] * inv_cell_size), cz = (int)floor (q[2] * inv_cell_size);
+    int nr_nn = 0;
+    double best = sqr_radius;
+    for (int x = cx - 1; x <= cx + 1; x++)
+      for (int y = cy - 1; y <= cy + 1; y++)
+        for (int z = cz - 1; z <= cz + 1; z++)
+        {
+          long long k = key (x, y, z);
+          vector<long long>::const_iterator it = lower_bound (cell_keys.begin (), cell_keys.end (), k);
+          if (it == cell_keys.end () || *it != k)
+            continue;
+          int c = it - cell_keys.begin ();
+          for (int i = cell_start[c]; i < cell_start[c+1]; i++)
+          {
+            const ANNpoint p = points[indices[i]];
+            double d = SQR(p[0] - q[0]) + SQR(p[1] - q[1]) + SQR(p[2] - q[2]);
+            if (d > sqr_radius)
+              continue;
+            nr_nn++;
+            if (d < best || (d == best && indices[i] < nn))
+            {
+              best = d;
+              nn = indices[i];
+            }
+          }
+        }
+    return nr_nn;
+  }
+
+  static long long key (int x, int y, int z)
+  {
+    return ((long long)(x + (1<<20)) << 42) | ((long long)(y + (1<<20)) << 21) | (long long)(z + (1<<20));
+  }
+
+  ANNpointArray points;
+  double inv_cell_size;
+  vector<long long> cell_keys; // sorted keys of the occupied cells
+  vector<int> cell_start;      // first entry of each cell in indices
+  vector<int> indices;         // point indices sorted by cell
+};
+
+RadiusGrid grid;
+
+// Checks every step-th model point for a scan point in the threshold, returns the number of matches.
+// Stops as soon as the transformation can't produce more than limit_match matches.
+int evaluateTransformation (const Matrix4f &transform, const PCD &model, double sqr_threshold, int step, int limit_match, int limit_inliers, vector<int> &match_idx, vector<int> &tmp_inliers)
+{
+  int nr_check = (model.header.nr_points - 1) / step + 1;
   
   // evaluate transformation through exhaustive search
   match_idx.clear (); match_idx.reserve (nr_check);
   tmp_inliers.clear (); tmp_inliers.reserve (nr_check);
-  ANNpointArray transformed = annAllocPts (model->header.nr_points, 3);
-  int pos_match = nr_check;
-  int pos_inliers = nr_check;
-  for (int cp = 0; cp < model->header.nr_points; cp += step)
+  int pos_inliers = model.header.nr_points / step;
+  for (int cp = 0, checked = 1; cp < model.header.nr_points; cp += step, checked++)
   {
-    Vector4f sp (model->points[cp][0], model->points[cp][1], model->points[cp][2], 1);
-    //ANNpoint point = annAllocPt (3);
-    Map<Vector3f> tp (&(transformed[cp][0]));
-    tp = (transform * sp).start<3> ();
-    /*kd_tree->annkSearch (point, 1, nnIdx, sqrDists, 0.0);
-      if (sqrDists[0] < sqr_threshold)
-      {
-      match_idx.push_back (cp);
-      tmp_inliers.push_back (nnIdx[0]);
-      pos_match++;
-      pos_inliers++;
-      }*/
-    int nr_nn = kd_tree->annkFRSearch (transformed[cp], sqr_threshold, 0, NULL, NULL, 0.0);
-    if (nr_nn > 0)
+    Vector4f sp (model.points[cp][0], model.points[cp][1], model.points[cp][2], 1);
+    Vector3f tp = (transform * sp).start<3> ();
+    double q[3] = {tp[0], tp[1], tp[2]};
+    // count and nearest neighbor in one search
+    int nn = -1;
+    if (grid.search (q, sqr_threshold, nn) > 0)
     {
       match_idx.push_back (cp);
-      //kd_tree->annkSearch (point, 1, nnIdx, sqrDists, 0.0);
-      kd_tree->annkFRSearch (transformed[cp], sqr_threshold, 1, nnIdx, sqrDists, 0.0);
-      tmp_inliers.push_back (nnIdx[0]);
-      pos_match++;
+      tmp_inliers.push_back (nn);
       pos_inliers++;
     }
-    //annDeallocPt (point);
     // skip checking if there is no chance of producing a better match
-    if (pos_match - cp/step < limit_match ||
+    if ((int)match_idx.size () + nr_check - checked <= limit_match ||
         pos_inliers - cp/step < limit_inliers) // this will not exit early enough as tmp_inliers may contains duplicates as well, but it helps
       break;
   }
-  return transformed;
+  return match_idx.size ();
+}
+
+// Candidate transformations of the exhaustive search, evaluated by several threads
+struct CandidateEvaluation
+{
+  const vector<Matrix4f, aligned_allocator<Matrix4f> > *transforms;
+  const PCD *model;
+  double sqr_threshold;
+  int step, limit_inliers;
+
+  boost::mutex mutex; // guards the rest
+  int next;
+  int best;           // the first transformation with the most matches so far
+  vector<int> best_match_idx, best_inliers;
+};
+
+void evaluateTransformations (CandidateEvaluation *e)
+{
+  vector<int> match_idx, tmp_inliers;
+  while (true)
+  {
+    int c, limit_match;
+    {
+      boost::mutex::scoped_lock lock (e->mutex);
+      if (e->next >= (int)e->transforms->size ())
+        return;
+      c = e->next++;
+      // ties are won by the earlier transformation, as in a sequential search
+      limit_match = e->best_match_idx.size ();
+      if (e->best > c)
+        limit_match--;
+    }
+
+    int nr_match = evaluateTransformation ((*e->transforms)[c], *e->model, e->sqr_threshold, e->step, limit_match, e->limit_inliers, match_idx, tmp_inliers);
+
+    boost::mutex::scoped_lock lock (e->mutex);
+    if (nr_match > (int)e->best_match_idx.size () || (nr_match > 0 && nr_match == (int)e->best_match_idx.size () && c < e->best))
+    {
+      e->best = c;
+      e->best_match_idx.swap (match_idx);
+      e->best_inliers.swap (tmp_inliers);
+    }
+  }
 }
 
 /* ---[ */
@@ -144,6 +248,7 @@ main (int argc, char** argv)
   int max_nr_nn = 1;
   double center_x, center_y;
   double center_th = -1;
+  int nr_threads = boost::thread::hardware_concurrency ();
   
   /// Check and info
   if (argc < 3)
@@ -160,6 +265,7 @@ main (int argc, char** argv)
     fprintf (stderr, "                     -max_nr_nn N = use at most this many neighbors when getting the final number of inliers (default "); print_value (stderr, "%g", max_nr_nn); fprintf (stderr, ")\n");
     fprintf (stderr, "                     -center_th X = check deviation in 2D of model center to specified x,y and reject if less than X -- disabled if < 0 (default "); print_value (stderr, "%g", center_th); fprintf (stderr, ")\n");
     fprintf (stderr, "                     -center X,Y  = if center_th > 0, the model's center should be closer to these coordinates in 2D than the threshold\n");
+    fprintf (stderr, "                     -nr_threads N = number of threads evaluating transformations in the exhaustive search (default "); print_value (stderr, "%d", nr_threads); fprintf (stderr, ")\n");
     fprintf (stderr, "\n");
     fprintf (stderr, "                     -message S   = message string to be saved as comment (default "); print_value (stderr, "\"\" - none"); fprintf (stderr, ")\n");
     fprintf (stderr, "                     -params 0/1  = disable/enable saving of parameters as comment (default "); print_value (stderr, "disabled"); fprintf (stderr, ")\n");
@@ -183,6 +289,7 @@ main (int argc, char** argv)
   string message; ParseArgument (argc, argv, "-message", message); 
   bool params = false; ParseArgument (argc, argv, "-params", params);
   ParseArgument (argc, argv, "-max_nr_nn", max_nr_nn);
+  ParseArgument (argc, argv, "-nr_threads", nr_threads);
   
   print_info (stderr, "Probability of failure: %g (global), %g (local)\n", 1-p_success, 1-p2success);
 
@@ -235,6 +342,7 @@ main (int argc, char** argv)
   //ANNkd_tree*  kd_tree  = new ANNkd_tree (points, header.nr_points, 3, BUCKET_SIZE);
   //ANNidxArray  nnIdx    = new ANNidx[1];
   //ANNdistArray sqrDists = new ANNdist[1];
+  grid.build (points, header.nr_points, threshold);
   
   /// Load the models from the files
   vector<PCD> models (pPCDFileIndices.size () - 2);
@@ -369,6 +477,7 @@ main (int argc, char** argv)
       /// @TODO save these for outside the RANSAC loop as well?
       vector<int> best_match_idx;
       int best_source;
+      vector<int> match_idx, tmp_inliers;
       
       /// Iterate
       bool found_correspondence = false;
@@ -397,25 +506,21 @@ main (int argc, char** argv)
           
           // get transform and evaluate
           Matrix4f transform = computeTransformation (points[target], model->points[source], use_rotation);
-          vector<int> match_idx, tmp_inliers;
-          ANNpointArray transformed = evaluateTransformation (transform, model, sqr_threshold, step, best_match_idx.size (), best_model_inliers.size (), match_idx, tmp_inliers);
+          evaluateTransformation (transform, *model, sqr_threshold, step, best_match_idx.size (), best_model_inliers.size (), match_idx, tmp_inliers);
           
 //          // check centroid
 //          if (SQR(transform(0,3)-center_x) + SQR(transform(1,3)-center_y) > sqr_center_th)
 //          {
 //            nr_skipped++;
-//            annDeallocPts (transformed);
 //            continue;
 //          }
 
           // save best transformation
           if (best_match_idx.size () < match_idx.size ())
           {
-            if (result != NULL) annDeallocPts (result);
             match_transform = transform;
-            best_match_idx = match_idx;
-            result = transformed;
-            inliers = tmp_inliers;
+            best_match_idx.swap (match_idx);
+            inliers.swap (tmp_inliers);
             best_source = source;
             
             // compute the k2 parameter (k2=log(z)/log(1-w^n))
@@ -427,8 +532,6 @@ main (int argc, char** argv)
             
             //print_info (stderr, "[MODEL] Trial %d out of %g: best is: %d/%d so far.\n" , iterations2, ceil (k2), best_match_idx.size (), nr_check);
           }
-          else
-            annDeallocPts (transformed);
           
           iterations2++;
           //#if DEBUG
@@ -445,39 +548,41 @@ main (int argc, char** argv)
       }
       else
       {
+        // get the transformations in order (random rotations are drawn for points with vertical normals)
+        vector<Matrix4f, aligned_allocator<Matrix4f> > transforms;
+        vector<int> sources;
         for (int source = 0; source < model->header.nr_points; source++)
         {
           // check only point correspondences that have a high chance of producing a good transform
           if (!potentialMatch (points[target], model->points[source], use_rotation))
             continue;
-          found_correspondence = true;
+          transforms.push_back (computeTransformation (points[target], model->points[source], use_rotation));
+          sources.push_back (source);
+        }
+        found_correspondence = !transforms.empty ();
 
-          // get transform and evaluate
-          Matrix4f transform = computeTransformation (points[target], model->points[source], use_rotation);
-          vector<int> match_idx, tmp_inliers;
-          ANNpointArray transformed = evaluateTransformation (transform, model, sqr_threshold, step, best_match_idx.size (), best_model_inliers.size (), match_idx, tmp_inliers);
-          
-//          // check centroid
-//          if (SQR(transform(0,3)-center_x) + SQR(transform(1,3)-center_y) > sqr_center_th)
-//          {
-//            nr_skipped++;
-//            annDeallocPts (transformed);
-//            continue;
-//          }
+        // evaluate them in parallel, keeping the first one with the most matches
+        CandidateEvaluation e;
+        e.transforms = &transforms;
+        e.model = &(*model);
+        e.sqr_threshold = sqr_threshold;
+        e.step = step;
+        e.limit_inliers = best_model_inliers.size ();
+        e.next = 0;
+        e.best = -1;
+        boost::thread_group threads;
+        for (int t = 0; t < max (1, min (nr_threads, (int)transforms.size ())); t++)
+          threads.create_thread (boost::bind (&evaluateTransformations, &e));
+        threads.join_all ();
 
-          // save best transformation
-          if (best_match_idx.size () < match_idx.size ())
-          {
-            if (result != NULL) annDeallocPts (result);
-            match_transform = transform;
-            best_match_idx = match_idx;
-            result = transformed;
-            inliers = tmp_inliers;
-            //print_info (stderr, "[MODEL] Trial %d out of %ld: best is: %d so far.\n" , source, model->header.nr_points, best_match_idx.size ());
-            best_source = source;
-          }
-          else
-            annDeallocPts (transformed);
+        // save best transformation
+        if (e.best >= 0)
+        {
+          match_transform = transforms[e.best];
+          best_match_idx.swap (e.best_match_idx);
+          inliers.swap (e.best_inliers);
+          //print_info (stderr, "[MODEL] Trial %d out of %ld: best is: %d so far.\n" , e.best, model->header.nr_points, best_match_idx.size ());
+          best_source = sources[e.best];
         }
         sum_iter += model->header.nr_points;
       }
@@ -505,6 +610,7 @@ main (int argc, char** argv)
 ///        {
         //cerr << "before: " << inliers.size () << endl;
 ///
+        result = annAllocPts (model->header.nr_points, 3);
         inliers.clear ();
         inliers.reserve (model->header.nr_points);
         //int pos_match = model->header.nr_points;
@@ -524,7 +630,8 @@ main (int argc, char** argv)
           //  cerr << sp.transpose () << " - " << tp.transpose () << endl;
           //  cerr << match_transform << endl;
           //}
-          int nr_nn = kd_tree->annkFRSearch (result[cp], sqr_threshold, 0, NULL, NULL, 0.0);
+          // count and the closest max_nr_nn neighbors in one search
+          int nr_nn = kd_tree->annkFRSearch (result[cp], sqr_threshold, max_nr_nn, nnIdx, sqrDists, 0.0);
           //cerr << nr_nn << "/";
           if (nr_nn > 0)
           {
@@ -532,7 +639,6 @@ main (int argc, char** argv)
             //match_idx.push_back (cp);
             if (nr_nn > max_nr_nn)
               nr_nn = max_nr_nn;
-            kd_tree->annkFRSearch (result[cp], sqr_threshold, nr_nn, nnIdx, sqrDists, 0.0);
             for (int nn = 0; nn < nr_nn; nn++)
               inliers.push_back (nnIdx[nn]);
             //pos_match++;
@@ -0,0 +1,366 @@
+#ifndef PCL_VTK_TOOLS_TRIANGLE_BVH_H_
+#define PCL_VTK_TOOLS_TRIANGLE_BVH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace pcl_vtk_tools
+{
+
+/**
+  * \brief Bounding volume hierarchy over a triangle mesh, for casting many rays from the same viewpoint.
+  *
+  * The tree is built with the surface area heuristic evaluated on binned triangle centroids. Rays are traced in
+  * bundles sharing their origin (e.g. neighbouring beams of a laser scan): a node is visited if any ray of the
+  * bundle hits its box before its current closest hit, and the per-triangle terms that only depend on the origin
+  * are computed once for the whole bundle.
+  */
+class TriangleBVH
+{
+ public:
+  //! \brief maximum number of rays traced together, larger bundles are split
+  static const int MAX_BUNDLE_SIZE = 16;
+
+  TriangleBVH () {}
+
+  /** \brief builds the tree
+    * \param vertices x y z of each vertex
+    * \param triangles three vertex indices per triangle
+    * \param max_leaf_size leaves with more triangles are split as long as that is cheaper
+    */
+  void
+    build (const std::vector<double> &vertices, const std::vector<int> &triangles, int max_leaf_size = 4)
+  {
+    int nr_triangles = triangles.size () / 3;
+    nodes_.clear ();
+    tris_.clear ();
+    if (nr_triangles == 0)
+      return;
+
+    // bounds and centroids of the triangles
+    std::vector<double> tri_min (3*nr_triangles), tri_max (3*nr_triangles), centroids (3*nr_triangles);
+    for (int i = 0; i < nr_triangles; i++)
+      for (int d = 0; d < 3; d++)
+      {
+        double a = vertices[3*triangles[3*i] + d], b = vertices[3*triangles[3*i+1] + d], c = vertices[3*triangles[3*i+2] + d];
+        tri_min[3*i+d] = std::min (a, std::min (b, c));
+        tri_max[3*i+d] = std::max (a, std::max (b, c));
+        centroids[3*i+d] = (tri_min[3*i+d] + tri_max[3*i+d]) / 2;
+      }
+    std::vector<int> order (nr_triangles);
+    for (int i = 0; i < nr_triangles; i++)
+      order[i] = i;
+
+    nodes_.reserve (2 * nr_triangles / std::max (1, max_leaf_size) + 1);
+    nodes_.push_back (Node ());
+    std::vector<BuildRange> stack (1, BuildRange (0, 0, nr_triangles, 0));
+    while (!stack.empty ())
+    {
+      BuildRange r = stack.back ();
+      stack.pop_back ();
+      int count = r.end - r.begin;
+
+      // node and centroid bounds
+      double c_min[3], c_max[3];
+      Node &node = nodes_[r.node];
+      for (int d = 0; d < 3; d++)
+      {
+        node.min[d] = c_min[d] = std::numeric_limits<double>::max ();
+        node.max[d] = c_max[d] = -std::numeric_limits<double>::max ();
+      }
+      for (int i = r.begin; i < r.end; i++)
+        for (int d = 0; d < 3; d++)
+        {
+          node.min[d] = std::min (node.min[d], tri_min[3*order[i]+d]);
+          node.max[d] = std::max (node.max[d], tri_max[3*order[i]+d]);
+          c_min[d] = std::min (c_min[d], centroids[3*order[i]+d]);
+          c_max[d] = std::max (c_max[d], centroids[3*order[i]+d]);
+        }
+      node.first = r.begin;
+      node.count = count;
+      node.axis = 0;
+      if (count <= max_leaf_size)
+        continue;
+
+      int axis = 0;
+      for (int d = 1; d < 3; d++)
+        if (c_max[d] - c_min[d] > c_max[axis] - c_min[axis])
+          axis = d;
+      double extent = c_max[axis] - c_min[axis];
+      if (extent <= 0)
+        continue;
+
+      // SAH on binned centroids
+      int bin_count[NR_BINS];
+      double bin_min[NR_BINS][3], bin_max[NR_BINS][3];
+      for (int b = 0; b < NR_BINS; b++)
+      {
+        bin_count[b] = 0;
+        for (int d = 0; d < 3; d++)
+        {
+          bin_min[b][d] = std::numeric_limits<double>::max ();
+          bin_max[b][d] = -std::numeric_limits<double>::max ();
+        }
+      }
+      double scale = NR_BINS / extent;
+      for (int i = r.begin; i < r.end; i++)
+      {
+        int b = std::min (NR_BINS - 1, (int)((centroids[3*order[i]+axis] - c_min[axis]) * scale));
+        bin_count[b]++;
+        for (int d = 0; d < 3; d++)
+        {
+          bin_min[b][d] = std::min (bin_min[b][d], tri_min[3*order[i]+d]);
+          bin_max[b][d] = std::max (bin_max[b][d], tri_max[3*order[i]+d]);
+        }
+      }
+      // sweep from the right, then from the left
+      double right_area[NR_BINS];
+      int right_count[NR_BINS];
+      double acc_min[3], acc_max[3];
+      int acc_count = 0;
+      resetBounds (acc_min, acc_max);
+      for (int b = NR_BINS - 1; b > 0; b--)
+      {
+        growBounds (acc_min, acc_max, bin_min[b], bin_max[b]);
+        acc_count += bin_count[b];
+        right_count[b] = acc_count;
+        right_area[b] = acc_count > 0 ? area (acc_min, acc_max) : 0;
+      }
+      int best_split = -1;
+      double best_cost = std::numeric_limits<double>::max ();
+      acc_count = 0;
+      resetBounds (acc_min, acc_max);
+      for (int b = 1; b < NR_BINS; b++)
+      {
+        growBounds (acc_min, acc_max, bin_min[b-1], bin_max[b-1]);
+        acc_count += bin_count[b-1];
+        if (acc_count == 0 || right_count[b] == 0)
+          continue;
+        double cost = acc_count * area (acc_min, acc_max) + right_count[b] * right_area[b];
+        if (cost < best_cost)
+        {
+          best_cost = cost;
+          best_split = b;
+        }
+      }
+      // a leaf is cheaper than splitting (one node traversal costs about as much as one triangle test)
+      double node_area = area (node.min, node.max);
+      if (best_split < 0 || (best_cost / node_area + 1 >= count && count <= 4 * max_leaf_size))
+        continue;
+
+      int mid;
+      if (r.depth < MAX_SAH_DEPTH)
+      {
+        std::vector<int>::iterator it = order.begin () + r.begin;
+        for (int i = r.begin; i < r.end; i++)
+          if (std::min (NR_BINS - 1, (int)((centroids[3*order[i]+axis] - c_min[axis]) * scale)) < best_split)
+            std::swap (order[i], *it++);
+        mid = it - order.begin ();
+      }
+      else
+      {
+        // median splits from here on, so the traversal stack can't overflow on badly unbalanced meshes
+        mid = (r.begin + r.end) / 2;
+        std::nth_element (order.begin () + r.begin, order.begin () + mid, order.begin () + r.end, CentroidLess (centroids, axis));
+      }
+
+      int left = nodes_.size ();
+      nodes_[r.node].first = left;
+      nodes_[r.node].count = 0;
+      nodes_[r.node].axis = axis;
+      nodes_.push_back (Node ());
+      nodes_.push_back (Node ());
+      stack.push_back (BuildRange (left, r.begin, mid, r.depth + 1));
+      stack.push_back (BuildRange (left + 1, mid, r.end, r.depth + 1));
+    }
+
+    // triangles in leaf order, as a vertex and two edges
+    tris_.resize (nr_triangles);
+    for (int i = 0; i < nr_triangles; i++)
+    {
+      const double *a = &vertices[3*triangles[3*order[i]]], *b = &vertices[3*triangles[3*order[i]+1]], *c = &vertices[3*triangles[3*order[i]+2]];
+      for (int d = 0; d < 3; d++)
+      {
+        tris_[i].v0[d] = a[d];
+        tris_[i].e1[d] = b[d] - a[d];
+        tris_[i].e2[d] = c[d] - a[d];
+      }
+    }
+  }
+
+  /** \brief finds the closest hits of a bundle of rays starting at the same point
+    * \param origin start point of the rays
+    * \param directions x y z of each ray, normalized if t should be a distance
+    * \param nr_rays number of rays
+    * \param max_t hits further away are ignored
+    * \param t ray parameter of the closest hit of each ray, or -1 if it didn't hit anything
+    */
+  void
+    intersect (const double origin[3], const double *directions, int nr_rays, double max_t, double *t) const
+  {
+    for (int first = 0; first < nr_rays; first += MAX_BUNDLE_SIZE)
+      intersectBundle (origin, directions + 3*first, std::min (MAX_BUNDLE_SIZE, nr_rays - first), max_t, t + first);
+  }
+
+  //! \brief number of nodes in the tree
+  int
+    size () const
+  {
+    return nodes_.size ();
+  }
+
+ private:
+  static const int NR_BINS = 16;
+  static const int MAX_SAH_DEPTH = 48;
+
+  struct Node
+  {
+    double min[3], max[3];
+    int first; // first child (the second one follows it) or first triangle
+    int count; // number of triangles, 0 for inner nodes
+    int axis;  // split axis of inner nodes
+  };
+
+  struct Triangle
+  {
+    double v0[3], e1[3], e2[3];
+  };
+
+  struct BuildRange
+  {
+    BuildRange (int n, int b, int e, int dep) : node (n), begin (b), end (e), depth (dep) {}
+    int node, begin, end, depth;
+  };
+
+  struct CentroidLess
+  {
+    CentroidLess (const std::vector<double> &c, int a) : centroids (c), axis (a) {}
+    bool operator() (int i, int j) const
+    {
+      return centroids[3*i+axis] < centroids[3*j+axis];
+    }
+    const std::vector<double> &centroids;
+    int axis;
+  };
+
+  static void
+    resetBounds (double min[3], double max[3])
+  {
+    for (int d = 0; d < 3; d++)
+    {
+      min[d] = std::numeric_limits<double>::max ();
+      max[d] = -std::numeric_limits<double>::max ();
+    }
+  }
+
+  static void
+    growBounds (double min[3], double max[3], const double b_min[3], const double b_max[3])
+  {
+    for (int d = 0; d < 3; d++)
+    {
+      min[d] = std::min (min[d], b_min[d]);
+      max[d] = std::max (max[d], b_max[d]);
+    }
+  }
+
+  static double
+    area (const double min[3], const double max[3])
+  {
+    double dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+    return dx*dy + dy*dz + dz*dx;
+  }
+
+  void
+    intersectBundle (const double o[3], const double *dir, int nr_rays, double max_t, double *t) const
+  {
+    double best[MAX_BUNDLE_SIZE], inv[MAX_BUNDLE_SIZE][3];
+    for (int r = 0; r < nr_rays; r++)
+    {
+      best[r] = max_t;
+      for (int d = 0; d < 3; d++)
+        inv[r][d] = 1.0 / dir[3*r+d];
+    }
+
+    int stack[128];
+    int top = 0;
+    if (!nodes_.empty ())
+      stack[top++] = 0;
+    while (top > 0)
+    {
+      const Node &node = nodes_[stack[--top]];
+
+      // does any ray hit the box before its closest hit so far?
+      bool hit = false;
+      for (int r = 0; r < nr_rays && !hit; r++)
+      {
+        double t_min = 0, t_max = best[r];
+        for (int d = 0; d < 3; d++)
+        {
+          double t1 = (node.min[d] - o[d]) * inv[r][d], t2 = (node.max[d] - o[d]) * inv[r][d];
+          if (t1 > t2)
+            std::swap (t1, t2);
+          t_min = std::max (t_min, t1);
+          t_max = std::min (t_max, t2);
+        }
+        hit = t_min <= t_max;
+      }
+      if (!hit)
+        continue;
+
+      if (node.count == 0)
+      {
+        // visit the child on the side the rays come from first
+        if (dir[node.axis] < 0)
+        {
+          stack[top++] = node.first;
+          stack[top++] = node.first + 1;
+        }
+        else
+        {
+          stack[top++] = node.first + 1;
+          stack[top++] = node.first;
+        }
+        continue;
+      }
+
+      for (int i = node.first; i < node.first + node.count; i++)
+      {
+        const Triangle &tri = tris_[i];
+        // Moeller-Trumbore, s = o - v0 and q = s x e1 are the same for all rays of the bundle
+        double s[3] = {o[0] - tri.v0[0], o[1] - tri.v0[1], o[2] - tri.v0[2]};
+        double q[3] = {s[1]*tri.e1[2] - s[2]*tri.e1[1], s[2]*tri.e1[0] - s[0]*tri.e1[2], s[0]*tri.e1[1] - s[1]*tri.e1[0]};
+        double e2_q = tri.e2[0]*q[0] + tri.e2[1]*q[1] + tri.e2[2]*q[2];
+        for (int r = 0; r < nr_rays; r++)
+        {
+          const double *d = dir + 3*r;
+          double p[3] = {d[1]*tri.e2[2] - d[2]*tri.e2[1], d[2]*tri.e2[0] - d[0]*tri.e2[2], d[0]*tri.e2[1] - d[1]*tri.e2[0]};
+          double det = tri.e1[0]*p[0] + tri.e1[1]*p[1] + tri.e1[2]*p[2];
+          if (det == 0)
+            continue;
+          double inv_det = 1.0 / det;
+          double u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv_det;
+          if (u < 0 || u > 1)
+            continue;
+          double v = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) * inv_det;
+          if (v < 0 || u + v > 1)
+            continue;
+          double tt = e2_q * inv_det;
+          if (tt >= 0 && tt < best[r])
+            best[r] = tt;
+        }
+      }
+    }
+
+    for (int r = 0; r < nr_rays; r++)
+      t[r] = best[r] < max_t ? best[r] : -1;
+  }
+
+  std::vector<Node> nodes_;
+  std::vector<Triangle> tris_;
+};
+
+}
+
+#endif
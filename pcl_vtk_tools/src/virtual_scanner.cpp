@@ -49,6 +49,7 @@
 #include <ros/ros.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 // PCL dependencies
 #include <pcl/ros/register_point_struct.h>
 #include <pcl/io/pcd_io.h>
@@ -62,12 +63,11 @@
 
 // VTK dependencies (will go away after CVPR when we merge with trunk)
 #include <vtkMath.h>
-#include <vtkGeneralTransform.h>
 #include <vtkPlatonicSolidSource.h>
 #include <vtkLoopSubdivisionFilter.h>
 #include <vtkPLYReader.h>
 #include <vtkSmartPointer.h>
-#include <vtkCellLocator.h>
+#include <vtkCellArray.h>
 #include <vtkPolyData.h>
 
 //terminal_tools includes
@@ -76,7 +76,9 @@
 
 //local includes
 #include "pcl_vtk_tools/misc.h"
+#include "pcl_vtk_tools/triangle_bvh.h"
 
+#include <sstream>
 #include <vector>
 #define EPS 0.00001
 
@@ -103,16 +105,266 @@ vtkPolyData*
   return (reader->GetOutput ());
 }
 
-// struct PointXYZViewpoint;
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Collects the triangles of all polygons and triangle strips of a mesh
+  * (polygons are split into fans).
+  * \param data the mesh
+  * \param vertices x y z of each vertex
+  * \param triangles three vertex indices per triangle
+  */
+void
+  getTriangles (vtkPolyData* data, std::vector<double> &vertices, std::vector<int> &triangles)
+{
+  vertices.resize (3 * data->GetNumberOfPoints ());
+  for (vtkIdType i = 0; i < data->GetNumberOfPoints (); i++)
+    data->GetPoint (i, &vertices[3*i]);
+
+  vtkIdType nr_pts, *pts;
+  vtkCellArray *polys = data->GetPolys ();
+  for (polys->InitTraversal (); polys->GetNextCell (nr_pts, pts); )
+    for (vtkIdType j = 2; j < nr_pts; j++)
+    {
+      triangles.push_back (pts[0]);
+      triangles.push_back (pts[j-1]);
+      triangles.push_back (pts[j]);
+    }
+  vtkCellArray *strips = data->GetStrips ();
+  for (strips->InitTraversal (); strips->GetNextCell (nr_pts, pts); )
+    for (vtkIdType j = 2; j < nr_pts; j++)
+    {
+      triangles.push_back (pts[j-2]);
+      triangles.push_back (pts[j-1]);
+      triangles.push_back (pts[j]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Rotation by angle (in degrees) around axis, the same as vtkGeneralTransform::RotateWXYZ.
+  */
+void
+  getRotation (double angle, const double axis[3], double r[3][3])
+{
+  double len = sqrt (axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+  double x = axis[0], y = axis[1], z = axis[2];
+  if (len != 0)
+  {
+    x /= len; y /= len; z /= len;
+  }
+  double c = cos (angle * M_PI / 180.0), s = sin (angle * M_PI / 180.0), t = 1 - c;
+  r[0][0] = t*x*x + c;   r[0][1] = t*x*y - s*z; r[0][2] = t*x*z + s*y;
+  r[1][0] = t*x*y + s*z; r[1][1] = t*y*y + c;   r[1][2] = t*y*z - s*x;
+  r[2][0] = t*x*z - s*y; r[2][1] = t*y*z + s*x; r[2][2] = t*z*z + c;
+}
+
+// Everything the views share; the views are scanned by several threads
+struct ScanJob
+{
+  ScanParameters sp;
+  pcl_vtk_tools::TriangleBVH bvh;
+  vtkPolyData *sphere;
+  bool single_view, object_coordinates, binary;
+  double scan_dist;
+  double view_point[3], view_ray[3];
+  int noise_model;
+  itpp::Normal_RNG *n_rng;
+  itpp::Laplace_RNG *lap_rng;
+  std::string base_name;
+
+  int number_of_views, next_view;
+  boost::mutex mutex; // guards next_view, the random number generators and the output
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Scans the model from one viewpoint.
+  * \param job the model and scanner setup
+  * \param i index of the viewpoint on the sphere
+  * \param cloud the resulting points
+  */
+void
+  scanView (ScanJob &job, int i, pcl::PointCloud<pcl::PointWithViewpoint> &cloud)
+{
+  // Virtual camera parameters
+  double eye[3]     = {0.0, 0.0, 0.0};
+  double viewray[3] = {0.0, 0.0, 0.0};
+  double up[3]      = {0.0, 0.0, 0.0};
+  double right[3]  = {0.0, 0.0, 0.0};
+  double x_axis[3] = {1.0, 0.0, 0.0};
+  double z_axis[3] = {0.0, 0.0, 1.0};
+
+  if (job.single_view)
+  {
+    for (int d = 0; d < 3; d++)
+    {
+      eye[d] = job.view_point[d];
+      viewray[d] = job.view_ray[d];
+    }
+  }
+  else
+  {
+    job.sphere->GetPoint (i, eye);
+    if (fabs(eye[0]) < EPS) eye[0] = 0;
+    if (fabs(eye[1]) < EPS) eye[1] = 0;
+    if (fabs(eye[2]) < EPS) eye[2] = 0;
+
+    viewray[0] = -eye[0];
+    viewray[1] = -eye[1];
+    viewray[2] = -eye[2];
+    eye[0] *= job.scan_dist;
+    eye[1] *= job.scan_dist;
+    eye[2] *= job.scan_dist;
+  }
+
+  if ((viewray[0] == 0) && (viewray[1] == 0))
+    vtkMath::Cross (viewray, x_axis, right);
+  else
+    vtkMath::Cross (viewray, z_axis, right);
+  if (fabs(right[0]) < EPS) right[0] = 0;
+  if (fabs(right[1]) < EPS) right[1] = 0;
+  if (fabs(right[2]) < EPS) right[2] = 0;
+
+  vtkMath::Cross (viewray, right, up);
+  if (fabs(up[0]) < EPS) up[0] = 0;
+  if (fabs(up[1]) < EPS) up[1] = 0;
+  if (fabs(up[2]) < EPS) up[2] = 0;
+
+  if (!job.object_coordinates)
+  {
+    // Normalization
+    double right_len = sqrt (right[0]*right[0] + right[1]*right[1] + right[2]*right[2]);
+    right[0] /= right_len;
+    right[1] /= right_len;
+    right[2] /= right_len;
+    double up_len = sqrt (up[0]*up[0] + up[1]*up[1] + up[2]*up[2]);
+    up[0] /= up_len;
+    up[1] /= up_len;
+    up[2] /= up_len;
+
+    // Output resulting vectors
+    boost::mutex::scoped_lock lock (job.mutex);
+    cerr << "Viewray Right Up:" << endl;
+    cerr << viewray[0] << " " << viewray[1] << " " << viewray[2] << " " << endl;
+    cerr << right[0] << " " << right[1] << " " << right[2] << " " << endl;
+    cerr << up[0] << " " << up[1] << " " << up[2] << " " << endl;
+  }
+
+  // right = viewray x up
+  vtkMath::Cross (viewray, up, right);
+
+  // The horizontal rotations are the same for every vertical step
+  const ScanParameters &sp = job.sp;
+  double hor_start  = - ((double)(sp.nr_points_in_scans-1) / 2.0) * sp.hor_res;
+  double vert_start = - ((double)(sp.nr_scans-1) / 2.0) * sp.vert_res;
+  std::vector<double> hor_rot (9 * sp.nr_points_in_scans);
+  for (int h = 0; h < sp.nr_points_in_scans; h++)
+    getRotation (hor_start + h * sp.hor_res, up, (double (*)[3])&hor_rot[9*h]);
+
+  std::vector<double> beams (3 * sp.nr_points_in_scans), t (sp.nr_points_in_scans);
+  double vert_rot[3][3], temp_beam[3];
+  cloud.points.clear ();
+
+  // Sweep vertically
+  for (int v = 0; v < sp.nr_scans; v++)
+  {
+    getRotation (vert_start + v * sp.vert_res, right, vert_rot);
+    for (int d = 0; d < 3; d++)
+      temp_beam[d] = vert_rot[d][0]*viewray[0] + vert_rot[d][1]*viewray[1] + vert_rot[d][2]*viewray[2];
+
+    // Create the beam vectors with (lat,long) angles (vert, hor) with the viewray
+    for (int h = 0; h < sp.nr_points_in_scans; h++)
+    {
+      const double *r = &hor_rot[9*h];
+      double *beam = &beams[3*h];
+      for (int d = 0; d < 3; d++)
+        beam[d] = r[3*d]*temp_beam[0] + r[3*d+1]*temp_beam[1] + r[3*d+2]*temp_beam[2];
+      vtkMath::Normalize (beam);
+    }
+
+    // Sweep horizontally, find the first intersection up to max range
+    job.bvh.intersect (eye, &beams[0], sp.nr_points_in_scans, sp.max_dist, &t[0]);
+    for (int h = 0; h < sp.nr_points_in_scans; h++)
+    {
+      if (t[h] < 0)
+        continue;
+      double x[3];
+      for (int d = 0; d < 3; d++)
+        x[d] = eye[d] + beams[3*h+d] * t[h];
+
+      pcl::PointWithViewpoint pt;
+      if (job.object_coordinates)
+      {
+        pt.x = x[0]; pt.y = x[1]; pt.z = x[2];
+        pt.vp_x = eye[0]; pt.vp_y = eye[1]; pt.vp_z = eye[2];
+      }
+      else
+      {
+        // z axis is the viewray
+        // y axis is up
+        // x axis is -right (negative because z*y=-x but viewray*up=right)
+        pt.x = -right[0]*x[1] + up[0]*x[2] + viewray[0]*x[0] + eye[0];
+        pt.y = -right[1]*x[1] + up[1]*x[2] + viewray[1]*x[0] + eye[1];
+        pt.z = -right[2]*x[1] + up[2]*x[2] + viewray[2]*x[0] + eye[2];
+        pt.vp_x = pt.vp_y = pt.vp_z = 0.0;
+      }
+      cloud.points.push_back (pt);
+    } // Horizontal
+  } // Vertical
+  cloud.width = cloud.points.size ();
+  cloud.height = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** \brief Scans, noisifies and saves views until all are done.
+  */
+void
+  scanViews (ScanJob *job)
+{
+  pcl::PointCloud<pcl::PointWithViewpoint> cloud;
+  pcl::PCDWriter writer;
+  while (true)
+  {
+    int i;
+    {
+      boost::mutex::scoped_lock lock (job->mutex);
+      if (job->next_view >= job->number_of_views)
+        return;
+      i = job->next_view++;
+    }
+
+    scanView (*job, i, cloud);
+
+    // Noisify each point in the dataset
+    // \note: we might decide to noisify along the ray later
+    if (job->noise_model != 0)
+    {
+      boost::mutex::scoped_lock lock (job->mutex);
+      for (size_t cp = 0; cp < cloud.points.size (); ++cp)
+      {
+        // Add noise ?
+        switch (job->noise_model)
+        {
+          // Gaussian
+          case 1: { cloud.points[cp].x += (*job->n_rng) (); cloud.points[cp].y += (*job->n_rng) (); cloud.points[cp].z += (*job->n_rng) (); break; }
+          // Laplace
+          case 2: { cloud.points[cp].x += (*job->lap_rng) (); cloud.points[cp].y += (*job->lap_rng) (); cloud.points[cp].z += (*job->lap_rng) (); break; }
+        }
+      }
+    }
+
+    // Downsample and remove silly point duplicates
+    //pcl::PointCloud<pcl::PointWithViewpoint> cloud_downsampled;
+    //grid.setInputCloud (boost::make_shared<pcl::PointCloud<pcl::PointWithViewpoint> > (cloud));
+    //grid.filter (cloud_downsampled);
 
-// POINT_CLOUD_REGISTER_POINT_STRUCT (PointXYZViewpoint,
-//                                    (float, x, x)
-//                                    (float, y, y)
-//                                    (float, z, z)
-//                                    (float, vx, vx)
-//                                    (float, vy, vy)
-//                                    (float, vz, vz)
-// );
+    // Saves the point cloud data to disk
+    std::stringstream fname;
+    fname << job->base_name << i << ".pcd";
+    {
+      boost::mutex::scoped_lock lock (job->mutex);
+      ROS_INFO ("Writing %d points to %s", (int)cloud.points.size (), fname.str ().c_str ());
+    }
+    writer.write (fname.str (), cloud, job->binary);
+  }
+}
 
 /* ---[ */
 int
@@ -120,21 +372,26 @@ int
 {
   if (argc < 3)
     {
-    ROS_INFO("Usage %s -single_view <0|1> -view_point <x,y,z> -target_point <x,y,z> <model.ply | model.vtk>", argv[0]);
+    ROS_INFO("Usage %s -single_view <0|1> -view_point <x,y,z> -target_point <x,y,z> [-nr_threads <n>] [-binary <0|1>] <model.ply | model.vtk>", argv[0]);
     return -1;
     }
   std::string filename;
   // Parse the command line arguments for .vtk or .ply files
   std::vector<int> p_file_indices_vtk = terminal_tools::parse_file_extension_argument (argc, argv, ".vtk");
   std::vector<int> p_file_indices_ply = terminal_tools::parse_file_extension_argument (argc, argv, ".ply");
-  bool object_coordinates = true;
-  terminal_tools::parse_argument (argc, argv, "-object_coordinates", object_coordinates);
-  bool single_view = false;
-  terminal_tools::parse_argument (argc, argv, "-single_view", single_view);
+  ScanJob job;
+  job.object_coordinates = true;
+  terminal_tools::parse_argument (argc, argv, "-object_coordinates", job.object_coordinates);
+  job.single_view = false;
+  terminal_tools::parse_argument (argc, argv, "-single_view", job.single_view);
   double vx = 0, vy = 0, vz = 0;
   terminal_tools::parse_3x_arguments (argc, argv, "-view_point", vx, vy, vz);
   double tx = 0, ty = 0, tz = 0;
   terminal_tools::parse_3x_arguments (argc, argv, "-target_point", tx, ty, tz);
+  int nr_threads = boost::thread::hardware_concurrency ();
+  terminal_tools::parse_argument (argc, argv, "-nr_threads", nr_threads);
+  job.binary = true;
+  terminal_tools::parse_argument (argc, argv, "-binary", job.binary);
   vtkSmartPointer<vtkPolyData> data;
   // Loading VTK file
   if (p_file_indices_vtk.size() != 0)
@@ -160,29 +417,18 @@ int
       return -1;
     }
   // Default scan parameters
-  ScanParameters sp;
+  ScanParameters &sp = job.sp;
   sp.nr_scans           = 900;
   sp.nr_points_in_scans = 900;
   sp.max_dist           = 30000;   // maximum distance (in mm)
   sp.vert_res           = 0.25;
   sp.hor_res            = 0.25;
 
-  int noise_model = 0;              // set the default noise level to none
+  job.noise_model = 0;              // set the default noise level to none
   double noise_std = 0.5;           // 0.5 standard deviations by default
 
   int subdiv_level = 1;
-  double scan_dist = 3;
-  std::string fname, base;
-  char seq[256];
-
-  // Compute start/stop for vertical and horizontal
-  double vert_start = - ((double)(sp.nr_scans-1) / 2.0) * sp.vert_res;
-  double vert_end   = + ((sp.nr_scans-1) * sp.vert_res) + vert_start;
-  double hor_start  = - ((double)(sp.nr_points_in_scans-1) / 2.0) * sp.hor_res;
-  double hor_end    = + ((sp.nr_points_in_scans-1) * sp.hor_res) + hor_start;
-
-  // Prepare the point cloud data
-  pcl::PointCloud<pcl::PointWithViewpoint> cloud;
+  job.scan_dist = 3;
 
   // Prepare the leaves for downsampling
   pcl::VoxelGrid<pcl::PointWithViewpoint> grid;
@@ -193,20 +439,25 @@ int
   // Create random noise distributions with mean <0> and standard deviation <std>
   itpp::Normal_RNG    n_rng   (0.0, noise_std*noise_std);
   itpp::Laplace_RNG   lap_rng (0.0, noise_std*noise_std);
+  job.n_rng = &n_rng;
+  job.lap_rng = &lap_rng;
+
+  // The viewpoint and direction for single views
+  job.view_point[0] = vx; job.view_point[1] = vy; job.view_point[2] = vz;
+  job.view_ray[0] = tx - vx; job.view_ray[1] = ty - vy; job.view_ray[2] = tz - vz;
+  if (job.single_view)
+  {
+    double len = sqrt (job.view_ray[0]*job.view_ray[0] + job.view_ray[1]*job.view_ray[1] + job.view_ray[2]*job.view_ray[2]);
+    if (len == 0)
+    {
+      ROS_ERROR ("The single_view option is enabled but the view_point and the target_point are the same!");
+      return (0);
+    }
+    job.view_ray[0] /= len;
+    job.view_ray[1] /= len;
+    job.view_ray[2] /= len;
+  }
 
-  std::vector<std::string> st;
-  // Virtual camera parameters
-  double eye[3]     = {0.0, 0.0, 0.0};
-  double viewray[3] = {0.0, 0.0, 0.0};
-  double up[3]      = {0.0, 0.0, 0.0};
-  double right[3]  = {0.0, 0.0, 0.0};
-  double x_axis[3] = {1.0, 0.0, 0.0};
-  double z_axis[3] = {0.0, 0.0, 1.0};
-  double bounds[6];
-  double temp_beam[3], beam[3], p[3];
-  double p_coords[3], x[3], t;
-  int subId;
- 
   // Create a Icosahedron at center in origin and radius of 1
   vtkSmartPointer<vtkPlatonicSolidSource> icosa = vtkSmartPointer<vtkPlatonicSolidSource>::New ();
   icosa->SetSolidTypeToIcosahedron ();
@@ -218,193 +469,49 @@ int
   subdivide->SetInputConnection (icosa->GetOutputPort ());
 
   // Get camera positions
-  vtkPolyData *sphere = subdivide->GetOutput ();
-  sphere->Update ();
-  if(!single_view)
-    ROS_INFO ("Created %d camera position points.", (int)sphere->GetNumberOfPoints ());
-
-  // Build a spatial locator for our dataset
-  vtkSmartPointer<vtkCellLocator> tree = vtkSmartPointer<vtkCellLocator>::New ();
-  tree->SetDataSet (data);
-  tree->CacheCellBoundsOn ();
-  tree->SetTolerance (0.0);
-  tree->SetNumberOfCellsPerBucket (1);
-  tree->AutomaticOn ();
-  tree->BuildLocator ();
-  tree->Update ();
-
-  // Get the min-max bounds of data
-  data->GetBounds (bounds);
+  job.sphere = subdivide->GetOutput ();
+  job.sphere->Update ();
+  if(!job.single_view)
+    ROS_INFO ("Created %d camera position points.", (int)job.sphere->GetNumberOfPoints ());
+
+  // Build a bounding volume hierarchy over the triangles of our dataset
+  std::vector<double> vertices;
+  std::vector<int> triangles;
+  getTriangles (data, vertices, triangles);
+  ros::WallTime start = ros::WallTime::now ();
+  job.bvh.build (vertices, triangles);
+  ROS_INFO ("Built a BVH with %d nodes over %d triangles in %g seconds.", job.bvh.size (), (int)triangles.size () / 3,
+            (ros::WallTime::now () - start).toSec ());
 
   // if single view is required iterate over loop only once
-  int number_of_points = sphere->GetNumberOfPoints ();
-  if (single_view)
-    number_of_points = 1;
+  job.number_of_views = job.sphere->GetNumberOfPoints ();
+  if (job.single_view)
+    job.number_of_views = 1;
 
-  int sid = -1;
-  for (int i = 0; i < number_of_points; i++)
+  std::vector<std::string> st;
+  boost::trim (filename);
+  boost::split (st, filename, boost::is_any_of ("/"), boost::token_compress_on);
+  job.base_name = st.at (st.size () - 1);
+  std::string output_dir = job.base_name;
+  boost::filesystem::path outpath (output_dir);
+  if (!boost::filesystem::exists (outpath))
   {
-    sphere->GetPoint (i, eye);
-    if (fabs(eye[0]) < EPS) eye[0] = 0;
-    if (fabs(eye[1]) < EPS) eye[1] = 0;
-    if (fabs(eye[2]) < EPS) eye[2] = 0;
-
-    viewray[0] = -eye[0];
-    viewray[1] = -eye[1];
-    viewray[2] = -eye[2];
-    eye[0] *= scan_dist;
-    eye[1] *= scan_dist;
-    eye[2] *= scan_dist;
-    //Change here if only single view point is required
-    if (single_view)
-    {
-      eye[0] = vx;//0.0;
-      eye[1] = vy;//-0.26;
-      eye[2] = vz;//-0.86;
-      viewray[0] = tx - vx;
-      viewray[1] = ty - vy;
-      viewray[2] = tz - vz;
-      double len = sqrt (viewray[0]*viewray[0] + viewray[1]*viewray[1] + viewray[2]*viewray[2]);
-      if (len == 0)
-      {
-        ROS_ERROR ("The single_view option is enabled but the view_point and the target_point are the same!");
-        break;
-      }
-      viewray[0] /= len;
-      viewray[1] /= len;
-      viewray[2] /= len;
-    }
-
-    if ((viewray[0] == 0) && (viewray[1] == 0))
-      vtkMath::Cross (viewray, x_axis, right);
-    else
-      vtkMath::Cross (viewray, z_axis, right);
-    if (fabs(right[0]) < EPS) right[0] = 0;
-    if (fabs(right[1]) < EPS) right[1] = 0;
-    if (fabs(right[2]) < EPS) right[2] = 0;
-
-    vtkMath::Cross (viewray, right, up);
-    if (fabs(up[0]) < EPS) up[0] = 0;
-    if (fabs(up[1]) < EPS) up[1] = 0;
-    if (fabs(up[2]) < EPS) up[2] = 0;
-
-    if (!object_coordinates)
-    {
-      // Normalization
-      double right_len = sqrt (right[0]*right[0] + right[1]*right[1] + right[2]*right[2]);
-      right[0] /= right_len;
-      right[1] /= right_len;
-      right[2] /= right_len;
-      double up_len = sqrt (up[0]*up[0] + up[1]*up[1] + up[2]*up[2]);
-      up[0] /= up_len;
-      up[1] /= up_len;
-      up[2] /= up_len;
-    
-      // Output resulting vectors
-      cerr << "Viewray Right Up:" << endl;
-      cerr << viewray[0] << " " << viewray[1] << " " << viewray[2] << " " << endl;
-      cerr << right[0] << " " << right[1] << " " << right[2] << " " << endl;
-      cerr << up[0] << " " << up[1] << " " << up[2] << " " << endl;
-    }
-
-    // Create a transformation
-    vtkGeneralTransform* tr1 = vtkGeneralTransform::New ();
-    vtkGeneralTransform* tr2 = vtkGeneralTransform::New ();
-
-    // right = viewray x up
-    vtkMath::Cross (viewray, up, right);
-
-    // Sweep vertically
-    for (double vert = vert_start; vert <= vert_end; vert += sp.vert_res)
-    {
-      sid++;
-
-      tr1->Identity ();
-      tr1->RotateWXYZ (vert, right);
-      tr1->InternalTransformPoint (viewray, temp_beam);
-
-      // Sweep horizontally
-      int pid = -1;
-      for (double hor = hor_start; hor <= hor_end; hor += sp.hor_res)
-      {
-        pid ++;
-      
-        // Create a beam vector with (lat,long) angles (vert, hor) with the viewray
-        tr2->Identity ();
-        tr2->RotateWXYZ (hor, up);
-        tr2->InternalTransformPoint (temp_beam, beam);
-        vtkMath::Normalize (beam);
-
-        // Find point at max range: p = eye + beam * max_dist
-        for (int d = 0; d < 3; d++)
-          p[d] = eye[d] + beam[d] * sp.max_dist;
-
-        // Put p_coords into laser scan at packetid = vert, scan id = hor
-        vtkIdType cellId;
-        if (tree->IntersectWithLine (eye, p, 0, t, x, p_coords, subId, cellId))
-        {
-          pcl::PointWithViewpoint pt;
-          if (object_coordinates)
-          {
-            pt.x = x[0]; pt.y = x[1]; pt.z = x[2];
-            pt.vp_x = eye[0]; pt.vp_y = eye[1]; pt.vp_z = eye[2];
-          }
-          else
-          {
-            // z axis is the viewray
-            // y axis is up
-            // x axis is -right (negative because z*y=-x but viewray*up=right)
-            pt.x = -right[0]*x[1] + up[0]*x[2] + viewray[0]*x[0] + eye[0];
-            pt.y = -right[1]*x[1] + up[1]*x[2] + viewray[1]*x[0] + eye[1];
-            pt.z = -right[2]*x[1] + up[2]*x[2] + viewray[2]*x[0] + eye[2];
-            pt.vp_x = pt.vp_y = pt.vp_z = 0.0;
-          }
-          cloud.points.push_back(pt);
-        }
-      } // Horizontal
-    } // Vertical
-
-    // Noisify each point in the dataset
-    // \note: we might decide to noisify along the ray later
-    for (size_t cp = 0; cp < cloud.points.size (); ++cp)
-    {
-      // Add noise ?
-      switch (noise_model)
-      {
-        // Gaussian
-        case 1: { cloud.points[cp].x += n_rng (); cloud.points[cp].y += n_rng (); cloud.points[cp].z += n_rng (); break; }
-        // Laplace
-        case 2: { cloud.points[cp].x += lap_rng (); cloud.points[cp].y += lap_rng (); cloud.points[cp].z += lap_rng (); break; }
-      }
-    }
-
-    // Downsample and remove silly po int duplicates
-    pcl::PointCloud<pcl::PointWithViewpoint> cloud_downsampled;
-    grid.setInputCloud (boost::make_shared<pcl::PointCloud<pcl::PointWithViewpoint> > (cloud));
-    //grid.filter (cloud_downsampled);
-
-    // Saves the point cloud data to disk
-    sprintf (seq, "%d", (int)i);
-    boost::trim (filename);
-    boost::split (st, filename, boost::is_any_of ("/"), boost::token_compress_on);
-
-    std::stringstream ss;
-    std::string output_dir = st.at (st.size () - 1);
-    boost::filesystem::path outpath (output_dir);
-    if (!boost::filesystem::exists (outpath))
+    if (!boost::filesystem::create_directories (outpath))
     {
-      if (!boost::filesystem::create_directories (outpath))
-      {
-        ROS_ERROR ("Error creating directory %s.", output_dir.c_str ());
-        return (-1);
-      }
-      ROS_INFO ("Creating directory %s", output_dir.c_str ());
+      ROS_ERROR ("Error creating directory %s.", output_dir.c_str ());
+      return (-1);
     }
-
-    fname = st.at (st.size () - 1) + seq + ".pcd";
-    ROS_INFO ("Writing %d points to %s", (int)cloud.points.size (), fname.c_str ());
-    pcl::io::savePCDFile (fname.c_str (), cloud);
-  } // sphere
+    ROS_INFO ("Creating directory %s", output_dir.c_str ());
+  }
+
+  // Scan the views in parallel
+  start = ros::WallTime::now ();
+  job.next_view = 0;
+  boost::thread_group threads;
+  for (int t = 0; t < std::max (1, std::min (nr_threads, job.number_of_views)); t++)
+    threads.create_thread (boost::bind (&scanViews, &job));
+  threads.join_all ();
+  ROS_INFO ("Scanned %d views in %g seconds.", job.number_of_views, (ros::WallTime::now () - start).toSec ());
   return (0);
 }
 /* ]--- */
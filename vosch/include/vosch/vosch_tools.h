@@ -42,54 +42,154 @@ bool readPoints( const char *name, pcl::PointCloud<T>& cloud );
 //------------------------
 /// \brief compute normals
 template <typename T1, typename T2>
-  void computeNormal( pcl::PointCloud<T1> input_cloud, pcl::PointCloud<T2>& output_cloud );
+  void computeNormal( const pcl::PointCloud<T1> &input_cloud, pcl::PointCloud<T2>& output_cloud );
 
 //--------------------------
 /// \brief function for GRSD 
 int getType (float min_radius, float max_radius);
 
+//--------------------
+/// \brief concatenate
+const std::vector<float> concVector( const std::vector<float> &v1, const std::vector<float> &v2 );
+
+//-----------------------------------------------------------------------------
+/// \brief extracts any combination of GRSD / C3-HLAC / VOSCH descriptors of one voxelized cloud.
+///
+/// Normals, RSD radii (GRSD voxel types) and the 26-neighbour table of the voxels are computed once, on first use,
+/// and shared by all extract* calls. The extractor either owns the grid and the clouds (setInputCloud) or refers
+/// to ones owned by the caller (setInput), which are then neither copied nor modified and must stay alive while
+/// the extractor is used. Extractors cannot be copied.
+template <typename PointT>
+class VOSCHExtractor
+{
+public:
+  typedef pcl::PointCloud<PointT> PointCloud;
+
+  VOSCHExtractor ();
+
+  /// \brief compute normals of an RGB cloud and voxelize it. PointT has to hold xyz, rgb and normals.
+  template <typename PointInT>
+  void setInputCloud( const pcl::PointCloud<PointInT> &input_cloud, const float voxel_size );
+
+  /// \brief use an already voxelized cloud with normals (grid has to be created with setSaveLeafLayout(true), e.g. by getVoxelGrid)
+  void setInput( const pcl::VoxelGrid<PointT> &grid, const PointCloud &cloud, const PointCloud &cloud_downsampled, const float voxel_size );
+
+  const pcl::VoxelGrid<PointT>& getGrid() const { return *grid_; }
+  const PointCloud& getCloud() const { return *cloud_; }
+  const PointCloud& getDownsampledCloud() const { return *cloud_downsampled_; }
+  float getVoxelSize() const { return voxel_size_; }
+
+  /// \brief GRSD type of every downsampled point
+  const std::vector<int>& getTypes();
+
+  /// \brief indices of the 26 neighbour voxels of every downsampled point (-1 if empty), point after point.
+  ///        The first 13 of each point are the half neighbourhood used by GRSD325, the other 13 their mirror images.
+  const std::vector<int>& getNeighbors();
+
+  /// \brief answer subdivided GRSD requests (extractGRSDSignature21, extractVOSCH and extractConVOSCH with
+  ///        subdivision_size > 0) from 3D summed-area tables of the per-voxel GRSD transitions. The tables are built
+  ///        once, after that the histogram of every box costs 8 lookups per bin, whatever its size and position.
+  ///        Memory: 20 ints per voxel of the bounding box of the grid.
+  void setUseIntegralVolume( const bool use_integral_volume ){ use_integral_volume_ = use_integral_volume; }
+
+  /// \brief GRSD (20 dims) of the voxels in [box_min, box_max), in voxel coordinates relative to the minimum box
+  ///        coordinates of the grid. Builds the summed-area tables on first use.
+  void getGRSDSignature21InBox( const Eigen::Vector3i &box_min, const Eigen::Vector3i &box_max, std::vector<float> &feature, const bool is_normalize = false );
+
+  /// \brief GRSD (20 dims)
+  Eigen::Vector3i extractGRSDSignature21( std::vector< std::vector<float> > &feature, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+
+  /// \brief rotation-variant GRSD (325 dims)
+  Eigen::Vector3i extractGRSDSignature325( std::vector< std::vector<float> > &feature, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+
+  /// \brief PlusGRSD (110 dims)
+  Eigen::Vector3i extractPlusGRSDSignature110( std::vector< std::vector<float> > &feature, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+
+  /// \brief C3-HLAC (117 dims)
+  void extractC3HLACSignature117( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 );
+
+  /// \brief C3-HLAC (981 dims)
+  void extractC3HLACSignature981( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 );
+
+  /// \brief VOSCH = GRSD + C3-HLAC117 (137 dims)
+  Eigen::Vector3i extractVOSCH( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+
+  /// \brief ConVOSCH = GRSD + C3-HLAC981 (1001 dims)
+  Eigen::Vector3i extractConVOSCH( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+
+protected:
+  /// \brief check the subdivision parameters and compute the number of subdivisions along each axis
+  bool computeSubdivision( const char *caller, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, Eigen::Vector3i &subdiv_b, int &hist_num );
+
+  /// \brief compute the subdivision (histogram) index of every downsampled point, -1 for points before the offset
+  bool computeHistIndices( const char *caller, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, std::vector<int> &hist_idx, Eigen::Vector3i &subdiv_b, int &hist_num );
+
+  /// \brief build the summed-area table of every GRSD bin over the voxel grid
+  void computeIntegralVolume();
+
+  /// \brief the accessors of pcl::VoxelGrid are not const-qualified, but none of the ones used here modifies the grid
+  pcl::VoxelGrid<PointT>& grid() { return const_cast< pcl::VoxelGrid<PointT>& >( *grid_ ); }
+
+  pcl::VoxelGrid<PointT> own_grid_;
+  PointCloud own_cloud_, own_cloud_downsampled_;
+
+  const pcl::VoxelGrid<PointT> *grid_;
+  const PointCloud *cloud_, *cloud_downsampled_;
+  float voxel_size_;
+
+  std::vector<int> types_;
+  std::vector<int> neighbors_;
+  bool has_types_, has_neighbors_;
+
+  /// \brief (nx+1) x (ny+1) x (nz+1) cells of 20 bins each, x fastest
+  std::vector<int> integral_volume_;
+  Eigen::Vector3i integral_dims_;
+  bool has_integral_volume_, use_integral_volume_;
+
+private:
+  /// \brief not copyable: grid_ and the clouds may point into the own_* members of the object
+  VOSCHExtractor( const VOSCHExtractor& );
+  VOSCHExtractor& operator=( const VOSCHExtractor& );
+};
+
 //-------------------------
 /// \brief extract - GRSD -
 template <typename T>
-Eigen::Vector3i extractGRSDSignature21(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+Eigen::Vector3i extractGRSDSignature21( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
 
 template <typename T>
-void extractGRSDSignature21(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize = false );
+void extractGRSDSignature21( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize = false );
 
 //------------------------------------------
 /// \brief extract - rotation-variant GRSD -
 template <typename T>
-Eigen::Vector3i extractGRSDSignature325(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+Eigen::Vector3i extractGRSDSignature325( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
 
 template <typename T>
-void extractGRSDSignature325(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize = false );
+void extractGRSDSignature325( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize = false );
 
 //------------------------------
 /// \brief extract - PlusGRSD -
 template <typename T>
-Eigen::Vector3i extractPlusGRSDSignature110(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+Eigen::Vector3i extractPlusGRSDSignature110( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
 
 template <typename T>
-void extractPlusGRSDSignature110(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize = false );
-
-//--------------------
-/// \brief concatenate
-const std::vector<float> concVector( const std::vector<float> v1, const std::vector<float> v2 );
+void extractPlusGRSDSignature110( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize = false );
 
 //---------------
 /// \brief VOSCH
 template <typename PointT>
-Eigen::Vector3i extractVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+Eigen::Vector3i extractVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
 
 template <typename PointT>
-void extractVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 );
+void extractVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 );
 
 //-----------------
 /// \brief ConVOSCH
 template <typename PointT>
-Eigen::Vector3i extractConVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
+Eigen::Vector3i extractConVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize = false );
 
 template <typename PointT>
-void extractConVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 );
+void extractConVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 );
 
 #include <vosch/vosch_tools.hpp>
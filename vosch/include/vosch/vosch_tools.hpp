@@ -15,7 +15,7 @@ bool readPoints( const char *name, pcl::PointCloud<T>& cloud ){
 //------------------
 //* compute normals
 template <typename T1, typename T2>
-void computeNormal( pcl::PointCloud<T1> input_cloud, pcl::PointCloud<T2>& output_cloud ){
+void computeNormal( const pcl::PointCloud<T1> &input_cloud, pcl::PointCloud<T2>& output_cloud ){
   // if ((int)input_cloud.points.size () < k_)
   // {
   //   ROS_WARN ("Filtering returned %d points! Continuing.", (int)input_cloud.points.size ());
@@ -65,72 +65,25 @@ int getType (float min_radius, float max_radius)
   /*   return CYLINDER; // cylinder (rim) */
 }
 
-//--------------------
-//* extract - GRSD -
-template <typename T>
-Eigen::Vector3i extractGRSDSignature21(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize  ){
-#ifndef QUIET
-  ROS_INFO("rsd %f, normals %f, leaf %f", rsd_radius_search, normals_radius_search, voxel_size);
-#endif
-  feature.resize( 0 );
-  boost::shared_ptr< const pcl::PointCloud<T> > cloud_downsampled_ptr;
-  cloud_downsampled_ptr.reset (new pcl::PointCloud<T> (cloud_downsampled));
+//--------------
+//* concatenate
+const std::vector<float> concVector( const std::vector<float> &v1, const std::vector<float> &v2 ){
+  std::vector<float> vec = v1;
+  vec.insert(vec.end(), v2.begin(), v2.end());
+  return vec;
+}
 
-  //* for computing multiple GRSD with subdivisions
-  int hist_num = 1;
-  float inverse_subdivision_size = 0;
-  Eigen::Vector3i div_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i min_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i subdiv_b_ = Eigen::Vector3i::Zero();
-  Eigen::Vector3i subdivb_mul_= Eigen::Vector3i::Zero();
-  if( subdivision_size > 0 ){
-    inverse_subdivision_size = 1.0 / subdivision_size;
-    div_b_ = grid.getNrDivisions();
-    min_b_ = grid.getMinBoxCoordinates();
-    if( ( div_b_[0] <= offset_x ) || ( div_b_[1] <= offset_y ) || ( div_b_[2] <= offset_z ) ){
-      std::cerr << "(In extractGRSDSignature21) offset values (" << offset_x << "," << offset_y << "," << offset_z << ") exceed voxel grid size (" << div_b_[0] << "," << div_b_[1] << "," << div_b_[2] << ")."<< std::endl;
-      return Eigen::Vector3i::Zero();
-    }
-    subdiv_b_ = Eigen::Vector3i ( ceil( ( div_b_[0] - offset_x )*inverse_subdivision_size ), ceil( ( div_b_[1] - offset_y )*inverse_subdivision_size ), ceil( ( div_b_[2] - offset_z )*inverse_subdivision_size ) );
-    subdivb_mul_ = Eigen::Vector3i ( 1, subdiv_b_[0], subdiv_b_[0] * subdiv_b_[1] );
-    hist_num = subdiv_b_[0] * subdiv_b_[1] * subdiv_b_[2];
-  }
-  else if( subdivision_size < 0 ){
-    std::cerr << "(In extractGRSDSignature21) Invalid subdivision size: " << subdivision_size << std::endl;
-    return Eigen::Vector3i::Zero();
-  }
+//* does not delete, for handing clouds owned by somebody else to PCL classes which want shared pointers
+struct NullDeleter
+{
+  void operator() (const void *) const {}
+};
 
-  // Compute RSD
-  pcl::RSDEstimation <T, T, pcl::PrincipalRadiiRSD> rsd;
-  rsd.setInputCloud( cloud_downsampled_ptr );
-  boost::shared_ptr< const pcl::PointCloud<T> > cloud_ptr = cloud.makeShared();
-  rsd.setSearchSurface( cloud_ptr );
-  rsd.setInputNormals( cloud_ptr );
-#ifndef QUIET
-  ROS_INFO("radius search: %f", std::max(rsd_radius_search, voxel_size/2 * sqrt(3)));
-#endif
-  rsd.setRadiusSearch(std::max(rsd_radius_search, voxel_size/2 * sqrt(3)));
-  boost::shared_ptr< pcl::KdTree<T> > tree2 = boost::make_shared<pcl::KdTreeFLANN<T> > ();
-  tree2->setInputCloud (cloud.makeShared());
-  rsd.setSearchMethod(tree2);
-  pcl::PointCloud<pcl::PrincipalRadiiRSD> radii;
-  t1 = my_clock();
-  rsd.compute(radii);
-#ifndef QUIET
-  ROS_INFO("RSD compute done in %f seconds.", my_clock()-t1);
-#endif
-  
-  // Get rmin/rmax for adjacent 27 voxel
-  t1 = my_clock();
+//* relative coordinates of the 26 neighbour voxels
+inline Eigen::MatrixXi getRelativeCoordinates26 (){
   Eigen::MatrixXi relative_coordinates (3, 13);
-
-  //Eigen::MatrixXi transition_matrix =  Eigen::MatrixXi::Zero(6, 6);
-  std::vector< Eigen::MatrixXi > transition_matrix( hist_num );
-  for( int i=0; i<hist_num; i++ )
-    transition_matrix[ i ] =  Eigen::MatrixXi::Zero(6, 6);
-
   int idx = 0;
-  
+
   // 0 - 8
   for( int i=-1; i<2; i++ )
   {
@@ -158,135 +111,56 @@ Eigen::Vector3i extractGRSDSignature21(pcl::VoxelGrid<T> grid, pcl::PointCloud<T
   Eigen::MatrixXi relative_coordinates_all (3, 26);
   relative_coordinates_all.block<3, 13>(0, 0) = relative_coordinates;
   relative_coordinates_all.block<3, 13>(0, 13) = -relative_coordinates;
-  
-  // Get transition matrix
-  std::vector<int> types (radii.points.size());
- 
-  for (size_t idx = 0; idx < radii.points.size (); ++idx)
-    types[idx] = getType(radii.points[idx].r_min, radii.points[idx].r_max);
-  
-  for (size_t idx = 0; idx < cloud_downsampled_ptr->points.size (); ++idx)
-  {
-    // calc hist_idx
-    int hist_idx;
-    if( hist_num == 1 ) hist_idx = 0;
-    else{
-      const int tmp_x = floor( cloud_downsampled_ptr->points[ idx ].x/voxel_size ) - min_b_[ 0 ] - offset_x;
-      const int tmp_y = floor( cloud_downsampled_ptr->points[ idx ].y/voxel_size ) - min_b_[ 1 ] - offset_y;
-      const int tmp_z = floor( cloud_downsampled_ptr->points[ idx ].z/voxel_size ) - min_b_[ 2 ] - offset_z;
-      /* const int x_mul_y = div_b_[0] * div_b_[1]; */
-      /* const int tmp_z = idx / x_mul_y - offset_z; */
-      /* const int tmp_y = ( idx % x_mul_y ) / div_b_[0] - offset_y; */
-      /* const int tmp_x = idx % div_b_[0] - offset_x; */
-      if( ( tmp_x < 0 ) || ( tmp_y < 0 ) || ( tmp_z < 0 ) ) continue; // ignore idx smaller than offset.
-      Eigen::Vector3i ijk = Eigen::Vector3i ( floor ( tmp_x * inverse_subdivision_size), floor ( tmp_y * inverse_subdivision_size), floor ( tmp_z * inverse_subdivision_size) );
-      hist_idx = ijk.dot (subdivb_mul_);
-    }
-
-    int source_type = types[idx];
-    std::vector<int> neighbors = grid.getNeighborCentroidIndices ( cloud_downsampled_ptr->points[idx], relative_coordinates_all);
-    for (unsigned id_n = 0; id_n < neighbors.size(); id_n++)
-    {
-      int neighbor_type;
-      if (neighbors[id_n] == -1)
-        neighbor_type = EMPTY;
-      else
-        neighbor_type = types[neighbors[id_n]];
-
-      transition_matrix[ hist_idx ](source_type, neighbor_type)++;
-    }
-  }
-#ifndef QUIET
-  std::cerr << "transition matrix" << std::endl << transition_matrix[0] << std::endl;
-  ROS_INFO("GRSD compute done in %f seconds.", my_clock()-t1);
-#endif
+  return relative_coordinates_all;
+}
 
-  pcl::PointCloud<pcl::GRSDSignature21> cloud_grsd;
-  cloud_grsd.points.resize(hist_num);
-  
-  for( int h=0; h<hist_num; h++ ){
-    int nrf = 0;
-    for (int i=0; i<NR_CLASS+1; i++)
-      for (int j=i; j<NR_CLASS+1; j++)
-    /* for (int i=1; i<NR_CLASS+1; i++) */
-    /*   for (int j=0; j<=i; j++) */
-    cloud_grsd.points[ h ].histogram[nrf++] = transition_matrix[ h ](i, j) + transition_matrix[ h ](j, i);
-  }
+//-----------------
+//* VOSCHExtractor
+template <typename PointT>
+VOSCHExtractor<PointT>::VOSCHExtractor () :
+  grid_ (&own_grid_), cloud_ (&own_cloud_), cloud_downsampled_ (&own_cloud_downsampled_), voxel_size_ (0),
+  has_types_ (false), has_neighbors_ (false), integral_dims_ (Eigen::Vector3i::Zero ()),
+  has_integral_volume_ (false), use_integral_volume_ (false)
+{
+}
 
-  feature.resize( hist_num );
-  if( is_normalize ){
-    for( int h=0; h<hist_num; h++ ){
-      feature[ h ].resize( 20 );
-      for( int i=0; i<20; i++)
-        feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ] * NORMALIZE_GRSD;
-    }
-  }
-  else{
-    for( int h=0; h<hist_num; h++ ){
-      feature[ h ].resize( 20 );
-      for( int i=0; i<20; i++)
-        feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ];
-    }
-  }
-  return subdiv_b_;
+template <typename PointT> template <typename PointInT>
+void VOSCHExtractor<PointT>::setInputCloud( const pcl::PointCloud<PointInT> &input_cloud, const float voxel_size ){
+  computeNormal( input_cloud, own_cloud_ );
+  getVoxelGrid( own_grid_, own_cloud_, own_cloud_downsampled_, voxel_size );
+  setInput( own_grid_, own_cloud_, own_cloud_downsampled_, voxel_size );
 }
 
-template <typename T>
-void extractGRSDSignature21(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize  ){
-  std::vector< std::vector<float> > tmp( 1 );
-  extractGRSDSignature21( grid, cloud, cloud_downsampled, tmp, voxel_size, 0, 0, 0, 0, is_normalize ); // for one signature
-  feature = tmp[ 0 ];
+template <typename PointT>
+void VOSCHExtractor<PointT>::setInput( const pcl::VoxelGrid<PointT> &grid, const PointCloud &cloud, const PointCloud &cloud_downsampled, const float voxel_size ){
+  grid_ = &grid;
+  cloud_ = &cloud;
+  cloud_downsampled_ = &cloud_downsampled;
+  voxel_size_ = voxel_size;
+  has_types_ = has_neighbors_ = has_integral_volume_ = false;
 }
 
-//-----------------------------------
-//* extract - rotation-variant GRSD -
-template <typename T>
-Eigen::Vector3i extractGRSDSignature325(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize  ){
+template <typename PointT>
+const std::vector<int>& VOSCHExtractor<PointT>::getTypes(){
+  if( has_types_ )
+    return types_;
+
 #ifndef QUIET
-  ROS_INFO("rsd %f, normals %f, leaf %f", rsd_radius_search, normals_radius_search, voxel_size);
+  ROS_INFO("rsd %f, normals %f, leaf %f", rsd_radius_search, normals_radius_search, voxel_size_);
 #endif
-  feature.resize( 0 );
-  boost::shared_ptr< const pcl::PointCloud<T> > cloud_downsampled_ptr;
-  cloud_downsampled_ptr.reset (new pcl::PointCloud<T> (cloud_downsampled));
-  pcl::PointCloud<pcl::GRSDSignature325> cloud_grsd;
-  
-  //* for computing multiple GRSD with subdivisions
-  int hist_num = 1;
-  float inverse_subdivision_size = 0;
-  Eigen::Vector3i div_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i min_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i subdiv_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i subdivb_mul_= Eigen::Vector3i::Zero();
-  if( subdivision_size > 0 ){
-    inverse_subdivision_size = 1.0 / subdivision_size;
-    div_b_ = grid.getNrDivisions();
-    min_b_ = grid.getMinBoxCoordinates();
-    if( ( div_b_[0] <= offset_x ) || ( div_b_[1] <= offset_y ) || ( div_b_[2] <= offset_z ) ){
-      std::cerr << "(In extractGRSDSignature325) offset values (" << offset_x << "," << offset_y << "," << offset_z << ") exceed voxel grid size (" << div_b_[0] << "," << div_b_[1] << "," << div_b_[2] << ")."<< std::endl;
-      return Eigen::Vector3i::Zero();
-    }
-    subdiv_b_ = Eigen::Vector3i ( ceil( ( div_b_[0] - offset_x )*inverse_subdivision_size ), ceil( ( div_b_[1] - offset_y )*inverse_subdivision_size ), ceil( ( div_b_[2] - offset_z )*inverse_subdivision_size ) );
-    subdivb_mul_ = Eigen::Vector3i ( 1, subdiv_b_[0], subdiv_b_[0] * subdiv_b_[1] );
-    hist_num = subdiv_b_[0] * subdiv_b_[1] * subdiv_b_[2];
-  }
-  else if( subdivision_size < 0 ){
-    std::cerr << "(In extractGRSDSignature325) Invalid subdivision size: " << subdivision_size << std::endl;
-    return Eigen::Vector3i::Zero();
-  }
-  cloud_grsd.points.resize(hist_num);
-
   // Compute RSD
-  pcl::RSDEstimation <T, T, pcl::PrincipalRadiiRSD> rsd;
+  boost::shared_ptr< const PointCloud > cloud_ptr ( cloud_, NullDeleter () );
+  boost::shared_ptr< const PointCloud > cloud_downsampled_ptr ( cloud_downsampled_, NullDeleter () );
+  pcl::RSDEstimation <PointT, PointT, pcl::PrincipalRadiiRSD> rsd;
   rsd.setInputCloud( cloud_downsampled_ptr );
-  boost::shared_ptr< const pcl::PointCloud<T> > cloud_ptr = cloud.makeShared();
   rsd.setSearchSurface( cloud_ptr );
   rsd.setInputNormals( cloud_ptr );
 #ifndef QUIET
-  ROS_INFO("radius search: %f", std::max(rsd_radius_search, voxel_size/2 * sqrt(3)));
+  ROS_INFO("radius search: %f", std::max(rsd_radius_search, voxel_size_/2 * sqrt(3)));
 #endif
-  rsd.setRadiusSearch(std::max(rsd_radius_search, voxel_size/2 * sqrt(3)));
-  boost::shared_ptr< pcl::KdTree<T> > tree2 = boost::make_shared<pcl::KdTreeFLANN<T> > ();
-  tree2->setInputCloud (cloud.makeShared());
+  rsd.setRadiusSearch(std::max(rsd_radius_search, voxel_size_/2 * sqrt(3)));
+  boost::shared_ptr< pcl::KdTree<PointT> > tree2 = boost::make_shared<pcl::KdTreeFLANN<PointT> > ();
+  tree2->setInputCloud (cloud_ptr);
   rsd.setSearchMethod(tree2);
   pcl::PointCloud<pcl::PrincipalRadiiRSD> radii;
   t1 = my_clock();
@@ -294,260 +168,363 @@ Eigen::Vector3i extractGRSDSignature325(pcl::VoxelGrid<T> grid, pcl::PointCloud<
 #ifndef QUIET
   ROS_INFO("RSD compute done in %f seconds.", my_clock()-t1);
 #endif
-  
-  // Get rmin/rmax for adjacent 27 voxel
+
+  types_.resize (radii.points.size());
+  for (size_t idx = 0; idx < radii.points.size (); ++idx)
+    types_[idx] = getType(radii.points[idx].r_min, radii.points[idx].r_max);
+  has_types_ = true;
+  return types_;
+}
+
+template <typename PointT>
+const std::vector<int>& VOSCHExtractor<PointT>::getNeighbors(){
+  if( has_neighbors_ )
+    return neighbors_;
+
+  const Eigen::MatrixXi relative_coordinates_all = getRelativeCoordinates26 ();
+  const size_t nr_points = cloud_downsampled_->points.size ();
+  neighbors_.resize (nr_points * 26);
+  for (size_t idx = 0; idx < nr_points; ++idx)
+  {
+    std::vector<int> neighbors = grid().getNeighborCentroidIndices ( cloud_downsampled_->points[idx], relative_coordinates_all);
+    std::copy (neighbors.begin (), neighbors.end (), neighbors_.begin () + idx * 26);
+  }
+  has_neighbors_ = true;
+  return neighbors_;
+}
+
+template <typename PointT>
+bool VOSCHExtractor<PointT>::computeSubdivision( const char *caller, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, Eigen::Vector3i &subdiv_b_, int &hist_num ){
+  //* for computing multiple GRSD with subdivisions
+  hist_num = 1;
+  subdiv_b_ = Eigen::Vector3i::Zero();
+  if( subdivision_size < 0 ){
+    std::cerr << "(In " << caller << ") Invalid subdivision size: " << subdivision_size << std::endl;
+    return false;
+  }
+  if( subdivision_size == 0 )
+    return true;
+
+  const float inverse_subdivision_size = 1.0 / subdivision_size;
+  const Eigen::Vector3i div_b_ = grid().getNrDivisions();
+  if( ( div_b_[0] <= offset_x ) || ( div_b_[1] <= offset_y ) || ( div_b_[2] <= offset_z ) ){
+    std::cerr << "(In " << caller << ") offset values (" << offset_x << "," << offset_y << "," << offset_z << ") exceed voxel grid size (" << div_b_[0] << "," << div_b_[1] << "," << div_b_[2] << ")."<< std::endl;
+    return false;
+  }
+  subdiv_b_ = Eigen::Vector3i ( ceil( ( div_b_[0] - offset_x )*inverse_subdivision_size ), ceil( ( div_b_[1] - offset_y )*inverse_subdivision_size ), ceil( ( div_b_[2] - offset_z )*inverse_subdivision_size ) );
+  hist_num = subdiv_b_[0] * subdiv_b_[1] * subdiv_b_[2];
+  return true;
+}
+
+template <typename PointT>
+bool VOSCHExtractor<PointT>::computeHistIndices( const char *caller, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, std::vector<int> &hist_idx, Eigen::Vector3i &subdiv_b_, int &hist_num ){
+  hist_idx.assign( cloud_downsampled_->points.size (), 0 );
+  if( !computeSubdivision( caller, subdivision_size, offset_x, offset_y, offset_z, subdiv_b_, hist_num ) )
+    return false;
+  if( subdivision_size == 0 )
+    return true;
+
+  const float inverse_subdivision_size = 1.0 / subdivision_size;
+  const Eigen::Vector3i min_b_ = grid().getMinBoxCoordinates();
+  const Eigen::Vector3i subdivb_mul_ = Eigen::Vector3i ( 1, subdiv_b_[0], subdiv_b_[0] * subdiv_b_[1] );
+  for (size_t idx = 0; idx < cloud_downsampled_->points.size (); ++idx)
+  {
+    const int tmp_x = floor( cloud_downsampled_->points[ idx ].x/voxel_size_ ) - min_b_[ 0 ] - offset_x;
+    const int tmp_y = floor( cloud_downsampled_->points[ idx ].y/voxel_size_ ) - min_b_[ 1 ] - offset_y;
+    const int tmp_z = floor( cloud_downsampled_->points[ idx ].z/voxel_size_ ) - min_b_[ 2 ] - offset_z;
+    if( ( tmp_x < 0 ) || ( tmp_y < 0 ) || ( tmp_z < 0 ) ){
+      hist_idx[ idx ] = -1; // ignore idx smaller than offset.
+      continue;
+    }
+    Eigen::Vector3i ijk = Eigen::Vector3i ( floor ( tmp_x * inverse_subdivision_size), floor ( tmp_y * inverse_subdivision_size), floor ( tmp_z * inverse_subdivision_size) );
+    hist_idx[ idx ] = ijk.dot (subdivb_mul_);
+  }
+  return true;
+}
+
+//----------------------------------
+//* GRSD summed-area tables
+template <typename PointT>
+void VOSCHExtractor<PointT>::computeIntegralVolume(){
+  if( has_integral_volume_ )
+    return;
+
+  const std::vector<int> &types = getTypes ();
+  const std::vector<int> &neighbors = getNeighbors ();
   t1 = my_clock();
-  Eigen::MatrixXi relative_coordinates (3, 13);
 
-  int idx = 0;
-  
-  // 0 - 8
-  for( int i=-1; i<2; i++ )
+  // histogram bin of an (unordered) pair of types, as in extractGRSDSignature21. Both (i,j) and (j,i) go to
+  // the same bin, so a transition between equal types counts twice.
+  int pair_bin[ NR_CLASS+1 ][ NR_CLASS+1 ];
+  int nrf = 0;
+  for (int i=0; i<NR_CLASS+1; i++)
+    for (int j=i; j<NR_CLASS+1; j++, nrf++)
+      pair_bin[ i ][ j ] = pair_bin[ j ][ i ] = nrf;
+  const int nr_bins = 20; // the EMPTY-EMPTY bin is always 0 and not part of the feature
+
+  const Eigen::Vector3i div_b_ = grid().getNrDivisions();
+  const Eigen::Vector3i min_b_ = grid().getMinBoxCoordinates();
+  integral_dims_ = div_b_ + Eigen::Vector3i::Ones ();
+  const size_t stride_y = integral_dims_[0] * nr_bins;
+  const size_t stride_z = integral_dims_[1] * stride_y;
+  integral_volume_.assign( integral_dims_[2] * stride_z, 0 );
+
+  // per-voxel transition counts, shifted by one cell so that the first row/column/slice stays 0
+  for (size_t idx = 0; idx < cloud_downsampled_->points.size (); ++idx)
   {
-    for( int j=-1; j<2; j++ )
+    const int x = floor( cloud_downsampled_->points[ idx ].x/voxel_size_ ) - min_b_[ 0 ];
+    const int y = floor( cloud_downsampled_->points[ idx ].y/voxel_size_ ) - min_b_[ 1 ];
+    const int z = floor( cloud_downsampled_->points[ idx ].z/voxel_size_ ) - min_b_[ 2 ];
+    if( x < 0 || y < 0 || z < 0 || x >= div_b_[0] || y >= div_b_[1] || z >= div_b_[2] )
+      continue;
+    int *cell = &integral_volume_[ ( z + 1 ) * stride_z + ( y + 1 ) * stride_y + ( x + 1 ) * nr_bins ];
+    const int source_type = types[ idx ];
+    const int *n = &neighbors[ idx * 26 ];
+    for (unsigned id_n = 0; id_n < 26; id_n++)
     {
-      relative_coordinates( 0, idx ) = i;
-      relative_coordinates( 1, idx ) = j;
-      relative_coordinates( 2, idx ) = -1;
-      idx++;
+      const int neighbor_type = ( n[id_n] == -1 ) ? EMPTY : types[ n[id_n] ];
+      const int bin = pair_bin[ source_type ][ neighbor_type ];
+      if( bin < nr_bins )
+        cell[ bin ] += ( source_type == neighbor_type ) ? 2 : 1;
     }
   }
-  // 9 - 11
-  for( int i=-1; i<2; i++ )
+
+  // prefix sums along x, y and z
+  for (int z = 1; z < integral_dims_[2]; z++)
+    for (int y = 1; y < integral_dims_[1]; y++)
+    {
+      int *row = &integral_volume_[ z * stride_z + y * stride_y ];
+      for (int x = 1; x < integral_dims_[0]; x++)
+        for (int b = 0; b < nr_bins; b++)
+          row[ x * nr_bins + b ] += row[ ( x - 1 ) * nr_bins + b ];
+    }
+  for (int z = 1; z < integral_dims_[2]; z++)
+    for (int y = 1; y < integral_dims_[1]; y++)
+    {
+      int *row = &integral_volume_[ z * stride_z + y * stride_y ];
+      const int *prev = row - stride_y;
+      for (size_t i = 0; i < stride_y; i++)
+        row[ i ] += prev[ i ];
+    }
+  for (int z = 1; z < integral_dims_[2]; z++)
   {
-    relative_coordinates( 0, idx ) = i;
-    relative_coordinates( 1, idx ) = -1;
-    relative_coordinates( 2, idx ) = 0;
-    idx++;
+    int *slice = &integral_volume_[ z * stride_z ];
+    const int *prev = slice - stride_z;
+    for (size_t i = 0; i < stride_z; i++)
+      slice[ i ] += prev[ i ];
   }
-  // 12
-  relative_coordinates( 0, idx ) = -1;
-  relative_coordinates( 1, idx ) = 0;
-  relative_coordinates( 2, idx ) = 0;
+  has_integral_volume_ = true;
+#ifndef QUIET
+  ROS_INFO("GRSD integral volume (%d x %d x %d voxels) done in %f seconds.", div_b_[0], div_b_[1], div_b_[2], my_clock()-t1);
+#endif
+}
 
-  // Get transition matrix
-  std::vector<int> types (radii.points.size());
- 
-  for (size_t idx = 0; idx < radii.points.size (); ++idx)
-    types[idx] = getType(radii.points[idx].r_min, radii.points[idx].r_max);
-  
-  for (size_t idx = 0; idx < cloud_downsampled_ptr->points.size (); ++idx)
+template <typename PointT>
+void VOSCHExtractor<PointT>::getGRSDSignature21InBox( const Eigen::Vector3i &box_min, const Eigen::Vector3i &box_max, std::vector<float> &feature, const bool is_normalize ){
+  computeIntegralVolume ();
+  const int nr_bins = 20;
+  feature.assign( nr_bins, 0 );
+
+  // clip to the grid
+  int lo[3], hi[3];
+  for (int d = 0; d < 3; d++)
   {
-    // calc hist_idx
-    int hist_idx;
-    if( hist_num == 1 ) hist_idx = 0;
-    else{
-      const int tmp_x = floor( cloud_downsampled_ptr->points[ idx ].x/voxel_size ) - min_b_[ 0 ] - offset_x;
-      const int tmp_y = floor( cloud_downsampled_ptr->points[ idx ].y/voxel_size ) - min_b_[ 1 ] - offset_y;
-      const int tmp_z = floor( cloud_downsampled_ptr->points[ idx ].z/voxel_size ) - min_b_[ 2 ] - offset_z;
-      /* const int x_mul_y = div_b_[0] * div_b_[1]; */
-      /* const int tmp_z = idx / x_mul_y - offset_z; */
-      /* const int tmp_y = ( idx % x_mul_y ) / div_b_[0] - offset_y; */
-      /* const int tmp_x = idx % div_b_[0] - offset_x; */
-      if( ( tmp_x < 0 ) || ( tmp_y < 0 ) || ( tmp_z < 0 ) ) continue; // ignore idx smaller than offset.
-      Eigen::Vector3i ijk = Eigen::Vector3i ( floor ( tmp_x * inverse_subdivision_size), floor ( tmp_y * inverse_subdivision_size), floor ( tmp_z * inverse_subdivision_size) );
-      hist_idx = ijk.dot (subdivb_mul_);
-    }
+    lo[d] = std::max( 0, std::min( box_min[d], integral_dims_[d] - 1 ) );
+    hi[d] = std::max( 0, std::min( box_max[d], integral_dims_[d] - 1 ) );
+    if( hi[d] <= lo[d] )
+      return;
+  }
+
+  const size_t stride_y = integral_dims_[0] * nr_bins;
+  const size_t stride_z = integral_dims_[1] * stride_y;
+#define VOSCH_CORNER(x, y, z) (&integral_volume_[ (z) * stride_z + (y) * stride_y + (x) * nr_bins ])
+  const int *c111 = VOSCH_CORNER( hi[0], hi[1], hi[2] );
+  const int *c011 = VOSCH_CORNER( lo[0], hi[1], hi[2] );
+  const int *c101 = VOSCH_CORNER( hi[0], lo[1], hi[2] );
+  const int *c110 = VOSCH_CORNER( hi[0], hi[1], lo[2] );
+  const int *c001 = VOSCH_CORNER( lo[0], lo[1], hi[2] );
+  const int *c010 = VOSCH_CORNER( lo[0], hi[1], lo[2] );
+  const int *c100 = VOSCH_CORNER( hi[0], lo[1], lo[2] );
+  const int *c000 = VOSCH_CORNER( lo[0], lo[1], lo[2] );
+#undef VOSCH_CORNER
+  const float scale = is_normalize ? NORMALIZE_GRSD : 1.0f;
+  for (int b = 0; b < nr_bins; b++)
+    feature[ b ] = ( c111[b] - c011[b] - c101[b] - c110[b] + c001[b] + c010[b] + c100[b] - c000[b] ) * scale;
+}
+
+//--------------------
+//* extract - GRSD -
+template <typename PointT>
+Eigen::Vector3i VOSCHExtractor<PointT>::extractGRSDSignature21( std::vector< std::vector<float> > &feature, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
+  feature.resize( 0 );
+  if( use_integral_volume_ && subdivision_size > 0 ){
+    Eigen::Vector3i subdiv_b_;
+    int hist_num;
+    if( !computeSubdivision( "extractGRSDSignature21", subdivision_size, offset_x, offset_y, offset_z, subdiv_b_, hist_num ) )
+      return Eigen::Vector3i::Zero();
+    feature.resize( hist_num );
+    const Eigen::Vector3i offset ( offset_x, offset_y, offset_z );
+    int h = 0;
+    for (int k = 0; k < subdiv_b_[2]; k++)
+      for (int j = 0; j < subdiv_b_[1]; j++)
+        for (int i = 0; i < subdiv_b_[0]; i++, h++)
+        {
+          const Eigen::Vector3i box_min = offset + Eigen::Vector3i ( i, j, k ) * subdivision_size;
+          getGRSDSignature21InBox( box_min, box_min + Eigen::Vector3i::Constant ( subdivision_size ), feature[ h ], is_normalize );
+        }
+    return subdiv_b_;
+  }
+
+  std::vector<int> hist_idx;
+  Eigen::Vector3i subdiv_b_;
+  int hist_num;
+  if( !computeHistIndices( "extractGRSDSignature21", subdivision_size, offset_x, offset_y, offset_z, hist_idx, subdiv_b_, hist_num ) )
+    return Eigen::Vector3i::Zero();
+
+  const std::vector<int> &types = getTypes ();
+  const std::vector<int> &neighbors = getNeighbors ();
 
+  // Get transition matrix
+  t1 = my_clock();
+  std::vector< Eigen::MatrixXi > transition_matrix( hist_num );
+  for( int i=0; i<hist_num; i++ )
+    transition_matrix[ i ] =  Eigen::MatrixXi::Zero(6, 6);
+
+  for (size_t idx = 0; idx < cloud_downsampled_->points.size (); ++idx)
+  {
+    if( hist_idx[ idx ] < 0 ) continue;
+    Eigen::MatrixXi &matrix = transition_matrix[ hist_idx[ idx ] ];
     int source_type = types[idx];
-    std::vector<int> neighbors = grid.getNeighborCentroidIndices ( cloud_downsampled_ptr->points[idx], relative_coordinates);
-    for (unsigned id_n = 0; id_n < neighbors.size(); id_n++)
+    const int *n = &neighbors[ idx * 26 ];
+    for (unsigned id_n = 0; id_n < 26; id_n++)
     {
       int neighbor_type;
-      if (neighbors[id_n] == -1)
+      if (n[id_n] == -1)
         neighbor_type = EMPTY;
       else
-        neighbor_type = types[neighbors[id_n]];
+        neighbor_type = types[n[id_n]];
 
-      // ignore EMPTY
-      if( neighbor_type != EMPTY )
-	cloud_grsd.points[ hist_idx ].histogram[ source_type + neighbor_type * 5 + id_n * 25 ]++;
+      matrix(source_type, neighbor_type)++;
     }
   }
 #ifndef QUIET
+  std::cerr << "transition matrix" << std::endl << transition_matrix[0] << std::endl;
   ROS_INFO("GRSD compute done in %f seconds.", my_clock()-t1);
 #endif
 
-  feature.resize( hist_num );
-  if( is_normalize ){
-    for( int h=0; h<hist_num; h++ ){
-      feature[ h ].resize( GRSD_LARGE_DIM );
-      for( int i=0; i<GRSD_LARGE_DIM; i++)
-        feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ] * NORMALIZE_GRSD;
-    }
+  pcl::PointCloud<pcl::GRSDSignature21> cloud_grsd;
+  cloud_grsd.points.resize(hist_num);
+  
+  for( int h=0; h<hist_num; h++ ){
+    int nrf = 0;
+    for (int i=0; i<NR_CLASS+1; i++)
+      for (int j=i; j<NR_CLASS+1; j++)
+    cloud_grsd.points[ h ].histogram[nrf++] = transition_matrix[ h ](i, j) + transition_matrix[ h ](j, i);
   }
-  else{
-    for( int h=0; h<hist_num; h++ ){
-      feature[ h ].resize( GRSD_LARGE_DIM );
-      for( int i=0; i<GRSD_LARGE_DIM; i++)
-        feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ];
-    }
+
+  feature.resize( hist_num );
+  const float scale = is_normalize ? NORMALIZE_GRSD : 1.0f;
+  for( int h=0; h<hist_num; h++ ){
+    feature[ h ].resize( 20 );
+    for( int i=0; i<20; i++)
+      feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ] * scale;
   }
   return subdiv_b_;
 }
 
-template <typename T>
-void extractGRSDSignature325(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize  ){
-  std::vector< std::vector<float> > tmp( 1 );
-  extractGRSDSignature325( grid, cloud, cloud_downsampled, tmp, voxel_size, 0, 0, 0, 0, is_normalize ); // for one signature
-  feature = tmp[ 0 ];
-}
-
 //-----------------------------------
-//* extract - PlusGRSD -
-template <typename T>
-Eigen::Vector3i extractPlusGRSDSignature110(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize  ){
-#ifndef QUIET
-  ROS_INFO("rsd %f, normals %f, leaf %f", rsd_radius_search, normals_radius_search, voxel_size);
-#endif
+//* extract - rotation-variant GRSD -
+template <typename PointT>
+Eigen::Vector3i VOSCHExtractor<PointT>::extractGRSDSignature325( std::vector< std::vector<float> > &feature, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
   feature.resize( 0 );
-  boost::shared_ptr< const pcl::PointCloud<T> > cloud_downsampled_ptr;
-  cloud_downsampled_ptr.reset (new pcl::PointCloud<T> (cloud_downsampled));
-  
-  //* for computing multiple GRSD with subdivisions
-  int hist_num = 1;
-  float inverse_subdivision_size = 0;
-  Eigen::Vector3i div_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i min_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i subdiv_b_= Eigen::Vector3i::Zero();
-  Eigen::Vector3i subdivb_mul_= Eigen::Vector3i::Zero();
-  if( subdivision_size > 0 ){
-    inverse_subdivision_size = 1.0 / subdivision_size;
-    div_b_ = grid.getNrDivisions();
-    min_b_ = grid.getMinBoxCoordinates();
-    if( ( div_b_[0] <= offset_x ) || ( div_b_[1] <= offset_y ) || ( div_b_[2] <= offset_z ) ){
-      std::cerr << "(In extractPlusGRSDSignature110) offset values (" << offset_x << "," << offset_y << "," << offset_z << ") exceed voxel grid size (" << div_b_[0] << "," << div_b_[1] << "," << div_b_[2] << ")."<< std::endl;
-      return Eigen::Vector3i::Zero();
-    }
-    subdiv_b_ = Eigen::Vector3i ( ceil( ( div_b_[0] - offset_x )*inverse_subdivision_size ), ceil( ( div_b_[1] - offset_y )*inverse_subdivision_size ), ceil( ( div_b_[2] - offset_z )*inverse_subdivision_size ) );
-    subdivb_mul_ = Eigen::Vector3i ( 1, subdiv_b_[0], subdiv_b_[0] * subdiv_b_[1] );
-    hist_num = subdiv_b_[0] * subdiv_b_[1] * subdiv_b_[2];
-  }
-  else if( subdivision_size < 0 ){
-    std::cerr << "(In extractPlusGRSDSignature110) Invalid subdivision size: " << subdivision_size << std::endl;
+  std::vector<int> hist_idx;
+  Eigen::Vector3i subdiv_b_;
+  int hist_num;
+  if( !computeHistIndices( "extractGRSDSignature325", subdivision_size, offset_x, offset_y, offset_z, hist_idx, subdiv_b_, hist_num ) )
     return Eigen::Vector3i::Zero();
-  }
 
-  // Compute RSD
-  pcl::RSDEstimation <T, T, pcl::PrincipalRadiiRSD> rsd;
-  rsd.setInputCloud( cloud_downsampled_ptr );
-  boost::shared_ptr< const pcl::PointCloud<T> > cloud_ptr = cloud.makeShared();
-  rsd.setSearchSurface( cloud_ptr );
-  rsd.setInputNormals( cloud_ptr );
-#ifndef QUIET
-  ROS_INFO("radius search: %f", std::max(rsd_radius_search, voxel_size/2 * sqrt(3)));
-#endif
-  rsd.setRadiusSearch(std::max(rsd_radius_search, voxel_size/2 * sqrt(3)));
-  boost::shared_ptr< pcl::KdTree<T> > tree2 = boost::make_shared<pcl::KdTreeFLANN<T> > ();
-  tree2->setInputCloud (cloud.makeShared());
-  rsd.setSearchMethod(tree2);
-  pcl::PointCloud<pcl::PrincipalRadiiRSD> radii;
-  t1 = my_clock();
-  rsd.compute(radii);
-#ifndef QUIET
-  ROS_INFO("RSD compute done in %f seconds.", my_clock()-t1);
-  pcl::io::savePCDFile ("hoge.pcd", cloud_downsampled, false);
-#endif
-  
-  // Get rmin/rmax for adjacent 27 voxel
+  const std::vector<int> &types = getTypes ();
+  const std::vector<int> &neighbors = getNeighbors ();
+
   t1 = my_clock();
-  Eigen::MatrixXi relative_coordinates (3, 13);
+  pcl::PointCloud<pcl::GRSDSignature325> cloud_grsd;
+  cloud_grsd.points.resize(hist_num);
 
-  int idx = 0;
-  
-  // 0 - 8
-  for( int i=-1; i<2; i++ )
+  for (size_t idx = 0; idx < cloud_downsampled_->points.size (); ++idx)
   {
-    for( int j=-1; j<2; j++ )
+    if( hist_idx[ idx ] < 0 ) continue;
+    float *histogram = cloud_grsd.points[ hist_idx[ idx ] ].histogram;
+    int source_type = types[idx];
+    const int *n = &neighbors[ idx * 26 ];
+    // only the first half of the neighbourhood
+    for (unsigned id_n = 0; id_n < 13; id_n++)
     {
-      relative_coordinates( 0, idx ) = i;
-      relative_coordinates( 1, idx ) = j;
-      relative_coordinates( 2, idx ) = -1;
-      idx++;
+      // ignore EMPTY
+      if (n[id_n] != -1)
+        histogram[ source_type + types[n[id_n]] * 5 + id_n * 25 ]++;
     }
   }
-  // 9 - 11
-  for( int i=-1; i<2; i++ )
-  {
-    relative_coordinates( 0, idx ) = i;
-    relative_coordinates( 1, idx ) = -1;
-    relative_coordinates( 2, idx ) = 0;
-    idx++;
+#ifndef QUIET
+  ROS_INFO("GRSD compute done in %f seconds.", my_clock()-t1);
+#endif
+
+  feature.resize( hist_num );
+  const float scale = is_normalize ? NORMALIZE_GRSD : 1.0f;
+  for( int h=0; h<hist_num; h++ ){
+    feature[ h ].resize( GRSD_LARGE_DIM );
+    for( int i=0; i<GRSD_LARGE_DIM; i++)
+      feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ] * scale;
   }
-  // 12
-  relative_coordinates( 0, idx ) = -1;
-  relative_coordinates( 1, idx ) = 0;
-  relative_coordinates( 2, idx ) = 0;
+  return subdiv_b_;
+}
 
-  Eigen::MatrixXi relative_coordinates_all (3, 26);
-  relative_coordinates_all.block<3, 13>(0, 0) = relative_coordinates;
-  relative_coordinates_all.block<3, 13>(0, 13) = -relative_coordinates;
+//-----------------------------------
+//* extract - PlusGRSD -
+template <typename PointT>
+Eigen::Vector3i VOSCHExtractor<PointT>::extractPlusGRSDSignature110( std::vector< std::vector<float> > &feature, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
+  feature.resize( 0 );
+  std::vector<int> hist_idx;
+  Eigen::Vector3i subdiv_b_;
+  int hist_num;
+  if( !computeHistIndices( "extractPlusGRSDSignature110", subdivision_size, offset_x, offset_y, offset_z, hist_idx, subdiv_b_, hist_num ) )
+    return Eigen::Vector3i::Zero();
 
-  // Get transition matrix
-  std::vector<int> types (radii.points.size());
- 
-  for (size_t idx = 0; idx < radii.points.size (); ++idx)
-    types[idx] = getType(radii.points[idx].r_min, radii.points[idx].r_max);
-  
-  // TODO voxelization does not re-normalize the normals!
-  for (size_t idx = 0; idx < cloud_downsampled_ptr->points.size (); ++idx)
-    cloud_downsampled.points[idx].getNormalVector3fMap ().normalize ();
+  const std::vector<int> &types = getTypes ();
+  const std::vector<int> &neighbors = getNeighbors ();
+
+  t1 = my_clock();
+  // voxelization does not re-normalize the normals
+  const size_t nr_points = cloud_downsampled_->points.size ();
+  std::vector<Eigen::Vector3f> normals (nr_points);
+  std::vector<bool> has_normal (nr_points);
+  for (size_t idx = 0; idx < nr_points; ++idx)
+  {
+    const PointT &p = cloud_downsampled_->points[idx];
+    has_normal[idx] = std::isfinite( p.normal_x ) && std::isfinite( p.normal_y ) && std::isfinite( p.normal_z );
+    normals[idx] = Eigen::Vector3f (p.normal_x, p.normal_y, p.normal_z);
+    normals[idx].normalize ();
+  }
 
-  // TODO use consts and iterators
   std::vector<Eigen::MatrixXi> transition_matrix_list (hist_num * NR_DIV, Eigen::MatrixXi::Zero (NR_CLASS, NR_CLASS));
   std::vector<Eigen::VectorXi> transitions_to_empty( hist_num, Eigen::VectorXi::Zero (NR_CLASS));
 
-  for (size_t idx = 0; idx < cloud_downsampled_ptr->points.size (); ++idx)
+  for (size_t idx = 0; idx < nr_points; ++idx)
   {
-    // calc hist_idx
-    int hist_idx;
-    if( hist_num == 1 ) hist_idx = 0;
-    else{
-      const int tmp_x = floor( cloud_downsampled_ptr->points[ idx ].x/voxel_size ) - min_b_[ 0 ] - offset_x;
-      const int tmp_y = floor( cloud_downsampled_ptr->points[ idx ].y/voxel_size ) - min_b_[ 1 ] - offset_y;
-      const int tmp_z = floor( cloud_downsampled_ptr->points[ idx ].z/voxel_size ) - min_b_[ 2 ] - offset_z;
-      /* const int x_mul_y = div_b_[0] * div_b_[1]; */
-      /* const int tmp_z = idx / x_mul_y - offset_z; */
-      /* const int tmp_y = ( idx % x_mul_y ) / div_b_[0] - offset_y; */
-      /* const int tmp_x = idx % div_b_[0] - offset_x; */
-      if( ( tmp_x < 0 ) || ( tmp_y < 0 ) || ( tmp_z < 0 ) ) continue; // ignore idx smaller than offset.
-      Eigen::Vector3i ijk = Eigen::Vector3i ( floor ( tmp_x * inverse_subdivision_size), floor ( tmp_y * inverse_subdivision_size), floor ( tmp_z * inverse_subdivision_size) );
-      hist_idx = ijk.dot (subdivb_mul_);
-    }
-
+    if( hist_idx[ idx ] < 0 || !has_normal[ idx ] ) continue;
+    const int h = hist_idx[ idx ];
     int source_type = types[idx];
-    std::vector<int> neighbors = grid.getNeighborCentroidIndices ( cloud_downsampled_ptr->points[idx], relative_coordinates_all);
-    Eigen::Vector3f source_normal = cloud_downsampled.points[idx].getNormalVector3fMap ();
-    if( std::isfinite( cloud_downsampled.points[idx].normal_x ) && std::isfinite( cloud_downsampled.points[idx].normal_y ) && std::isfinite( cloud_downsampled.points[idx].normal_z ) ){
-      for (unsigned id_n = 0; id_n < neighbors.size(); id_n++)
-	{
-	  int neighbor_type;
-	  if (neighbors[id_n] == -1)
-	    neighbor_type = EMPTY;
-	  else
-	    neighbor_type = types[neighbors[id_n]];
-	  
-	  // count transitions: TODO optimize Asako style :)  but what about empty?
-	  if (neighbors[id_n] == -1)
-	    transitions_to_empty[ hist_idx ](source_type)++;
-	  else{
-	    // compute angle between average normals of voxels
-	    assert (source_type != EMPTY);
-	    //        double sine = source_normal.cross (cloud_downsampled.points[neighbors[id_n]].getNormalVector3fMap ()).norm ();
-	    //        int angle_bin = std::min (NR_DIV-1, (int) floor (sine * NR_DIV));
-	    //        transition_matrix_list[angle_bin](source_type, neighbor_type)++;
-	    //std::cout << cloud_downsampled.points[neighbors[id_n]].getNormalVector3fMap () << std::endl;
-	    //std::cout << cloud_downsampled.points[neighbors[id_n]].normal_x << " " << cloud_downsampled.points[neighbors[id_n]].normal_y << " " << cloud_downsampled.points[neighbors[id_n]].normal_z << std::endl;
-	    if( std::isfinite( cloud_downsampled.points[neighbors[id_n]].normal_x ) && std::isfinite( cloud_downsampled.points[neighbors[id_n]].normal_y ) && std::isfinite( cloud_downsampled.points[neighbors[id_n]].normal_z ) ) 
-	      transition_matrix_list[ (std::min (NR_DIV-1, (int) floor (sqrt (source_normal.cross (cloud_downsampled.points[neighbors[id_n]].getNormalVector3fMap ()).norm ()) * NR_DIV)) )*hist_num + hist_idx ](source_type, neighbor_type)++;
-	    else
-	      transitions_to_empty[ hist_idx ](source_type)++;
-	    //        double unsigned_cosine = fabs(source_normal.dot (cloud_downsampled.points[neighbors[id_n]].getNormalVector3fMap ()));
-	    //        if (unsigned_cosine > 1) unsigned_cosine = 1;
-	    //        int angle_bin = std::min (NR_DIV-1, (int) floor (acos (unsigned_cosine) / unit_angle));
-	    //std::cerr << "angle difference = " << acos (unsigned_cosine) << "(" << unsigned_cosine << ") => index: " << angle_bin << std::endl;
-	  }
-	}
+    const int *n = &neighbors[ idx * 26 ];
+    for (unsigned id_n = 0; id_n < 26; id_n++)
+    {
+      // count transitions
+      if (n[id_n] == -1 || !has_normal[ n[id_n] ])
+        transitions_to_empty[ h ](source_type)++;
+      else
+      {
+        // angle bin between average normals of voxels
+        const int angle_bin = std::min (NR_DIV-1, (int) floor (sqrt (normals[idx].cross (normals[n[id_n]]).norm ()) * NR_DIV));
+        transition_matrix_list[ angle_bin * hist_num + h ](source_type, types[n[id_n]])++;
+      }
     }
   }
 
@@ -563,20 +540,12 @@ Eigen::Vector3i extractPlusGRSDSignature110(pcl::VoxelGrid<T> grid, pcl::PointCl
 
   for( int h=0; h<hist_num; h++ ){  
     int nrf = 0;
-
     for ( int d=0; d<NR_DIV; d++ )
-      {
-	for (int i=0; i<NR_CLASS; i++)
-	  for (int j=i; j<NR_CLASS; j++)
-	    cloud_grsd.points[h].histogram[nrf++] = transition_matrix_list[ d * hist_num + h ](i, j);
-      }
+      for (int i=0; i<NR_CLASS; i++)
+        for (int j=i; j<NR_CLASS; j++)
+          cloud_grsd.points[h].histogram[nrf++] = transition_matrix_list[ d * hist_num + h ](i, j);
     for (int it = 0; it < NR_CLASS; ++it)
       cloud_grsd.points[h].histogram[nrf++] = transitions_to_empty[ h ][it];
-    //std::cerr << std::endl;
-
-#ifndef QUIET
-    std::cerr << "PlusGRSDS: " << cloud_grsd.points[0] << std::endl;
-#endif
   }
 
 #ifndef QUIET
@@ -584,46 +553,35 @@ Eigen::Vector3i extractPlusGRSDSignature110(pcl::VoxelGrid<T> grid, pcl::PointCl
 #endif
 
   feature.resize( hist_num );
-  if( is_normalize ){
-    for( int h=0; h<hist_num; h++ ){
-      feature[ h ].resize( 110 );
-      for( int i=0; i<110; i++)
-        feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ] * NORMALIZE_GRSD;
-    }
-  }
-  else{
-    for( int h=0; h<hist_num; h++ ){
-      feature[ h ].resize( 110 );
-      for( int i=0; i<110; i++)
-        feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ];
-    }
+  const float scale = is_normalize ? NORMALIZE_GRSD : 1.0f;
+  for( int h=0; h<hist_num; h++ ){
+    feature[ h ].resize( 110 );
+    for( int i=0; i<110; i++)
+      feature[ h ][ i ] = cloud_grsd.points[ h ].histogram[ i ] * scale;
   }
   return subdiv_b_;
 }
 
-template <typename T>
-void extractPlusGRSDSignature110(pcl::VoxelGrid<T> grid, pcl::PointCloud<T> cloud, pcl::PointCloud<T> cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize  ){
-  std::vector< std::vector<float> > tmp( 1 );
-  extractPlusGRSDSignature110( grid, cloud, cloud_downsampled, tmp, voxel_size, 0, 0, 0, 0, is_normalize ); // for one signature
-  feature = tmp[ 0 ];
+//--------------
+//* C3-HLAC
+template <typename PointT>
+void VOSCHExtractor<PointT>::extractC3HLACSignature117( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z ){
+  ::extractC3HLACSignature117( grid(), *cloud_downsampled_, feature, color_threshold_r, color_threshold_g, color_threshold_b, voxel_size_, subdivision_size, offset_x, offset_y, offset_z );
 }
 
-//--------------
-//* concatenate
-const std::vector<float> concVector( const std::vector<float> v1, const std::vector<float> v2 ){
-  std::vector<float> vec = v1;
-  vec.insert(vec.end(), v2.begin(), v2.end());
-  return vec;
+template <typename PointT>
+void VOSCHExtractor<PointT>::extractC3HLACSignature981( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z ){
+  ::extractC3HLACSignature981( grid(), *cloud_downsampled_, feature, color_threshold_r, color_threshold_g, color_threshold_b, voxel_size_, subdivision_size, offset_x, offset_y, offset_z );
 }
 
 //--------------
 //* VOSCH
 template <typename PointT>
-Eigen::Vector3i extractVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize  ){
+Eigen::Vector3i VOSCHExtractor<PointT>::extractVOSCH( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
   std::vector< std::vector<float> > grsd;
-  Eigen::Vector3i subdiv_b_ = extractGRSDSignature21( grid, cloud, cloud_downsampled, grsd, voxel_size, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
+  Eigen::Vector3i subdiv_b_ = extractGRSDSignature21( grsd, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
   std::vector< std::vector<float> > c3_hlac;
-  extractC3HLACSignature117( grid, cloud_downsampled, c3_hlac, color_threshold_r, color_threshold_g, color_threshold_b, voxel_size, subdivision_size, offset_x, offset_y, offset_z );
+  extractC3HLACSignature117( c3_hlac, color_threshold_r, color_threshold_g, color_threshold_b, subdivision_size, offset_x, offset_y, offset_z );
 
   const int hist_num = grsd.size();
   for( int h=0; h<hist_num; h++ )
@@ -631,21 +589,14 @@ Eigen::Vector3i extractVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT
   return subdiv_b_;
 }
 
-template <typename PointT>
-void extractVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 ){
-  std::vector< std::vector<float> > tmp;
-  extractVOSCH( grid, cloud, cloud_downsampled, tmp, color_threshold_r, color_threshold_g, color_threshold_b, voxel_size ); // for one signature
-  feature = tmp[ 0 ];
-}
-
 //--------------
 //* ConVOSCH
 template <typename PointT>
-Eigen::Vector3i extractConVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0, const bool is_normalize  ){
+Eigen::Vector3i VOSCHExtractor<PointT>::extractConVOSCH( std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
   std::vector< std::vector<float> > grsd;
-  Eigen::Vector3i subdiv_b_ = extractGRSDSignature21( grid, cloud, cloud_downsampled, grsd, voxel_size, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
+  Eigen::Vector3i subdiv_b_ = extractGRSDSignature21( grsd, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
   std::vector< std::vector<float> > c3_hlac;
-  extractC3HLACSignature981( grid, cloud_downsampled, c3_hlac, color_threshold_r, color_threshold_g, color_threshold_b, voxel_size, subdivision_size, offset_x, offset_y, offset_z );
+  extractC3HLACSignature981( c3_hlac, color_threshold_r, color_threshold_g, color_threshold_b, subdivision_size, offset_x, offset_y, offset_z );
 
   const int hist_num = grsd.size();
   for( int h=0; h<hist_num; h++ )
@@ -653,8 +604,85 @@ Eigen::Vector3i extractConVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<Poi
   return subdiv_b_;
 }
 
+//-----------------------------------------------------------------------------
+//* one-shot functions, each of them computes its own RSD radii and neighbour table.
+//* Use a VOSCHExtractor to compute several descriptors of the same cloud.
+
+//--------------------
+//* extract - GRSD -
+template <typename T>
+Eigen::Vector3i extractGRSDSignature21( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
+  VOSCHExtractor<T> extractor;
+  extractor.setInput( grid, cloud, cloud_downsampled, voxel_size );
+  return extractor.extractGRSDSignature21( feature, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
+}
+
+template <typename T>
+void extractGRSDSignature21( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize ){
+  std::vector< std::vector<float> > tmp( 1 );
+  extractGRSDSignature21( grid, cloud, cloud_downsampled, tmp, voxel_size, 0, 0, 0, 0, is_normalize ); // for one signature
+  feature = tmp[ 0 ];
+}
+
+//-----------------------------------
+//* extract - rotation-variant GRSD -
+template <typename T>
+Eigen::Vector3i extractGRSDSignature325( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
+  VOSCHExtractor<T> extractor;
+  extractor.setInput( grid, cloud, cloud_downsampled, voxel_size );
+  return extractor.extractGRSDSignature325( feature, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
+}
+
+template <typename T>
+void extractGRSDSignature325( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize ){
+  std::vector< std::vector<float> > tmp( 1 );
+  extractGRSDSignature325( grid, cloud, cloud_downsampled, tmp, voxel_size, 0, 0, 0, 0, is_normalize ); // for one signature
+  feature = tmp[ 0 ];
+}
+
+//-----------------------------------
+//* extract - PlusGRSD -
+template <typename T>
+Eigen::Vector3i extractPlusGRSDSignature110( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector< std::vector<float> > &feature, const float voxel_size, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
+  VOSCHExtractor<T> extractor;
+  extractor.setInput( grid, cloud, cloud_downsampled, voxel_size );
+  return extractor.extractPlusGRSDSignature110( feature, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
+}
+
+template <typename T>
+void extractPlusGRSDSignature110( const pcl::VoxelGrid<T> &grid, const pcl::PointCloud<T> &cloud, const pcl::PointCloud<T> &cloud_downsampled, std::vector<float> &feature, const float voxel_size, const bool is_normalize ){
+  std::vector< std::vector<float> > tmp( 1 );
+  extractPlusGRSDSignature110( grid, cloud, cloud_downsampled, tmp, voxel_size, 0, 0, 0, 0, is_normalize ); // for one signature
+  feature = tmp[ 0 ];
+}
+
+//--------------
+//* VOSCH
+template <typename PointT>
+Eigen::Vector3i extractVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
+  VOSCHExtractor<PointT> extractor;
+  extractor.setInput( grid, cloud, cloud_downsampled, voxel_size );
+  return extractor.extractVOSCH( feature, color_threshold_r, color_threshold_g, color_threshold_b, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
+}
+
+template <typename PointT>
+void extractVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z ){
+  std::vector< std::vector<float> > tmp;
+  extractVOSCH( grid, cloud, cloud_downsampled, tmp, color_threshold_r, color_threshold_g, color_threshold_b, voxel_size ); // for one signature
+  feature = tmp[ 0 ];
+}
+
+//--------------
+//* ConVOSCH
+template <typename PointT>
+Eigen::Vector3i extractConVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector< std::vector<float> > &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z, const bool is_normalize ){
+  VOSCHExtractor<PointT> extractor;
+  extractor.setInput( grid, cloud, cloud_downsampled, voxel_size );
+  return extractor.extractConVOSCH( feature, color_threshold_r, color_threshold_g, color_threshold_b, subdivision_size, offset_x, offset_y, offset_z, is_normalize );
+}
+
 template <typename PointT>
-void extractConVOSCH(pcl::VoxelGrid<PointT> grid, pcl::PointCloud<PointT> cloud, pcl::PointCloud<PointT> cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size = 0, const int offset_x = 0, const int offset_y = 0, const int offset_z = 0 ){
+void extractConVOSCH( const pcl::VoxelGrid<PointT> &grid, const pcl::PointCloud<PointT> &cloud, const pcl::PointCloud<PointT> &cloud_downsampled, std::vector<float> &feature, int color_threshold_r, int color_threshold_g, int color_threshold_b, const float voxel_size, const int subdivision_size, const int offset_x, const int offset_y, const int offset_z ){
   std::vector< std::vector<float> > tmp;
   extractConVOSCH( grid, cloud, cloud_downsampled, tmp, color_threshold_r, color_threshold_g, color_threshold_b, voxel_size ); // for one signature
   feature = tmp[ 0 ];
@@ -0,0 +1,82 @@
+#define QUIET 1
+#include "vosch/vosch_tools.h"
+
+//-------------------------------------------------------------------------
+//* compares extracting all descriptors with the one-shot functions (each
+//* of them computes its own RSD radii and voxel neighbours) against one
+//* VOSCHExtractor sharing them, e.g. on data/sample_*.pcd
+int main( int argc, char** argv ){
+  if( argc < 2 ){
+    ROS_ERROR ("Need at least one parameter! Syntax is: %s {input_pointcloud_filename.pcd} [more .pcd files]\n", argv[0]);
+    return(-1);
+  }
+  //* voxel size (downsample_leaf)
+  const double voxel_size = 0.01;
+  const int color_threshold = 127;
+
+  for( int f=1; f<argc; f++ ){
+    //* read
+    pcl::PointCloud<pcl::PointXYZRGB> input_cloud;
+    readPoints( argv[f], input_cloud );
+    if( input_cloud.points.empty() )
+      continue;
+
+    std::vector< std::vector<float> > grsd, grsd325, plus_grsd, vosch, con_vosch;
+
+    //* one-shot functions
+    double start = my_clock();
+    pcl::PointCloud<pcl::PointXYZRGBNormal> cloud;
+    computeNormal( input_cloud, cloud );
+    pcl::VoxelGrid<pcl::PointXYZRGBNormal> grid;
+    pcl::PointCloud<pcl::PointXYZRGBNormal> cloud_downsampled;
+    getVoxelGrid( grid, cloud, cloud_downsampled, voxel_size );
+    double prepare = my_clock() - start;
+    extractGRSDSignature21( grid, cloud, cloud_downsampled, grsd, voxel_size );
+    extractGRSDSignature325( grid, cloud, cloud_downsampled, grsd325, voxel_size );
+    extractPlusGRSDSignature110( grid, cloud, cloud_downsampled, plus_grsd, voxel_size );
+    extractVOSCH( grid, cloud, cloud_downsampled, vosch, color_threshold, color_threshold, color_threshold, voxel_size );
+    extractConVOSCH( grid, cloud, cloud_downsampled, con_vosch, color_threshold, color_threshold, color_threshold, voxel_size );
+    double one_shot = my_clock() - start;
+
+    //* shared extractor
+    std::vector< std::vector<float> > grsd_e, grsd325_e, plus_grsd_e, vosch_e, con_vosch_e;
+    start = my_clock();
+    VOSCHExtractor<pcl::PointXYZRGBNormal> extractor;
+    extractor.setInputCloud( input_cloud, voxel_size );
+    extractor.extractGRSDSignature21( grsd_e );
+    extractor.extractGRSDSignature325( grsd325_e );
+    extractor.extractPlusGRSDSignature110( plus_grsd_e );
+    extractor.extractVOSCH( vosch_e, color_threshold, color_threshold, color_threshold );
+    extractor.extractConVOSCH( con_vosch_e, color_threshold, color_threshold, color_threshold );
+    double shared = my_clock() - start;
+
+    //* sliding boxes: subdivided GRSD for every offset, re-extracted vs. read from summed-area tables
+    const int box_size = 10, step = 5;
+    const Eigen::Vector3i div_b = grid.getNrDivisions();
+    std::vector< std::vector<float> > boxes, boxes_e;
+    double scan[2];
+    for( int mode=0; mode<2; mode++ ){
+      extractor.setUseIntegralVolume( mode == 1 );
+      std::vector< std::vector<float> > &result = ( mode == 0 ) ? boxes : boxes_e;
+      start = my_clock();
+      for( int oz=0; oz<box_size && oz<div_b[2]; oz+=step )
+        for( int oy=0; oy<box_size && oy<div_b[1]; oy+=step )
+          for( int ox=0; ox<box_size && ox<div_b[0]; ox+=step ){
+            std::vector< std::vector<float> > tmp;
+            extractor.extractGRSDSignature21( tmp, box_size, ox, oy, oz );
+            result.insert( result.end(), tmp.begin(), tmp.end() );
+          }
+      scan[ mode ] = my_clock() - start;
+    }
+
+    const bool same = ( boxes == boxes_e ) && ( grsd == grsd_e ) && ( grsd325 == grsd325_e ) && ( plus_grsd == plus_grsd_e ) && ( vosch == vosch_e ) && ( con_vosch == con_vosch_e );
+    ROS_INFO("%s: %d points, %d voxels", argv[f], (int)input_cloud.points.size(), (int)cloud_downsampled.points.size());
+    ROS_INFO("  normals + voxelization: %f s", prepare);
+    ROS_INFO("  GRSD21 + GRSD325 + PlusGRSD110 + VOSCH + ConVOSCH: one-shot functions %f s, shared extractor %f s (%.2fx)%s",
+             one_shot, shared, one_shot / shared, same ? "" : " - DESCRIPTORS DIFFER!");
+    ROS_INFO("  %d sliding %d-voxel boxes: re-extraction %f s, summed-area tables %f s (including construction)",
+             (int)boxes.size(), box_size, scan[0], scan[1]);
+  }
+
+  return(0);
+}